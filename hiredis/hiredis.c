@@ -35,6 +35,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/uio.h>
 
 #include "hiredis.h"
 #include "net.h"
@@ -50,7 +51,7 @@ typedef struct redisReader {
     size_t pos; /* buffer cursor */
     size_t len; /* buffer length */
 
-    redisReadTask rstack[3]; /* stack of read tasks */
+    redisReadTask rstack[4]; /* stack of read tasks */
     int ridx; /* index of stack */
     void *privdata; /* user-settable arbitrary field */
 } redisReader;
@@ -339,10 +340,11 @@ static int processMultiBulkItem(redisReader *r) {
     long elements;
     int root = 0;
 
-    /* Set error for nested multi bulks with depth > 1 */
-    if (r->ridx == 2) {
+    /* Set error for nested multi bulks with depth > 2, which is as deep
+     * as CLUSTER SLOTS goes. */
+    if (r->ridx == 3) {
         redisSetReplyReaderError(r,sdscatprintf(sdsempty(),
-            "No support for nested multi bulk replies with depth > 1"));
+            "No support for nested multi bulk replies with depth > 2"));
         return -1;
     }
 
@@ -642,6 +644,7 @@ int redisvFormatCommand(char **target, const char *format, va_list ap) {
                     char _format[16];
                     const char *_p = c+1;
                     size_t _l = 0;
+                    char _mod = 0;
                     va_list _cpy;
 
                     /* Flags */
@@ -664,7 +667,12 @@ int redisvFormatCommand(char **target, const char *format, va_list ap) {
                     if (*_p != '\0') {
                         if (*_p == 'h' || *_p == 'l') {
                             /* Allow a single repetition for these modifiers */
-                            if (_p[0] == _p[1]) _p++;
+                            if (_p[0] == _p[1]) {
+                                _mod = (_p[0] == 'l') ? 'L' : 'H';
+                                _p++;
+                            } else {
+                                _mod = *_p;
+                            }
                             _p++;
                         }
                     }
@@ -685,8 +693,16 @@ int redisvFormatCommand(char **target, const char *format, va_list ap) {
                         }
                     }
 
-                    /* Consume and discard vararg */
-                    va_arg(ap,void);
+                    /* Consume and discard vararg, according to its type */
+                    if (*_p != '\0' && strchr("eEfFgGaA",*_p) != NULL) {
+                        va_arg(ap,double);
+                    } else if (_mod == 'L') {
+                        va_arg(ap,long long);
+                    } else if (_mod == 'l') {
+                        va_arg(ap,long);
+                    } else {
+                        va_arg(ap,int);
+                    }
                 }
             }
             touched = 1;
@@ -792,6 +808,17 @@ void __redisSetError(redisContext *c, int type, const sds errstr) {
     }
 }
 
+/* Free the queue of output regions. */
+static void __redisDiscardOutput(redisContext *c) {
+    int j;
+    for (j = 0; j < c->outcount; j++)
+        if (c->out[j].owned != NULL)
+            sdsfree(c->out[j].owned);
+    free(c->out);
+    c->out = NULL;
+    c->outcount = c->outcap = 0;
+}
+
 static redisContext *redisContextInit(void) {
     redisContext *c = calloc(sizeof(redisContext),1);
     c->err = 0;
@@ -799,6 +826,9 @@ static redisContext *redisContextInit(void) {
     c->obuf = sdsempty();
     c->fn = &defaultFunctions;
     c->reader = NULL;
+    c->out = NULL;
+    c->outcount = 0;
+    c->outcap = 0;
     return c;
 }
 
@@ -811,6 +841,7 @@ void redisFree(redisContext *c) {
         sdsfree(c->obuf);
     if (c->reader != NULL)
         redisReplyReaderFree(c->reader);
+    __redisDiscardOutput(c);
     free(c);
 }
 
@@ -910,6 +941,67 @@ int redisBufferRead(redisContext *c) {
     return REDIS_OK;
 }
 
+/* Write the queued output regions, followed by the output buffer, to the
+ * socket with a single writev(2). Regions which have been written in full
+ * are dropped from the queue. */
+static int __redisBufferWritev(redisContext *c, int *done) {
+    struct iovec iov[REDIS_IOV_MAX];
+    ssize_t nwritten;
+    int cnt = 0, j;
+
+    for (j = 0; j < c->outcount && cnt < REDIS_IOV_MAX-1; j++) {
+        iov[cnt].iov_base = (char*)c->out[j].buf;
+        iov[cnt].iov_len = c->out[j].len;
+        cnt++;
+    }
+    if (j == c->outcount && sdslen(c->obuf) > 0) {
+        iov[cnt].iov_base = c->obuf;
+        iov[cnt].iov_len = sdslen(c->obuf);
+        cnt++;
+    }
+
+    nwritten = writev(c->fd,iov,cnt);
+    if (nwritten == -1) {
+        if (errno == EAGAIN && !(c->flags & REDIS_BLOCK)) {
+            /* Try again later */
+        } else {
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            return REDIS_ERR;
+        }
+    } else {
+        j = 0;
+        while (nwritten > 0 && j < c->outcount) {
+            redisOutput *o = &c->out[j];
+            if ((size_t)nwritten >= o->len) {
+                nwritten -= o->len;
+                if (o->owned != NULL)
+                    sdsfree(o->owned);
+                j++;
+            } else {
+                o->buf += nwritten;
+                o->len -= nwritten;
+                nwritten = 0;
+            }
+        }
+        if (j > 0) {
+            memmove(c->out,c->out+j,(c->outcount-j)*sizeof(redisOutput));
+            c->outcount -= j;
+        }
+
+        /* Anything left over was written from the output buffer. */
+        if (nwritten > 0) {
+            if (nwritten == (signed)sdslen(c->obuf)) {
+                sdsfree(c->obuf);
+                c->obuf = sdsempty();
+            } else {
+                c->obuf = sdsrange(c->obuf,nwritten,-1);
+            }
+        }
+    }
+    if (done != NULL) *done = (c->outcount == 0 && sdslen(c->obuf) == 0);
+    return REDIS_OK;
+}
+
 /* Write the output buffer to the socket.
  *
  * Returns REDIS_OK when the buffer is empty, or (a part of) the buffer was
@@ -921,6 +1013,8 @@ int redisBufferRead(redisContext *c) {
  */
 int redisBufferWrite(redisContext *c, int *done) {
     int nwritten;
+    if (c->outcount > 0)
+        return __redisBufferWritev(c,done);
     if (sdslen(c->obuf) > 0) {
         nwritten = write(c->fd,c->obuf,sdslen(c->obuf));
         if (nwritten == -1) {
@@ -1019,6 +1113,54 @@ void redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const
     free(cmd);
 }
 
+/* Add a region to the queue of output. */
+static void __redisQueueOutput(redisContext *c, const char *buf, size_t len, sds owned) {
+    if (c->outcount == c->outcap) {
+        int cap = c->outcap ? c->outcap*2 : 8;
+        redisOutput *out = realloc(c->out,cap*sizeof(redisOutput));
+        if (!out) redisOOM();
+        c->out = out;
+        c->outcap = cap;
+    }
+    c->out[c->outcount].buf = buf;
+    c->out[c->outcount].len = len;
+    c->out[c->outcount].owned = owned;
+    c->outcount++;
+}
+
+/* Queue a caller's buffer to be written after everything so far. */
+static void __redisAppendRef(redisContext *c, const char *buf, size_t len) {
+    if (sdslen(c->obuf) > 0) {
+        __redisQueueOutput(c,c->obuf,sdslen(c->obuf),c->obuf);
+        c->obuf = sdsempty();
+    }
+    __redisQueueOutput(c,buf,len,NULL);
+}
+
+/* Like redisAppendCommandArgv(), but arguments of REDIS_REF_MIN bytes or
+ * more are not copied: they are written straight from the caller's memory,
+ * alongside the rest of the command, with writev(2). Those arguments must
+ * therefore remain valid until the output buffer has been written, which
+ * for a blocking context is when the next reply has been read. */
+void redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
+    char hdr[32];
+    size_t len;
+    int j;
+
+    sprintf(hdr,"*%d\r\n",argc);
+    c->obuf = sdscat(c->obuf,hdr);
+    for (j = 0; j < argc; j++) {
+        len = argvlen ? argvlen[j] : strlen(argv[j]);
+        sprintf(hdr,"$%zu\r\n",len);
+        c->obuf = sdscat(c->obuf,hdr);
+        if (len >= REDIS_REF_MIN)
+            __redisAppendRef(c,argv[j],len);
+        else
+            c->obuf = sdscatlen(c->obuf,argv[j],len);
+        c->obuf = sdscatlen(c->obuf,"\r\n",2);
+    }
+}
+
 /* Helper function for the redisCommand* family of functions.
  *
  * Write a formatted command to the output buffer. If the given context is
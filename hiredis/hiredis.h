@@ -115,6 +115,21 @@ typedef struct redisReplyObjectFunctions {
 
 struct redisContext; /* need forward declaration of redisContext */
 
+/* Arguments of at least this many bytes are written straight from the
+ * caller's memory by redisAppendCommandArgvRef(), rather than copied. */
+#define REDIS_REF_MIN 4096
+
+/* The most regions written with a single writev(2). */
+#define REDIS_IOV_MAX 64
+
+/* A region of output queued ahead of the output buffer: either memory we
+ * own, or memory belonging to the caller (when "owned" is NULL). */
+typedef struct redisOutput {
+    const char *buf;
+    size_t len;
+    char *owned;
+} redisOutput;
+
 /* Context for a connection to Redis */
 typedef struct redisContext {
     int fd;
@@ -126,6 +141,11 @@ typedef struct redisContext {
     /* Function set for reply buildup and reply reader */
     redisReplyObjectFunctions *fn;
     void *reader;
+
+    /* Regions of output waiting to be written before the output buffer */
+    redisOutput *out;
+    int outcount;
+    int outcap;
 } redisContext;
 
 void freeReplyObject(void *reply);
@@ -167,6 +187,11 @@ int redisGetReplyFromReader(redisContext *c, void **reply);
 void redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 void redisAppendCommand(redisContext *c, const char *format, ...);
 void redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+void redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+
+/* Write a command which has already been formatted, e.g. by
+ * redisvFormatCommand(), to the output buffer. */
+void __redisAppendCommand(redisContext *c, char *cmd, size_t len);
 
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
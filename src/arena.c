@@ -0,0 +1,184 @@
+/* arena.c -- A simple region allocator.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Replies from redis are made up of many small objects, each of which
+ * would otherwise be allocated, and later freed, on its own.  Instead
+ * they're carved from large blocks, which are all released together
+ * once the operation which used them is complete.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+/**
+ * The alignment of every allocation.
+ */
+#define ARENA_ALIGN 16
+
+/**
+ * Round a size up to our alignment.
+ */
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/**
+ * The space taken by the header of a block.
+ */
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_block))
+
+
+
+/**
+ * The memory of a block, following its header.
+ */
+static char *
+block_data(const arena_block * b)
+{
+    return ((char *)b + ARENA_HEADER);
+}
+
+
+/**
+ * Setup an arena.
+ */
+void
+arena_init(arena * a, size_t block_size)
+{
+    a->head = NULL;
+    a->block_size = ARENA_ROUND(block_size);
+}
+
+
+/**
+ * Allocate memory from the arena.
+ */
+void *
+arena_alloc(arena * a, size_t size)
+{
+    arena_block *b = a->head;
+    void *ptr;
+
+    size = ARENA_ROUND(size ? size : 1);
+
+    if ((b == NULL) || (b->size - b->used < size))
+    {
+        /**
+         * Large requests get a block of their own, placed behind the
+         * current block so that it may still be used.
+         */
+        size_t want = (size > a->block_size / 2) ? size : a->block_size;
+
+        b = malloc(ARENA_HEADER + want);
+        if (b == NULL)
+            return NULL;
+
+        b->size = want;
+        b->used = 0;
+
+        if ((want != a->block_size) && (a->head != NULL))
+        {
+            b->next = a->head->next;
+            a->head->next = b;
+        }
+        else
+        {
+            b->next = a->head;
+            a->head = b;
+        }
+    }
+
+    ptr = block_data(b) + b->used;
+    b->used += size;
+
+    return (ptr);
+}
+
+
+/**
+ * Release everything allocated, keeping one block of the usual size.
+ */
+void
+arena_reset(arena * a)
+{
+    arena_block *keep = NULL;
+    arena_block *b = a->head;
+    arena_block *next;
+
+    while (b != NULL)
+    {
+        next = b->next;
+
+        if ((keep == NULL) && (b->size == a->block_size))
+        {
+            keep = b;
+            keep->used = 0;
+            keep->next = NULL;
+        }
+        else
+        {
+            free(b);
+        }
+
+        b = next;
+    }
+
+    a->head = keep;
+}
+
+
+/**
+ * Release all the memory held by the arena.
+ */
+void
+arena_free(arena * a)
+{
+    arena_reset(a);
+    free(a->head);
+    a->head = NULL;
+}
+
+
+/**
+ * Was the given pointer allocated from this arena?
+ */
+int
+arena_owns(const arena * a, const void *ptr)
+{
+    const arena_block *b;
+    const char *p = ptr;
+
+    for (b = a->head; b != NULL; b = b->next)
+    {
+        if ((p >= block_data(b)) && (p < block_data(b) + b->size))
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * The number of bytes allocated since the arena was reset.
+ */
+size_t
+arena_used(const arena * a)
+{
+    const arena_block *b;
+    size_t used = 0;
+
+    for (b = a->head; b != NULL; b = b->next)
+        used += b->used;
+
+    return (used);
+}
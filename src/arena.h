@@ -0,0 +1,73 @@
+/* arena.h -- A simple region allocator.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _ARENA_H
+#define _ARENA_H 1
+
+#include <stddef.h>
+
+
+/**
+ * A block of memory from which allocations are carved.
+ */
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+} arena_block;
+
+/**
+ * An arena: a list of blocks, the newest first.
+ */
+typedef struct arena
+{
+    arena_block *head;
+    size_t block_size;
+} arena;
+
+
+/**
+ * Setup an arena, which allocates memory in blocks of the given size.
+ */
+void arena_init(arena * a, size_t block_size);
+
+/**
+ * Allocate memory from the arena.
+ *
+ * The memory is suitably aligned for any type, and remains valid until
+ * the arena is reset.  Returns NULL if we're out of memory.
+ */
+void *arena_alloc(arena * a, size_t size);
+
+/**
+ * Release everything allocated from the arena in one go, keeping a
+ * single block for reuse.
+ */
+void arena_reset(arena * a);
+
+/**
+ * Release all the memory held by the arena.
+ */
+void arena_free(arena * a);
+
+/**
+ * Was the given pointer allocated from this arena?
+ */
+int arena_owns(const arena * a, const void *ptr);
+
+/**
+ * The number of bytes allocated from the arena since it was reset.
+ */
+size_t arena_used(const arena * a);
+
+
+#endif /* _ARENA_H */
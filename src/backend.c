@@ -0,0 +1,150 @@
+/* backend.c -- Stores which stand in for the redis server.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  Every command the filesystem sends goes through the redis_* wrappers
+ * in redisfs.c, which hand it to the async engine, to the nodes of a
+ * cluster, or to a connection from the pool.  A backend is one more
+ * choice there: the command is formatted just as hiredis would send it,
+ * and given to something else to answer, such as the in-memory store
+ * of mock.c.
+ *
+ */
+
+#include <stdlib.h>
+
+
+#include "hiredis.h"
+#include "backend.h"
+
+
+
+/**
+ * The backend in use, if any.  This is chosen before the filesystem is
+ * mounted and never changes while it is.
+ */
+static backend *_g_backend = NULL;
+
+
+
+/**
+ * Send every command to the given backend, rather than to redis.
+ */
+void
+backend_start(backend * b)
+{
+    _g_backend = b;
+}
+
+
+/**
+ * Is a backend in use?
+ */
+int
+backend_running()
+{
+    return (_g_backend != NULL);
+}
+
+
+/**
+ * The backend in use, or NULL.
+ */
+backend *
+backend_current()
+{
+    return (_g_backend);
+}
+
+
+/**
+ * Stop using, and free, the current backend.
+ */
+void
+backend_stop()
+{
+    backend *b = _g_backend;
+
+    _g_backend = NULL;
+    if ((b != NULL) && (b->destroy != NULL))
+        b->destroy(b);
+}
+
+
+/**
+ * Queue a formatted command.
+ */
+int
+backend_vappend(const char *format, va_list ap)
+{
+    char *cmd = NULL;
+    int len;
+    int ret;
+
+    len = redisvFormatCommand(&cmd, format, ap);
+    if (len < 0)
+        return REDIS_ERR;
+
+    ret = backend_append(cmd, len);
+    free(cmd);
+
+    return (ret);
+}
+
+
+/**
+ * Queue a command which has already been formatted.
+ */
+int
+backend_append(const char *cmd, size_t len)
+{
+    if (_g_backend->append(_g_backend, cmd, len) != 0)
+        return REDIS_ERR;
+
+    return REDIS_OK;
+}
+
+
+/**
+ * Queue a command given as a vector of arguments.
+ */
+int
+backend_append_argv(int argc, const char **argv, const size_t * argvlen)
+{
+    char *cmd = NULL;
+    int len;
+    int ret;
+
+    len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+
+    ret = _g_backend->append(_g_backend, cmd, len);
+    free(cmd);
+
+    return ((ret == 0) ? REDIS_OK : REDIS_ERR);
+}
+
+
+/**
+ * Read the reply to the oldest command this thread has queued.
+ */
+int
+backend_get_reply(void **reply)
+{
+    *reply = NULL;
+
+    if (_g_backend->get_reply(_g_backend, reply) != 0)
+        return REDIS_ERR;
+
+    return ((*reply != NULL) ? REDIS_OK : REDIS_ERR);
+}
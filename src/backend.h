@@ -0,0 +1,86 @@
+/* backend.h -- Stores which stand in for the redis server.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _BACKEND_H
+#define _BACKEND_H 1
+
+#include <stdarg.h>
+#include <stddef.h>
+
+
+/**
+ * A store which answers the commands we would otherwise send to redis.
+ *
+ * Commands are given already formatted in the redis protocol, and each
+ * thread reads the replies to its own commands in the order they were
+ * queued.  Replies are built as hiredis builds them, so they may be
+ * freed with freeReplyObject().
+ */
+typedef struct backend
+{
+    const char *name;
+
+    /**
+     * Queue a command.  Returns 0 on success, -1 on failure.
+     */
+    int (*append) (struct backend * b, const char *cmd, size_t len);
+
+    /**
+     * Read the reply to the oldest command queued by this thread,
+     * which is NULL on failure.  Returns 0 on success, -1 on failure.
+     */
+    int (*get_reply) (struct backend * b, void **reply);
+
+    /**
+     * Free the backend, and anything it holds.
+     */
+    void (*destroy) (struct backend * b);
+
+    void *data;
+} backend;
+
+
+/**
+ * Send every command to the given backend, rather than to redis.
+ */
+void backend_start(backend * b);
+
+/**
+ * Is a backend in use, and if so which?
+ */
+int backend_running();
+backend *backend_current();
+
+/**
+ * Stop using, and free, the current backend.
+ */
+void backend_stop();
+
+
+/**
+ * Queue a command for the current backend, in the manner of
+ * redisvAppendCommand() & redisAppendCommandArgv().
+ */
+int backend_vappend(const char *format, va_list ap);
+int backend_append_argv(int argc, const char **argv, const size_t * argvlen);
+
+/**
+ * Queue a command which has already been formatted.
+ */
+int backend_append(const char *cmd, size_t len);
+
+/**
+ * Read the reply to the oldest command this thread has queued.
+ */
+int backend_get_reply(void **reply);
+
+
+#endif /* _BACKEND_H */
@@ -0,0 +1,784 @@
+/* cache.c -- In-process cache of path lookups and inode attributes.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Every FUSE callback starts by resolving a path to an inode, and many
+ * then fetch the attributes of that inode.  Both are cached here, in a
+ * pair of hash-tables, for a configurable period of time.  The extended
+ * attributes of an inode are kept alongside its attributes, with their
+ * own expiry time.
+ *
+ *  Each lookup is also chained from its parent directory, and from the
+ * inode it resolves to, so that invalidating a directory or an inode
+ * only visits the lookups which are affected.  A lookup is only stored
+ * while its parent is, so following the chains from a directory finds
+ * every path beneath it.
+ *
+ *  The cache is protected by its own mutex, because it is updated both
+ * by the FUSE callbacks and by the thread listening for keyspace
+ * notifications.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+
+/**
+ * The number of buckets in each table.
+ */
+#define CACHE_BUCKETS 16384
+
+/**
+ * The maximum number of entries we'll store in each table.
+ */
+#define CACHE_MAX_ENTRIES 262144
+
+
+/**
+ * A cached path -> inode mapping, which lives in three chains: those
+ * of its path, its parent and its inode.
+ */
+typedef struct cache_dentry
+{
+    char *path;
+    long long parent;
+    long long inode;
+    long long expires;
+    struct cache_dentry *next;
+    struct cache_dentry **prev;
+    struct cache_dentry *next_sibling;
+    struct cache_dentry **prev_sibling;
+    struct cache_dentry *next_alias;
+    struct cache_dentry **prev_alias;
+} cache_dentry;
+
+
+/**
+ * The cached attributes of an inode.
+ */
+typedef struct cache_attr
+{
+    long long inode;
+    int has_stat;
+    struct stat st;
+    long long expires;
+    char *xattrs;               /* NULL if they aren't cached */
+    size_t xattrs_len;
+    long long xattrs_expires;
+    struct cache_attr *next;
+} cache_attr;
+
+
+/**
+ * Our tables, and the number of entries in each.  Lookups are found by
+ * path in _dentries, by parent in _siblings and by inode in _aliases.
+ */
+static cache_dentry *_dentries[CACHE_BUCKETS];
+static cache_dentry *_siblings[CACHE_BUCKETS];
+static cache_dentry *_aliases[CACHE_BUCKETS];
+static cache_attr *_attrs[CACHE_BUCKETS];
+static int _dentry_count = 0;
+static int _attr_count = 0;
+
+/**
+ * Lifetime of entries, in milliseconds.
+ */
+static long _ttl = 0;
+
+/**
+ * Mutex for safety.
+ */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+static long long
+cache_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Hash a path into a bucket.
+ */
+static unsigned int
+hash_path(const char *path)
+{
+    unsigned int hash = 5381;
+
+    while (*path)
+        hash = (hash * 33) ^ (unsigned char)*path++;
+
+    return (hash % CACHE_BUCKETS);
+}
+
+
+/**
+ * Hash an inode into a bucket.
+ */
+static unsigned int
+hash_inode(long long inode)
+{
+    return ((unsigned int)inode % CACHE_BUCKETS);
+}
+
+
+/**
+ * Add a dentry to each of its chains.  Must be called with the lock
+ * held.
+ */
+static void
+link_dentry(cache_dentry * d)
+{
+    cache_dentry **head;
+
+    head = &_dentries[hash_path(d->path)];
+    d->next = *head;
+    d->prev = head;
+    if (*head != NULL)
+        (*head)->prev = &d->next;
+    *head = d;
+
+    head = &_siblings[hash_inode(d->parent)];
+    d->next_sibling = *head;
+    d->prev_sibling = head;
+    if (*head != NULL)
+        (*head)->prev_sibling = &d->next_sibling;
+    *head = d;
+
+    head = &_aliases[hash_inode(d->inode)];
+    d->next_alias = *head;
+    d->prev_alias = head;
+    if (*head != NULL)
+        (*head)->prev_alias = &d->next_alias;
+    *head = d;
+
+    _dentry_count += 1;
+}
+
+
+/**
+ * Remove a dentry from each of its chains, and free it.  Must be called
+ * with the lock held.
+ */
+static void
+free_dentry(cache_dentry * d)
+{
+    *d->prev = d->next;
+    if (d->next != NULL)
+        d->next->prev = d->prev;
+
+    *d->prev_sibling = d->next_sibling;
+    if (d->next_sibling != NULL)
+        d->next_sibling->prev_sibling = d->prev_sibling;
+
+    *d->prev_alias = d->next_alias;
+    if (d->next_alias != NULL)
+        d->next_alias->prev_alias = d->prev_alias;
+
+    free(d->path);
+    free(d);
+    _dentry_count -= 1;
+}
+
+
+static void remove_dentry(cache_dentry * d);
+
+/**
+ * Remove every dentry inside the given directory, and everything
+ * beneath those.  Must be called with the lock held.
+ *
+ * Removing a subdirectory may remove others from the same chain, so we
+ * start again from its head after each.
+ */
+static void
+remove_children(long long parent)
+{
+    cache_dentry *d = _siblings[hash_inode(parent)];
+
+    while (d != NULL)
+    {
+        if (d->parent == parent)
+        {
+            remove_dentry(d);
+            d = _siblings[hash_inode(parent)];
+        }
+        else
+            d = d->next_sibling;
+    }
+}
+
+
+/**
+ * Remove a dentry and everything beneath it.  Must be called with the
+ * lock held.
+ */
+static void
+remove_dentry(cache_dentry * d)
+{
+    long long inode = d->inode;
+
+    free_dentry(d);
+    remove_children(inode);
+}
+
+
+/**
+ * Remove every dentry, optionally only those which have expired, along
+ * with everything beneath them.  Must be called with the lock held.
+ */
+static void
+remove_dentries(int expired_only)
+{
+    long long now = cache_now();
+    int i;
+
+    for (i = 0; i < CACHE_BUCKETS; i++)
+    {
+        cache_dentry *d = _dentries[i];
+
+        while (d != NULL)
+        {
+            if (!expired_only || (d->expires <= now))
+            {
+                remove_dentry(d);
+                d = _dentries[i];
+            }
+            else
+                d = d->next;
+        }
+    }
+}
+
+
+/**
+ * Is the given directory the root, or cached?  Must be called with the
+ * lock held.
+ */
+static int
+dentry_known(long long inode)
+{
+    cache_dentry *d;
+
+    if (inode == -99)
+        return 1;
+
+    for (d = _aliases[hash_inode(inode)]; d != NULL; d = d->next_alias)
+    {
+        if (d->inode == inode)
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Free an attribute entry.
+ */
+static void
+free_attr(cache_attr * a)
+{
+    free(a->xattrs);
+    free(a);
+}
+
+
+/**
+ * Remove every attribute entry, optionally only those which have
+ * expired.  Must be called with the lock held.
+ */
+static void
+remove_attrs(int expired_only)
+{
+    long long now = cache_now();
+    int i;
+
+    for (i = 0; i < CACHE_BUCKETS; i++)
+    {
+        cache_attr **cur = &_attrs[i];
+
+        while (*cur != NULL)
+        {
+            cache_attr *a = *cur;
+
+            if (!expired_only ||
+                ((!a->has_stat || (a->expires <= now)) &&
+                 ((a->xattrs == NULL) || (a->xattrs_expires <= now))))
+            {
+                *cur = a->next;
+                free_attr(a);
+                _attr_count -= 1;
+            }
+            else
+                cur = &a->next;
+        }
+    }
+}
+
+
+/**
+ * Setup the cache.
+ */
+void
+cache_init(long ttl)
+{
+    cache_flush();
+    _ttl = ttl;
+}
+
+
+/**
+ * Is the cache in use?
+ */
+int
+cache_enabled()
+{
+    return (_ttl > 0);
+}
+
+
+/**
+ * Discard every entry.
+ */
+void
+cache_flush()
+{
+    pthread_mutex_lock(&_lock);
+    remove_dentries(0);
+    remove_attrs(0);
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Lookup the inode for the given path.
+ */
+long long
+cache_get_inode(const char *path)
+{
+    cache_dentry *d;
+    long long inode = -1;
+
+    if (_ttl <= 0)
+        return -1;
+
+    pthread_mutex_lock(&_lock);
+
+    for (d = _dentries[hash_path(path)]; d != NULL; d = d->next)
+    {
+        if (strcmp(d->path, path) == 0)
+        {
+            if (d->expires > cache_now())
+                inode = d->inode;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return (inode);
+}
+
+
+/**
+ * Record the inode for the given path.
+ */
+void
+cache_set_inode(const char *path, long long parent, long long inode)
+{
+    cache_dentry *d;
+    long long now;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    now = cache_now();
+
+    for (d = _dentries[hash_path(path)]; d != NULL; d = d->next)
+    {
+        if (strcmp(d->path, path) == 0)
+            break;
+    }
+
+    /**
+     * A path which now resolves elsewhere forgets what was beneath it.
+     */
+    if (d != NULL)
+    {
+        if ((d->parent == parent) && (d->inode == inode))
+        {
+            d->expires = now + _ttl;
+            pthread_mutex_unlock(&_lock);
+            return;
+        }
+        remove_dentry(d);
+    }
+
+    /**
+     * If we're full drop the stale entries, and if that doesn't help
+     * start again from scratch.
+     */
+    if (_dentry_count >= CACHE_MAX_ENTRIES)
+    {
+        remove_dentries(1);
+        if (_dentry_count >= CACHE_MAX_ENTRIES)
+            remove_dentries(0);
+    }
+
+    /**
+     * Nothing would forget a path whose parent we don't know.
+     */
+    if (!dentry_known(parent))
+    {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+
+    d = malloc(sizeof(cache_dentry));
+    if (d != NULL)
+    {
+        d->path = strdup(path);
+        d->parent = parent;
+        d->inode = inode;
+        d->expires = now + _ttl;
+        if (d->path != NULL)
+            link_dentry(d);
+        else
+            free(d);
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Forget the given path, and everything beneath it.
+ */
+void
+cache_invalidate_path(const char *path)
+{
+    cache_dentry *d;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    for (d = _dentries[hash_path(path)]; d != NULL; d = d->next)
+    {
+        if (strcmp(d->path, path) == 0)
+        {
+            remove_dentry(d);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Forget every path which lives inside the given directory.
+ */
+void
+cache_invalidate_children(long long parent)
+{
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+    remove_children(parent);
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Forget every path which resolves to the given inode, along with
+ * everything beneath each.
+ */
+void
+cache_invalidate_entry(long long inode)
+{
+    cache_dentry *d;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    d = _aliases[hash_inode(inode)];
+    while (d != NULL)
+    {
+        if (d->inode == inode)
+        {
+            remove_dentry(d);
+            d = _aliases[hash_inode(inode)];
+        }
+        else
+            d = d->next_alias;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Lookup the attributes of the given inode.
+ */
+int
+cache_get_stat(long long inode, struct stat *st)
+{
+    cache_attr *a;
+    int found = 0;
+
+    if (_ttl <= 0)
+        return 0;
+
+    pthread_mutex_lock(&_lock);
+
+    for (a = _attrs[hash_inode(inode)]; a != NULL; a = a->next)
+    {
+        if (a->inode == inode)
+        {
+            if (a->has_stat && (a->expires > cache_now()))
+            {
+                memcpy(st, &a->st, sizeof(struct stat));
+                found = 1;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return (found);
+}
+
+
+/**
+ * Find the entry of an inode, optionally adding an empty one if there
+ * is none.  Must be called with the lock held.
+ */
+static cache_attr *
+find_attr(long long inode, int add)
+{
+    unsigned int bucket = hash_inode(inode);
+    cache_attr *a;
+
+    for (a = _attrs[bucket]; a != NULL; a = a->next)
+    {
+        if (a->inode == inode)
+            return (a);
+    }
+
+    if (!add)
+        return (NULL);
+
+    if (_attr_count >= CACHE_MAX_ENTRIES)
+    {
+        remove_attrs(1);
+        if (_attr_count >= CACHE_MAX_ENTRIES)
+            remove_attrs(0);
+    }
+
+    a = calloc(1, sizeof(cache_attr));
+    if (a != NULL)
+    {
+        a->inode = inode;
+        a->next = _attrs[bucket];
+        _attrs[bucket] = a;
+        _attr_count += 1;
+    }
+
+    return (a);
+}
+
+
+/**
+ * Store attributes, optionally refreshing the expiry time.
+ */
+static void
+store_stat(long long inode, const struct stat *st, int refresh)
+{
+    cache_attr *a;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    a = find_attr(inode, refresh);
+    if ((a != NULL) && (refresh || a->has_stat))
+    {
+        memcpy(&a->st, st, sizeof(struct stat));
+        if (refresh)
+            a->expires = cache_now() + _ttl;
+        a->has_stat = 1;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Record the attributes of the given inode.
+ */
+void
+cache_set_stat(long long inode, const struct stat *st)
+{
+    store_stat(inode, st, 1);
+}
+
+
+/**
+ * Replace the attributes of an inode which is already cached.
+ */
+void
+cache_update_stat(long long inode, const struct stat *st)
+{
+    store_stat(inode, st, 0);
+}
+
+
+/**
+ * Forget the attributes of the given inode.
+ */
+void
+cache_invalidate_stat(long long inode)
+{
+    cache_attr **cur;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    cur = &_attrs[hash_inode(inode)];
+    while (*cur != NULL)
+    {
+        cache_attr *a = *cur;
+
+        if (a->inode == inode)
+        {
+            *cur = a->next;
+            free_attr(a);
+            _attr_count -= 1;
+            break;
+        }
+        cur = &a->next;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Lookup the extended attributes of the given inode.
+ */
+int
+cache_get_xattrs(long long inode, char **data, size_t * len)
+{
+    cache_attr *a;
+    int found = 0;
+
+    if (_ttl <= 0)
+        return 0;
+
+    pthread_mutex_lock(&_lock);
+
+    a = find_attr(inode, 0);
+    if ((a != NULL) && (a->xattrs != NULL) &&
+        (a->xattrs_expires > cache_now()))
+    {
+        *data = malloc(a->xattrs_len + 1);
+        if (*data != NULL)
+        {
+            memcpy(*data, a->xattrs, a->xattrs_len);
+            *len = a->xattrs_len;
+            found = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return (found);
+}
+
+
+/**
+ * Record the extended attributes of the given inode.
+ */
+void
+cache_set_xattrs(long long inode, const char *data, size_t len)
+{
+    cache_attr *a;
+    char *copy;
+
+    if (_ttl <= 0)
+        return;
+
+    copy = malloc(len + 1);
+    if (copy == NULL)
+        return;
+    memcpy(copy, data, len);
+
+    pthread_mutex_lock(&_lock);
+
+    a = find_attr(inode, 1);
+    if (a != NULL)
+    {
+        free(a->xattrs);
+        a->xattrs = copy;
+        a->xattrs_len = len;
+        a->xattrs_expires = cache_now() + _ttl;
+        copy = NULL;
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    free(copy);
+}
+
+
+/**
+ * Forget the extended attributes of the given inode.
+ */
+void
+cache_invalidate_xattrs(long long inode)
+{
+    cache_attr *a;
+
+    if (_ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    a = find_attr(inode, 0);
+    if (a != NULL)
+    {
+        free(a->xattrs);
+        a->xattrs = NULL;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
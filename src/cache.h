@@ -0,0 +1,109 @@
+/* cache.h -- In-process cache of path lookups and inode attributes.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _CACHE_H
+#define _CACHE_H 1
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+
+/**
+ * Setup the cache, with entries living for the given number of
+ * milliseconds.  A TTL of zero disables caching entirely.
+ */
+void cache_init(long ttl);
+
+/**
+ * Is the cache in use?
+ */
+int cache_enabled();
+
+/**
+ * Discard every entry.
+ */
+void cache_flush();
+
+
+/**
+ * Lookup the inode for the given path.
+ *
+ * Returns -1 if the path isn't cached.
+ */
+long long cache_get_inode(const char *path);
+
+/**
+ * Record the inode for the given path, along with the inode of the
+ * directory which contains it.
+ */
+void cache_set_inode(const char *path, long long parent, long long inode);
+
+/**
+ * Forget the given path, and everything beneath it.
+ */
+void cache_invalidate_path(const char *path);
+
+/**
+ * Forget every path which lives inside the given directory.
+ */
+void cache_invalidate_children(long long parent);
+
+/**
+ * Forget every path which resolves to the given inode.
+ */
+void cache_invalidate_entry(long long inode);
+
+
+/**
+ * Lookup the attributes of the given inode.
+ *
+ * Returns 1 on a hit, 0 otherwise.
+ */
+int cache_get_stat(long long inode, struct stat *st);
+
+/**
+ * Record the attributes of the given inode.
+ */
+void cache_set_stat(long long inode, const struct stat *st);
+
+/**
+ * Replace the attributes of an inode which is already cached,
+ * without extending the lifetime of the entry.
+ */
+void cache_update_stat(long long inode, const struct stat *st);
+
+/**
+ * Forget the attributes of the given inode, and its extended
+ * attributes.
+ */
+void cache_invalidate_stat(long long inode);
+
+/**
+ * Lookup the extended attributes of the given inode, as stored by
+ * cache_set_xattrs(), setting data to a copy which the caller must free.
+ *
+ * Returns 1 on a hit, 0 otherwise.
+ */
+int cache_get_xattrs(long long inode, char **data, size_t * len);
+
+/**
+ * Record the extended attributes of the given inode, which we treat as
+ * an opaque buffer.
+ */
+void cache_set_xattrs(long long inode, const char *data, size_t len);
+
+/**
+ * Forget the extended attributes of the given inode.
+ */
+void cache_invalidate_xattrs(long long inode);
+
+
+#endif /* _CACHE_H */
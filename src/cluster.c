@@ -0,0 +1,547 @@
+/* cluster.c -- Connections to the nodes of a Redis Cluster.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  A cluster spreads its keys between many nodes, by slot.  We learn
+ * which node serves each slot when we start, and then send each command
+ * straight to the node serving its key, opening connections to nodes as
+ * they're needed.
+ *
+ *  Commands are pipelined just as they are upon a single connection.
+ * Each one queued is remembered, along with the node it was sent to and
+ * its position amongst the commands sent to that node, so that replies
+ * may be returned in the order the commands were queued even though
+ * different nodes answer them.
+ *
+ *  If the slots move a node replies with MOVED, or ASK while a slot is
+ * being migrated, and the command is sent again to the node it names.
+ * A MOVED reply also updates the map of slots shared by every thread.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cluster.h"
+#include "slots.h"
+
+
+/**
+ * The most times we'll follow redirections for a single command.
+ */
+#define CLUSTER_REDIRECTS 5
+
+
+/**
+ * A node of the cluster.
+ */
+typedef struct cluster_node
+{
+    char host[256];
+    int port;
+} cluster_node;
+
+
+/**
+ * The nodes we know of, the node serving each slot, and the lock which
+ * protects them both.
+ */
+static cluster_node _nodes[CLUSTER_MAX_NODES];
+static int _node_count = 0;
+static unsigned char _slots[SLOT_COUNT];
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * A command awaiting its reply.
+ */
+typedef struct pending_command
+{
+    char *cmd;
+    size_t len;
+    int node;
+    long long seq;
+    int redirects;
+    void *reply;
+} pending_command;
+
+
+/**
+ * A set of connections, and the commands outstanding upon them.
+ *
+ * For each node we count the commands sent, and the replies received,
+ * so that we know which command each reply belongs to.
+ */
+struct cluster
+{
+    redisContext *conns[CLUSTER_MAX_NODES];
+    long long sent[CLUSTER_MAX_NODES];
+    long long received[CLUSTER_MAX_NODES];
+    pending_command *pending;
+    int head;
+    int count;
+    int size;
+    int failed;
+    redisReplyObjectFunctions *fn;
+    void (*free_reply) (void *);
+};
+
+
+
+/**
+ * Find the given node, adding it if it is new.  Must be called with
+ * the lock held.
+ */
+static int
+find_node(const char *host, int port)
+{
+    int i;
+
+    for (i = 0; i < _node_count; i++)
+    {
+        if ((_nodes[i].port == port) && (strcmp(_nodes[i].host, host) == 0))
+            return (i);
+    }
+
+    if (_node_count == CLUSTER_MAX_NODES)
+    {
+        fprintf(stderr, "Too many cluster nodes; ignoring %s:%d.\n", host,
+                port);
+        return 0;
+    }
+
+    snprintf(_nodes[_node_count].host, sizeof(_nodes[0].host), "%s", host);
+    _nodes[_node_count].port = port;
+
+    return (_node_count++);
+}
+
+
+/**
+ * Learn which node serves each slot.
+ */
+int
+cluster_discover(const char *host, int port)
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c = NULL;
+    redisReply *reply = NULL;
+    size_t i;
+    int ret = -1;
+
+    c = redisConnectWithTimeout(host, port, timeout);
+    if ((c == NULL) || (c->err))
+    {
+        if (c != NULL)
+            redisFree(c);
+        return -1;
+    }
+
+    reply = redisCommand(c, "CLUSTER SLOTS");
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+        (reply->elements > 0))
+    {
+        pthread_mutex_lock(&_lock);
+
+        /**
+         * The node we were given is used for commands without a key.
+         */
+        find_node(host, port);
+
+        for (i = 0; i < reply->elements; i++)
+        {
+            redisReply *range = reply->element[i];
+            redisReply *master;
+            const char *h;
+            long long s;
+            int node;
+
+            if ((range->type != REDIS_REPLY_ARRAY) || (range->elements < 3))
+                continue;
+
+            master = range->element[2];
+            if ((master->type != REDIS_REPLY_ARRAY) || (master->elements < 2))
+                continue;
+
+            /**
+             * A node which doesn't know its own address says so with an
+             * empty host; it is the one we asked.
+             */
+            h = master->element[0]->str;
+            if ((h == NULL) || (*h == '\0'))
+                h = host;
+
+            node = find_node(h, (int)master->element[1]->integer);
+
+            for (s = range->element[0]->integer;
+                 (s <= range->element[1]->integer) && (s < SLOT_COUNT); s++)
+                _slots[s] = node;
+        }
+
+        pthread_mutex_unlock(&_lock);
+        ret = 0;
+    }
+
+    if (reply != NULL)
+        freeReplyObject(reply);
+    redisFree(c);
+
+    return (ret);
+}
+
+
+/**
+ * Create a new, empty, set of connections.
+ */
+cluster *
+cluster_new(redisReplyObjectFunctions * fn, void (*free_reply) (void *))
+{
+    cluster *c = calloc(1, sizeof(cluster));
+
+    if (c == NULL)
+        return NULL;
+
+    c->fn = fn;
+    c->free_reply = free_reply;
+
+    return (c);
+}
+
+
+/**
+ * Has any connection failed?
+ */
+int
+cluster_failed(cluster * c)
+{
+    return (c->failed);
+}
+
+
+/**
+ * Close every connection, and forget any outstanding commands.
+ */
+void
+cluster_free(cluster * c)
+{
+    int i;
+
+    if (c == NULL)
+        return;
+
+    for (i = 0; i < CLUSTER_MAX_NODES; i++)
+    {
+        if (c->conns[i] != NULL)
+            redisFree(c->conns[i]);
+    }
+
+    for (i = c->head; i < c->count; i++)
+    {
+        free(c->pending[i].cmd);
+        if (c->pending[i].reply != NULL)
+            c->free_reply(c->pending[i].reply);
+    }
+
+    free(c->pending);
+    free(c);
+}
+
+
+/**
+ * The connection to the given node, which is opened if need be.
+ */
+static redisContext *
+connection(cluster * c, int node)
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *r;
+    char host[256];
+    int port;
+
+    if (c->conns[node] != NULL)
+        return (c->conns[node]);
+
+    pthread_mutex_lock(&_lock);
+    snprintf(host, sizeof(host), "%s", _nodes[node].host);
+    port = _nodes[node].port;
+    pthread_mutex_unlock(&_lock);
+
+    r = redisConnectWithTimeout(host, port, timeout);
+    if ((r == NULL) || (r->err))
+    {
+        fprintf(stderr, "Failed to connect to cluster node [%s:%d].\n", host,
+                port);
+        if (r != NULL)
+            redisFree(r);
+        c->failed = 1;
+        return NULL;
+    }
+
+    if (c->fn != NULL)
+        redisSetReplyObjectFunctions(r, c->fn);
+
+    c->conns[node] = r;
+    c->sent[node] = 0;
+    c->received[node] = 0;
+
+    return (r);
+}
+
+
+/**
+ * Send the given pending command to the given node.
+ */
+static int
+send_pending(cluster * c, int i, int node, int asking)
+{
+    pending_command *p = &c->pending[i];
+    redisContext *r = connection(c, node);
+
+    if (r == NULL)
+        return REDIS_ERR;
+
+    if (asking)
+    {
+        __redisAppendCommand(r, (char *)"*1\r\n$6\r\nASKING\r\n", 16);
+        c->sent[node] += 1;
+    }
+
+    __redisAppendCommand(r, p->cmd, p->len);
+    p->node = node;
+    p->seq = c->sent[node]++;
+
+    return REDIS_OK;
+}
+
+
+/**
+ * Remember a formatted command, which we now own, and send it to the
+ * node serving its key.
+ */
+static int
+queue(cluster * c, char *cmd, int len)
+{
+    const char *key = NULL;
+    size_t keylen = 0;
+    int node = 0;
+
+    if (len < 0)
+    {
+        c->failed = 1;
+        return REDIS_ERR;
+    }
+
+    if (c->count == c->size)
+    {
+        int size = (c->size > 0) ? (c->size * 2) : 64;
+        pending_command *p = realloc(c->pending,
+                                     size * sizeof(pending_command));
+
+        if (p == NULL)
+        {
+            free(cmd);
+            c->failed = 1;
+            return REDIS_ERR;
+        }
+
+        c->pending = p;
+        c->size = size;
+    }
+
+    if (slot_command_key(cmd, len, &key, &keylen))
+    {
+        pthread_mutex_lock(&_lock);
+        node = _slots[slot_of(key, keylen)];
+        pthread_mutex_unlock(&_lock);
+    }
+
+    memset(&c->pending[c->count], 0, sizeof(pending_command));
+    c->pending[c->count].cmd = cmd;
+    c->pending[c->count].len = len;
+    c->count += 1;
+
+    return (send_pending(c, c->count - 1, node, 0));
+}
+
+
+int
+cluster_vappend(cluster * c, const char *format, va_list ap)
+{
+    char *cmd = NULL;
+    int len = redisvFormatCommand(&cmd, format, ap);
+
+    return (queue(c, cmd, len));
+}
+
+
+int
+cluster_append_formatted(cluster * c, char *cmd, int len)
+{
+    return (queue(c, cmd, len));
+}
+
+
+int
+cluster_append(cluster * c, const char *format, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, format);
+    ret = cluster_vappend(c, format, ap);
+    va_end(ap);
+
+    return (ret);
+}
+
+
+int
+cluster_append_argv(cluster * c, int argc, const char **argv,
+                    const size_t * argvlen)
+{
+    char *cmd = NULL;
+    int len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+
+    return (queue(c, cmd, len));
+}
+
+
+/**
+ * Write out everything queued upon every connection, so that all of the
+ * nodes are working on our commands at once.
+ */
+static int
+flush(cluster * c)
+{
+    int i;
+
+    for (i = 0; i < CLUSTER_MAX_NODES; i++)
+    {
+        int done = 0;
+
+        if (c->conns[i] == NULL)
+            continue;
+
+        while (!done)
+        {
+            if (redisBufferWrite(c->conns[i], &done) != REDIS_OK)
+            {
+                c->failed = 1;
+                return REDIS_ERR;
+            }
+        }
+    }
+
+    return REDIS_OK;
+}
+
+
+/**
+ * Read the next reply from the given node, and file it with the command
+ * it answers.  The replies to ASKING are discarded.
+ */
+static int
+read_one(cluster * c, int node)
+{
+    void *reply = NULL;
+    int i;
+
+    if ((c->conns[node] == NULL) ||
+        (redisGetReply(c->conns[node], &reply) != REDIS_OK))
+    {
+        c->failed = 1;
+        return REDIS_ERR;
+    }
+
+    for (i = c->head; i < c->count; i++)
+    {
+        pending_command *p = &c->pending[i];
+
+        if ((p->node == node) && (p->seq == c->received[node]))
+        {
+            p->reply = reply;
+            reply = NULL;
+            break;
+        }
+    }
+
+    c->received[node] += 1;
+
+    if (reply != NULL)
+        c->free_reply(reply);
+
+    return REDIS_OK;
+}
+
+
+/**
+ * Read the reply to the oldest command we've queued.
+ */
+int
+cluster_get_reply(cluster * c, void **reply)
+{
+    pending_command *p;
+
+    *reply = NULL;
+
+    if ((c->head >= c->count) || (flush(c) != REDIS_OK))
+        return REDIS_ERR;
+
+    while (1)
+    {
+        redisReply *r;
+        char host[256];
+        int slot = 0;
+        int port = 0;
+        int kind = 0;
+        int node;
+
+        p = &c->pending[c->head];
+        while (p->reply == NULL)
+        {
+            if (read_one(c, p->node) != REDIS_OK)
+                return REDIS_ERR;
+        }
+
+        r = p->reply;
+        if ((r->type == REDIS_REPLY_ERROR) &&
+            (p->redirects < CLUSTER_REDIRECTS))
+            kind = slot_redirect(r->str, &slot, host, sizeof(host), &port);
+
+        if (kind == 0)
+            break;
+
+        pthread_mutex_lock(&_lock);
+        node = find_node(host, port);
+        if (kind == SLOT_MOVED)
+            _slots[slot] = node;
+        pthread_mutex_unlock(&_lock);
+
+        c->free_reply(r);
+        p->reply = NULL;
+        p->redirects += 1;
+
+        if ((send_pending(c, c->head, node, (kind == SLOT_ASK)) != REDIS_OK) ||
+            (flush(c) != REDIS_OK))
+            return REDIS_ERR;
+    }
+
+    *reply = p->reply;
+    free(p->cmd);
+
+    c->head += 1;
+    if (c->head == c->count)
+        c->head = c->count = 0;
+
+    return REDIS_OK;
+}
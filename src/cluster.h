@@ -0,0 +1,91 @@
+/* cluster.h -- Connections to the nodes of a Redis Cluster.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _CLUSTER_H
+#define _CLUSTER_H 1
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "hiredis.h"
+
+
+/**
+ * The most nodes we'll talk to.
+ */
+#define CLUSTER_MAX_NODES 128
+
+
+/**
+ * A set of connections, one to each node of the cluster, along with the
+ * commands waiting for replies upon them.
+ *
+ * Like a single connection this may only be used by one thread at a
+ * time, and replies are returned in the order commands were queued,
+ * whichever node answers them.
+ */
+typedef struct cluster cluster;
+
+
+/**
+ * Learn which node serves each slot, by asking the given node.
+ *
+ * Returns 0 on success, -1 if the node isn't part of a cluster.
+ */
+int cluster_discover(const char *host, int port);
+
+/**
+ * Create a new, empty, set of connections.
+ *
+ * Replies are built with the given functions, if any, and released
+ * with the given function when we discard them ourselves.
+ */
+cluster *cluster_new(redisReplyObjectFunctions * fn,
+                     void (*free_reply) (void *));
+
+/**
+ * Has any connection failed?
+ */
+int cluster_failed(cluster * c);
+
+/**
+ * Close every connection, and forget any outstanding commands.
+ */
+void cluster_free(cluster * c);
+
+
+/**
+ * Queue a command, in the manner of redisvAppendCommand(), on the node
+ * serving its key.
+ */
+int cluster_vappend(cluster * c, const char *format, va_list ap);
+int cluster_append(cluster * c, const char *format, ...);
+
+/**
+ * Queue a command which has already been formatted, taking ownership of
+ * it.
+ */
+int cluster_append_formatted(cluster * c, char *cmd, int len);
+
+/**
+ * Queue a command given as a vector of arguments.
+ */
+int cluster_append_argv(cluster * c, int argc, const char **argv,
+                        const size_t * argvlen);
+
+/**
+ * Read the reply to the oldest command we've queued, following any
+ * redirection to another node.
+ */
+int cluster_get_reply(cluster * c, void **reply);
+
+
+#endif /* _CLUSTER_H */
@@ -0,0 +1,180 @@
+/* codec.c -- Compression of the chunks of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Each chunk of a compressed file is stored in a frame, which begins
+ * with a byte naming the codec used.  A compressed chunk follows that
+ * with its original length, as four bytes, most significant first,
+ * and then the compressed data:
+ *
+ *    [CODEC_NONE] [data ..]
+ *    [CODEC_ZLIB] [length x 4] [deflated data ..]
+ *
+ *  Chunks which are small, or which don't compress, are stored as-is
+ * so that reading them costs nothing.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "codec.h"
+
+
+/**
+ * The size of the header of a compressed frame.
+ */
+#define CODEC_HEADER 5
+
+/**
+ * A chunk must shrink by at least this fraction to be worth storing
+ * compressed.
+ */
+#define CODEC_SAVING 8
+
+
+
+/**
+ * Find the codec with the given name.
+ */
+int
+codec_lookup(const char *name)
+{
+    if ((name == NULL) || (strcmp(name, "none") == 0))
+        return CODEC_NONE;
+    if (strcmp(name, "zlib") == 0)
+        return CODEC_ZLIB;
+
+    return -1;
+}
+
+
+/**
+ * The name of the given codec.
+ */
+const char *
+codec_name(int codec)
+{
+    return ((codec == CODEC_ZLIB) ? "zlib" : "none");
+}
+
+
+/**
+ * Store a chunk as-is.
+ */
+static char *
+encode_raw(const char *buf, size_t len, size_t *out_len)
+{
+    char *frame = malloc(len + 1);
+
+    if (frame == NULL)
+        return NULL;
+
+    frame[0] = CODEC_NONE;
+    memcpy(frame + 1, buf, len);
+    *out_len = len + 1;
+
+    return (frame);
+}
+
+
+/**
+ * Encode a chunk.
+ */
+char *
+codec_encode(int codec, const char *buf, size_t len, size_t min_len,
+             size_t *out_len)
+{
+    uLongf size;
+    char *frame;
+
+    if ((codec != CODEC_ZLIB) || (len < min_len) || (len == 0))
+        return (encode_raw(buf, len, out_len));
+
+    size = compressBound(len);
+    frame = malloc(CODEC_HEADER + size);
+    if (frame == NULL)
+        return NULL;
+
+    /**
+     * Give up on anything which doesn't shrink enough to be worth the
+     * cost of inflating it again.
+     */
+    if ((compress2((Bytef *) frame + CODEC_HEADER, &size, (const Bytef *)buf,
+                   len, Z_BEST_SPEED) != Z_OK) ||
+        (CODEC_HEADER + size > len - (len / CODEC_SAVING)))
+    {
+        free(frame);
+        return (encode_raw(buf, len, out_len));
+    }
+
+    frame[0] = CODEC_ZLIB;
+    frame[1] = (len >> 24) & 0xff;
+    frame[2] = (len >> 16) & 0xff;
+    frame[3] = (len >> 8) & 0xff;
+    frame[4] = len & 0xff;
+    *out_len = CODEC_HEADER + size;
+
+    return (frame);
+}
+
+
+/**
+ * Decode a frame.
+ */
+char *
+codec_decode(const char *frame, size_t len, size_t max_len, size_t *out_len)
+{
+    const unsigned char *p = (const unsigned char *)frame;
+    uLongf size;
+    char *buf;
+
+    if (len < 1)
+        return NULL;
+
+    if (p[0] == CODEC_NONE)
+    {
+        if (len - 1 > max_len)
+            return NULL;
+
+        buf = malloc(len);
+        if (buf == NULL)
+            return NULL;
+
+        memcpy(buf, frame + 1, len - 1);
+        *out_len = len - 1;
+        return (buf);
+    }
+
+    if ((p[0] != CODEC_ZLIB) || (len < CODEC_HEADER))
+        return NULL;
+
+    size = ((uLongf) p[1] << 24) | ((uLongf) p[2] << 16) |
+        ((uLongf) p[3] << 8) | (uLongf) p[4];
+    if (size > max_len)
+        return NULL;
+
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        return NULL;
+
+    if ((uncompress((Bytef *) buf, &size, (const Bytef *)frame + CODEC_HEADER,
+                    len - CODEC_HEADER) != Z_OK))
+    {
+        free(buf);
+        return NULL;
+    }
+
+    *out_len = size;
+    return (buf);
+}
@@ -0,0 +1,58 @@
+/* codec.h -- Compression of the chunks of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _CODEC_H
+#define _CODEC_H 1
+
+#include <stddef.h>
+
+
+/**
+ * The codecs we support.
+ */
+#define CODEC_NONE 0
+#define CODEC_ZLIB 1
+
+
+/**
+ * Find the codec with the given name, e.g. "zlib".
+ *
+ * Returns -1 if it isn't one we support.
+ */
+int codec_lookup(const char *name);
+
+/**
+ * The name of the given codec.
+ */
+const char *codec_name(int codec);
+
+
+/**
+ * Encode a chunk with the given codec, into a newly allocated frame.
+ *
+ * The chunk is stored as-is, but still framed, if it is shorter than
+ * min_len or doesn't compress well.  The length of the frame is stored
+ * in *out_len.  Returns NULL if we're out of memory.
+ */
+char *codec_encode(int codec, const char *buf, size_t len, size_t min_len,
+                   size_t *out_len);
+
+/**
+ * Decode a frame into a newly allocated chunk, of no more than max_len
+ * bytes, the length of which is stored in *out_len.
+ *
+ * Returns NULL if the frame is corrupt, or we're out of memory.
+ */
+char *codec_decode(const char *frame, size_t len, size_t max_len,
+                   size_t *out_len);
+
+
+#endif /* _CODEC_H */
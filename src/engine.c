@@ -0,0 +1,511 @@
+/* engine.c -- Share one asynchronous connection between many threads.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Rather than each thread waiting on a connection of its own, every
+ * command is written to a single non-blocking connection, which is
+ * driven by an event loop in a thread of its own.  The replies are
+ * matched up with the commands by hiredis, and handed back to whichever
+ * thread is waiting for them.
+ *
+ *  Many threads may therefore have commands outstanding at once, and
+ * they are pipelined onto the wire together.
+ *
+ *  The asynchronous context isn't thread-safe, so everything which
+ * touches it is done while holding our lock.  Each thread keeps the
+ * commands it has queued in a list of its own, so that engine_get_reply()
+ * behaves just like redisGetReply() on a pipelined connection.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "hiredis.h"
+#include "async.h"
+#include "sds.h"
+#include "engine.h"
+
+
+/**
+ * A command which is waiting for its reply.
+ */
+typedef struct engine_op
+{
+    redisReply *reply;
+    int done;
+    pthread_cond_t *cond;
+    struct engine_op *next;
+} engine_op;
+
+
+/**
+ * The server we talk to, and our connection to it.
+ */
+static char _host[100];
+static int _port = 0;
+static redisAsyncContext *_ac = NULL;
+
+/**
+ * Incremented whenever we connect, so that the loop can tell when the
+ * connection it was polling has been replaced.
+ */
+static unsigned int _generation = 0;
+
+/**
+ * The events the connection is waiting for.
+ */
+static int _reading = 0;
+static int _writing = 0;
+
+/**
+ * A pipe used to wake the event loop when there is something to write.
+ */
+static int _wake[2] = { -1, -1 };
+
+/**
+ * The event loop thread.
+ */
+static pthread_t _thread;
+static int _running = 0;
+static int _stopping = 0;
+
+/**
+ * Mutex for safety.
+ */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The commands queued by the current thread, and the condition it
+ * waits upon for their replies.
+ */
+static __thread engine_op *_head = NULL;
+static __thread engine_op *_tail = NULL;
+static __thread pthread_cond_t _cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * hiredis frees each reply once its callback returns; this is the reply
+ * the callback has taken ownership of, which mustn't be.
+ */
+static redisReplyObjectFunctions _functions;
+static void *_claimed = NULL;
+
+
+
+/**
+ * Wake the event loop.
+ */
+static void
+engine_wake()
+{
+    char c = 0;
+
+    if (write(_wake[1], &c, 1) < 0)
+    {
+        /* The pipe is full; the loop is going to wake anyway. */
+    }
+}
+
+
+/**
+ * The hooks hiredis uses to tell us which events it is waiting for.
+ * These are always called with the lock held.
+ */
+static void
+engine_add_read(void *data)
+{
+    _reading = 1;
+}
+
+static void
+engine_del_read(void *data)
+{
+    _reading = 0;
+}
+
+static void
+engine_add_write(void *data)
+{
+    if (!_writing)
+    {
+        _writing = 1;
+        engine_wake();
+    }
+}
+
+static void
+engine_del_write(void *data)
+{
+    _writing = 0;
+}
+
+/**
+ * Called as the context is freed, whether we asked for that or the
+ * connection failed.
+ */
+static void
+engine_cleanup(void *data)
+{
+    _reading = 0;
+    _writing = 0;
+    _ac = NULL;
+}
+
+
+/**
+ * Free a reply, unless a callback has taken it.
+ */
+static void
+engine_free_reply(void *reply)
+{
+    if (reply == _claimed)
+    {
+        _claimed = NULL;
+        return;
+    }
+    freeReplyObject(reply);
+}
+
+
+/**
+ * Called by hiredis when the reply to a command arrives, or with a NULL
+ * reply if the connection failed first.
+ */
+static void
+engine_reply(redisAsyncContext * ac, void *reply, void *privdata)
+{
+    engine_op *op = privdata;
+
+    _claimed = reply;
+
+    op->reply = reply;
+    op->done = 1;
+    pthread_cond_signal(op->cond);
+}
+
+
+/**
+ * Connect to the server, unless we already are.  Must be called with
+ * the lock held.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+static int
+engine_connect()
+{
+    if (_ac != NULL)
+        return 0;
+
+    _ac = redisAsyncConnect(_host, _port);
+    if (_ac == NULL)
+        return -1;
+
+    if (_ac->err)
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d]: %s\n",
+                _host, _port, _ac->errstr);
+        redisAsyncFree(_ac);
+        _ac = NULL;
+        return -1;
+    }
+
+    /**
+     * Keep replies alive past their callbacks.
+     */
+    memcpy(&_functions, _ac->c.fn, sizeof(_functions));
+    _functions.freeObject = engine_free_reply;
+    redisAsyncSetReplyObjectFunctions(_ac, &_functions);
+
+    _ac->ev.addRead = engine_add_read;
+    _ac->ev.delRead = engine_del_read;
+    _ac->ev.addWrite = engine_add_write;
+    _ac->ev.delWrite = engine_del_write;
+    _ac->ev.cleanup = engine_cleanup;
+    _ac->ev.data = NULL;
+
+    _generation += 1;
+    return 0;
+}
+
+
+/**
+ * The event loop: wait for the connection to become readable or
+ * writable, and let hiredis do the rest.
+ */
+static void *
+engine_loop(void *arg)
+{
+    struct pollfd fds[2];
+    unsigned int generation;
+    char buf[64];
+    int count;
+
+    while (1)
+    {
+        pthread_mutex_lock(&_lock);
+
+        if (_stopping)
+        {
+            pthread_mutex_unlock(&_lock);
+            break;
+        }
+
+        fds[0].fd = _wake[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        count = 1;
+
+        if ((_ac != NULL) && (_reading || _writing))
+        {
+            fds[1].fd = _ac->c.fd;
+            fds[1].events = (_reading ? POLLIN : 0) | (_writing ? POLLOUT : 0);
+            fds[1].revents = 0;
+            count = 2;
+        }
+        generation = _generation;
+
+        pthread_mutex_unlock(&_lock);
+
+        if (poll(fds, count, 1000) < 0)
+        {
+            if (errno != EINTR)
+                perror("poll");
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            while (read(_wake[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        if (count < 2)
+            continue;
+
+        pthread_mutex_lock(&_lock);
+
+        if ((_ac != NULL) && (generation == _generation))
+        {
+            if (fds[1].revents & (POLLIN | POLLERR | POLLHUP))
+                redisAsyncHandleRead(_ac);
+
+            if ((_ac != NULL) && (generation == _generation) &&
+                (fds[1].revents & POLLOUT))
+                redisAsyncHandleWrite(_ac);
+        }
+
+        pthread_mutex_unlock(&_lock);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Start the engine.
+ */
+int
+engine_start(const char *host, int port)
+{
+    int i;
+
+    snprintf(_host, sizeof(_host), "%s", host);
+    _port = port;
+
+    if (pipe(_wake) != 0)
+        return -1;
+
+    for (i = 0; i < 2; i++)
+        fcntl(_wake[i], F_SETFL, fcntl(_wake[i], F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_lock(&_lock);
+    i = engine_connect();
+    pthread_mutex_unlock(&_lock);
+
+    if ((i != 0) || (pthread_create(&_thread, NULL, engine_loop, NULL) != 0))
+    {
+        close(_wake[0]);
+        close(_wake[1]);
+        return -1;
+    }
+
+    _running = 1;
+    return 0;
+}
+
+
+/**
+ * Is the engine in use?
+ */
+int
+engine_running()
+{
+    return (_running);
+}
+
+
+/**
+ * Stop the engine.
+ */
+void
+engine_stop()
+{
+    if (!_running)
+        return;
+
+    pthread_mutex_lock(&_lock);
+    _stopping = 1;
+    engine_wake();
+    pthread_mutex_unlock(&_lock);
+
+    pthread_join(_thread, NULL);
+
+    /**
+     * Freeing the context runs the callbacks of anything outstanding
+     * with a NULL reply.
+     */
+    pthread_mutex_lock(&_lock);
+    if (_ac != NULL)
+        redisAsyncFree(_ac);
+    _running = 0;
+    pthread_mutex_unlock(&_lock);
+
+    close(_wake[0]);
+    close(_wake[1]);
+}
+
+
+/**
+ * Add a command to the list of the current thread.
+ */
+static engine_op *
+engine_push()
+{
+    engine_op *op = malloc(sizeof(engine_op));
+
+    if (op == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for a command.\n");
+        exit(1);
+    }
+
+    op->reply = NULL;
+    op->done = 0;
+    op->cond = &_cond;
+    op->next = NULL;
+
+    if (_tail != NULL)
+        _tail->next = op;
+    else
+        _head = op;
+    _tail = op;
+
+    return (op);
+}
+
+
+/**
+ * Queue a command.
+ */
+int
+engine_vappend(const char *format, va_list ap, size_t * len)
+{
+    engine_op *op = engine_push();
+    int ret = REDIS_ERR;
+    size_t before = 0;
+
+    pthread_mutex_lock(&_lock);
+
+    /**
+     * The command is formatted onto the end of the output buffer, which
+     * is only written out with the lock held.
+     */
+    if (engine_connect() == 0)
+    {
+        before = sdslen(_ac->c.obuf);
+        if (redisvAsyncCommand(_ac, engine_reply, op, format, ap) ==
+            REDIS_OK)
+            ret = REDIS_OK;
+    }
+
+    if (ret == REDIS_OK)
+    {
+        if (len != NULL)
+            *len = sdslen(_ac->c.obuf) - before;
+    }
+    else
+    {
+        op->done = 1;
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return (ret);
+}
+
+
+/**
+ * Queue a command given as a vector of arguments.
+ */
+int
+engine_append_argv(int argc, const char **argv, const size_t * argvlen)
+{
+    engine_op *op = engine_push();
+    int ret = REDIS_ERR;
+
+    pthread_mutex_lock(&_lock);
+
+    if ((engine_connect() == 0) &&
+        (redisAsyncCommandArgv(_ac, engine_reply, op, argc, argv, argvlen) ==
+         REDIS_OK))
+        ret = REDIS_OK;
+    else
+        op->done = 1;
+
+    pthread_mutex_unlock(&_lock);
+
+    return (ret);
+}
+
+
+/**
+ * Wait for the reply to the oldest command queued by this thread.
+ */
+int
+engine_get_reply(void **reply)
+{
+    engine_op *op = _head;
+
+    *reply = NULL;
+
+    if (op == NULL)
+        return REDIS_ERR;
+
+    _head = op->next;
+    if (_head == NULL)
+        _tail = NULL;
+
+    pthread_mutex_lock(&_lock);
+    while (!op->done)
+        pthread_cond_wait(op->cond, &_lock);
+    pthread_mutex_unlock(&_lock);
+
+    *reply = op->reply;
+    free(op);
+
+    return ((*reply != NULL) ? REDIS_OK : REDIS_ERR);
+}
@@ -0,0 +1,61 @@
+/* engine.h -- Share one asynchronous connection between many threads.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _ENGINE_H
+#define _ENGINE_H 1
+
+#include <stdarg.h>
+#include <stddef.h>
+
+
+/**
+ * Connect to the given server and start the thread running our event
+ * loop.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int engine_start(const char *host, int port);
+
+/**
+ * Is the engine in use?
+ */
+int engine_running();
+
+/**
+ * Stop the event loop, failing anything still outstanding.
+ */
+void engine_stop();
+
+
+/**
+ * Queue a command, in the manner of redisvAppendCommand(), noting its
+ * size in "len" if that isn't NULL.
+ *
+ * Commands queued by one thread are answered, via engine_get_reply(),
+ * in the order they were queued.
+ */
+int engine_vappend(const char *format, va_list ap, size_t * len);
+
+/**
+ * Queue a command given as a vector of arguments.
+ */
+int engine_append_argv(int argc, const char **argv, const size_t * argvlen);
+
+/**
+ * Wait for the reply to the oldest command queued by this thread.
+ *
+ * The reply is NULL if the connection failed, and must be freed with
+ * freeReplyObject() otherwise.
+ */
+int engine_get_reply(void **reply);
+
+
+#endif /* _ENGINE_H */
@@ -0,0 +1,213 @@
+/* main.c -- Mount the redis-based filesystem.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  The filesystem itself lives in redisfs.c; here we check that we may
+ * mount it, and hand it to FUSE.  Kept apart so that the filesystem can
+ * be linked, and driven directly, without mounting anything.
+ *
+ */
+
+#define FUSE_USE_VERSION 26
+
+
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "redisfs.h"
+
+
+
+/**
+ * Write our current process ID to a file.
+ */
+int
+writePID(const char *filename)
+{
+    char buf[20];
+    int fd;
+    long pid;
+
+    if ((fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1)
+        return -1;
+
+    pid = getpid();
+    snprintf(buf, sizeof(buf), "%ld", (long)pid);
+    if (write(fd, buf, strlen(buf)) != strlen(buf))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/**
+ * Mount the filesystem, and serve it with the low-level API of FUSE
+ * until we're unmounted, given the args. we'd pass to fuse_main().
+ */
+int
+run_lowlevel(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
+    struct fuse_session *se = NULL;
+    struct fuse_chan *ch = NULL;
+    int ret = -1;
+    int i;
+
+    /**
+     * The mount-point is given to fuse_mount(), and we never leave the
+     * foreground, so both it and "-f" are dropped.
+     */
+    for (i = 0; i < argc; i++)
+    {
+        if ((i == 1) || (strcmp(argv[i], "-f") == 0))
+            continue;
+
+        if (fuse_opt_add_arg(&args, argv[i]) != 0)
+        {
+            fuse_opt_free_args(&args);
+            return -1;
+        }
+    }
+
+    ch = fuse_mount(_g_mount, &args);
+    if (ch == NULL)
+    {
+        fuse_opt_free_args(&args);
+        return -1;
+    }
+
+    se = fuse_lowlevel_new(&args, &redisfs_lowlevel_operations,
+                           sizeof(redisfs_lowlevel_operations), NULL);
+    if (se != NULL)
+    {
+        if (fuse_set_signal_handlers(se) != -1)
+        {
+            fuse_session_add_chan(se, ch);
+            ret = fuse_session_loop_mt(se);
+            fuse_remove_signal_handlers(se);
+            fuse_session_remove_chan(ch);
+        }
+        fuse_session_destroy(se);
+    }
+
+    fuse_unmount(_g_mount, ch);
+    fuse_opt_free_args(&args);
+
+    return (ret);
+}
+
+
+/**
+ *  Entry point to our code.
+ *
+ *  We support minimal command line parsing, then connect to redis and
+ * hand over to FUSE.
+ */
+int
+main(int argc, char *argv[])
+{
+    struct stat statbuf;
+    char options[256];
+    int ret;
+
+    /**
+     * Args. passed to FUSE's init, to which the options telling the
+     * kernel how long it may cache are added once we know them.
+     */
+    char *args[] = {
+        "fuse-redisfs", _g_mount,
+        "-o", "allow_other",
+        "-o", "nonempty",
+        "-f",
+        NULL, NULL,
+        NULL, NULL,
+        NULL
+    };
+
+    /**
+     * The number of those args. in use.
+     */
+    int args_c = 7;
+
+    /**
+     * Parse any command line arguments we might have.
+     */
+    if ((ret = parse_options(argc, argv)) != 0)
+        return (ret);
+
+    /**
+     * Complain if we're not launched as root.
+     */
+    if (getuid() != 0)
+    {
+        fprintf(stderr, "You must start this program as root.\n");
+        return -1;
+    }
+
+    /**
+     * Complain if our mount-point isn't a directory.
+     */
+    if ((stat(_g_mount, &statbuf) != 0) ||
+        ((statbuf.st_mode & S_IFMT) != S_IFDIR))
+    {
+        fprintf(stderr, "%s doesn't exist or isn't a directory!\n", _g_mount);
+        return -1;
+    }
+
+
+    /**
+     * Write out our pid.
+     */
+    if (!writePID("/var/run/redisfs.pid"))
+    {
+        fprintf(stderr, "Writing PID file failed\n");
+        return -1;
+    }
+
+    /**
+     * Connect, and prepare the filesystem.
+     */
+    if (setup_filesystem() != 0)
+        return -1;
+
+    /**
+     * The kernel's caching, which depends upon whether the filesystem
+     * turned out to be read-only, and --debug, which causes us to pass
+     * "-o debug" to FUSE.
+     */
+    if (kernel_options(options, sizeof(options)) > 0)
+    {
+        args[args_c++] = "-o";
+        args[args_c++] = options;
+    }
+    if (_g_debug)
+    {
+        args[args_c++] = "-o";
+        args[args_c++] = "debug";
+    }
+
+    /**
+     * Launch fuse.
+     */
+    if (_g_lowlevel)
+        return (run_lowlevel(args_c, args));
+
+    return (fuse_main(args_c, args, &redisfs_operations, NULL));
+}
@@ -0,0 +1,1478 @@
+/* mock.c -- An in-memory store which answers redis commands.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  This store lets the filesystem be mounted, tested, and measured,
+ * without a redis server.  Commands are parsed from the protocol, run
+ * at once under a single lock, and their replies queued for the thread
+ * which sent them.
+ *
+ *  Keys, the members of sets, and the fields of hashes, are all kept in
+ * chained hash tables which double in size as they fill.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "hiredis.h"
+#include "mock.h"
+
+
+/**
+ * The types of value a key may hold.
+ */
+#define MOCK_STRING 1
+#define MOCK_SET    2
+#define MOCK_HASH   3
+
+/**
+ * The number of buckets a table starts with.
+ */
+#define MOCK_BUCKETS 16
+
+/**
+ * The longest number we'll parse from an argument.
+ */
+#define MOCK_NUMBER 32
+
+
+/**
+ * A key, a member of a set, or a field of a hash.
+ */
+typedef struct mock_entry
+{
+    char *name;
+    size_t len;
+    unsigned int hash;
+    int type;                   /* of keys */
+    char *value;                /* of strings, and the fields of hashes */
+    size_t value_len;
+    struct mock_table *table;   /* of sets & hashes */
+    struct mock_entry *next;
+} mock_entry;
+
+typedef struct mock_table
+{
+    mock_entry **buckets;
+    size_t size;
+    size_t count;
+} mock_table;
+
+typedef struct mock_store
+{
+    mock_table keys;
+    pthread_mutex_t lock;
+} mock_store;
+
+
+/**
+ * The replies waiting to be read by this thread.
+ */
+typedef struct mock_pending
+{
+    redisReply *reply;
+    struct mock_pending *next;
+} mock_pending;
+
+static __thread mock_pending *_head = NULL;
+static __thread mock_pending *_tail = NULL;
+
+
+
+/**
+ * The FNV-1a hash of a buffer.
+ */
+static unsigned int
+hash_of(const char *buf, size_t len)
+{
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)buf[i];
+        h *= 16777619u;
+    }
+
+    return (h);
+}
+
+
+/**
+ * Setup an empty table.
+ */
+static int
+table_init(mock_table * t)
+{
+    t->buckets = calloc(MOCK_BUCKETS, sizeof(mock_entry *));
+    t->size = MOCK_BUCKETS;
+    t->count = 0;
+
+    return ((t->buckets != NULL) ? 0 : -1);
+}
+
+
+static void table_clear(mock_table * t);
+
+/**
+ * Free an entry, and anything it holds.
+ */
+static void
+entry_free(mock_entry * e)
+{
+    if (e->table != NULL)
+    {
+        table_clear(e->table);
+        free(e->table);
+    }
+    free(e->value);
+    free(e->name);
+    free(e);
+}
+
+
+/**
+ * Free every entry of a table, and its buckets.
+ */
+static void
+table_clear(mock_table * t)
+{
+    size_t i;
+
+    for (i = 0; i < t->size; i++)
+    {
+        mock_entry *e = t->buckets[i];
+
+        while (e != NULL)
+        {
+            mock_entry *next = e->next;
+
+            entry_free(e);
+            e = next;
+        }
+    }
+
+    free(t->buckets);
+    t->buckets = NULL;
+    t->size = 0;
+    t->count = 0;
+}
+
+
+/**
+ * Find the named entry of a table, or NULL.
+ */
+static mock_entry *
+table_find(mock_table * t, const char *name, size_t len)
+{
+    unsigned int h = hash_of(name, len);
+    mock_entry *e;
+
+    for (e = t->buckets[h % t->size]; e != NULL; e = e->next)
+    {
+        if ((e->hash == h) && (e->len == len) &&
+            (memcmp(e->name, name, len) == 0))
+            return (e);
+    }
+
+    return (NULL);
+}
+
+
+/**
+ * Double the number of buckets of a table.
+ */
+static void
+table_grow(mock_table * t)
+{
+    size_t size = t->size * 2;
+    mock_entry **buckets = calloc(size, sizeof(mock_entry *));
+    size_t i;
+
+    if (buckets == NULL)
+        return;
+
+    for (i = 0; i < t->size; i++)
+    {
+        mock_entry *e = t->buckets[i];
+
+        while (e != NULL)
+        {
+            mock_entry *next = e->next;
+
+            e->next = buckets[e->hash % size];
+            buckets[e->hash % size] = e;
+            e = next;
+        }
+    }
+
+    free(t->buckets);
+    t->buckets = buckets;
+    t->size = size;
+}
+
+
+/**
+ * Find the named entry of a table, adding it if it is missing, in which
+ * case *added is set.
+ *
+ * Returns NULL on failure.
+ */
+static mock_entry *
+table_add(mock_table * t, const char *name, size_t len, int *added)
+{
+    mock_entry *e = table_find(t, name, len);
+
+    *added = 0;
+    if (e != NULL)
+        return (e);
+
+    e = calloc(1, sizeof(mock_entry));
+    if (e == NULL)
+        return (NULL);
+
+    e->name = malloc(len + 1);
+    if (e->name == NULL)
+    {
+        free(e);
+        return (NULL);
+    }
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+    e->len = len;
+    e->hash = hash_of(name, len);
+
+    if (t->count >= t->size)
+        table_grow(t);
+
+    e->next = t->buckets[e->hash % t->size];
+    t->buckets[e->hash % t->size] = e;
+    t->count += 1;
+    *added = 1;
+
+    return (e);
+}
+
+
+/**
+ * Remove the named entry of a table.
+ *
+ * Returns 1 if it was present, 0 otherwise.
+ */
+static int
+table_remove(mock_table * t, const char *name, size_t len)
+{
+    unsigned int h = hash_of(name, len);
+    mock_entry **p;
+
+    for (p = &t->buckets[h % t->size]; *p != NULL; p = &(*p)->next)
+    {
+        mock_entry *e = *p;
+
+        if ((e->hash == h) && (e->len == len) &&
+            (memcmp(e->name, name, len) == 0))
+        {
+            *p = e->next;
+            entry_free(e);
+            t->count -= 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Replace the value of an entry.
+ *
+ * Returns 0 on success.
+ */
+static int
+entry_set_value(mock_entry * e, const char *value, size_t len)
+{
+    char *copy = malloc(len + 1);
+
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    free(e->value);
+    e->value = copy;
+    e->value_len = len;
+
+    return 0;
+}
+
+
+
+/**
+ * Replies, built just as hiredis builds them.
+ */
+static redisReply *
+reply_new(int type)
+{
+    redisReply *r = calloc(1, sizeof(redisReply));
+
+    if (r != NULL)
+        r->type = type;
+    return (r);
+}
+
+static redisReply *
+reply_string(int type, const char *str, size_t len)
+{
+    redisReply *r = reply_new(type);
+
+    if (r == NULL)
+        return (NULL);
+
+    r->str = malloc(len + 1);
+    if (r->str == NULL)
+    {
+        free(r);
+        return (NULL);
+    }
+    memcpy(r->str, str, len);
+    r->str[len] = '\0';
+    r->len = len;
+
+    return (r);
+}
+
+static redisReply *
+reply_bulk(const char *str, size_t len)
+{
+    return (reply_string(REDIS_REPLY_STRING, str, len));
+}
+
+static redisReply *
+reply_status(const char *str)
+{
+    return (reply_string(REDIS_REPLY_STATUS, str, strlen(str)));
+}
+
+static redisReply *
+reply_error(const char *str)
+{
+    return (reply_string(REDIS_REPLY_ERROR, str, strlen(str)));
+}
+
+static redisReply *
+reply_integer(long long value)
+{
+    redisReply *r = reply_new(REDIS_REPLY_INTEGER);
+
+    if (r != NULL)
+        r->integer = value;
+    return (r);
+}
+
+static redisReply *
+reply_nil()
+{
+    return (reply_new(REDIS_REPLY_NIL));
+}
+
+static redisReply *
+reply_array(size_t elements)
+{
+    redisReply *r = reply_new(REDIS_REPLY_ARRAY);
+
+    if (r == NULL)
+        return (NULL);
+
+    r->element = calloc((elements > 0) ? elements : 1, sizeof(redisReply *));
+    if (r->element == NULL)
+    {
+        free(r);
+        return (NULL);
+    }
+    r->elements = elements;
+
+    return (r);
+}
+
+
+/**
+ * Free a reply, as freeReplyObject() would.
+ */
+void
+mock_free_reply(void *reply)
+{
+    redisReply *r = reply;
+    size_t i;
+
+    if (r == NULL)
+        return;
+
+    if (r->type == REDIS_REPLY_ARRAY)
+    {
+        for (i = 0; i < r->elements; i++)
+            mock_free_reply(r->element[i]);
+        free(r->element);
+    }
+    else
+        free(r->str);
+
+    free(r);
+}
+
+
+/**
+ * The errors we might reply with.
+ */
+#define ERR_TYPE "WRONGTYPE Operation against a key holding the wrong kind of value"
+#define ERR_INTEGER "ERR value is not an integer or out of range"
+#define ERR_SYNTAX "ERR syntax error"
+
+
+
+/**
+ * Parse an argument as a number.
+ *
+ * Returns 0 on success.
+ */
+static int
+arg_number(const char *arg, size_t len, long long *value)
+{
+    char buf[MOCK_NUMBER];
+    char *end = NULL;
+
+    if ((len == 0) || (len >= sizeof(buf)))
+        return -1;
+
+    memcpy(buf, arg, len);
+    buf[len] = '\0';
+    *value = strtoll(buf, &end, 10);
+
+    return ((*end == '\0') ? 0 : -1);
+}
+
+
+/**
+ * Find a key, which must hold the given type of value if it exists.
+ *
+ * Returns the key, or NULL if it doesn't exist, and sets *wrong if it
+ * holds some other type.
+ */
+static mock_entry *
+find_key(mock_store * s, const char *name, size_t len, int type, int *wrong)
+{
+    mock_entry *e = table_find(&s->keys, name, len);
+
+    *wrong = ((e != NULL) && (e->type != type));
+    return (*wrong ? NULL : e);
+}
+
+
+/**
+ * Find a key, which must hold the given type of value, creating it if
+ * it doesn't exist.
+ *
+ * Returns NULL, setting *wrong, if it holds some other type, or on
+ * failure.
+ */
+static mock_entry *
+add_key(mock_store * s, const char *name, size_t len, int type, int *wrong)
+{
+    mock_entry *e;
+    int added;
+
+    *wrong = 0;
+
+    e = table_add(&s->keys, name, len, &added);
+    if (e == NULL)
+        return (NULL);
+
+    if (!added)
+    {
+        *wrong = (e->type != type);
+        return (*wrong ? NULL : e);
+    }
+
+    e->type = type;
+    if (type != MOCK_STRING)
+    {
+        e->table = malloc(sizeof(mock_table));
+        if ((e->table == NULL) || (table_init(e->table) != 0))
+        {
+            free(e->table);
+            e->table = NULL;
+            table_remove(&s->keys, name, len);
+            return (NULL);
+        }
+    }
+
+    return (e);
+}
+
+
+/**
+ * Remove a set or hash which has become empty.
+ */
+static void
+drop_if_empty(mock_store * s, mock_entry * e)
+{
+    if ((e->table != NULL) && (e->table->count == 0))
+        table_remove(&s->keys, e->name, e->len);
+}
+
+
+
+/**
+ * Each command is given its arguments, the command itself first.
+ */
+typedef redisReply *(*mock_handler) (mock_store * s, int argc,
+                                     const char **argv, size_t * argvlen);
+
+
+static redisReply *
+cmd_ping(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (reply_status("PONG"));
+}
+
+
+static redisReply *
+cmd_get(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    int wrong;
+    mock_entry *e = find_key(s, argv[1], argvlen[1], MOCK_STRING, &wrong);
+
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (reply_nil());
+    return (reply_bulk(e->value, e->value_len));
+}
+
+
+static redisReply *
+cmd_set(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    mock_entry *e;
+    int added;
+
+    e = table_add(&s->keys, argv[1], argvlen[1], &added);
+    if (e == NULL)
+        return (NULL);
+
+    if (e->table != NULL)
+    {
+        table_clear(e->table);
+        free(e->table);
+        e->table = NULL;
+    }
+    e->type = MOCK_STRING;
+
+    if (entry_set_value(e, argv[2], argvlen[2]) != 0)
+        return (NULL);
+
+    return (reply_status("OK"));
+}
+
+
+static redisReply *
+cmd_setnx(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    if (table_find(&s->keys, argv[1], argvlen[1]) != NULL)
+        return (reply_integer(0));
+
+    mock_free_reply(cmd_set(s, argc, argv, argvlen));
+    return (reply_integer(1));
+}
+
+
+static redisReply *
+cmd_mget(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    redisReply *r = reply_array(argc - 1);
+    int i;
+
+    if (r == NULL)
+        return (NULL);
+
+    for (i = 1; i < argc; i++)
+    {
+        mock_entry *e = table_find(&s->keys, argv[i], argvlen[i]);
+
+        if ((e != NULL) && (e->type == MOCK_STRING))
+            r->element[i - 1] = reply_bulk(e->value, e->value_len);
+        else
+            r->element[i - 1] = reply_nil();
+    }
+
+    return (r);
+}
+
+
+static redisReply *
+cmd_mset(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    int i;
+
+    if ((argc % 2) != 1)
+        return (reply_error("ERR wrong number of arguments for 'mset' command"));
+
+    for (i = 1; i < argc; i += 2)
+        mock_free_reply(cmd_set(s, 3, argv + i - 1, argvlen + i - 1));
+
+    return (reply_status("OK"));
+}
+
+
+static redisReply *
+cmd_del(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long removed = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+        removed += table_remove(&s->keys, argv[i], argvlen[i]);
+
+    return (reply_integer(removed));
+}
+
+
+static redisReply *
+cmd_exists(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long found = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+        found += (table_find(&s->keys, argv[i], argvlen[i]) != NULL);
+
+    return (reply_integer(found));
+}
+
+
+static redisReply *
+cmd_type(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    mock_entry *e = table_find(&s->keys, argv[1], argvlen[1]);
+
+    if (e == NULL)
+        return (reply_status("none"));
+
+    switch (e->type)
+    {
+    case MOCK_SET:
+        return (reply_status("set"));
+    case MOCK_HASH:
+        return (reply_status("hash"));
+    default:
+        return (reply_status("string"));
+    }
+}
+
+
+/**
+ * Add to the integer held by a key.
+ */
+static redisReply *
+incr_by(mock_store * s, const char *name, size_t len, long long by)
+{
+    char buf[MOCK_NUMBER];
+    long long value = 0;
+    mock_entry *e;
+    int wrong;
+
+    e = add_key(s, name, len, MOCK_STRING, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (NULL);
+
+    if ((e->value != NULL) &&
+        (arg_number(e->value, e->value_len, &value) != 0))
+        return (reply_error(ERR_INTEGER));
+
+    value += by;
+    snprintf(buf, sizeof(buf), "%lld", value);
+    if (entry_set_value(e, buf, strlen(buf)) != 0)
+        return (NULL);
+
+    return (reply_integer(value));
+}
+
+
+static redisReply *
+cmd_incr(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (incr_by(s, argv[1], argvlen[1], 1));
+}
+
+
+static redisReply *
+cmd_decr(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (incr_by(s, argv[1], argvlen[1], -1));
+}
+
+
+static redisReply *
+cmd_incrby(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long by;
+
+    if (arg_number(argv[2], argvlen[2], &by) != 0)
+        return (reply_error(ERR_INTEGER));
+
+    return (incr_by(s, argv[1], argvlen[1], by));
+}
+
+
+static redisReply *
+cmd_getrange(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long start, end, len;
+    mock_entry *e;
+    int wrong;
+
+    if ((arg_number(argv[2], argvlen[2], &start) != 0) ||
+        (arg_number(argv[3], argvlen[3], &end) != 0))
+        return (reply_error(ERR_INTEGER));
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_STRING, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+
+    len = (e != NULL) ? (long long)e->value_len : 0;
+    if (start < 0)
+        start += len;
+    if (end < 0)
+        end += len;
+    if (start < 0)
+        start = 0;
+    if (end >= len)
+        end = len - 1;
+
+    if ((e == NULL) || (start > end))
+        return (reply_bulk("", 0));
+
+    return (reply_bulk(e->value + start, end - start + 1));
+}
+
+
+static redisReply *
+cmd_setrange(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long offset;
+    size_t len;
+    mock_entry *e;
+    int wrong;
+
+    if ((arg_number(argv[2], argvlen[2], &offset) != 0) || (offset < 0))
+        return (reply_error("ERR offset is out of range"));
+
+    e = add_key(s, argv[1], argvlen[1], MOCK_STRING, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (NULL);
+
+    len = offset + argvlen[3];
+    if (len > e->value_len)
+    {
+        char *value = realloc(e->value, len + 1);
+
+        if (value == NULL)
+            return (NULL);
+        memset(value + e->value_len, 0, len - e->value_len);
+        value[len] = '\0';
+        e->value = value;
+        e->value_len = len;
+    }
+    else if (e->value == NULL)
+    {
+        if (entry_set_value(e, "", 0) != 0)
+            return (NULL);
+    }
+
+    memcpy(e->value + offset, argv[3], argvlen[3]);
+
+    return (reply_integer(e->value_len));
+}
+
+
+static redisReply *
+cmd_sadd(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long added = 0;
+    mock_entry *e;
+    int wrong;
+    int i;
+
+    e = add_key(s, argv[1], argvlen[1], MOCK_SET, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (NULL);
+
+    for (i = 2; i < argc; i++)
+    {
+        int one;
+
+        if (table_add(e->table, argv[i], argvlen[i], &one) == NULL)
+            return (NULL);
+        added += one;
+    }
+
+    return (reply_integer(added));
+}
+
+
+static redisReply *
+cmd_srem(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long removed = 0;
+    mock_entry *e;
+    int wrong;
+    int i;
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_SET, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (reply_integer(0));
+
+    for (i = 2; i < argc; i++)
+        removed += table_remove(e->table, argv[i], argvlen[i]);
+
+    drop_if_empty(s, e);
+
+    return (reply_integer(removed));
+}
+
+
+/**
+ * The number of entries of a set or hash.
+ */
+static redisReply *
+count_of(mock_store * s, const char *name, size_t len, int type)
+{
+    int wrong;
+    mock_entry *e = find_key(s, name, len, type, &wrong);
+
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    return (reply_integer((e != NULL) ? (long long)e->table->count : 0));
+}
+
+
+static redisReply *
+cmd_scard(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (count_of(s, argv[1], argvlen[1], MOCK_SET));
+}
+
+
+static redisReply *
+cmd_hlen(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (count_of(s, argv[1], argvlen[1], MOCK_HASH));
+}
+
+
+/**
+ * List the entries of the given buckets of a set or hash: their names,
+ * their values, or both.
+ */
+#define LIST_NAMES  1
+#define LIST_VALUES 2
+
+static redisReply *
+list_entries(mock_table * t, size_t first, size_t last, int what)
+{
+    size_t count = 0;
+    size_t i, n = 0;
+    redisReply *r;
+    mock_entry *e;
+
+    for (i = first; i < last; i++)
+        for (e = t->buckets[i]; e != NULL; e = e->next)
+            count += 1;
+
+    if (what == (LIST_NAMES | LIST_VALUES))
+        count *= 2;
+
+    r = reply_array(count);
+    if (r == NULL)
+        return (NULL);
+
+    for (i = first; i < last; i++)
+        for (e = t->buckets[i]; e != NULL; e = e->next)
+        {
+            if (what & LIST_NAMES)
+                r->element[n++] = reply_bulk(e->name, e->len);
+            if (what & LIST_VALUES)
+                r->element[n++] = reply_bulk(e->value, e->value_len);
+        }
+
+    return (r);
+}
+
+
+/**
+ * List every entry of a set or hash, which is empty if missing.
+ */
+static redisReply *
+list_key(mock_store * s, const char *name, size_t len, int type, int what)
+{
+    int wrong;
+    mock_entry *e = find_key(s, name, len, type, &wrong);
+
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (reply_array(0));
+    return (list_entries(e->table, 0, e->table->size, what));
+}
+
+
+static redisReply *
+cmd_smembers(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (list_key(s, argv[1], argvlen[1], MOCK_SET, LIST_NAMES));
+}
+
+
+/**
+ * A member of a set.  Rather than a random one this is always the
+ * first found, which is as good for our purposes and repeatable.
+ */
+static redisReply *
+cmd_srandmember(mock_store * s, int argc, const char **argv,
+                size_t * argvlen)
+{
+    mock_entry *e, *m;
+    size_t i;
+    int wrong;
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_SET, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+
+    if (e != NULL)
+        for (i = 0; i < e->table->size; i++)
+            if ((m = e->table->buckets[i]) != NULL)
+                return (reply_bulk(m->name, m->len));
+
+    return (reply_nil());
+}
+
+
+/**
+ * The cursor of SSCAN is the index of the next bucket to visit; each
+ * call returns whole buckets until it has at least COUNT members.  So
+ * long as the set isn't resized, every member present throughout the
+ * scan is returned once.
+ */
+static redisReply *
+cmd_sscan(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long cursor, count = 10;
+    redisReply *r, *members;
+    mock_entry *e;
+    char buf[MOCK_NUMBER];
+    size_t last, found = 0;
+    int wrong;
+    int i;
+
+    if (arg_number(argv[2], argvlen[2], &cursor) != 0)
+        return (reply_error("ERR invalid cursor"));
+
+    for (i = 3; i + 1 < argc; i += 2)
+    {
+        if ((argvlen[i] == 5) && (strncasecmp(argv[i], "COUNT", 5) == 0) &&
+            ((arg_number(argv[i + 1], argvlen[i + 1], &count) != 0) ||
+             (count < 1)))
+            return (reply_error(ERR_SYNTAX));
+    }
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_SET, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+
+    if ((e == NULL) || (cursor < 0) || ((size_t)cursor >= e->table->size))
+    {
+        members = reply_array(0);
+        last = 0;
+    }
+    else
+    {
+        mock_entry *m;
+
+        for (last = cursor; (last < e->table->size) &&
+             (found < (size_t)count); last++)
+            for (m = e->table->buckets[last]; m != NULL; m = m->next)
+                found += 1;
+
+        members = list_entries(e->table, cursor, last, LIST_NAMES);
+        if (last == e->table->size)
+            last = 0;
+    }
+
+    r = reply_array(2);
+    if ((r == NULL) || (members == NULL))
+    {
+        mock_free_reply(r);
+        mock_free_reply(members);
+        return (NULL);
+    }
+
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)last);
+    r->element[0] = reply_bulk(buf, strlen(buf));
+    r->element[1] = members;
+
+    return (r);
+}
+
+
+static redisReply *
+cmd_hget(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    mock_entry *e, *f;
+    int wrong;
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_HASH, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (reply_nil());
+
+    f = table_find(e->table, argv[2], argvlen[2]);
+    if (f == NULL)
+        return (reply_nil());
+    return (reply_bulk(f->value, f->value_len));
+}
+
+
+static redisReply *
+cmd_hmget(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    mock_entry *e;
+    redisReply *r;
+    int wrong;
+    int i;
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_HASH, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+
+    r = reply_array(argc - 2);
+    if (r == NULL)
+        return (NULL);
+
+    for (i = 2; i < argc; i++)
+    {
+        mock_entry *f = (e != NULL) ?
+            table_find(e->table, argv[i], argvlen[i]) : NULL;
+
+        r->element[i - 2] = (f != NULL) ?
+            reply_bulk(f->value, f->value_len) : reply_nil();
+    }
+
+    return (r);
+}
+
+
+/**
+ * Set the given fields of a hash, counting those which are new.
+ */
+static redisReply *
+set_fields(mock_store * s, int argc, const char **argv, size_t * argvlen,
+           int count)
+{
+    long long added = 0;
+    mock_entry *e;
+    int wrong;
+    int i;
+
+    if ((argc % 2) != 0)
+        return (reply_error("ERR wrong number of arguments for HMSET"));
+
+    e = add_key(s, argv[1], argvlen[1], MOCK_HASH, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (NULL);
+
+    for (i = 2; i < argc; i += 2)
+    {
+        int one;
+        mock_entry *f = table_add(e->table, argv[i], argvlen[i], &one);
+
+        if ((f == NULL) ||
+            (entry_set_value(f, argv[i + 1], argvlen[i + 1]) != 0))
+            return (NULL);
+        added += one;
+    }
+
+    return (count ? reply_integer(added) : reply_status("OK"));
+}
+
+
+static redisReply *
+cmd_hset(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (set_fields(s, argc, argv, argvlen, 1));
+}
+
+
+static redisReply *
+cmd_hmset(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (set_fields(s, argc, argv, argvlen, 0));
+}
+
+
+static redisReply *
+cmd_hdel(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    long long removed = 0;
+    mock_entry *e;
+    int wrong;
+    int i;
+
+    e = find_key(s, argv[1], argvlen[1], MOCK_HASH, &wrong);
+    if (wrong)
+        return (reply_error(ERR_TYPE));
+    if (e == NULL)
+        return (reply_integer(0));
+
+    for (i = 2; i < argc; i++)
+        removed += table_remove(e->table, argv[i], argvlen[i]);
+
+    drop_if_empty(s, e);
+
+    return (reply_integer(removed));
+}
+
+
+static redisReply *
+cmd_hvals(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (list_key(s, argv[1], argvlen[1], MOCK_HASH, LIST_VALUES));
+}
+
+
+static redisReply *
+cmd_hgetall(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    return (list_key(s, argv[1], argvlen[1], MOCK_HASH,
+                     LIST_NAMES | LIST_VALUES));
+}
+
+
+
+/**
+ * The commands we understand, with the least & most arguments each
+ * takes, counting the command itself.  A maximum of zero means there
+ * is no limit.
+ */
+typedef struct mock_command
+{
+    const char *name;
+    mock_handler handler;
+    int min;
+    int max;
+} mock_command;
+
+static mock_command _commands[] = {
+    {"DECR", cmd_decr, 2, 2},
+    {"DEL", cmd_del, 2, 0},
+    {"EXISTS", cmd_exists, 2, 0},
+    {"GET", cmd_get, 2, 2},
+    {"GETRANGE", cmd_getrange, 4, 4},
+    {"HDEL", cmd_hdel, 3, 0},
+    {"HGET", cmd_hget, 3, 3},
+    {"HGETALL", cmd_hgetall, 2, 2},
+    {"HLEN", cmd_hlen, 2, 2},
+    {"HMGET", cmd_hmget, 3, 0},
+    {"HMSET", cmd_hmset, 4, 0},
+    {"HSET", cmd_hset, 4, 0},
+    {"HVALS", cmd_hvals, 2, 2},
+    {"INCR", cmd_incr, 2, 2},
+    {"INCRBY", cmd_incrby, 3, 3},
+    {"MGET", cmd_mget, 2, 0},
+    {"MSET", cmd_mset, 3, 0},
+    {"PING", cmd_ping, 1, 2},
+    {"SADD", cmd_sadd, 3, 0},
+    {"SCARD", cmd_scard, 2, 2},
+    {"SET", cmd_set, 3, 3},
+    {"SETNX", cmd_setnx, 3, 3},
+    {"SETRANGE", cmd_setrange, 4, 4},
+    {"SMEMBERS", cmd_smembers, 2, 2},
+    {"SRANDMEMBER", cmd_srandmember, 2, 2},
+    {"SREM", cmd_srem, 3, 0},
+    {"SSCAN", cmd_sscan, 3, 0},
+    {"SUBSTR", cmd_getrange, 4, 4},
+    {"TYPE", cmd_type, 2, 2},
+    {"UNLINK", cmd_del, 2, 0},
+    {NULL, NULL, 0, 0}
+};
+
+
+/**
+ * Run a single command.
+ */
+static redisReply *
+execute(mock_store * s, int argc, const char **argv, size_t * argvlen)
+{
+    char msg[128];
+    int i;
+
+    for (i = 0; _commands[i].name != NULL; i++)
+    {
+        mock_command *c = &_commands[i];
+
+        if ((strlen(c->name) != argvlen[0]) ||
+            (strncasecmp(c->name, argv[0], argvlen[0]) != 0))
+            continue;
+
+        if ((argc < c->min) || ((c->max > 0) && (argc > c->max)))
+        {
+            snprintf(msg, sizeof(msg),
+                     "ERR wrong number of arguments for '%s' command",
+                     c->name);
+            return (reply_error(msg));
+        }
+
+        return (c->handler(s, argc, argv, argvlen));
+    }
+
+    snprintf(msg, sizeof(msg), "ERR unknown command '%.*s'",
+             (int)((argvlen[0] < 32) ? argvlen[0] : 32), argv[0]);
+    return (reply_error(msg));
+}
+
+
+/**
+ * Parse a number, ended by CRLF, from the protocol.
+ *
+ * Returns 0 on success, advancing *p.
+ */
+static int
+parse_number(const char **p, const char *end, long long *value)
+{
+    const char *crlf = *p;
+    char buf[MOCK_NUMBER];
+
+    while ((crlf + 1 < end) && !((crlf[0] == '\r') && (crlf[1] == '\n')))
+        crlf++;
+
+    if ((crlf + 1 >= end) || (crlf == *p) ||
+        ((size_t)(crlf - *p) >= sizeof(buf)))
+        return -1;
+
+    memcpy(buf, *p, crlf - *p);
+    buf[crlf - *p] = '\0';
+    *value = atoll(buf);
+    *p = crlf + 2;
+
+    return 0;
+}
+
+
+/**
+ * Split a command, in the protocol, into its arguments.
+ */
+int
+mock_parse(const char *cmd, size_t len, const char ***argv,
+              size_t ** argvlen)
+{
+    const char *p = cmd;
+    const char *end = cmd + len;
+    long long argc, n;
+    int i;
+
+    if ((len < 1) || (*p++ != '*') || (parse_number(&p, end, &argc) != 0) ||
+        (argc < 1))
+        return -1;
+
+    *argv = malloc(sizeof(char *) * argc);
+    *argvlen = malloc(sizeof(size_t) * argc);
+    if ((*argv == NULL) || (*argvlen == NULL))
+    {
+        free(*argv);
+        free(*argvlen);
+        return -1;
+    }
+
+    for (i = 0; i < argc; i++)
+    {
+        if ((p >= end) || (*p++ != '$') || (parse_number(&p, end, &n) != 0) ||
+            (n < 0) || (end - p < n + 2))
+        {
+            free(*argv);
+            free(*argvlen);
+            return -1;
+        }
+
+        (*argv)[i] = p;
+        (*argvlen)[i] = n;
+        p += n + 2;
+    }
+
+    return (argc);
+}
+
+
+/**
+ * Queue the reply to a command for this thread.
+ */
+static int
+queue_reply(redisReply * reply)
+{
+    mock_pending *p = malloc(sizeof(mock_pending));
+
+    if (p == NULL)
+        return -1;
+
+    p->reply = reply;
+    p->next = NULL;
+    if (_tail != NULL)
+        _tail->next = p;
+    else
+        _head = p;
+    _tail = p;
+
+    return 0;
+}
+
+
+/**
+ * Run a command, queueing its reply.
+ */
+static int
+mock_append(backend * b, const char *cmd, size_t len)
+{
+    mock_store *s = b->data;
+    const char **argv = NULL;
+    size_t *argvlen = NULL;
+    redisReply *reply;
+    int argc;
+
+    argc = mock_parse(cmd, len, &argv, &argvlen);
+    if (argc < 0)
+        reply = reply_error("ERR Protocol error");
+    else
+    {
+        pthread_mutex_lock(&s->lock);
+        reply = execute(s, argc, argv, argvlen);
+        pthread_mutex_unlock(&s->lock);
+
+        free(argv);
+        free(argvlen);
+    }
+
+    if (reply == NULL)
+        reply = reply_error("ERR out of memory");
+
+    if ((reply == NULL) || (queue_reply(reply) != 0))
+    {
+        mock_free_reply(reply);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Read the oldest reply queued for this thread.
+ */
+static int
+mock_get_reply(backend * b, void **reply)
+{
+    mock_pending *p = _head;
+
+    *reply = NULL;
+    if (p == NULL)
+        return -1;
+
+    _head = p->next;
+    if (_head == NULL)
+        _tail = NULL;
+
+    *reply = p->reply;
+    free(p);
+
+    return 0;
+}
+
+
+/**
+ * Free the store, and everything in it.
+ */
+static void
+mock_destroy(backend * b)
+{
+    mock_store *s = b->data;
+
+    table_clear(&s->keys);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    free(b);
+}
+
+
+/**
+ * A new, empty, store.
+ */
+backend *
+mock_new()
+{
+    backend *b = calloc(1, sizeof(backend));
+    mock_store *s = calloc(1, sizeof(mock_store));
+
+    if ((b == NULL) || (s == NULL) || (table_init(&s->keys) != 0))
+    {
+        free(b);
+        free(s);
+        return (NULL);
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+
+    b->name = "mock";
+    b->append = mock_append;
+    b->get_reply = mock_get_reply;
+    b->destroy = mock_destroy;
+    b->data = s;
+
+    return (b);
+}
+
+
+/**
+ * The number of keys held by the given store.
+ */
+long long
+mock_count(backend * b)
+{
+    mock_store *s = b->data;
+    long long count;
+
+    pthread_mutex_lock(&s->lock);
+    count = s->keys.count;
+    pthread_mutex_unlock(&s->lock);
+
+    return (count);
+}
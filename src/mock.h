@@ -0,0 +1,50 @@
+/* mock.h -- An in-memory store which answers redis commands.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _MOCK_H
+#define _MOCK_H 1
+
+#include "backend.h"
+
+
+/**
+ * A new, empty, store.
+ *
+ * It holds strings, sets and hashes, and answers the commands used by
+ * the filesystem upon them.  Anything else, such as SCRIPT, is refused
+ * as an unknown command.
+ *
+ * Returns NULL on failure.
+ */
+backend *mock_new();
+
+/**
+ * The number of keys held by the given store.
+ */
+long long mock_count(backend * b);
+
+/**
+ * Split a command, given in the redis protocol, into its arguments,
+ * which point into the command.
+ *
+ * Returns the number of arguments, or -1 if the command is malformed.
+ * The caller must free *argv and *argvlen.
+ */
+int mock_parse(const char *cmd, size_t len, const char ***argv,
+               size_t ** argvlen);
+
+/**
+ * Free a reply, as freeReplyObject() would.
+ */
+void mock_free_reply(void *reply);
+
+
+#endif /* _MOCK_H */
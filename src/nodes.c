@@ -0,0 +1,300 @@
+/* nodes.c -- The inodes the kernel knows of, and where they live.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  With the low-level API of FUSE the kernel names entries by inode,
+ * rather than by path.  Most operations need nothing more, but those
+ * which change the tree are still shared with the path-based API, so we
+ * remember the parent and name of every inode the kernel has looked up,
+ * and may build its path from them.
+ *
+ *  Each inode is kept until the kernel forgets as many lookups of it as
+ * it made.  One which has been removed, or replaced by a rename, has no
+ * name, so that nothing is done to whichever entry now has its old
+ * path.  The table is a small hash of inodes, guarded by a single
+ * lock, as with times.c.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "nodes.h"
+
+
+/**
+ * The number of chains in our table.
+ */
+#define NODES_BUCKETS 4096
+
+/**
+ * No path is deeper than this.
+ */
+#define NODES_DEPTH 1024
+
+
+typedef struct node
+{
+    long long inode;
+    long long parent;
+    char *name;
+    unsigned long lookups;
+    struct node *next;
+} node;
+
+
+static node *_buckets[NODES_BUCKETS];
+static int _count = 0;
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The chain holding the given inode.
+ */
+static node **
+chain(long long inode)
+{
+    return (&_buckets[(unsigned long long)inode % NODES_BUCKETS]);
+}
+
+
+/**
+ * Find an inode, with the lock held.
+ */
+static node *
+find(long long inode)
+{
+    node *n;
+
+    for (n = *chain(inode); n != NULL; n = n->next)
+    {
+        if (n->inode == inode)
+            return (n);
+    }
+
+    return (NULL);
+}
+
+
+/**
+ * Set the parent and name of a node, with the lock held.
+ */
+static int
+place(node * n, long long parent, const char *name)
+{
+    char *copy;
+
+    if ((n->name != NULL) && (n->parent == parent) &&
+        (strcmp(n->name, name) == 0))
+        return 0;
+
+    copy = strdup(name);
+    if (copy == NULL)
+        return -1;
+
+    free(n->name);
+    n->name = copy;
+    n->parent = parent;
+
+    return 0;
+}
+
+
+/**
+ * Note a lookup of an inode.
+ */
+int
+nodes_remember(long long inode, long long parent, const char *name)
+{
+    node *n;
+    int ret = 0;
+
+    if (inode == NODES_ROOT)
+        return 0;
+
+    pthread_mutex_lock(&_lock);
+
+    n = find(inode);
+    if (n == NULL)
+    {
+        n = calloc(1, sizeof(node));
+        if ((n == NULL) || (place(n, parent, name) != 0))
+        {
+            free(n);
+            pthread_mutex_unlock(&_lock);
+            return -1;
+        }
+
+        n->inode = inode;
+        n->next = *chain(inode);
+        *chain(inode) = n;
+        _count += 1;
+    }
+    else
+    {
+        ret = place(n, parent, name);
+    }
+
+    n->lookups += 1;
+
+    pthread_mutex_unlock(&_lock);
+
+    return (ret);
+}
+
+
+/**
+ * Drop lookups of an inode.
+ */
+void
+nodes_forget(long long inode, unsigned long count)
+{
+    node **p;
+
+    pthread_mutex_lock(&_lock);
+
+    for (p = chain(inode); *p != NULL; p = &(*p)->next)
+    {
+        node *n = *p;
+
+        if (n->inode != inode)
+            continue;
+
+        if (n->lookups > count)
+        {
+            n->lookups -= count;
+            break;
+        }
+
+        *p = n->next;
+        free(n->name);
+        free(n);
+        _count -= 1;
+        break;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Note a rename.
+ */
+void
+nodes_move(long long inode, long long parent, const char *name)
+{
+    node *n;
+
+    pthread_mutex_lock(&_lock);
+
+    n = find(inode);
+    if ((n != NULL) && (n->name != NULL))
+        place(n, parent, name);
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Note a removal.
+ */
+void
+nodes_remove(long long inode)
+{
+    node *n;
+
+    pthread_mutex_lock(&_lock);
+
+    n = find(inode);
+    if (n != NULL)
+    {
+        free(n->name);
+        n->name = NULL;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Build the path of an inode, from the name upwards.
+ */
+int
+nodes_path(long long inode, char *buf, size_t len)
+{
+    const char *names[NODES_DEPTH];
+    size_t used = 0;
+    int depth = 0;
+    int ret = 0;
+
+    if (len < 2)
+        return -1;
+
+    if (inode == NODES_ROOT)
+    {
+        strcpy(buf, "/");
+        return 0;
+    }
+
+    pthread_mutex_lock(&_lock);
+
+    while (inode != NODES_ROOT)
+    {
+        node *n = find(inode);
+
+        if ((n == NULL) || (n->name == NULL) || (depth == NODES_DEPTH))
+        {
+            ret = -1;
+            break;
+        }
+
+        names[depth++] = n->name;
+        inode = n->parent;
+    }
+
+    while ((ret == 0) && (depth-- > 0))
+    {
+        size_t l = strlen(names[depth]);
+
+        if (used + l + 2 > len)
+        {
+            ret = -1;
+            break;
+        }
+
+        buf[used++] = '/';
+        memcpy(buf + used, names[depth], l);
+        used += l;
+    }
+    buf[used] = '\0';
+
+    pthread_mutex_unlock(&_lock);
+
+    return (ret);
+}
+
+
+/**
+ * The number of inodes known.
+ */
+int
+nodes_count()
+{
+    int count;
+
+    pthread_mutex_lock(&_lock);
+    count = _count;
+    pthread_mutex_unlock(&_lock);
+
+    return (count);
+}
@@ -0,0 +1,63 @@
+/* nodes.h -- The inodes the kernel knows of, and where they live.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _NODES_H
+#define _NODES_H 1
+
+#include <stddef.h>
+
+
+/**
+ * The inode of the root directory, which is always known.
+ */
+#define NODES_ROOT -99
+
+
+/**
+ * Note that the kernel has looked up the given inode, as the entry of
+ * the given name within the given directory.
+ *
+ * Returns 0 on success, -1 if we're out of memory.
+ */
+int nodes_remember(long long inode, long long parent, const char *name);
+
+/**
+ * Drop the given number of lookups of an inode, forgetting it once none
+ * remain.
+ */
+void nodes_forget(long long inode, unsigned long count);
+
+/**
+ * Note that an inode has been renamed, if it is known.
+ */
+void nodes_move(long long inode, long long parent, const char *name);
+
+/**
+ * Note that an inode has been removed from its directory, so that it no
+ * longer has a path, though it is kept until the kernel forgets it.
+ */
+void nodes_remove(long long inode);
+
+/**
+ * Write the path of an inode into the given buffer.
+ *
+ * Returns 0 on success, -1 if the inode, or a directory above it, isn't
+ * known or has been removed, or the path doesn't fit.
+ */
+int nodes_path(long long inode, char *buf, size_t len);
+
+/**
+ * The number of inodes known, other than the root.
+ */
+int nodes_count();
+
+
+#endif /* _NODES_H */
@@ -0,0 +1,389 @@
+/* pagecache.c -- A bounded LRU cache of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Contents read from redis, and the ranges fetched ahead of sequential
+ * readers, are kept here in fixed-size pages so that later reads may be
+ * served without a round-trip.
+ *
+ *  Pages are found via a hash-table, and kept on a list in order of use
+ * so that once the cache is full the least recently used page is the
+ * one discarded.  Each page also expires after a while, so that changes
+ * made by other mounts are eventually seen.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pagecache.h"
+
+
+/**
+ * The number of buckets in our table.
+ */
+#define PAGE_BUCKETS 4096
+
+
+/**
+ * A cached page.
+ */
+typedef struct cache_page
+{
+    long long inode;
+    long idx;
+    char *data;
+    size_t len;
+    long long expires;
+
+    struct cache_page *next;    /* in the bucket */
+    struct cache_page *newer;   /* in the LRU list */
+    struct cache_page *older;
+} cache_page;
+
+
+/**
+ * Our table, and the LRU list running through it.
+ */
+static cache_page *_pages[PAGE_BUCKETS];
+static cache_page *_newest = NULL;
+static cache_page *_oldest = NULL;
+
+/**
+ * Our limits, and the number of bytes in use.
+ */
+static size_t _page_size = 65536;
+static size_t _max_bytes = 0;
+static size_t _bytes = 0;
+static long _ttl = 0;
+
+/**
+ * Mutex for safety.
+ */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+static long long
+pagecache_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Hash a page into a bucket.
+ */
+static unsigned int
+hash_page(long long inode, long idx)
+{
+    unsigned int hash = (unsigned int)inode * 2654435761u;
+
+    hash ^= (unsigned int)idx + 0x9e3779b9u + (hash << 6) + (hash >> 2);
+    return (hash % PAGE_BUCKETS);
+}
+
+
+/**
+ * Find a page.  Must be called with the lock held.
+ */
+static cache_page *
+find_page(long long inode, long idx)
+{
+    cache_page *p;
+
+    for (p = _pages[hash_page(inode, idx)]; p != NULL; p = p->next)
+    {
+        if ((p->inode == inode) && (p->idx == idx))
+            return (p);
+    }
+    return NULL;
+}
+
+
+/**
+ * Unlink a page from the LRU list.  Must be called with the lock held.
+ */
+static void
+unlink_lru(cache_page * p)
+{
+    if (p->newer != NULL)
+        p->newer->older = p->older;
+    else
+        _newest = p->older;
+
+    if (p->older != NULL)
+        p->older->newer = p->newer;
+    else
+        _oldest = p->newer;
+
+    p->newer = NULL;
+    p->older = NULL;
+}
+
+
+/**
+ * Make a page the most recently used.  Must be called with the lock
+ * held.
+ */
+static void
+push_lru(cache_page * p)
+{
+    p->older = _newest;
+    p->newer = NULL;
+
+    if (_newest != NULL)
+        _newest->newer = p;
+    _newest = p;
+
+    if (_oldest == NULL)
+        _oldest = p;
+}
+
+
+/**
+ * Remove and free a page.  Must be called with the lock held.
+ */
+static void
+remove_page(cache_page * p)
+{
+    cache_page **cur = &_pages[hash_page(p->inode, p->idx)];
+
+    while (*cur != NULL)
+    {
+        if (*cur == p)
+        {
+            *cur = p->next;
+            break;
+        }
+        cur = &(*cur)->next;
+    }
+
+    unlink_lru(p);
+
+    _bytes -= p->len;
+    free(p->data);
+    free(p);
+}
+
+
+/**
+ * Setup the cache.
+ */
+void
+pagecache_init(size_t page_size, size_t max_bytes, long ttl)
+{
+    pagecache_flush();
+
+    pthread_mutex_lock(&_lock);
+    _page_size = page_size;
+    _max_bytes = max_bytes;
+    _ttl = ttl;
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Is the cache in use?
+ */
+int
+pagecache_enabled()
+{
+    return (_max_bytes > 0);
+}
+
+
+/**
+ * The size of each page.
+ */
+size_t
+pagecache_page_size()
+{
+    return (_page_size);
+}
+
+
+/**
+ * Lookup a page.
+ */
+int
+pagecache_get(long long inode, long idx, char *buf, size_t * len)
+{
+    cache_page *p;
+    int found = 0;
+
+    if (_max_bytes == 0)
+        return 0;
+
+    pthread_mutex_lock(&_lock);
+
+    p = find_page(inode, idx);
+    if (p != NULL)
+    {
+        if (p->expires > pagecache_now())
+        {
+            memcpy(buf, p->data, p->len);
+            *len = p->len;
+            found = 1;
+
+            unlink_lru(p);
+            push_lru(p);
+        }
+        else
+        {
+            remove_page(p);
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return (found);
+}
+
+
+/**
+ * Is the given page present?
+ */
+int
+pagecache_contains(long long inode, long idx)
+{
+    cache_page *p;
+    int found = 0;
+
+    if (_max_bytes == 0)
+        return 0;
+
+    pthread_mutex_lock(&_lock);
+
+    p = find_page(inode, idx);
+    if ((p != NULL) && (p->expires > pagecache_now()))
+        found = 1;
+
+    pthread_mutex_unlock(&_lock);
+    return (found);
+}
+
+
+/**
+ * Store a page.
+ */
+void
+pagecache_put(long long inode, long idx, const char *data, size_t len)
+{
+    cache_page *p;
+    unsigned int bucket;
+
+    if ((_max_bytes == 0) || (len > _page_size))
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    p = find_page(inode, idx);
+    if (p != NULL)
+        remove_page(p);
+
+    /**
+     * Make room, discarding the least recently used pages.
+     */
+    while ((_oldest != NULL) && (_bytes + len > _max_bytes))
+        remove_page(_oldest);
+
+    p = malloc(sizeof(cache_page));
+    if (p != NULL)
+    {
+        p->data = malloc(len ? len : 1);
+        if (p->data == NULL)
+        {
+            free(p);
+            pthread_mutex_unlock(&_lock);
+            return;
+        }
+
+        memcpy(p->data, data, len);
+        p->inode = inode;
+        p->idx = idx;
+        p->len = len;
+        p->expires = pagecache_now() + _ttl;
+
+        bucket = hash_page(inode, idx);
+        p->next = _pages[bucket];
+        _pages[bucket] = p;
+
+        push_lru(p);
+        _bytes += len;
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Forget every page of the given inode.
+ */
+void
+pagecache_invalidate(long long inode)
+{
+    cache_page *p;
+    cache_page *older;
+
+    if (_max_bytes == 0)
+        return;
+
+    pthread_mutex_lock(&_lock);
+
+    for (p = _newest; p != NULL; p = older)
+    {
+        older = p->older;
+        if (p->inode == inode)
+            remove_page(p);
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Discard every page.
+ */
+void
+pagecache_flush()
+{
+    pthread_mutex_lock(&_lock);
+
+    while (_oldest != NULL)
+        remove_page(_oldest);
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * The number of bytes currently cached.
+ */
+size_t
+pagecache_bytes()
+{
+    size_t bytes;
+
+    pthread_mutex_lock(&_lock);
+    bytes = _bytes;
+    pthread_mutex_unlock(&_lock);
+
+    return (bytes);
+}
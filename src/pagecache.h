@@ -0,0 +1,73 @@
+/* pagecache.h -- A bounded LRU cache of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H 1
+
+#include <sys/types.h>
+
+
+/**
+ * Setup the cache, holding pages of the given size, up to a total of
+ * max_bytes, each of which lives for ttl milliseconds.
+ *
+ * A max_bytes of zero disables the cache entirely.
+ */
+void pagecache_init(size_t page_size, size_t max_bytes, long ttl);
+
+/**
+ * Is the cache in use?
+ */
+int pagecache_enabled();
+
+/**
+ * The size of each page.
+ */
+size_t pagecache_page_size();
+
+/**
+ * Lookup the given page of an inode, copying it into the buffer, which
+ * must be able to hold a whole page.
+ *
+ * Pages shorter than the page size end at the end of the file.
+ *
+ * Returns 1 on a hit, 0 otherwise, and sets *len to the length of
+ * the page.
+ */
+int pagecache_get(long long inode, long idx, char *buf, size_t * len);
+
+/**
+ * Is the given page present?
+ */
+int pagecache_contains(long long inode, long idx);
+
+/**
+ * Store a page of an inode, of up to a page in length.
+ */
+void pagecache_put(long long inode, long idx, const char *data, size_t len);
+
+/**
+ * Forget every page of the given inode.
+ */
+void pagecache_invalidate(long long inode);
+
+/**
+ * Discard every page.
+ */
+void pagecache_flush();
+
+/**
+ * The number of bytes currently cached.
+ */
+size_t pagecache_bytes();
+
+
+#endif /* _PAGECACHE_H */
@@ -0,0 +1,275 @@
+/* record.c -- A backend which records the commands passing through it.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Wrapped around another backend this counts the commands sent, and
+ * the round-trips they took, so that the cost of each operation may be
+ * measured exactly, and can log them for a closer look.
+ *
+ *  As with the statistics of stats.c, the first reply a thread reads
+ * after sending commands costs a round-trip, and the rest of the batch
+ * is free.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hiredis.h"
+#include "mock.h"
+#include "record.h"
+
+
+/**
+ * Arguments longer than this are shortened in the log.
+ */
+#define RECORD_ARGUMENT 48
+
+
+typedef struct record_state
+{
+    backend *inner;
+    FILE *log;
+    record_counts counts;
+    pthread_mutex_t lock;
+} record_state;
+
+
+/**
+ * Has this thread sent commands since it last read a reply?
+ */
+static __thread int _sending = 0;
+
+
+
+/**
+ * The number of decimal digits of a number.
+ */
+static size_t
+digits(long long n)
+{
+    size_t d = 1;
+
+    if (n < 0)
+        n = -n;
+    while (n >= 10)
+    {
+        n /= 10;
+        d += 1;
+    }
+
+    return (d);
+}
+
+
+/**
+ * The size a reply would have had upon the wire.
+ */
+static size_t
+reply_size(redisReply * reply)
+{
+    size_t size;
+    size_t i;
+
+    if (reply == NULL)
+        return 0;
+
+    switch (reply->type)
+    {
+    case REDIS_REPLY_STRING:
+        return (reply->len + digits(reply->len) + 5);
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        return (reply->len + 3);
+    case REDIS_REPLY_INTEGER:
+        return (digits(reply->integer) + 3);
+    case REDIS_REPLY_ARRAY:
+        size = digits(reply->elements) + 3;
+        for (i = 0; i < reply->elements; i++)
+            size += reply_size(reply->element[i]);
+        return (size);
+    default:
+        return 5;
+    }
+}
+
+
+/**
+ * Write a single argument to the log.
+ */
+static void
+log_argument(FILE * log, const char *arg, size_t len)
+{
+    size_t shown = (len > RECORD_ARGUMENT) ? RECORD_ARGUMENT : len;
+    size_t i;
+
+    for (i = 0; i < shown; i++)
+    {
+        unsigned char c = arg[i];
+
+        if ((c > ' ') && (c < 127) && (c != '\\'))
+            fputc(c, log);
+        else
+            fprintf(log, "\\x%02x", c);
+    }
+
+    if (shown < len)
+        fprintf(log, "..(%lu bytes)", (unsigned long)len);
+}
+
+
+/**
+ * Count, and perhaps log, a command before passing it on.
+ */
+static int
+record_append(backend * b, const char *cmd, size_t len)
+{
+    record_state *s = b->data;
+
+    pthread_mutex_lock(&s->lock);
+
+    s->counts.commands += 1;
+    s->counts.bytes_out += len;
+
+    if (s->log != NULL)
+    {
+        const char **argv = NULL;
+        size_t *argvlen = NULL;
+        int argc = mock_parse(cmd, len, &argv, &argvlen);
+        int i;
+
+        fprintf(s->log, "%lld", s->counts.round_trips + 1);
+        for (i = 0; i < argc; i++)
+        {
+            fputc(' ', s->log);
+            log_argument(s->log, argv[i], argvlen[i]);
+        }
+        fputc('\n', s->log);
+
+        if (argc >= 0)
+        {
+            free(argv);
+            free(argvlen);
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    _sending = 1;
+
+    return (s->inner->append(s->inner, cmd, len));
+}
+
+
+/**
+ * Count a reply, and the round-trip it may have cost.
+ */
+static int
+record_get_reply(backend * b, void **reply)
+{
+    record_state *s = b->data;
+    int ret = s->inner->get_reply(s->inner, reply);
+
+    pthread_mutex_lock(&s->lock);
+
+    if (_sending)
+        s->counts.round_trips += 1;
+    s->counts.bytes_in += reply_size(*reply);
+
+    pthread_mutex_unlock(&s->lock);
+
+    _sending = 0;
+
+    return (ret);
+}
+
+
+/**
+ * Free the recorder, and the backend it wraps.
+ */
+static void
+record_destroy(backend * b)
+{
+    record_state *s = b->data;
+
+    if (s->inner->destroy != NULL)
+        s->inner->destroy(s->inner);
+    if (s->log != NULL)
+        fflush(s->log);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    free(b);
+}
+
+
+/**
+ * A backend passing every command to another, which it then owns.
+ */
+backend *
+record_new(backend * inner, FILE * log)
+{
+    backend *b;
+    record_state *s;
+
+    if (inner == NULL)
+        return (NULL);
+
+    b = calloc(1, sizeof(backend));
+    s = calloc(1, sizeof(record_state));
+    if ((b == NULL) || (s == NULL))
+    {
+        free(b);
+        free(s);
+        return (NULL);
+    }
+
+    s->inner = inner;
+    s->log = log;
+    pthread_mutex_init(&s->lock, NULL);
+
+    b->name = "record";
+    b->append = record_append;
+    b->get_reply = record_get_reply;
+    b->destroy = record_destroy;
+    b->data = s;
+
+    return (b);
+}
+
+
+/**
+ * What has been asked of the given recorder.
+ */
+void
+record_get(backend * b, record_counts * counts)
+{
+    record_state *s = b->data;
+
+    pthread_mutex_lock(&s->lock);
+    *counts = s->counts;
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/**
+ * Forget what has been asked of the given recorder.
+ */
+void
+record_reset(backend * b)
+{
+    record_state *s = b->data;
+
+    pthread_mutex_lock(&s->lock);
+    memset(&s->counts, 0, sizeof(s->counts));
+    pthread_mutex_unlock(&s->lock);
+}
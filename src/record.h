@@ -0,0 +1,53 @@
+/* record.h -- A backend which records the commands passing through it.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _RECORD_H
+#define _RECORD_H 1
+
+#include <stdio.h>
+
+#include "backend.h"
+
+
+/**
+ * What has been asked of a recording backend.
+ */
+typedef struct record_counts
+{
+    long long commands;
+    long long round_trips;
+    long long bytes_out;
+    long long bytes_in;
+} record_counts;
+
+
+/**
+ * A backend which passes every command on to another, which it owns,
+ * counting them and, if log isn't NULL, writing each to it as a line.
+ *
+ * Each line starts with the number of the round-trip which carried the
+ * command, followed by its arguments, e.g. "3 HGET skx:DIRNAME:-99 foo".
+ * Any argument bytes which aren't printable are escaped as "\xNN", and
+ * long arguments are shortened.
+ *
+ * Returns NULL on failure.
+ */
+backend *record_new(backend * inner, FILE * log);
+
+/**
+ * What has been asked of the given recording backend, since it was
+ * created or last reset.
+ */
+void record_get(backend * b, record_counts * counts);
+void record_reset(backend * b);
+
+
+#endif /* _RECORD_H */
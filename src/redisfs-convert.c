@@ -0,0 +1,505 @@
+/* redisfs-convert.c -- Utility to change the schema of a filesystem
+ *
+ *
+ * Copyright (c) 2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  The meta-data of each inode may be stored either as a key per field,
+ * (e.g. "skx:INODE:6:MODE"), or as a single hash ("skx:INODE:6").
+ *
+ *  This utility walks the directory tree of a filesystem, from the root,
+ * and rewrites the meta-data of every inode it finds in the requested
+ * schema.  The directory name-indexes are rebuilt as we go.
+ *
+ *  The filesystem must not be mounted while this runs.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+
+
+#include "hiredis.h"
+
+
+
+/**
+ * Handle to the redis server.
+ */
+redisContext *_g_redis = NULL;
+
+
+/**
+ * The host and port of the redis server we're connecting to.
+ */
+int _g_redis_port = 6379;
+char _g_redis_host[100] = { "localhost" };
+
+
+/**
+ * Are we running with --debug in play?
+ */
+int _g_debug = 0;
+
+/**
+ * The prefix of the filesystem we're converting.
+ */
+char _g_prefix[20] = { "skx" };
+
+/**
+ * Are we converting to the hash schema?
+ */
+int _g_to_hash = 1;
+
+/**
+ * The number of inodes we've converted.
+ */
+int _g_converted = 0;
+
+
+/**
+ * The fields making up the meta-data of an inode.
+ */
+const char *_g_fields[] = {
+    "NAME", "TYPE", "MODE", "GID", "UID", "ATIME", "CTIME", "MTIME",
+    "SIZE", "LINK", "TARGET", "GEN", "CODEC", "SPILL", NULL
+};
+
+#define FIELD_COUNT 14
+
+
+
+/**
+ * If our service isn't alive then connect to it.
+ */
+void
+redis_alive()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+
+    if ((_g_redis != NULL) && (_g_redis->err == 0))
+        return;
+
+    if (_g_redis != NULL)
+        redisFree(_g_redis);
+
+    _g_redis = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
+    if ((_g_redis == NULL) || (_g_redis->err))
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        exit(1);
+    }
+}
+
+
+/**
+ * Move the meta-data of one inode from individual keys into a hash.
+ *
+ * Returns the type of the inode, which the caller must free, or NULL
+ * if it has none.
+ */
+char *
+inode_to_hash(const char *inode)
+{
+    const char *argv[2 + FIELD_COUNT * 2];
+    size_t argvlen[2 + FIELD_COUNT * 2];
+    char keys[FIELD_COUNT][96];
+    char hash[64];
+    char *type = NULL;
+    redisReply *reply = NULL;
+    redisReply *r = NULL;
+    int argc = 0;
+    int i;
+
+    snprintf(hash, sizeof(hash), "%s:INODE:%s", _g_prefix, inode);
+
+    argv[argc++] = "MGET";
+    for (i = 0; i < FIELD_COUNT; i++)
+    {
+        snprintf(keys[i], sizeof(keys[i]), "%s:%s", hash, _g_fields[i]);
+        argv[argc++] = keys[i];
+    }
+    for (i = 0; i < argc; i++)
+        argvlen[i] = strlen(argv[i]);
+
+    reply = redisCommandArgv(_g_redis, argc, argv, argvlen);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY) ||
+        (reply->elements != FIELD_COUNT))
+    {
+        if (reply != NULL)
+            freeReplyObject(reply);
+        return NULL;
+    }
+
+    /**
+     * Store the fields which are set in the hash, and then remove the
+     * old keys, in a single round-trip.
+     */
+    argc = 0;
+    argv[argc] = "HMSET";
+    argvlen[argc++] = 5;
+    argv[argc] = hash;
+    argvlen[argc++] = strlen(hash);
+
+    for (i = 0; i < FIELD_COUNT; i++)
+    {
+        if (reply->element[i]->type != REDIS_REPLY_STRING)
+            continue;
+
+        argv[argc] = _g_fields[i];
+        argvlen[argc++] = strlen(_g_fields[i]);
+        argv[argc] = reply->element[i]->str;
+        argvlen[argc++] = reply->element[i]->len;
+    }
+
+    if (reply->element[1]->type == REDIS_REPLY_STRING)
+        type = strdup(reply->element[1]->str);
+
+    if (argc > 2)
+    {
+        redisAppendCommandArgv(_g_redis, argc, argv, argvlen);
+
+        argc = 0;
+        argv[argc++] = "DEL";
+        for (i = 0; i < FIELD_COUNT; i++)
+            argv[argc++] = keys[i];
+        for (i = 0; i < argc; i++)
+            argvlen[i] = strlen(argv[i]);
+        redisAppendCommandArgv(_g_redis, argc, argv, argvlen);
+
+        for (i = 0; i < 2; i++)
+        {
+            redisGetReply(_g_redis, (void **)&r);
+            freeReplyObject(r);
+        }
+    }
+
+    freeReplyObject(reply);
+    return (type);
+}
+
+
+/**
+ * Move the meta-data of one inode from a hash into individual keys.
+ *
+ * Returns the type of the inode, which the caller must free, or NULL
+ * if it has none.
+ */
+char *
+inode_to_keys(const char *inode)
+{
+    const char **argv = NULL;
+    size_t *argvlen = NULL;
+    char (*keys)[96] = NULL;
+    char hash[64];
+    char *type = NULL;
+    redisReply *reply = NULL;
+    redisReply *r = NULL;
+    int argc = 0;
+    int i;
+
+    snprintf(hash, sizeof(hash), "%s:INODE:%s", _g_prefix, inode);
+
+    reply = redisCommand(_g_redis, "HGETALL %s", hash);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY) ||
+        (reply->elements < 2))
+    {
+        if (reply != NULL)
+            freeReplyObject(reply);
+        return NULL;
+    }
+
+    argv = malloc(sizeof(char *) * (reply->elements + 1));
+    argvlen = malloc(sizeof(size_t) * (reply->elements + 1));
+    keys = malloc(sizeof(*keys) * (reply->elements / 2));
+
+    argv[argc] = "MSET";
+    argvlen[argc++] = 4;
+
+    for (i = 0; i + 1 < reply->elements; i += 2)
+    {
+        snprintf(keys[i / 2], sizeof(keys[i / 2]), "%s:%s", hash,
+                 reply->element[i]->str);
+
+        argv[argc] = keys[i / 2];
+        argvlen[argc++] = strlen(keys[i / 2]);
+        argv[argc] = reply->element[i + 1]->str;
+        argvlen[argc++] = reply->element[i + 1]->len;
+
+        if (strcmp(reply->element[i]->str, "TYPE") == 0)
+            type = strdup(reply->element[i + 1]->str);
+    }
+
+    redisAppendCommandArgv(_g_redis, argc, argv, argvlen);
+    redisAppendCommand(_g_redis, "DEL %s", hash);
+
+    for (i = 0; i < 2; i++)
+    {
+        redisGetReply(_g_redis, (void **)&r);
+        freeReplyObject(r);
+    }
+
+    free(argv);
+    free(argvlen);
+    free(keys);
+    freeReplyObject(reply);
+
+    return (type);
+}
+
+
+/**
+ * Fetch the name of an inode, after it has been converted.
+ */
+char *
+get_name(const char *inode)
+{
+    redisReply *reply = NULL;
+    char *name = NULL;
+
+    if (_g_to_hash)
+        reply = redisCommand(_g_redis, "HGET %s:INODE:%s NAME", _g_prefix,
+                             inode);
+    else
+        reply = redisCommand(_g_redis, "GET %s:INODE:%s:NAME", _g_prefix,
+                             inode);
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        name = strdup(reply->str);
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    return (name);
+}
+
+
+/**
+ * Convert every entry in the given directory, recursively, rebuilding
+ * the name-index of the directory as we go.
+ */
+void
+convert_directory(long long dir)
+{
+    redisReply *reply = NULL;
+    redisReply *r = NULL;
+    int count = 0;
+    int i;
+
+    redis_alive();
+
+    reply = redisCommand(_g_redis, "SMEMBERS %s:DIRENT:%lld", _g_prefix, dir);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY))
+    {
+        if (reply != NULL)
+            freeReplyObject(reply);
+        return;
+    }
+
+    redisAppendCommand(_g_redis, "DEL %s:DIRNAME:%lld", _g_prefix, dir);
+    count += 1;
+
+    for (i = 0; i < reply->elements; i++)
+    {
+        char *inode = reply->element[i]->str;
+        char *type = NULL;
+        char *name = NULL;
+
+        type = _g_to_hash ? inode_to_hash(inode) : inode_to_keys(inode);
+        name = get_name(inode);
+
+        if (_g_debug)
+            fprintf(stderr, "Converted inode %s [%s] '%s'\n", inode,
+                    type ? type : "?", name ? name : "?");
+
+        if (name != NULL)
+        {
+            redisAppendCommand(_g_redis, "HSET %s:DIRNAME:%lld %s %s",
+                               _g_prefix, dir, name, inode);
+            count += 1;
+        }
+
+        if ((type != NULL) && (strcmp(type, "DIR") == 0))
+            convert_directory(atoll(inode));
+
+        _g_converted += 1;
+
+        free(type);
+        free(name);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        redisGetReply(_g_redis, (void **)&r);
+        freeReplyObject(r);
+    }
+
+    freeReplyObject(reply);
+}
+
+
+
+/**
+ * Show minimal usage information.
+ */
+int
+usage(int argc, char *argv[])
+{
+    printf("%s - Change the schema of a redisfs filesystem\n", argv[0]);
+    printf("\nOptions:\n\n");
+    printf("\t--debug      - Launch with debugging information.\n");
+    printf("\t--help       - Show this minimal help information.\n");
+    printf("\t--host       - The hostname of the redis server [localhost]\n");
+    printf("\t--port       - The port of the redis server [6389].\n");
+    printf("\t--prefix     - The prefix of the filesystem to convert [skx].\n");
+    printf("\t--schema     - The schema to convert to, 'hash' or 'keys' [hash].\n");
+    printf("\n");
+
+    return 1;
+}
+
+/**
+ *  Entry point to our code.
+ *
+ *  Parse our arguments, make sure the filesystem isn't already in the
+ * schema requested, and then convert it.
+ *
+ */
+int
+main(int argc, char *argv[])
+{
+    redisReply *reply = NULL;
+    int c;
+    int current = 0;
+
+    /**
+     * Parse any command line arguments we might have.
+     */
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"debug", no_argument, 0, 'd'},
+            {"help", no_argument, 0, 'h'},
+            {"host", required_argument, 0, 's'},
+            {"port", required_argument, 0, 'P'},
+            {"prefix", required_argument, 0, 'p'},
+            {"schema", required_argument, 0, 'S'},
+            {"version", no_argument, 0, 'v'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "s:P:p:S:hdv", long_options,
+                        &option_index);
+
+        /*
+         * Detect the end of the options.
+         */
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+        case 'v':
+            fprintf(stderr,
+                    "redisfs-convert - version %s - <http://www.steve.org.uk/Software/redisfs>\n",
+                    VERSION);
+            exit(0);
+
+        case 'P':
+            _g_redis_port = atoi(optarg);
+            break;
+        case 's':
+            snprintf(_g_redis_host, sizeof(_g_redis_host) - 1, "%s", optarg);
+            break;
+        case 'd':
+            _g_debug += 1;
+            break;
+        case 'p':
+            snprintf(_g_prefix, sizeof(_g_prefix) - 1, "%s", optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "hash") == 0)
+                _g_to_hash = 1;
+            else if (strcmp(optarg, "keys") == 0)
+                _g_to_hash = 0;
+            else
+                return (usage(argc, argv));
+            break;
+        case 'h':
+            return (usage(argc, argv));
+            break;
+        default:
+            abort();
+        }
+    }
+
+    /**
+     * Show our options.
+     */
+    printf("Connecting to redis server %s:%d.\n",
+           _g_redis_host, _g_redis_port);
+
+    redis_alive();
+
+    /**
+     * The keys of a filesystem made for a cluster are named differently.
+     */
+    reply = redisCommand(_g_redis, "EXISTS %s:GLOBAL:HASHTAGS", _g_prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER) &&
+        (reply->integer != 0))
+    {
+        fprintf(stderr,
+                "The prefix '%s' uses hash tags, which we can't convert.\n",
+                _g_prefix);
+        freeReplyObject(reply);
+        return -1;
+    }
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    /**
+     * Filesystems which don't record a schema use a key per field.
+     */
+    reply = redisCommand(_g_redis, "GET %s:GLOBAL:SCHEMA", _g_prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
+        (strcmp(reply->str, "hash") == 0))
+        current = 1;
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    if (current == _g_to_hash)
+    {
+        printf("The prefix '%s' already uses the '%s' schema.\n", _g_prefix,
+               _g_to_hash ? "hash" : "keys");
+        return 0;
+    }
+
+    printf("Converting prefix '%s' to the '%s' schema.\n", _g_prefix,
+           _g_to_hash ? "hash" : "keys");
+
+    /**
+     * The root directory is inode -99, and has no meta-data of its own.
+     */
+    convert_directory(-99);
+
+    reply = redisCommand(_g_redis, "SET %s:GLOBAL:SCHEMA %s", _g_prefix,
+                         _g_to_hash ? "hash" : "keys");
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    printf("Converted %d inodes.\n", _g_converted);
+
+    return 0;
+}
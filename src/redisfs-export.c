@@ -0,0 +1,1021 @@
+/* redisfs-export.c -- Utility to copy a filesystem out to a local tree
+ *
+ *
+ * Copyright (c) 2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  This is the reverse of redisfs-import: the keys of the filesystem are
+ * read directly, rather than through a mount, and written out as a tree
+ * of local files.
+ *
+ *  The directories are walked from the top, fetching the meta-data of
+ * every entry of a directory with a single pipeline.  Sub-directories and
+ * symbolic links are created as they're found, and files are queued for
+ * several workers, each with a connection of their own, which fetch the
+ * contents of a batch of files at once.
+ *
+ *  The modes and timestamps of directories are set once everything
+ * within them has been written.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+#include "hiredis.h"
+
+
+
+/**
+ * The host and port of the redis server we're connecting to.
+ */
+int _g_redis_port = 6379;
+char _g_redis_host[100] = { "localhost" };
+
+
+/**
+ * Are we running with --debug in play?
+ */
+int _g_debug = 0;
+
+/**
+ * Should we refrain from reporting our progress?
+ */
+int _g_quiet = 0;
+
+/**
+ * The prefix of the filesystem we're copying.
+ */
+char _g_prefix[20] = { "skx" };
+
+
+/**
+ * The layout of the filesystem, as with redisfs-import.
+ */
+int _g_hash = 0;
+long _g_chunk_size = 0;
+
+
+/**
+ * The number of files each worker fetches with a single pipeline, and
+ * the number of workers.
+ */
+int _g_batch = 256;
+int _g_jobs = 4;
+
+
+/**
+ * A worker stops adding files to its batch once they hold this many
+ * bytes, and fetches larger files this much at a time.
+ */
+#define PIPELINE_BYTES (8 * 1024 * 1024)
+#define PIECE_SIZE (1024 * 1024)
+
+
+/**
+ * The fields we fetch for every entry, in order.
+ */
+static const char *_g_fields[] = {
+    "NAME", "TYPE", "MODE", "UID", "GID", "ATIME", "MTIME", "SIZE",
+    "TARGET", "CODEC", "SPILL"
+};
+
+#define FIELD_COUNT (sizeof(_g_fields) / sizeof(_g_fields[0]))
+
+enum
+{ F_NAME, F_TYPE, F_MODE, F_UID, F_GID, F_ATIME, F_MTIME, F_SIZE,
+    F_TARGET, F_CODEC, F_SPILL
+};
+
+
+/**
+ * An entry waiting to be written: a file for the workers, or a directory
+ * whose mode and times are set at the end.
+ */
+typedef struct export_entry
+{
+    long long inode;
+    char *path;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t atime;
+    time_t mtime;
+    long long size;
+    struct export_entry *next;
+} export_entry;
+
+
+/**
+ * The files found by the walk, waiting for a worker.
+ */
+#define QUEUE_SIZE 4096
+
+export_entry *_g_queue[QUEUE_SIZE];
+int _g_queue_head = 0;
+int _g_queue_count = 0;
+int _g_walk_done = 0;
+pthread_mutex_t _g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _g_queue_filled = PTHREAD_COND_INITIALIZER;
+pthread_cond_t _g_queue_drained = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * The directories we've created, most recent first.
+ */
+export_entry *_g_dirs = NULL;
+
+
+/**
+ * Our progress so far.
+ */
+unsigned long long _g_exported = 0;
+unsigned long long _g_bytes = 0;
+unsigned long long _g_failed = 0;
+long long _g_started = 0;
+long long _g_reported = 0;
+pthread_mutex_t _g_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+long long
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Connect to the redis server, or exit.
+ */
+redisContext *
+redis_connect()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c;
+
+    c = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
+    if ((c == NULL) || (c->err))
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        exit(1);
+    }
+
+    if (_g_debug)
+        fprintf(stderr, "Connected to redis server on [%s:%d]\n",
+                _g_redis_host, _g_redis_port);
+
+    return (c);
+}
+
+
+/**
+ * Fetch the value of a GLOBAL key of our filesystem, which the caller
+ * must free, or NULL if it isn't set.
+ */
+char *
+get_global(redisContext * c, const char *name)
+{
+    redisReply *reply = redisCommand(c, "GET %s:GLOBAL:%s", _g_prefix, name);
+    char *val = NULL;
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        val = strdup(reply->str);
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    return (val);
+}
+
+
+/**
+ * Find the layout of the filesystem.
+ *
+ * Returns 0 on success, -1 if it isn't one we can read.
+ */
+int
+setup_layout(redisContext * c)
+{
+    char *val;
+
+    if ((val = get_global(c, "HASHTAGS")) != NULL)
+    {
+        fprintf(stderr,
+                "The prefix '%s' lives upon a cluster, which we can't export.\n",
+                _g_prefix);
+        free(val);
+        return -1;
+    }
+    if ((val = get_global(c, "DEDUP")) != NULL)
+    {
+        fprintf(stderr,
+                "The prefix '%s' stores shared blocks, which we can't export.\n",
+                _g_prefix);
+        free(val);
+        return -1;
+    }
+
+    if ((val = get_global(c, "SCHEMA")) != NULL)
+    {
+        _g_hash = (strcmp(val, "hash") == 0);
+        free(val);
+    }
+    if ((val = get_global(c, "CHUNKSIZE")) != NULL)
+    {
+        _g_chunk_size = atol(val);
+        free(val);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Append the command fetching the fields of an inode.
+ */
+void
+append_fetch(redisContext * c, long long inode)
+{
+    const char *argv[2 + FIELD_COUNT];
+    size_t argvlen[2 + FIELD_COUNT];
+    char keys[FIELD_COUNT][96];
+    char hash[64];
+    int argc = 0;
+    size_t i;
+
+    snprintf(hash, sizeof(hash), "%s:INODE:%lld", _g_prefix, inode);
+
+    if (_g_hash)
+    {
+        argv[argc++] = "HMGET";
+        argv[argc++] = hash;
+        for (i = 0; i < FIELD_COUNT; i++)
+            argv[argc++] = _g_fields[i];
+    }
+    else
+    {
+        argv[argc++] = "MGET";
+        for (i = 0; i < FIELD_COUNT; i++)
+        {
+            snprintf(keys[i], sizeof(keys[i]), "%s:%s", hash, _g_fields[i]);
+            argv[argc++] = keys[i];
+        }
+    }
+
+    for (i = 0; i < (size_t) argc; i++)
+        argvlen[i] = strlen(argv[i]);
+
+    redisAppendCommandArgv(c, argc, argv, argvlen);
+}
+
+
+/**
+ * The value of a field from the reply of append_fetch, or NULL.
+ */
+const char *
+field(redisReply * reply, int i)
+{
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY) ||
+        ((size_t) i >= reply->elements) ||
+        (reply->element[i]->type != REDIS_REPLY_STRING))
+        return NULL;
+
+    return (reply->element[i]->str);
+}
+
+long long
+field_number(redisReply * reply, int i)
+{
+    const char *val = field(reply, i);
+
+    return ((val != NULL) ? atoll(val) : 0);
+}
+
+
+/**
+ * Find the inode of the directory at the given path within the
+ * filesystem, by way of the name-index of each directory above it.
+ *
+ * Returns -1 if there is no such directory.
+ */
+long long
+find_directory(redisContext * c, const char *path)
+{
+    redisReply *reply = NULL;
+    long long inode = -99;
+    char *copy = strdup(path);
+    char *name;
+    char *save = NULL;
+    int dir;
+
+    for (name = strtok_r(copy, "/", &save); name != NULL;
+         name = strtok_r(NULL, "/", &save))
+    {
+        reply = redisCommand(c, "HGET %s:DIRNAME:%lld %s", _g_prefix, inode,
+                             name);
+        inode = -1;
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            inode = atoll(reply->str);
+        if (reply != NULL)
+            freeReplyObject(reply);
+
+        if (inode == -1)
+            break;
+
+        append_fetch(c, inode);
+        reply = NULL;
+        redisGetReply(c, (void **)&reply);
+        dir = ((field(reply, F_TYPE) != NULL) &&
+               (strcmp(field(reply, F_TYPE), "DIR") == 0));
+        if (reply != NULL)
+            freeReplyObject(reply);
+
+        if (!dir)
+        {
+            inode = -1;
+            break;
+        }
+    }
+
+    free(copy);
+    return (inode);
+}
+
+
+/**
+ * Add to our totals, and report them if it's time to.
+ */
+void
+report_progress(unsigned long long done, unsigned long long bytes,
+                unsigned long long failed, int final)
+{
+    long long now;
+
+    pthread_mutex_lock(&_g_progress_lock);
+
+    _g_exported += done;
+    _g_bytes += bytes;
+    _g_failed += failed;
+
+    now = now_ms();
+    if ((!_g_quiet) && (final || (now - _g_reported >= 1000)))
+    {
+        double secs = (now - _g_started) / 1000.0;
+
+        _g_reported = now;
+        printf("%sExported %llu entries, %llu bytes, in %.1f seconds (%.0f/s)",
+               isatty(1) ? "\r" : "", _g_exported, _g_bytes, secs,
+               (secs > 0) ? _g_exported / secs : 0.0);
+        if (_g_failed)
+            printf(", %llu failed", _g_failed);
+        printf("%s", (final || !isatty(1)) ? "\n" : "");
+        fflush(stdout);
+    }
+
+    pthread_mutex_unlock(&_g_progress_lock);
+}
+
+
+/**
+ * Hand a file to the workers, waiting for room if need be.
+ */
+void
+queue_entry(export_entry * e)
+{
+    pthread_mutex_lock(&_g_queue_lock);
+
+    while (_g_queue_count == QUEUE_SIZE)
+        pthread_cond_wait(&_g_queue_drained, &_g_queue_lock);
+
+    _g_queue[(_g_queue_head + _g_queue_count) % QUEUE_SIZE] = e;
+    _g_queue_count += 1;
+
+    pthread_cond_signal(&_g_queue_filled);
+    pthread_mutex_unlock(&_g_queue_lock);
+}
+
+
+/**
+ * Take files from the queue, waiting for some, until we have max of
+ * them or they hold more than PIPELINE_BYTES.
+ *
+ * Returns the number taken, which is zero once the walk is done and
+ * every file has been taken.
+ */
+int
+take_entries(export_entry ** out, int max)
+{
+    long long bytes = 0;
+    int taken = 0;
+
+    pthread_mutex_lock(&_g_queue_lock);
+
+    while ((_g_queue_count == 0) && !_g_walk_done)
+        pthread_cond_wait(&_g_queue_filled, &_g_queue_lock);
+
+    while ((_g_queue_count > 0) && (taken < max) && (bytes < PIPELINE_BYTES))
+    {
+        out[taken] = _g_queue[_g_queue_head];
+        bytes += out[taken]->size;
+        taken += 1;
+        _g_queue_head = (_g_queue_head + 1) % QUEUE_SIZE;
+        _g_queue_count -= 1;
+    }
+
+    pthread_cond_broadcast(&_g_queue_drained);
+    pthread_mutex_unlock(&_g_queue_lock);
+
+    return (taken);
+}
+
+
+/**
+ * Set the owner, mode and times of a local entry.
+ */
+void
+set_attributes(export_entry * e)
+{
+    struct utimbuf times;
+
+    if (geteuid() == 0)
+    {
+        if (chown(e->path, e->uid, e->gid) != 0)
+            fprintf(stderr, "Failed to change the owner of %s: %s\n",
+                    e->path, strerror(errno));
+    }
+
+    chmod(e->path, e->mode & 07777);
+
+    times.actime = e->atime;
+    times.modtime = e->mtime;
+    utime(e->path, &times);
+}
+
+
+/**
+ * The number of commands fetching the contents of a file.
+ */
+long
+piece_count(export_entry * e)
+{
+    long piece = (_g_chunk_size > 0) ? _g_chunk_size : PIECE_SIZE;
+
+    return ((e->size + piece - 1) / piece);
+}
+
+
+/**
+ * Append the commands fetching the contents of a file.
+ */
+void
+append_contents(redisContext * c, export_entry * e)
+{
+    long count = piece_count(e);
+    long i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (_g_chunk_size > 0)
+            redisAppendCommand(c, "GET %s:INODE:%lld:CHUNK:%ld", _g_prefix,
+                               e->inode, i);
+        else
+            redisAppendCommand(c, "GETRANGE %s:INODE:%lld:DATA %lld %lld",
+                               _g_prefix, e->inode,
+                               (long long)i * PIECE_SIZE,
+                               (long long)(i + 1) * PIECE_SIZE - 1);
+    }
+}
+
+
+/**
+ * Read the contents of a file, for which append_contents was called, and
+ * write them out.
+ *
+ * Returns the number of bytes written, or -1 on error.  Every reply is
+ * read either way.
+ */
+long long
+write_contents(redisContext * c, export_entry * e)
+{
+    long piece = (_g_chunk_size > 0) ? _g_chunk_size : PIECE_SIZE;
+    long count = piece_count(e);
+    redisReply *reply = NULL;
+    long long written = 0;
+    int failed = 0;
+    long i;
+    int fd;
+
+    fd = open(e->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", e->path,
+                strerror(errno));
+        failed = 1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (redisGetReply(c, (void **)&reply) != REDIS_OK)
+        {
+            fprintf(stderr, "Lost connection to redis: %s\n", c->errstr);
+            exit(1);
+        }
+
+        /**
+         * Missing chunks are holes, which the final truncate leaves.
+         */
+        if ((!failed) && (reply->type == REDIS_REPLY_STRING) &&
+            (reply->len > 0))
+        {
+            off_t offset = (off_t) i * piece;
+            size_t len = reply->len;
+
+            if (offset + (long long)len > e->size)
+                len = e->size - offset;
+
+            if (pwrite(fd, reply->str, len, offset) != (ssize_t) len)
+            {
+                fprintf(stderr, "Failed to write %s: %s\n", e->path,
+                        strerror(errno));
+                failed = 1;
+            }
+            written += len;
+        }
+        else if (reply->type == REDIS_REPLY_ERROR)
+        {
+            fprintf(stderr, "Failed to fetch %s: %s\n", e->path, reply->str);
+            failed = 1;
+        }
+
+        freeReplyObject(reply);
+    }
+
+    if (fd >= 0)
+    {
+        if ((!failed) && (ftruncate(fd, e->size) != 0))
+            failed = 1;
+        close(fd);
+    }
+
+    if (failed)
+        return -1;
+
+    set_attributes(e);
+
+    return (written);
+}
+
+
+/**
+ * A worker, which fetches batches of files over its own connection until
+ * there are none left.
+ */
+void *
+export_worker(void *arg)
+{
+    redisContext *c = redis_connect();
+    export_entry **batch = calloc(_g_batch, sizeof(export_entry *));
+    int count;
+
+    if (batch == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    while ((count = take_entries(batch, _g_batch)) > 0)
+    {
+        unsigned long long failed = 0;
+        unsigned long long bytes = 0;
+        int i;
+
+        for (i = 0; i < count; i++)
+            append_contents(c, batch[i]);
+
+        for (i = 0; i < count; i++)
+        {
+            long long n = write_contents(c, batch[i]);
+
+            if (n < 0)
+                failed += 1;
+            else
+                bytes += n;
+
+            free(batch[i]->path);
+            free(batch[i]);
+        }
+
+        report_progress(count - failed, bytes, failed, 0);
+    }
+
+    free(batch);
+    redisFree(c);
+    return NULL;
+}
+
+
+/**
+ * A new entry for the given path, from the fields of an inode.
+ */
+export_entry *
+new_entry(const char *path, long long inode, redisReply * meta)
+{
+    export_entry *e = calloc(1, sizeof(export_entry));
+
+    if ((e == NULL) || ((e->path = strdup(path)) == NULL))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    e->inode = inode;
+    e->mode = field_number(meta, F_MODE);
+    e->uid = field_number(meta, F_UID);
+    e->gid = field_number(meta, F_GID);
+    e->atime = field_number(meta, F_ATIME);
+    e->mtime = field_number(meta, F_MTIME);
+    e->size = field_number(meta, F_SIZE);
+
+    return (e);
+}
+
+
+/**
+ * Copy out the contents of the directory with the given inode into the
+ * given local directory, which exists, and the directories beneath it.
+ */
+void
+export_tree(redisContext * c, long long inode, const char *path)
+{
+    redisReply *members = NULL;
+    redisReply **metas = NULL;
+    char child[PATH_MAX];
+    size_t i;
+
+    members = redisCommand(c, "SMEMBERS %s:DIRENT:%lld", _g_prefix, inode);
+    if ((members == NULL) || (members->type != REDIS_REPLY_ARRAY))
+    {
+        fprintf(stderr, "Failed to read the directory %s\n", path);
+        if (members != NULL)
+            freeReplyObject(members);
+        report_progress(0, 0, 1, 0);
+        return;
+    }
+
+    /**
+     * Fetch the fields of every entry at once, reading every reply before
+     * we descend, as that uses the same connection.
+     */
+    metas = calloc(members->elements + 1, sizeof(redisReply *));
+    if (metas == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < members->elements; i++)
+        append_fetch(c, atoll(members->element[i]->str));
+
+    for (i = 0; i < members->elements; i++)
+    {
+        if (redisGetReply(c, (void **)&metas[i]) != REDIS_OK)
+        {
+            fprintf(stderr, "Lost connection to redis: %s\n", c->errstr);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < members->elements; i++)
+    {
+        long long member = atoll(members->element[i]->str);
+        redisReply *meta = metas[i];
+        const char *name = field(meta, F_NAME);
+        const char *type = field(meta, F_TYPE);
+        export_entry *e;
+
+        if ((name == NULL) || (type == NULL) || (strchr(name, '/') != NULL)
+            || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+        {
+            fprintf(stderr, "Skipping inode %lld of %s: it is damaged.\n",
+                    member, path);
+            report_progress(0, 0, 1, 0);
+            continue;
+        }
+
+        if (snprintf(child, sizeof(child), "%s/%s", path, name) >=
+            (int)sizeof(child))
+        {
+            fprintf(stderr, "Skipping %s/%s: the name is too long.\n", path,
+                    name);
+            report_progress(0, 0, 1, 0);
+            continue;
+        }
+
+        if (_g_debug)
+            fprintf(stderr, "Exporting inode %lld as %s\n", member, child);
+
+        if (strcmp(type, "DIR") == 0)
+        {
+            if ((mkdir(child, 0700) != 0) && (errno != EEXIST))
+            {
+                fprintf(stderr, "Failed to create %s: %s\n", child,
+                        strerror(errno));
+                report_progress(0, 0, 1, 0);
+            }
+            else
+            {
+                e = new_entry(child, member, meta);
+                e->next = _g_dirs;
+                _g_dirs = e;
+
+                export_tree(c, member, child);
+                report_progress(1, 0, 0, 0);
+            }
+        }
+        else if (strcmp(type, "LINK") == 0)
+        {
+            const char *target = field(meta, F_TARGET);
+
+            unlink(child);
+            if ((target == NULL) || (symlink(target, child) != 0))
+            {
+                fprintf(stderr, "Failed to create the link %s\n", child);
+                report_progress(0, 0, 1, 0);
+            }
+            else
+            {
+                if ((geteuid() == 0) &&
+                    (lchown(child, field_number(meta, F_UID),
+                            field_number(meta, F_GID)) != 0))
+                    fprintf(stderr, "Failed to change the owner of %s\n",
+                            child);
+                report_progress(1, 0, 0, 0);
+            }
+        }
+        else if ((field(meta, F_CODEC) != NULL) ||
+                 (field(meta, F_SPILL) != NULL))
+        {
+            /**
+             * The contents are compressed, or held in the spill
+             * directory of a mount, neither of which we can read here.
+             */
+            fprintf(stderr,
+                    "Skipping %s: copy it through a mount, as its contents are %s.\n",
+                    child, (field(meta, F_CODEC) != NULL) ?
+                    "compressed" : "on the local disk of the mount");
+            report_progress(0, 0, 1, 0);
+        }
+        else
+        {
+            queue_entry(new_entry(child, member, meta));
+        }
+    }
+
+    for (i = 0; i < members->elements; i++)
+        freeReplyObject(metas[i]);
+    free(metas);
+    freeReplyObject(members);
+}
+
+
+/**
+ * Copy the directory of the filesystem with the given inode into the
+ * given local directory.
+ *
+ * Returns 0 on success.
+ */
+int
+export_all(redisContext * c, long long inode, const char *dest)
+{
+    pthread_t *workers;
+    int i;
+
+    if ((mkdir(dest, 0755) != 0) && (errno != EEXIST))
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", dest, strerror(errno));
+        return -1;
+    }
+
+    if (!_g_quiet)
+        printf("Using %d connections, and batches of %d files.\n", _g_jobs,
+               _g_batch);
+
+    _g_started = now_ms();
+
+    workers = calloc(_g_jobs, sizeof(pthread_t));
+    if (workers == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < _g_jobs; i++)
+    {
+        if (pthread_create(&workers[i], NULL, export_worker, NULL) != 0)
+        {
+            fprintf(stderr, "Failed to start a worker thread.\n");
+            exit(1);
+        }
+    }
+
+    export_tree(c, inode, dest);
+
+    pthread_mutex_lock(&_g_queue_lock);
+    _g_walk_done = 1;
+    pthread_cond_broadcast(&_g_queue_filled);
+    pthread_mutex_unlock(&_g_queue_lock);
+
+    for (i = 0; i < _g_jobs; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+
+    /**
+     * Now that nothing more will be written beneath them, set the modes
+     * and times of the directories, the deepest first.
+     */
+    while (_g_dirs != NULL)
+    {
+        export_entry *e = _g_dirs;
+
+        _g_dirs = e->next;
+        set_attributes(e);
+        free(e->path);
+        free(e);
+    }
+
+    report_progress(0, 0, 0, 1);
+
+    return ((_g_failed == 0) ? 0 : -1);
+}
+
+
+
+/**
+ * Show minimal usage information.
+ */
+int
+usage(int argc, char *argv[])
+{
+    printf("%s - Copy a redisfs filesystem out to a local directory\n",
+           argv[0]);
+    printf("\nUsage: %s [options] directory\n", argv[0]);
+    printf("\nOptions:\n\n");
+    printf("\t--batch      - The number of files to fetch at once [256].\n");
+    printf("\t--debug      - Launch with debugging information.\n");
+    printf("\t--from       - The directory of the filesystem to copy [/].\n");
+    printf("\t--help       - Show this minimal help information.\n");
+    printf("\t--host       - The hostname of the redis server [localhost]\n");
+    printf("\t--jobs       - The number of connections to fetch with [4].\n");
+    printf("\t--port       - The port of the redis server [6389].\n");
+    printf("\t--prefix     - The prefix of the filesystem [skx].\n");
+    printf("\t--quiet      - Don't report our progress.\n");
+    printf("\n");
+
+    return 1;
+}
+
+/**
+ *  Entry point to our code.
+ *
+ *  Parse our arguments, find the layout of the filesystem and the
+ * directory we're copying, and then copy it.
+ *
+ */
+int
+main(int argc, char *argv[])
+{
+    redisContext *c = NULL;
+    char from[PATH_MAX] = { "/" };
+    long long inode;
+    int ch;
+
+    /**
+     * Parse any command line arguments we might have.
+     */
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"batch", required_argument, 0, 'b'},
+            {"debug", no_argument, 0, 'd'},
+            {"from", required_argument, 0, 'f'},
+            {"help", no_argument, 0, 'h'},
+            {"host", required_argument, 0, 's'},
+            {"jobs", required_argument, 0, 'j'},
+            {"port", required_argument, 0, 'P'},
+            {"prefix", required_argument, 0, 'p'},
+            {"quiet", no_argument, 0, 'q'},
+            {"version", no_argument, 0, 'v'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        ch = getopt_long(argc, argv, "s:P:p:f:b:j:hdqv", long_options,
+                         &option_index);
+
+        /*
+         * Detect the end of the options.
+         */
+        if (ch == -1)
+            break;
+
+        switch (ch)
+        {
+        case 'v':
+            fprintf(stderr,
+                    "redisfs-export - version %s - <http://www.steve.org.uk/Software/redisfs>\n",
+                    VERSION);
+            exit(0);
+
+        case 'P':
+            _g_redis_port = atoi(optarg);
+            break;
+        case 's':
+            snprintf(_g_redis_host, sizeof(_g_redis_host) - 1, "%s", optarg);
+            break;
+        case 'd':
+            _g_debug += 1;
+            break;
+        case 'q':
+            _g_quiet = 1;
+            break;
+        case 'p':
+            snprintf(_g_prefix, sizeof(_g_prefix) - 1, "%s", optarg);
+            break;
+        case 'f':
+            snprintf(from, sizeof(from) - 1, "%s", optarg);
+            break;
+        case 'b':
+            _g_batch = atoi(optarg);
+            if (_g_batch < 1)
+                _g_batch = 1;
+            break;
+        case 'j':
+            _g_jobs = atoi(optarg);
+            if (_g_jobs < 1)
+                _g_jobs = 1;
+            break;
+        case 'h':
+            return (usage(argc, argv));
+            break;
+        default:
+            abort();
+        }
+    }
+
+    if (optind != argc - 1)
+        return (usage(argc, argv));
+
+    /**
+     * Show our options.
+     */
+    if (!_g_quiet)
+        printf("Connecting to redis server %s:%d.\n",
+               _g_redis_host, _g_redis_port);
+
+    c = redis_connect();
+
+    if (setup_layout(c) != 0)
+        return 1;
+
+    inode = find_directory(c, from);
+    if (inode == -1)
+    {
+        fprintf(stderr, "There is no directory %s in the prefix '%s'.\n",
+                from, _g_prefix);
+        return 1;
+    }
+
+    if (!_g_quiet)
+        printf("Copying %s of prefix '%s' into %s.\n", from, _g_prefix,
+               argv[optind]);
+
+    return ((export_all(c, inode, argv[optind]) == 0) ? 0 : 1);
+}
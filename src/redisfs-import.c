@@ -0,0 +1,1175 @@
+/* redisfs-import.c -- Utility to load a directory tree into a filesystem
+ *
+ *
+ * Copyright (c) 2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  Copying a tree into a mounted filesystem costs several round-trips
+ * for every file, and every directory.  This utility writes the keys of
+ * the filesystem directly instead.
+ *
+ *  The tree is walked twice: once to count its entries, so that their
+ * inode numbers may be taken from GLOBAL:INODE with a single INCRBY,
+ * and then to queue each entry.  Several workers, each with a connection
+ * of their own, take the entries a batch at a time and write everything
+ * about them - the meta-data, the membership of the parent directory,
+ * and the contents - with a single deep pipeline.
+ *
+ *  The filesystem is best not mounted while this runs, as the caches of
+ * a mount won't know of the new entries until they expire.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#include "hiredis.h"
+
+
+
+/**
+ * The host and port of the redis server we're connecting to.
+ */
+int _g_redis_port = 6379;
+char _g_redis_host[100] = { "localhost" };
+
+
+/**
+ * Are we running with --debug in play?
+ */
+int _g_debug = 0;
+
+/**
+ * Should we refrain from reporting our progress?
+ */
+int _g_quiet = 0;
+
+/**
+ * The prefix of the filesystem we're loading into.
+ */
+char _g_prefix[20] = { "skx" };
+
+
+/**
+ * The layout of the filesystem: are the fields of an inode kept in a
+ * single hash, and what size are the chunks holding the contents of
+ * files, or zero if each file is a single value?
+ *
+ * These are read from the filesystem, or for a new one taken from our
+ * options and recorded.
+ */
+int _g_hash = 0;
+long _g_chunk_size = 0;
+
+
+/**
+ * The number of entries each worker writes with a single pipeline, and
+ * the number of workers.
+ */
+int _g_batch = 256;
+int _g_jobs = 4;
+
+
+/**
+ * Once this many bytes of commands are waiting we read their replies,
+ * rather than buffering more.
+ */
+#define PIPELINE_BYTES (8 * 1024 * 1024)
+
+/**
+ * Files which aren't stored in chunks are written this much at a time.
+ */
+#define PIECE_SIZE (1024 * 1024)
+
+
+/**
+ * The commands a worker has sent, and not yet read the replies to.
+ */
+typedef struct pipeline
+{
+    redisContext *c;
+    int replies;
+    size_t pending;
+    unsigned long long failed;
+} pipeline;
+
+
+/**
+ * An entry waiting to be written.
+ */
+typedef struct import_entry
+{
+    long long inode;
+    long long parent;
+    char *path;
+    char *name;
+    struct stat st;
+} import_entry;
+
+
+/**
+ * The entries found by the walk, waiting for a worker.
+ */
+#define QUEUE_SIZE 4096
+
+import_entry *_g_queue[QUEUE_SIZE];
+int _g_queue_head = 0;
+int _g_queue_count = 0;
+int _g_walk_done = 0;
+pthread_mutex_t _g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _g_queue_filled = PTHREAD_COND_INITIALIZER;
+pthread_cond_t _g_queue_drained = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * The inode numbers we've taken, the next to be given out, and the
+ * number of entries we found when counting.
+ */
+long long _g_next_inode = 0;
+long long _g_last_inode = -1;
+unsigned long long _g_found = 0;
+
+
+/**
+ * Our progress so far.
+ */
+unsigned long long _g_imported = 0;
+unsigned long long _g_bytes = 0;
+unsigned long long _g_failed = 0;
+long long _g_started = 0;
+long long _g_reported = 0;
+pthread_mutex_t _g_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+long long
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Connect to the redis server, or exit.
+ */
+redisContext *
+redis_connect()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c;
+
+    c = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
+    if ((c == NULL) || (c->err))
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        exit(1);
+    }
+
+    if (_g_debug)
+        fprintf(stderr, "Connected to redis server on [%s:%d]\n",
+                _g_redis_host, _g_redis_port);
+
+    return (c);
+}
+
+
+/**
+ * Fetch the value of a GLOBAL key of our filesystem, which the caller
+ * must free, or NULL if it isn't set.
+ */
+char *
+get_global(redisContext * c, const char *name)
+{
+    redisReply *reply = redisCommand(c, "GET %s:GLOBAL:%s", _g_prefix, name);
+    char *val = NULL;
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        val = strdup(reply->str);
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    return (val);
+}
+
+
+/**
+ * Find the layout of the filesystem, recording the one we were asked
+ * for if it is new.
+ *
+ * Returns 0 on success, -1 if we can't write to it.
+ */
+int
+setup_layout(redisContext * c)
+{
+    redisReply *reply = NULL;
+    char *val;
+    int existing = 0;
+
+    /**
+     * Layouts we can't write.
+     */
+    if ((val = get_global(c, "HASHTAGS")) != NULL)
+    {
+        fprintf(stderr,
+                "The prefix '%s' lives upon a cluster, which we can't import into.\n",
+                _g_prefix);
+        free(val);
+        return -1;
+    }
+    if ((val = get_global(c, "DEDUP")) != NULL)
+    {
+        fprintf(stderr,
+                "The prefix '%s' stores shared blocks, which we can't import into.\n",
+                _g_prefix);
+        free(val);
+        return -1;
+    }
+    if (((val = get_global(c, "GENERATION")) != NULL) && (atoll(val) > 0))
+    {
+        fprintf(stderr,
+                "The prefix '%s' has snapshots; import before taking them.\n",
+                _g_prefix);
+        free(val);
+        return -1;
+    }
+    free(val);
+
+    reply = redisCommand(c, "EXISTS %s:GLOBAL:INODE", _g_prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        existing = reply->integer;
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    /**
+     * The schema.  Filesystems which predate the choice use a key per
+     * field.
+     */
+    if ((val = get_global(c, "SCHEMA")) != NULL)
+    {
+        _g_hash = (strcmp(val, "hash") == 0);
+        free(val);
+    }
+    else if (existing)
+    {
+        _g_hash = 0;
+    }
+    else
+    {
+        reply = redisCommand(c, "SETNX %s:GLOBAL:SCHEMA %s", _g_prefix,
+                             _g_hash ? "hash" : "keys");
+        if (reply != NULL)
+            freeReplyObject(reply);
+    }
+
+    /**
+     * The chunk size.
+     */
+    if ((val = get_global(c, "CHUNKSIZE")) != NULL)
+    {
+        _g_chunk_size = atol(val);
+        free(val);
+    }
+    else if (existing)
+    {
+        _g_chunk_size = 0;
+    }
+    else if (_g_chunk_size > 0)
+    {
+        reply = redisCommand(c, "SETNX %s:GLOBAL:CHUNKSIZE %ld", _g_prefix,
+                             _g_chunk_size);
+        if (reply != NULL)
+            freeReplyObject(reply);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Find the inode of the directory at the given path within the
+ * filesystem, by way of the name-index of each directory above it.
+ *
+ * Returns -1 if there is no such directory.
+ */
+long long
+find_directory(redisContext * c, const char *path)
+{
+    redisReply *reply = NULL;
+    long long inode = -99;
+    char *copy = strdup(path);
+    char *name;
+    char *save = NULL;
+    int dir;
+
+    for (name = strtok_r(copy, "/", &save); name != NULL;
+         name = strtok_r(NULL, "/", &save))
+    {
+        reply = redisCommand(c, "HGET %s:DIRNAME:%lld %s", _g_prefix, inode,
+                             name);
+        inode = -1;
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            inode = atoll(reply->str);
+        if (reply != NULL)
+            freeReplyObject(reply);
+
+        if (inode == -1)
+            break;
+
+        if (_g_hash)
+            reply = redisCommand(c, "HGET %s:INODE:%lld TYPE", _g_prefix,
+                                 inode);
+        else
+            reply = redisCommand(c, "GET %s:INODE:%lld:TYPE", _g_prefix,
+                                 inode);
+        dir = ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
+               (strcmp(reply->str, "DIR") == 0));
+        if (reply != NULL)
+            freeReplyObject(reply);
+
+        if (!dir)
+        {
+            inode = -1;
+            break;
+        }
+    }
+
+    free(copy);
+    return (inode);
+}
+
+
+/**
+ * Add to our totals, and report them if it's time to.
+ */
+void
+report_progress(unsigned long long done, unsigned long long bytes,
+                unsigned long long failed, int final)
+{
+    long long now;
+
+    pthread_mutex_lock(&_g_progress_lock);
+
+    _g_imported += done;
+    _g_bytes += bytes;
+    _g_failed += failed;
+
+    now = now_ms();
+    if ((!_g_quiet) && (final || (now - _g_reported >= 1000)))
+    {
+        double secs = (now - _g_started) / 1000.0;
+
+        _g_reported = now;
+        printf("%sImported %llu of %llu entries, %llu bytes, in %.1f seconds (%.0f/s)",
+               isatty(1) ? "\r" : "", _g_imported, _g_found, _g_bytes, secs,
+               (secs > 0) ? _g_imported / secs : 0.0);
+        if (_g_failed)
+            printf(", %llu failed", _g_failed);
+        printf("%s", (final || !isatty(1)) ? "\n" : "");
+        fflush(stdout);
+    }
+
+    pthread_mutex_unlock(&_g_progress_lock);
+}
+
+
+/**
+ * Hand an entry to the workers, waiting for room if need be.
+ */
+void
+queue_entry(import_entry * e)
+{
+    pthread_mutex_lock(&_g_queue_lock);
+
+    while (_g_queue_count == QUEUE_SIZE)
+        pthread_cond_wait(&_g_queue_drained, &_g_queue_lock);
+
+    _g_queue[(_g_queue_head + _g_queue_count) % QUEUE_SIZE] = e;
+    _g_queue_count += 1;
+
+    pthread_cond_signal(&_g_queue_filled);
+    pthread_mutex_unlock(&_g_queue_lock);
+}
+
+
+/**
+ * Take up to max entries from the queue, waiting for some.
+ *
+ * Returns the number taken, which is zero once the walk is done and
+ * every entry has been taken.
+ */
+int
+take_entries(import_entry ** out, int max)
+{
+    int taken = 0;
+
+    pthread_mutex_lock(&_g_queue_lock);
+
+    while ((_g_queue_count == 0) && !_g_walk_done)
+        pthread_cond_wait(&_g_queue_filled, &_g_queue_lock);
+
+    while ((_g_queue_count > 0) && (taken < max))
+    {
+        out[taken++] = _g_queue[_g_queue_head];
+        _g_queue_head = (_g_queue_head + 1) % QUEUE_SIZE;
+        _g_queue_count -= 1;
+    }
+
+    pthread_cond_broadcast(&_g_queue_drained);
+    pthread_mutex_unlock(&_g_queue_lock);
+
+    return (taken);
+}
+
+
+/**
+ * Read the replies to the commands we've appended, counting errors.
+ */
+void
+read_replies(pipeline * p)
+{
+    redisReply *reply = NULL;
+
+    while (p->replies > 0)
+    {
+        if (redisGetReply(p->c, (void **)&reply) != REDIS_OK)
+        {
+            fprintf(stderr, "Lost connection to redis: %s\n", p->c->errstr);
+            exit(1);
+        }
+        if (reply->type == REDIS_REPLY_ERROR)
+        {
+            if (_g_debug)
+                fprintf(stderr, "Error: %s\n", reply->str);
+            p->failed += 1;
+        }
+        freeReplyObject(reply);
+        p->replies -= 1;
+    }
+
+    p->pending = 0;
+}
+
+
+/**
+ * Note a command we've appended, reading the replies once too much is
+ * waiting.
+ */
+void
+appended(pipeline * p, size_t bytes)
+{
+    p->replies += 1;
+    p->pending += bytes;
+
+    if (p->pending >= PIPELINE_BYTES)
+        read_replies(p);
+}
+
+
+/**
+ * Append the command storing the meta-data of an entry, in whichever
+ * schema is in use.
+ */
+void
+append_meta(pipeline * p, import_entry * e, const char *type,
+            const char *target)
+{
+    const char *argv[2 + 11 * 2];
+    size_t argvlen[2 + 11 * 2];
+    char keys[11][96];
+    char values[11][32];
+    const char *fields[11];
+    const char *vals[11];
+    char hash[64];
+    int count = 0;
+    int argc = 0;
+    int i;
+
+    fields[count] = "NAME";
+    vals[count++] = e->name;
+    fields[count] = "TYPE";
+    vals[count++] = type;
+    if (target != NULL)
+    {
+        fields[count] = "TARGET";
+        vals[count++] = target;
+    }
+
+    fields[count] = "MODE";
+    snprintf(values[count], sizeof(values[count]), "%d", (int)e->st.st_mode);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "UID";
+    snprintf(values[count], sizeof(values[count]), "%d", (int)e->st.st_uid);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "GID";
+    snprintf(values[count], sizeof(values[count]), "%d", (int)e->st.st_gid);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "SIZE";
+    snprintf(values[count], sizeof(values[count]), "%lld",
+             S_ISREG(e->st.st_mode) ? (long long)e->st.st_size : 0);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "CTIME";
+    snprintf(values[count], sizeof(values[count]), "%ld",
+             (long)e->st.st_ctime);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "MTIME";
+    snprintf(values[count], sizeof(values[count]), "%ld",
+             (long)e->st.st_mtime);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "ATIME";
+    snprintf(values[count], sizeof(values[count]), "%ld",
+             (long)e->st.st_atime);
+    vals[count] = values[count];
+    count++;
+    fields[count] = "LINK";
+    vals[count++] = "1";
+
+    snprintf(hash, sizeof(hash), "%s:INODE:%lld", _g_prefix, e->inode);
+
+    if (_g_hash)
+    {
+        argv[argc++] = "HMSET";
+        argv[argc++] = hash;
+        for (i = 0; i < count; i++)
+        {
+            argv[argc++] = fields[i];
+            argv[argc++] = vals[i];
+        }
+    }
+    else
+    {
+        argv[argc++] = "MSET";
+        for (i = 0; i < count; i++)
+        {
+            snprintf(keys[i], sizeof(keys[i]), "%s:%s", hash, fields[i]);
+            argv[argc++] = keys[i];
+            argv[argc++] = vals[i];
+        }
+    }
+
+    for (i = 0; i < argc; i++)
+        argvlen[i] = strlen(argv[i]);
+
+    redisAppendCommandArgv(p->c, argc, argv, argvlen);
+    appended(p, 0);
+}
+
+
+/**
+ * Append the commands storing the contents of a file, as they're read.
+ *
+ * Returns the number of bytes stored, or -1 if the file can't be read.
+ */
+long long
+append_contents(pipeline * p, import_entry * e)
+{
+    size_t piece = (_g_chunk_size > 0) ? _g_chunk_size : PIECE_SIZE;
+    char *buf;
+    off_t offset = 0;
+    int fd;
+
+    if (e->st.st_size == 0)
+        return 0;
+
+    fd = open(e->path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", e->path, strerror(errno));
+        return -1;
+    }
+
+    buf = malloc(piece);
+    if (buf == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    while (1)
+    {
+        size_t have = 0;
+        ssize_t got;
+
+        while (have < piece)
+        {
+            got = read(fd, buf + have, piece - have);
+            if (got <= 0)
+                break;
+            have += got;
+        }
+
+        if (have == 0)
+            break;
+
+        if (_g_chunk_size > 0)
+            redisAppendCommand(p->c, "SET %s:INODE:%lld:CHUNK:%ld %b",
+                               _g_prefix, e->inode,
+                               (long)(offset / _g_chunk_size), buf, have);
+        else if (offset == 0)
+            redisAppendCommand(p->c, "SET %s:INODE:%lld:DATA %b", _g_prefix,
+                               e->inode, buf, have);
+        else
+            redisAppendCommand(p->c, "SETRANGE %s:INODE:%lld:DATA %lld %b",
+                               _g_prefix, e->inode, (long long)offset, buf,
+                               have);
+
+        offset += have;
+        appended(p, have);
+
+        if (have < piece)
+            break;
+    }
+
+    free(buf);
+    close(fd);
+
+    return (offset);
+}
+
+
+/**
+ * A worker, which writes batches of entries over its own connection
+ * until there are none left.
+ */
+void *
+import_worker(void *arg)
+{
+    import_entry **batch = calloc(_g_batch, sizeof(import_entry *));
+    pipeline p;
+    int count;
+
+    if (batch == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.c = redis_connect();
+
+    while ((count = take_entries(batch, _g_batch)) > 0)
+    {
+        unsigned long long skipped = 0;
+        unsigned long long bytes = 0;
+        int i;
+
+        p.failed = 0;
+
+        for (i = 0; i < count; i++)
+        {
+            import_entry *e = batch[i];
+            char target[PATH_MAX];
+
+            if (_g_debug)
+                fprintf(stderr, "Importing %s as inode %lld\n", e->path,
+                        e->inode);
+
+            if (S_ISDIR(e->st.st_mode))
+            {
+                append_meta(&p, e, "DIR", NULL);
+            }
+            else if (S_ISLNK(e->st.st_mode))
+            {
+                ssize_t len = readlink(e->path, target, sizeof(target) - 1);
+
+                if (len < 0)
+                {
+                    fprintf(stderr, "Failed to read the link %s: %s\n",
+                            e->path, strerror(errno));
+                    skipped += 1;
+                    continue;
+                }
+                target[len] = '\0';
+                append_meta(&p, e, "LINK", target);
+            }
+            else
+            {
+                long long size = append_contents(&p, e);
+
+                if (size < 0)
+                {
+                    skipped += 1;
+                    continue;
+                }
+
+                /**
+                 * The file may have changed size since we looked; the
+                 * size recorded is that of what we stored.
+                 */
+                e->st.st_size = size;
+                bytes += size;
+                append_meta(&p, e, "FILE", NULL);
+            }
+
+            /**
+             * The entry only becomes visible once it is complete.
+             */
+            redisAppendCommand(p.c, "HSET %s:DIRNAME:%lld %s %lld",
+                               _g_prefix, e->parent, e->name, e->inode);
+            appended(&p, 0);
+            redisAppendCommand(p.c, "SADD %s:DIRENT:%lld %lld", _g_prefix,
+                               e->parent, e->inode);
+            appended(&p, 0);
+        }
+
+        read_replies(&p);
+
+        for (i = 0; i < count; i++)
+        {
+            free(batch[i]->path);
+            free(batch[i]);
+        }
+
+        /**
+         * An entry may have had several commands fail.
+         */
+        skipped += p.failed;
+        if (skipped > (unsigned long long)count)
+            skipped = count;
+
+        report_progress(count - skipped, bytes, skipped, 0);
+    }
+
+    free(batch);
+    redisFree(p.c);
+    return NULL;
+}
+
+
+/**
+ * Walk the given local directory, calling the given function for each
+ * entry of a type we can store, with its inode and that of its parent.
+ *
+ * Directories are given before their contents.
+ */
+typedef void (*walk_fn) (const char *path, const char *name,
+                         const struct stat * st, long long inode,
+                         long long parent);
+
+void
+walk_tree(const char *path, long long parent, walk_fn fn, int numbered)
+{
+    DIR *dir = opendir(path);
+    struct dirent *d;
+    char child[PATH_MAX];
+    struct stat st;
+
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    while ((d = readdir(dir)) != NULL)
+    {
+        long long inode = 0;
+
+        if ((strcmp(d->d_name, ".") == 0) || (strcmp(d->d_name, "..") == 0))
+            continue;
+
+        if (snprintf(child, sizeof(child), "%s/%s", path, d->d_name) >=
+            (int)sizeof(child))
+        {
+            fprintf(stderr, "Skipping %s/%s: the name is too long.\n", path,
+                    d->d_name);
+            continue;
+        }
+
+        if (lstat(child, &st) != 0)
+        {
+            fprintf(stderr, "Failed to stat %s: %s\n", child,
+                    strerror(errno));
+            continue;
+        }
+
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode) &&
+            !S_ISLNK(st.st_mode))
+        {
+            if (!numbered)
+                fprintf(stderr, "Skipping %s: it isn't a file, directory or link.\n",
+                        child);
+            continue;
+        }
+
+        /**
+         * Entries which appeared since we counted have no inode.
+         */
+        if (numbered)
+        {
+            if (_g_next_inode > _g_last_inode)
+            {
+                fprintf(stderr, "Skipping %s: it is new since we started.\n",
+                        child);
+                continue;
+            }
+            inode = _g_next_inode++;
+        }
+
+        fn(child, d->d_name, &st, inode, parent);
+
+        if (S_ISDIR(st.st_mode))
+            walk_tree(child, inode, fn, numbered);
+    }
+
+    closedir(dir);
+}
+
+
+/**
+ * Count an entry.
+ */
+void
+count_entry(const char *path, const char *name, const struct stat *st,
+            long long inode, long long parent)
+{
+    _g_found += 1;
+}
+
+
+/**
+ * Queue an entry for the workers.
+ */
+void
+import_entry_fn(const char *path, const char *name, const struct stat *st,
+                long long inode, long long parent)
+{
+    import_entry *e = calloc(1, sizeof(import_entry));
+
+    if ((e == NULL) || ((e->path = strdup(path)) == NULL))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    e->name = strrchr(e->path, '/') + 1;
+    e->inode = inode;
+    e->parent = parent;
+    e->st = *st;
+
+    queue_entry(e);
+}
+
+
+/**
+ * Load the given local directory into the directory with the given
+ * inode.
+ *
+ * Returns 0 on success.
+ */
+int
+import_tree(redisContext * c, const char *source, long long into)
+{
+    redisReply *reply = NULL;
+    pthread_t *workers;
+    DIR *dir;
+    struct dirent *d;
+    int i;
+
+    /**
+     * Names already present in the directory we're loading into would
+     * be replaced, so we refuse.
+     */
+    dir = opendir(source);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Failed to read %s: %s\n", source, strerror(errno));
+        return -1;
+    }
+    while ((d = readdir(dir)) != NULL)
+    {
+        if ((strcmp(d->d_name, ".") == 0) || (strcmp(d->d_name, "..") == 0))
+            continue;
+        reply = redisCommand(c, "HGET %s:DIRNAME:%lld %s", _g_prefix, into,
+                             d->d_name);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        {
+            fprintf(stderr,
+                    "'%s' already exists in the directory we're loading into.\n",
+                    d->d_name);
+            freeReplyObject(reply);
+            closedir(dir);
+            return -1;
+        }
+        if (reply != NULL)
+            freeReplyObject(reply);
+        reply = NULL;
+    }
+    closedir(dir);
+
+    /**
+     * Count the entries, and take an inode for each.
+     */
+    walk_tree(source, into, count_entry, 0);
+
+    if (_g_found == 0)
+    {
+        printf("There is nothing to import.\n");
+        return 0;
+    }
+
+    reply = redisCommand(c, "INCRBY %s:GLOBAL:INODE %llu", _g_prefix,
+                         _g_found);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_INTEGER))
+    {
+        fprintf(stderr, "Failed to allocate %llu inodes.\n", _g_found);
+        if (reply != NULL)
+            freeReplyObject(reply);
+        return -1;
+    }
+    _g_last_inode = reply->integer;
+    _g_next_inode = _g_last_inode - _g_found + 1;
+    freeReplyObject(reply);
+
+    if (!_g_quiet)
+    {
+        printf("Importing %llu entries as inodes %lld-%lld.\n", _g_found,
+               _g_next_inode, _g_last_inode);
+        printf("Using %d connections, and batches of %d entries.\n", _g_jobs,
+               _g_batch);
+    }
+
+    /**
+     * Then queue them for the workers.
+     */
+    _g_started = now_ms();
+
+    workers = calloc(_g_jobs, sizeof(pthread_t));
+    if (workers == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < _g_jobs; i++)
+    {
+        if (pthread_create(&workers[i], NULL, import_worker, NULL) != 0)
+        {
+            fprintf(stderr, "Failed to start a worker thread.\n");
+            exit(1);
+        }
+    }
+
+    walk_tree(source, into, import_entry_fn, 1);
+
+    pthread_mutex_lock(&_g_queue_lock);
+    _g_walk_done = 1;
+    pthread_cond_broadcast(&_g_queue_filled);
+    pthread_mutex_unlock(&_g_queue_lock);
+
+    for (i = 0; i < _g_jobs; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+
+    report_progress(0, 0, 0, 1);
+
+    return ((_g_failed == 0) ? 0 : -1);
+}
+
+
+
+/**
+ * Parse a size, such as "64k" or "1m".
+ */
+long
+parse_size(const char *str)
+{
+    char *end = NULL;
+    long val = strtol(str, &end, 10);
+
+    if ((end != NULL) && ((*end == 'k') || (*end == 'K')))
+        val *= 1024;
+    else if ((end != NULL) && ((*end == 'm') || (*end == 'M')))
+        val *= 1024 * 1024;
+
+    return (val);
+}
+
+
+/**
+ * Show minimal usage information.
+ */
+int
+usage(int argc, char *argv[])
+{
+    printf("%s - Load a directory tree into a redisfs filesystem\n", argv[0]);
+    printf("\nUsage: %s [options] directory\n", argv[0]);
+    printf("\nOptions:\n\n");
+    printf("\t--batch      - The number of entries to write at once [256].\n");
+    printf("\t--chunk-size - Store a new filesystem in chunks of this size, e.g. 64k.\n");
+    printf("\t--debug      - Launch with debugging information.\n");
+    printf("\t--help       - Show this minimal help information.\n");
+    printf("\t--host       - The hostname of the redis server [localhost]\n");
+    printf("\t--into       - The directory of the filesystem to load into [/].\n");
+    printf("\t--jobs       - The number of connections to write with [4].\n");
+    printf("\t--port       - The port of the redis server [6389].\n");
+    printf("\t--prefix     - The prefix of the filesystem [skx].\n");
+    printf("\t--quiet      - Don't report our progress.\n");
+    printf("\t--schema     - Store a new filesystem as 'keys' or a 'hash' [keys].\n");
+    printf("\n");
+
+    return 1;
+}
+
+/**
+ *  Entry point to our code.
+ *
+ *  Parse our arguments, find the layout of the filesystem and the
+ * directory we're loading into, and then load the tree.
+ *
+ */
+int
+main(int argc, char *argv[])
+{
+    redisContext *c = NULL;
+    char into[PATH_MAX] = { "/" };
+    long long inode;
+    int ch;
+
+    /**
+     * Parse any command line arguments we might have.
+     */
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"batch", required_argument, 0, 'b'},
+            {"chunk-size", required_argument, 0, 'C'},
+            {"debug", no_argument, 0, 'd'},
+            {"help", no_argument, 0, 'h'},
+            {"host", required_argument, 0, 's'},
+            {"into", required_argument, 0, 'i'},
+            {"jobs", required_argument, 0, 'j'},
+            {"port", required_argument, 0, 'P'},
+            {"prefix", required_argument, 0, 'p'},
+            {"quiet", no_argument, 0, 'q'},
+            {"schema", required_argument, 0, 'S'},
+            {"version", no_argument, 0, 'v'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        ch = getopt_long(argc, argv, "s:P:p:i:b:j:C:S:hdqv", long_options,
+                         &option_index);
+
+        /*
+         * Detect the end of the options.
+         */
+        if (ch == -1)
+            break;
+
+        switch (ch)
+        {
+        case 'v':
+            fprintf(stderr,
+                    "redisfs-import - version %s - <http://www.steve.org.uk/Software/redisfs>\n",
+                    VERSION);
+            exit(0);
+
+        case 'P':
+            _g_redis_port = atoi(optarg);
+            break;
+        case 's':
+            snprintf(_g_redis_host, sizeof(_g_redis_host) - 1, "%s", optarg);
+            break;
+        case 'd':
+            _g_debug += 1;
+            break;
+        case 'q':
+            _g_quiet = 1;
+            break;
+        case 'p':
+            snprintf(_g_prefix, sizeof(_g_prefix) - 1, "%s", optarg);
+            break;
+        case 'i':
+            snprintf(into, sizeof(into) - 1, "%s", optarg);
+            break;
+        case 'b':
+            _g_batch = atoi(optarg);
+            if (_g_batch < 1)
+                _g_batch = 1;
+            break;
+        case 'j':
+            _g_jobs = atoi(optarg);
+            if (_g_jobs < 1)
+                _g_jobs = 1;
+            break;
+        case 'C':
+            _g_chunk_size = parse_size(optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "hash") == 0)
+                _g_hash = 1;
+            else if (strcmp(optarg, "keys") == 0)
+                _g_hash = 0;
+            else
+                return (usage(argc, argv));
+            break;
+        case 'h':
+            return (usage(argc, argv));
+            break;
+        default:
+            abort();
+        }
+    }
+
+    if (optind != argc - 1)
+        return (usage(argc, argv));
+
+    /**
+     * Show our options.
+     */
+    if (!_g_quiet)
+        printf("Connecting to redis server %s:%d.\n",
+               _g_redis_host, _g_redis_port);
+
+    c = redis_connect();
+
+    if (setup_layout(c) != 0)
+        return 1;
+
+    inode = find_directory(c, into);
+    if (inode == -1)
+    {
+        fprintf(stderr, "There is no directory %s in the prefix '%s'.\n",
+                into, _g_prefix);
+        return 1;
+    }
+
+    if (!_g_quiet)
+        printf("Loading %s into %s of prefix '%s'.\n", argv[optind], into,
+               _g_prefix);
+
+    return ((import_tree(c, argv[optind], inode) == 0) ? 0 : 1);
+}
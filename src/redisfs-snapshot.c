@@ -19,28 +19,27 @@
  *  To create a new snapshot we merely clone each key & value which
  * contains our prefix.
  *
+ *  Keys are found with SCAN, in batches, and each batch is copied with
+ * a single pipeline of commands.  Several batches are copied at once,
+ * over connections of their own.
+ *
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 #include <errno.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 
 #include "hiredis.h"
 
 
 
-/**
- * Handle to the redis server.
- */
-redisContext *_g_redis = NULL;
-
-
 /**
  * The host and port of the redis server we're connecting to.
  */
@@ -53,6 +52,11 @@ char _g_redis_host[100] = { "localhost" };
  */
 int _g_debug = 0;
 
+/**
+ * Should we refrain from reporting our progress?
+ */
+int _g_quiet = 0;
+
 /**
  * The prefixes we copy from & to.
  */
@@ -60,206 +64,887 @@ char _g_old_prefix[20] = { "skx" };
 char _g_new_prefix[20] = { "snapshot" };
 
 
+/**
+ * The number of keys we ask SCAN for, and copy with a single pipeline,
+ * and the number of connections we copy with in parallel.
+ */
+int _g_batch = 1000;
+int _g_jobs = 4;
+
+
+/**
+ * The ways in which we might copy a key, from fastest to slowest.
+ *
+ * COPY needs redis 6.2, DUMP & RESTORE with REPLACE needs 3.0, and
+ * failing those we read and write each value according to its type.
+ */
+#define COPY_COMMAND 0
+#define COPY_RESTORE 1
+#define COPY_BY_TYPE 2
+
+int _g_method = COPY_BY_TYPE;
+
+/**
+ * Should we take a copy-on-write snapshot, rather than copying keys?
+ */
+int _g_cow = 0;
 
 /**
- * If our service isn't alive then connect to it.
+ * Is the SCAN command available?  (redis 2.8)
+ */
+int _g_scan = 0;
+
+
+/**
+ * The state of our walk over the keyspace, which is shared by every
+ * worker: the SCAN cursor, or the reply to KEYS and our position
+ * within it.
+ */
+unsigned long long _g_cursor = 0;
+int _g_scan_done = 0;
+redisReply *_g_keys = NULL;
+size_t _g_keys_offset = 0;
+char _g_pattern[64];
+pthread_mutex_t _g_scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Our progress so far.
+ */
+unsigned long long _g_copied = 0;
+unsigned long long _g_failed = 0;
+long long _g_started = 0;
+long long _g_reported = 0;
+pthread_mutex_t _g_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+long long
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Connect to the redis server, or exit.
+ */
+redisContext *
+redis_connect()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c;
+
+    c = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
+    if ((c == NULL) || (c->err))
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        exit(1);
+    }
+
+    if (_g_debug)
+        fprintf(stderr, "Connected to redis server on [%s:%d]\n",
+                _g_redis_host, _g_redis_port);
+
+    return (c);
+}
+
+
+/**
+ * Find the version of the server, as a number such as 20806 for 2.8.6.
+ *
+ * Returns zero if we can't tell.
+ */
+int
+server_version(redisContext * c)
+{
+    redisReply *reply = redisCommand(c, "INFO");
+    int major = 0, minor = 0, patch = 0;
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+    {
+        char *v = strstr(reply->str, "redis_version:");
+
+        if (v != NULL)
+            sscanf(v, "redis_version:%d.%d.%d", &major, &minor, &patch);
+    }
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    return ((major * 10000) + (minor * 100) + patch);
+}
+
+
+/**
+ * Build the SCAN pattern matching every key with the given prefix,
+ * escaping the characters which are special to it.
  */
 void
-redis_alive()
+build_pattern(const char *prefix, char *pattern, size_t size)
 {
-    struct timeval timeout = { 1, 5000000 };    // 1.5 seconds
-    redisReply *reply = NULL;
+    size_t len = 0;
 
-    /**
-     * If we have a handle see if it is alive.
-     */
-    if (_g_redis != NULL)
+    while ((*prefix != '\0') && (len + 3 < size))
     {
-        reply = redisCommand(_g_redis, "PING");
+        if (strchr("*?[]\\", *prefix) != NULL)
+            pattern[len++] = '\\';
+        pattern[len++] = *prefix++;
+    }
+    pattern[len++] = '*';
+    pattern[len] = '\0';
+}
+
+
+/**
+ * Find the next batch of keys to copy.
+ *
+ * Returns the number of keys, which are stored in *keys, and zero once
+ * there are no more.  The reply which holds them is stored in *reply,
+ * and must be freed by the caller if it isn't NULL.
+ */
+size_t
+next_batch(redisContext * c, redisReply *** keys, redisReply ** reply)
+{
+    size_t count = 0;
+
+    *reply = NULL;
+    pthread_mutex_lock(&_g_scan_lock);
 
-        if ((reply != NULL) &&
-            (reply->str != NULL) && (strcmp(reply->str, "PONG") == 0))
+    while (!_g_scan_done && (count == 0))
+    {
+        if (!_g_scan)
         {
-            freeReplyObject(reply);
-            return;
+            /**
+             * Without SCAN we must fetch every name at once, and hand
+             * them out a batch at a time.
+             */
+            if (_g_keys == NULL)
+                _g_keys = redisCommand(c, "KEYS %s", _g_pattern);
+
+            if ((_g_keys == NULL) || (_g_keys->type != REDIS_REPLY_ARRAY) ||
+                (_g_keys_offset >= _g_keys->elements))
+            {
+                _g_scan_done = 1;
+                break;
+            }
+
+            count = _g_keys->elements - _g_keys_offset;
+            if (count > (size_t)_g_batch)
+                count = _g_batch;
+
+            *keys = _g_keys->element + _g_keys_offset;
+            _g_keys_offset += count;
         }
         else
         {
-            if (reply != NULL)
-                freeReplyObject(reply);
+            char cursor[32];
+            char batch[16];
+            const char *argv[6];
+
+            snprintf(cursor, sizeof(cursor), "%llu", _g_cursor);
+            snprintf(batch, sizeof(batch), "%d", _g_batch);
+
+            argv[0] = "SCAN";
+            argv[1] = cursor;
+            argv[2] = "MATCH";
+            argv[3] = _g_pattern;
+            argv[4] = "COUNT";
+            argv[5] = batch;
+
+            *reply = redisCommandArgv(c, 6, argv, NULL);
+
+            if ((*reply == NULL) || ((*reply)->type != REDIS_REPLY_ARRAY) ||
+                ((*reply)->elements != 2))
+            {
+                if (*reply != NULL)
+                {
+                    fprintf(stderr, "SCAN failed: %s\n",
+                            ((*reply)->type == REDIS_REPLY_ERROR) ?
+                            (*reply)->str : "unexpected reply");
+                    freeReplyObject(*reply);
+                    *reply = NULL;
+                }
+                else
+                    fprintf(stderr, "SCAN failed: %s\n", c->errstr);
+
+                _g_failed += 1;
+                _g_scan_done = 1;
+                break;
+            }
+
+            /**
+             * A batch may well be empty, in which case we just carry
+             * on with the next.
+             */
+            _g_cursor = strtoull((*reply)->element[0]->str, NULL, 10);
+            if (_g_cursor == 0)
+                _g_scan_done = 1;
+
+            count = (*reply)->element[1]->elements;
+            *keys = (*reply)->element[1]->element;
+
+            if (count == 0)
+            {
+                freeReplyObject(*reply);
+                *reply = NULL;
+            }
         }
     }
 
-    /**
-     * OK we have no handle, create a connection to the server.
-     */
-    _g_redis = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
-    if (_g_redis == NULL)
+    pthread_mutex_unlock(&_g_scan_lock);
+    return (count);
+}
+
+
+/**
+ * Generate the name of the copy of the given key.
+ */
+char *
+new_name(const redisReply * key)
+{
+    size_t len = strlen(_g_new_prefix) + key->len - strlen(_g_old_prefix);
+    char *name = malloc(len + 1);
+
+    if (name != NULL)
+        sprintf(name, "%s%s", _g_new_prefix,
+                key->str + strlen(_g_old_prefix));
+
+    return (name);
+}
+
+
+/**
+ * Should the given key be left alone?
+ *
+ * If the new prefix begins with the old one then SCAN may well return
+ * the copies we've made, which we mustn't copy again.
+ */
+int
+skip_key(const redisReply * key)
+{
+    size_t len = strlen(_g_new_prefix);
+
+    if (key->type != REDIS_REPLY_STRING)
+        return 1;
+
+    if (strncmp(_g_new_prefix, _g_old_prefix, strlen(_g_old_prefix)) != 0)
+        return 0;
+
+    return ((key->len >= len) && (strncmp(key->str, _g_new_prefix, len) == 0));
+}
+
+
+/**
+ * Record the reply to a write, returning 1 if it succeeded.
+ */
+int
+write_ok(redisContext * c, const char *key)
+{
+    redisReply *reply = NULL;
+    int ok = 0;
+
+    if (redisGetReply(c, (void **)&reply) == REDIS_OK)
+        ok = (reply->type != REDIS_REPLY_ERROR);
+
+    if ((!ok) && (_g_debug || (_g_failed == 0)))
+        fprintf(stderr, "Failed to copy %s: %s\n", key,
+                (reply != NULL) ? reply->str : c->errstr);
+
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    return (ok);
+}
+
+
+/**
+ * Copy a batch of keys with COPY.
+ */
+void
+copy_command(redisContext * c, redisReply ** keys, char **names,
+             size_t count, unsigned long long *done,
+             unsigned long long *failed)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
     {
-        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
-                _g_redis_host, _g_redis_port);
-        exit(1);
+        const char *argv[4] = { "COPY", keys[i]->str, names[i], "REPLACE" };
+        size_t argvlen[4] = { 4, keys[i]->len, strlen(names[i]), 7 };
+
+        redisAppendCommandArgv(c, 4, argv, argvlen);
     }
-    else
+
+    for (i = 0; i < count; i++)
     {
-        if (_g_debug)
-            fprintf(stderr, "Reconnected to redis server on [%s:%d]\n",
-                    _g_redis_host, _g_redis_port);
+        if (write_ok(c, keys[i]->str))
+            *done += 1;
+        else
+            *failed += 1;
     }
 }
 
 
 /**
- * Clone all keys with the given prefix.
- *
- * For each key we find we need to generate teh new name, and copy the
- * contents.
+ * Copy a batch of keys with DUMP & RESTORE.
  *
+ * Every DUMP is sent at once, and then every RESTORE.
  */
 void
-clone_keys(char *prefix, char *new_prefix)
+copy_restore(redisContext * c, redisReply ** keys, char **names,
+             size_t count, unsigned long long *done,
+             unsigned long long *failed)
 {
-    redisReply *reply = NULL;
-    int additional;
+    redisReply **dumps = calloc(count, sizeof(redisReply *));
+    size_t restores = 0;
+    size_t i;
+
+    if (dumps == NULL)
+    {
+        *failed += count;
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *argv[2] = { "DUMP", keys[i]->str };
+        size_t argvlen[2] = { 4, keys[i]->len };
+
+        redisAppendCommandArgv(c, 2, argv, argvlen);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (redisGetReply(c, (void **)&dumps[i]) != REDIS_OK)
+            break;
+    }
 
+    if (c->err)
+        *failed += count;
 
     /**
-     * We need to make sure that we have free space to store
-     * the key names.
+     * A key which has vanished since we found it is simply skipped.
      */
-    additional = strlen(new_prefix) - strlen(prefix) + 1;
+    for (i = 0; (i < count) && (!c->err); i++)
+    {
+        if ((dumps[i] != NULL) && (dumps[i]->type == REDIS_REPLY_ERROR))
+        {
+            fprintf(stderr, "Failed to dump %s: %s\n", keys[i]->str,
+                    dumps[i]->str);
+            *failed += 1;
+        }
+        if ((dumps[i] == NULL) || (dumps[i]->type != REDIS_REPLY_STRING))
+            continue;
+
+        const char *argv[5] =
+            { "RESTORE", names[i], "0", dumps[i]->str, "REPLACE" };
+        size_t argvlen[5] =
+            { 7, strlen(names[i]), 1, dumps[i]->len, 7 };
+
+        redisAppendCommandArgv(c, 5, argv, argvlen);
+        restores += 1;
+    }
+
+    for (i = 0; (restores > 0) && (i < count); i++)
+    {
+        if ((dumps[i] == NULL) || (dumps[i]->type != REDIS_REPLY_STRING))
+            continue;
+
+        if (write_ok(c, keys[i]->str))
+            *done += 1;
+        else
+            *failed += 1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (dumps[i] != NULL)
+            freeReplyObject(dumps[i]);
+    }
+    free(dumps);
+
+    if (_g_debug > 1)
+        fprintf(stderr, "Restored %d of %d keys\n", (int)restores,
+                (int)count);
+}
 
 
+/**
+ * Copy a batch of keys by reading and writing each according to its
+ * type, for servers without DUMP.
+ *
+ * Our keys are all strings, sets, or hashes.
+ */
+void
+copy_by_type(redisContext * c, redisReply ** keys, char **names,
+             size_t count, unsigned long long *done,
+             unsigned long long *failed)
+{
+    redisReply **values = calloc(count, sizeof(redisReply *));
+    int *writes = calloc(count, sizeof(int));
+    size_t i;
+    size_t j;
+
+    if ((values == NULL) || (writes == NULL))
+    {
+        free(values);
+        free(writes);
+        *failed += count;
+        return;
+    }
+
     /**
-     * Ensure we're alive.
+     * [1/3] Find the type of each key.
      */
-    redis_alive();
+    for (i = 0; i < count; i++)
+    {
+        const char *argv[2] = { "TYPE", keys[i]->str };
+        size_t argvlen[2] = { 4, keys[i]->len };
+
+        redisAppendCommandArgv(c, 2, argv, argvlen);
+    }
+    for (i = 0; i < count; i++)
+    {
+        redisReply *r = NULL;
+        const char *cmd = NULL;
+
+        if (redisGetReply(c, (void **)&r) != REDIS_OK)
+            break;
+
+        if (strcmp(r->str, "string") == 0)
+            cmd = "GET";
+        else if (strcmp(r->str, "set") == 0)
+            cmd = "SMEMBERS";
+        else if (strcmp(r->str, "hash") == 0)
+            cmd = "HGETALL";
+        else if (strcmp(r->str, "none") != 0)
+        {
+            fprintf(stderr, "The key type '%s' of %s is not one we expect to find.\n",
+                    r->str, keys[i]->str);
+            *failed += 1;
+        }
+        freeReplyObject(r);
 
+        /**
+         * Remember what we've asked for, by queuing the read.
+         */
+        if (cmd != NULL)
+        {
+            const char *argv[2] = { cmd, keys[i]->str };
+            size_t argvlen[2] = { strlen(cmd), keys[i]->len };
+
+            redisAppendCommandArgv(c, 2, argv, argvlen);
+            writes[i] = (cmd[0] == 'G') ? 1 : (cmd[0] == 'S') ? 2 : 3;
+        }
+    }
 
     /**
-     * Wildcard search on the common-prefix.
+     * [2/3] Read the values.
      */
-    reply = redisCommand(_g_redis, "KEYS %s*", prefix);
+    for (i = 0; i < count; i++)
+    {
+        if (writes[i] == 0)
+            continue;
+        if (redisGetReply(c, (void **)&values[i]) != REDIS_OK)
+            break;
+    }
 
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+    if (c->err)
     {
-        int i;
+        *failed += count;
+        goto done;
+    }
 
-        if (_g_debug)
-            fprintf(stderr, "Found %d keys\n", (int)reply->elements);
+    /**
+     * [3/3] Replace the copies, recording how many replies we'll see.
+     */
+    for (i = 0; i < count; i++)
+    {
+        redisReply *v = values[i];
+        const char *name = names[i];
+        int type = writes[i];
 
-        for (i = 0; i < reply->elements; i++)
-        {
-            redisReply *r = NULL;
+        writes[i] = 0;
 
-          /**
-           * The name of the current key.
-           */
-            char *old_key = reply->element[i]->str;
+        if (v == NULL)
+            continue;
 
-            if (_g_debug)
-                fprintf(stderr, "Found key: %s\n", old_key);
+        if (type == 1)
+        {
+            const char *argv[3] = { "SET", name, v->str };
+            size_t argvlen[3] = { 3, strlen(name), v->len };
 
-          /**
-           * The name of the new key.
-           */
-            char *new_key = malloc(reply->element[i]->len + additional);
-            sprintf(new_key, "%s%s", new_prefix, old_key + strlen(prefix));
+            if (v->type != REDIS_REPLY_STRING)
+                continue;
+            redisAppendCommandArgv(c, 3, argv, argvlen);
+            writes[i] = 1;
+        }
+        else
+        {
+            const char *del[2] = { "DEL", name };
 
-            if (_g_debug)
-                fprintf(stderr, "\tcopying to: %s\n", new_key);
+            if ((v->type != REDIS_REPLY_ARRAY) || (v->elements == 0))
+                continue;
 
+            redisAppendCommandArgv(c, 2, del, NULL);
+            writes[i] = 1;
 
-            /**
-             * Get the type.
-             */
-            r = redisCommand(_g_redis, "TYPE %s", old_key);
-            if (r != NULL)
+            for (j = 0; j < v->elements; j += (type == 2) ? 1 : 2)
             {
-                if (_g_debug)
-                    fprintf(stderr, "\tkey has type '%s'\n", r->str);
-
-                /**
-                 * If type is a string ..
-                 */
-                if (strcmp(r->str, "string") == 0)
-                {
-                    redisReply *cur = NULL;
-
-                    /**
-                     * get the value of the key.
-                     */
-                    cur = redisCommand(_g_redis, "GET %s", old_key);
-
-                    if ((cur != NULL) && (cur->type == REDIS_REPLY_STRING))
-                    {
-                      /**
-                       * Set the value in the copied key.
-                       */
-                        redisReply *cp = NULL;
-
-                        cp = redisCommand(_g_redis, "SET %s %b", new_key,
-                                          cur->str, cur->len);
-                        freeReplyObject(cp);
-                    }
-                    freeReplyObject(cur);
-                }
-                else if (strcmp(r->str, "set") == 0)
+                if (type == 2)
                 {
-                  /**
-                   * The type is a set - we need to find and clone
-                   * each of the members.
-                   *
-                   * Thankfully the members of a set will be things
-                   * like "1", "2", "3" - we don't need to transform
-                   * those member names.
-                   *
-                   * Sometimes I'm lucky by accident, and sometimes by
-                   * design.  I will not comment either way ;)
-                   *
-                   */
-                    redisReply *cur = NULL;
-                    cur = redisCommand(_g_redis, "SMEMBERS %s", old_key);
-                    if (cur != NULL)
-                    {
-                        int i;
-
-                        if (_g_debug)
-                            fprintf(stderr, "\tcloning %d set members\n",
-                                    (int)cur->elements);
-
-                        for (i = 0; i < cur->elements; i++)
-                        {
-                            redisReply *r = NULL;
-                            r = redisCommand(_g_redis, "SADD %s %b",
-                                             new_key,
-                                             cur->element[i]->str,
-                                             cur->element[i]->len);
-                            freeReplyObject(r);
-                        }
-                    }
-                    freeReplyObject(cur);
+                    const char *argv[3] = { "SADD", name, v->element[j]->str };
+                    size_t argvlen[3] =
+                        { 4, strlen(name), v->element[j]->len };
+
+                    redisAppendCommandArgv(c, 3, argv, argvlen);
+                    writes[i] += 1;
                 }
-                else
+                else if (j + 1 < v->elements)
                 {
-                    fprintf(stderr,
-                            "The key type '%s' is not one we expect to find.\nAborting\n",
-                            r->str);
+                    const char *argv[4] = { "HSET", name,
+                        v->element[j]->str, v->element[j + 1]->str
+                    };
+                    size_t argvlen[4] = { 4, strlen(name),
+                        v->element[j]->len, v->element[j + 1]->len
+                    };
+
+                    redisAppendCommandArgv(c, 4, argv, argvlen);
+                    writes[i] += 1;
                 }
+            }
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        int ok = 1;
+
+        if (writes[i] == 0)
+            continue;
+
+        for (j = 0; j < (size_t)writes[i]; j++)
+            ok &= write_ok(c, keys[i]->str);
+
+        if (ok)
+            *done += 1;
+        else
+            *failed += 1;
+    }
+
+  done:
+    for (i = 0; i < count; i++)
+    {
+        if (values[i] != NULL)
+            freeReplyObject(values[i]);
+    }
+    free(values);
+    free(writes);
+}
+
+
+/**
+ * Add to our totals, and report them if it's time to.
+ */
+void
+report_progress(unsigned long long done, unsigned long long failed,
+                int final)
+{
+    long long now;
+
+    pthread_mutex_lock(&_g_progress_lock);
+
+    _g_copied += done;
+    _g_failed += failed;
+
+    now = now_ms();
+    if ((!_g_quiet) && (final || (now - _g_reported >= 1000)))
+    {
+        double secs = (now - _g_started) / 1000.0;
+
+        _g_reported = now;
+        printf("%sCopied %llu keys in %.1f seconds (%.0f/s)",
+               isatty(1) ? "\r" : "", _g_copied, secs,
+               (secs > 0) ? _g_copied / secs : 0.0);
+        if (_g_failed)
+            printf(", %llu failed", _g_failed);
+        printf("%s", (final || !isatty(1)) ? "\n" : "");
+        fflush(stdout);
+    }
+
+    pthread_mutex_unlock(&_g_progress_lock);
+}
+
+
+/**
+ * A worker, which copies batches of keys over its own connection until
+ * there are none left.
+ */
+void *
+clone_worker(void *arg)
+{
+    redisContext *c = redis_connect();
+    redisReply **keys = NULL;
+    redisReply *reply = NULL;
+    size_t count;
 
+    while ((count = next_batch(c, &keys, &reply)) > 0)
+    {
+        unsigned long long done = 0;
+        unsigned long long failed = 0;
+        char **names = calloc(count, sizeof(char *));
+        redisReply **todo = calloc(count, sizeof(redisReply *));
+        size_t n = 0;
+        size_t i;
+
+        if ((names == NULL) || (todo == NULL))
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if (skip_key(keys[i]))
+                continue;
+
+            if (_g_debug)
+                fprintf(stderr, "Found key: %s\n", keys[i]->str);
+
+            names[n] = new_name(keys[i]);
+            if (names[n] == NULL)
+            {
+                failed += 1;
+                continue;
             }
-            freeReplyObject(r);
+            todo[n++] = keys[i];
+        }
 
-            /**
-             * Free the keyname.
-             */
-            free(new_key);
+        if (_g_method == COPY_COMMAND)
+            copy_command(c, todo, names, n, &done, &failed);
+        else if (_g_method == COPY_RESTORE)
+            copy_restore(c, todo, names, n, &done, &failed);
+        else
+            copy_by_type(c, todo, names, n, &done, &failed);
 
+        /**
+         * If we lost our connection start another.
+         */
+        if (c->err)
+        {
+            fprintf(stderr, "Lost connection to redis: %s\n", c->errstr);
+            redisFree(c);
+            c = redis_connect();
         }
+
+        for (i = 0; i < n; i++)
+            free(names[i]);
+        free(names);
+        free(todo);
+
+        if (reply != NULL)
+            freeReplyObject(reply);
+
+        report_progress(done, failed, 0);
     }
 
-    freeReplyObject(reply);
+    redisFree(c);
+    return NULL;
+}
+
+
+/**
+ * Clone all keys with the given prefix.
+ *
+ * We walk the keyspace with SCAN, so the server is never blocked for
+ * long, and copy each batch of keys with a single pipeline.  Several
+ * workers do this at once, each with a connection of their own.
+ *
+ */
+void
+clone_keys(char *prefix, char *new_prefix)
+{
+    redisContext *c = redis_connect();
+    pthread_t *workers;
+    int version;
+    int i;
+
+    /**
+     * Find out what the server can do for us.
+     */
+    version = server_version(c);
+    _g_scan = (version >= 20800);
+
+    if (version >= 60200)
+        _g_method = COPY_COMMAND;
+    else if (version >= 30000)
+        _g_method = COPY_RESTORE;
+    else
+        _g_method = COPY_BY_TYPE;
+
+    redisFree(c);
 
+    if (!_g_quiet)
+    {
+        printf("Finding keys with %s, and copying them with %s.\n",
+               _g_scan ? "SCAN" : "KEYS",
+               (_g_method == COPY_COMMAND) ? "COPY" :
+               (_g_method == COPY_RESTORE) ? "DUMP & RESTORE" :
+               "reads & writes");
+        printf("Using %d connections, and batches of %d keys.\n", _g_jobs,
+               _g_batch);
+    }
+
+    build_pattern(prefix, _g_pattern, sizeof(_g_pattern));
+    _g_started = now_ms();
+
+    workers = calloc(_g_jobs, sizeof(pthread_t));
+    if (workers == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < _g_jobs; i++)
+    {
+        if (pthread_create(&workers[i], NULL, clone_worker, NULL) != 0)
+        {
+            fprintf(stderr, "Failed to start a worker thread.\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < _g_jobs; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+
+    if (_g_keys != NULL)
+        freeReplyObject(_g_keys);
+
+    report_progress(0, 0, 1);
+}
+
+
+
+/**
+ * Take a copy-on-write snapshot of the filesystem with the given prefix.
+ *
+ * Nothing is copied: we bump the generation of the filesystem, and
+ * record the generation captured beneath the new prefix.  Mounted
+ * filesystems then preserve each inode before they next change it.
+ *
+ * Returns 0 on success.
+ */
+int
+cow_snapshot(char *prefix, char *new_prefix)
+{
+    redisContext *c = redis_connect();
+    redisReply *reply = NULL;
+    long long generation = -1;
+    int version;
+    int ret = 0;
+    int i;
+
+    /**
+     * The prefixes are those given to redisfs, without the separator.
+     */
+    while ((strlen(prefix) > 0) && (prefix[strlen(prefix) - 1] == ':'))
+        prefix[strlen(prefix) - 1] = '\0';
+    while ((strlen(new_prefix) > 0) &&
+           (new_prefix[strlen(new_prefix) - 1] == ':'))
+        new_prefix[strlen(new_prefix) - 1] = '\0';
+
+    if ((strlen(prefix) == 0) || (strlen(new_prefix) == 0) ||
+        (strcmp(prefix, new_prefix) == 0))
+    {
+        fprintf(stderr, "The snapshot needs a prefix of its own.\n");
+        redisFree(c);
+        return -1;
+    }
+
+    /**
+     * Preserving inodes needs DUMP & RESTORE.
+     */
+    version = server_version(c);
+    if (version < 20600)
+    {
+        fprintf(stderr,
+                "Copy-on-write snapshots need redis 2.6 or later.\n");
+        redisFree(c);
+        return -1;
+    }
+
+    /**
+     * We can't take a snapshot of a snapshot, or overwrite a filesystem.
+     */
+    redisAppendCommand(c, "EXISTS %s:GLOBAL:PARENT", prefix);
+    redisAppendCommand(c, "EXISTS %s:GLOBAL:INODE", new_prefix);
+    redisAppendCommand(c, "EXISTS %s:GLOBAL:PARENT", new_prefix);
+
+    for (i = 0; i < 3; i++)
+    {
+        if ((redisGetReply(c, (void **)&reply) != REDIS_OK) ||
+            (reply->type != REDIS_REPLY_INTEGER) || (reply->integer != 0))
+            ret = -1;
+        if (reply != NULL)
+            freeReplyObject(reply);
+        reply = NULL;
+    }
+
+    if (ret != 0)
+    {
+        fprintf(stderr,
+                "Either '%s' is a snapshot, or '%s' is already in use.\n",
+                prefix, new_prefix);
+        redisFree(c);
+        return -1;
+    }
+
+    reply = redisCommand(c, "INCR %s:GLOBAL:GENERATION", prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        generation = reply->integer - 1;
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    if (generation < 0)
+    {
+        fprintf(stderr, "Failed to start a new generation.\n");
+        redisFree(c);
+        return -1;
+    }
+
+    reply = redisCommand(c, "MSET %s:GLOBAL:PARENT %s %s:GLOBAL:SNAPSHOT %lld",
+                         new_prefix, prefix, new_prefix, generation);
+    if ((reply == NULL) || (reply->type == REDIS_REPLY_ERROR))
+        ret = -1;
+    if (reply != NULL)
+        freeReplyObject(reply);
+
+    redisFree(c);
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "Failed to record the snapshot.\n");
+        return -1;
+    }
+
+    /**
+     * Mounted filesystems notice the new generation within a second.
+     */
+    sleep(2);
+
+    if (!_g_quiet)
+        printf("Snapshot '%s' captured generation %lld of '%s'.\n",
+               new_prefix, generation, prefix);
+
+    return 0;
 }
 
 
@@ -272,10 +957,14 @@ usage(int argc, char *argv[])
 {
     printf("%s - Filesystem based upon FUSE\n", argv[0]);
     printf("\nOptions:\n\n");
+    printf("\t--batch      - The number of keys to copy at once [1000].\n");
+    printf("\t--cow        - Take a copy-on-write snapshot, copying nothing now.\n");
     printf("\t--debug      - Launch with debugging information.\n");
     printf("\t--help       - Show this minimal help information.\n");
     printf("\t--host       - The hostname of the redis server [localhost]\n");
+    printf("\t--jobs       - The number of connections to copy with [4].\n");
     printf("\t--port       - The port of the redis server [6389].\n");
+    printf("\t--quiet      - Don't report our progress.\n");
     printf("\t--from       - The prefix we're copying from.\n");
     printf("\t--to         - The prefix we're copying to.\n");
     printf("\n");
@@ -301,10 +990,14 @@ main(int argc, char *argv[])
     while (1)
     {
         static struct option long_options[] = {
+            {"batch", required_argument, 0, 'b'},
+            {"cow", no_argument, 0, 'c'},
             {"debug", no_argument, 0, 'd'},
             {"help", no_argument, 0, 'h'},
             {"host", required_argument, 0, 's'},
+            {"jobs", required_argument, 0, 'j'},
             {"port", required_argument, 0, 'P'},
+            {"quiet", no_argument, 0, 'q'},
             {"from", required_argument, 0, 'f'},
             {"to", required_argument, 0, 't'},
             {"version", no_argument, 0, 'v'},
@@ -312,7 +1005,7 @@ main(int argc, char *argv[])
         };
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "s:P:f:t:hdv", long_options,
+        c = getopt_long(argc, argv, "s:P:f:t:b:j:hcdqv", long_options,
                         &option_index);
 
         /*
@@ -338,6 +1031,22 @@ main(int argc, char *argv[])
         case 'd':
             _g_debug += 1;
             break;
+        case 'q':
+            _g_quiet = 1;
+            break;
+        case 'c':
+            _g_cow = 1;
+            break;
+        case 'b':
+            _g_batch = atoi(optarg);
+            if (_g_batch < 1)
+                _g_batch = 1;
+            break;
+        case 'j':
+            _g_jobs = atoi(optarg);
+            if (_g_jobs < 1)
+                _g_jobs = 1;
+            break;
         case 'f':
             snprintf(_g_old_prefix, sizeof(_g_old_prefix) - 1, "%s", optarg);
             break;
@@ -358,13 +1067,20 @@ main(int argc, char *argv[])
     printf("Connecting to redis server %s:%d.\n",
            _g_redis_host, _g_redis_port);
 
-    printf("Cloning all keys with prefix '%s' -> '%s'\n",
-           _g_old_prefix, _g_new_prefix);
+    if (!_g_cow)
+        printf("Cloning all keys with prefix '%s' -> '%s'\n",
+               _g_old_prefix, _g_new_prefix);
+
+    /**
+     * Take a copy-on-write snapshot, if we were asked to.
+     */
+    if (_g_cow)
+        return ((cow_snapshot(_g_old_prefix, _g_new_prefix) == 0) ? 0 : 1);
 
     /**
      * Clone our keys
      */
     clone_keys(_g_old_prefix, _g_new_prefix);
 
-    return 0;
+    return ((_g_failed == 0) ? 0 : 1);
 }
@@ -39,10 +39,42 @@
  * SKX:INODE:6:MTIME  => "1234567"
  * SKX:INODE:6:LINK   => 1   [symlink count]
  * SKX:INODE:6:TARGET => ""   [symlink destination]
+ * SKX:INODE:6:DATA   => ".." [file contents]
+ *
+ *  With --spill-dir the contents of a file which grows beyond
+ * --spill-size are moved to a file of that directory instead, named by
+ * the SPILL field, e.g. "skx.6.0".  See spill.c.
+ *
+ *  If the filesystem was created with --chunk-size the contents are
+ * instead split across keys of that size, which need not all exist;
+ * missing chunks read as zeros:
+ *
+ * SKX:INODE:6:CHUNK:0 => ".."
+ * SKX:INODE:6:CHUNK:1 => ".."
  *
  *  (Here "SKX:" is the key-prefix.  We need to allow this such that
  * more than one filesystem may be mounted against a single redis-server.)
  *
+ *  A filesystem created with "--schema=hash" instead keeps the meta-data
+ * of each entry in a single hash, with the same field names, which saves
+ * memory and lets the attributes be fetched or removed in one step:
+ *
+ * SKX:INODE:6        => { "NAME" => "passwd", "TYPE" => "FILE", .. }
+ *
+ *  The contents remain in the DATA, or CHUNK, keys, and extended
+ * attributes in a hash of their own with either schema:
+ *
+ * SKX:INODE:6:XATTR  => { "user.origin" => "..", .. }
+ *
+ *  The schema in use is recorded in SKX:GLOBAL:SCHEMA, and
+ * redisfs-convert will move an existing filesystem from one schema to
+ * the other.
+ *
+ *  A filesystem made for a Redis Cluster, with --cluster, names the
+ * keys of each inode with a hash tag so that they share a slot, e.g.
+ * "SKX:{INODE:6}:NAME" and "SKX:{INODE:43}:DIRENT".  Chunks aren't
+ * tagged, so the contents of large files are spread across the nodes.
+ *
  *
  * Directories
  *
@@ -59,6 +91,14 @@
  *
  *  SKX:DIRENT:43
  *
+ *  To avoid scanning that set on every lookup each directory also has
+ * a hash mapping the names of its entries to their inodes:
+ *
+ *  SKX:DIRNAME:43     => { "passwd" => "6", "group" => "7" }
+ *
+ *  Directories created before this index existed are migrated the
+ * first time something inside them is looked up.
+ *
  *
  * </overview>
  *
@@ -68,6 +108,7 @@
 
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -80,13 +121,33 @@
 #include <pthread.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/xattr.h>
 #include <netinet/in.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
 
 #include "hiredis.h"
 #include "pathutil.h"
+#include "cache.h"
+#include "scripts.h"
+#include "writeback.h"
+#include "pagecache.h"
+#include "engine.h"
+#include "arena.h"
+#include "codec.h"
+#include "sha256.h"
+#include "cluster.h"
+#include "stats.h"
+#include "backend.h"
+#include "mock.h"
+#include "spill.h"
+#include "times.h"
+#include "nodes.h"
+#include "redisfs.h"
 
 
 
@@ -106,1716 +167,10361 @@ char _g_prefix[10] = { "skx" };
 
 
 /**
- * Mutex for safety.
+ * The number of locks inodes are striped across.
  */
-pthread_mutex_t _g_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_STRIPES 256
+
+/**
+ * Striped locks which protect the read-modify-write sequences used for
+ * a single file, or for the entries of a single directory.
+ */
+pthread_mutex_t _g_stripes[LOCK_STRIPES];
 
 
 /**
  * Handle to the redis server.
+ *
+ * Each thread has its own, which is taken from our pool of connections
+ * at the start of an operation and returned at the end of it.
  */
-redisContext *_g_redis = NULL;
+__thread redisContext *_g_redis = NULL;
 
 
 /**
- * The host and port of the redis server we're connecting to.
+ * The pool of connections, and the number of them which are free.
+ *
+ * Connections are created lazily, so a free slot may hold NULL.
  */
-int _g_redis_port = 6379;
-char _g_redis_host[100] = { "localhost" };
+redisContext **_g_pool = NULL;
+int _g_pool_free = 0;
 
+/**
+ * The number of connections in our pool.
+ */
+int _g_connections = 8;
 
 /**
- * Are we running with --debug in play?
+ * Mutex & condition protecting the pool.
  */
-int _g_debug = 0;
+pthread_mutex_t _g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _g_pool_cond = PTHREAD_COND_INITIALIZER;
 
+/**
+ * Should every thread share a single asynchronous connection, rather
+ * than using the pool?
+ */
+int _g_async = 0;
 
 /**
- * Are we running with --fast in play?
+ * Are we talking to a Redis Cluster?  If so each thread has a set of
+ * connections, to whichever nodes it has needed, in place of a single
+ * connection, and the pool holds those sets instead.
  */
-int _g_fast = 0;
+int _g_cluster_mode = 0;
+__thread cluster *_g_cluster = NULL;
+cluster **_g_cluster_pool = NULL;
 
+/**
+ * Replies read on pooled connections are built in an arena belonging to
+ * the reading thread, which is emptied when the connection is returned
+ * to the pool.  This may be disabled with --no-arena.
+ */
+#define REPLY_ARENA_BLOCK 65536
+__thread arena _g_reply_arena = { NULL, 0 };
+int _g_no_arena = 0;
 
 /**
- * Is our file-system (intentionally) read-only?
+ * Used to release the arena of a thread when it exits.
  */
-int _g_read_only = 0;
+pthread_key_t _g_arena_key;
+pthread_once_t _g_arena_once = PTHREAD_ONCE_INIT;
 
 
+/**
+ * The host and port of the redis server we're connecting to.
+ */
+int _g_redis_port = 6379;
+char _g_redis_host[100] = { "localhost" };
 
 
 /**
- * If our service isn't alive then connect to it.
+ * Replicas of the redis server, which serve operations that only read.
+ *
+ * Each pooled connection is paired with one to a replica, the pairs
+ * being spread between the replicas in turn, and an operation which
+ * only reads uses whichever of the pair it may.
  */
-void
-redis_alive()
+#define MAX_REPLICAS 16
+typedef struct replica
 {
-    struct timeval timeout = { 1, 5000000 };    // 1.5 seconds
-    redisReply *reply = NULL;
+    char host[100];
+    int port;
+} replica;
 
-    /**
-     * If we have a handle see if it is alive.
-     */
-    if (_g_redis != NULL)
-    {
-        reply = redisCommand(_g_redis, "PING");
+replica _g_replicas[MAX_REPLICAS];
+int _g_replica_count = 0;
+redisContext **_g_replica_pool = NULL;
+int *_g_replica_of = NULL;
 
-        if ((reply != NULL) &&
-            (reply->str != NULL) && (strcmp(reply->str, "PONG") == 0))
-        {
-            freeReplyObject(reply);
-            return;
-        }
-        else
-        {
-            if (reply != NULL)
-                freeReplyObject(reply);
-        }
-    }
+/**
+ * The pair of connections held by the current thread, the replica the
+ * second leads to, whether the operation only reads, and whether it is
+ * using the replica - in which case _g_redis is the second of the pair.
+ */
+__thread redisContext *_g_primary = NULL;
+__thread redisContext *_g_replica = NULL;
+__thread int _g_replica_index = 0;
+__thread int _g_reader = 0;
+__thread int _g_reading = 0;
 
-    /**
-     * OK we have no handle, create a connection to the server.
-     */
-    _g_redis = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
-    if (_g_redis == NULL)
-    {
-        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
-                _g_redis_host, _g_redis_port);
-        exit(1);
-    }
-    else
-    {
-        if (_g_debug)
-            fprintf(stderr, "Reconnected to redis server on [%s:%d]\n",
-                    _g_redis_host, _g_redis_port);
-    }
-}
+/**
+ * When an operation which might have changed something last finished.
+ * Reads go to the primary until REPLICA_GUARD milliseconds later, so
+ * that we read our own writes even if the replicas lag behind.
+ */
+#define REPLICA_GUARD 1000
+long long _g_last_write = -REPLICA_GUARD;
 
 
 /**
- * Called when our filesystem is created.
+ * The inode numbers leased from GLOBAL:INODE, INODE_LEASE at a time.
  *
- * Create our mutex, and establish a connection to redis.
+ * The lease is packed into a single word, so that numbers can be handed
+ * out with compare-and-swap: the last number leased is held above the
+ * low INODE_LEASE_BITS bits, which count those handed out so far.  The
+ * lock is only taken to lease more.
  */
-void *
-fs_init()
-{
-    if (_g_debug)
-        fprintf(stderr, "fs_init()\n");
+#define INODE_LEASE 1024
+#define INODE_LEASE_BITS 11
+#define INODE_LEASE_MASK ((1LL << INODE_LEASE_BITS) - 1)
+long long _g_inode_lease = INODE_LEASE;
+pthread_mutex_t _g_inode_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    pthread_mutex_init(&_g_lock, NULL);
 
-    return 0;
-}
+/**
+ * Do we keep statistics, with --stats, and which operations are slow
+ * enough, in milliseconds, to be logged via --stats-slow?
+ */
+int _g_stats = 0;
+double _g_stats_slow = 0;
+
+/**
+ * What the operation running in this thread has asked of the server.
+ */
+__thread stats_usage _g_usage;
 
 
 /**
- * This is called when our filesystem is destroyed.
- *
- * Destroy our mutex.
+ * Do we keep the filesystem in memory, with --backend=mock, rather than
+ * in redis?
  */
-void
-fs_destroy()
-{
-    if (_g_debug)
-        fprintf(stderr, "fs_destroy()\n");
+int _g_mock = 0;
 
-    pthread_mutex_destroy(&_g_lock);
-}
+
+/**
+ * Are we running with --debug in play?
+ */
+int _g_debug = 0;
 
 
 /**
- * Get the next INODE number to be used for a new file/directory.
- *
- * Returns -1 on failure.
+ * Are we running with --fast in play?
  */
-int
-get_next_inode()
-{
-    redisReply *reply = NULL;
-    int val = -1;
+int _g_fast = 0;
 
-    redis_alive();
 
-    reply = redisCommand(_g_redis, "INCR %s:GLOBAL:INODE", _g_prefix);
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
-        val = reply->integer;
-    freeReplyObject(reply);
+/**
+ * Is our file-system (intentionally) read-only?
+ */
+int _g_read_only = 0;
 
-    return (val);
-}
+
+/**
+ * The size of the chunks file contents are stored in, or zero if each
+ * file is stored as a single value.
+ */
+long _g_chunk_size = 0;
 
 
 /**
- * Remove all meta-data associated with an INODE.
+ * The maximum number of chunks we'll delete with a single command.
+ */
+#define CHUNK_BATCH 256
+
+/**
+ * The codec used to compress the chunks of new files, if any, and the
+ * size below which a chunk is stored as-is.
  *
- * e.g. size, owner, mtime, ctime.
+ * Once any mount has compressed files GLOBAL:COMPRESS is set, and the
+ * chunks of every file are then fetched whole, so that they may be
+ * decoded.  The codec of each file is recorded in its CODEC field.
  */
-void
-remove_inode(int inode)
-{
-    redisReply *reply = NULL;
+int _g_compress = CODEC_NONE;
+long _g_compress_min = 512;
+int _g_compressed = 0;
 
-    char *names[] = {
-        "DEL %s:INODE:%d:NAME", /* basename of file/dir */
-        "DEL %s:INODE:%d:TYPE", /* "FILE", "DIR", or "LINK" */
-        "DEL %s:INODE:%d:MODE", /* file mode */
-        "DEL %s:INODE:%d:GID",  /* GID of owner */
-        "DEL %s:INODE:%d:UID",  /* UID of owner */
-        "DEL %s:INODE:%d:ATIME",        /* access-time */
-        "DEL %s:INODE:%d:CTIME",        /* create time */
-        "DEL %s:INODE:%d:MTIME",        /* modification time */
-        "DEL %s:INODE:%d:SIZE", /* size of a file */
-        "DEL %s:INODE:%d:DATA", /* data stored in a file */
-        "DEL %s:INODE:%d:LINK", /* link-count */
-        "DEL %s:INODE:%d:TARGET",       /* destination of symlink */
-        NULL
-    };
+/**
+ * Are the chunks of files stored as blocks named by their digest, and
+ * shared between every file holding the same data?
+ *
+ * Each block lives in BLOCK:<digest>, with a count of the chunks which
+ * use it in BLOCK:<digest>:REFS, and each file maps the index of each
+ * chunk to its digest in the hash INODE:<n>:BLOCKS.  This is chosen
+ * when a new filesystem is first mounted, and recorded in GLOBAL:DEDUP.
+ */
+int _g_dedup = 0;
 
-    int i = 0;
+/**
+ * Are the contents of large files kept on disk, with --spill-dir, and
+ * beyond what size?  A filesystem which has done so records it in
+ * GLOBAL:SPILL, and may only be mounted with a --spill-dir thereafter.
+ */
+#define SPILL_DEFAULT (16 * 1024 * 1024)
+char _g_spill_dir[1024] = { "" };
+long _g_spill_size = SPILL_DEFAULT;
+int _g_spill = 0;
 
+/**
+ * The maximum number of blocks we'll release with a single command.
+ */
+#define BLOCK_BATCH 64
 
-    /**
-     * Can't happen.
-     */
-    if (inode < 0)
-    {
-        fprintf(stderr, "Tried to free an unset inode.\n");
-        return;
-    }
+/**
+ * How far store_blocks() has got with each chunk: it holds a reference
+ * to the new block, or has asked whether it is stored.
+ */
+#define BLOCK_HELD    1
+#define BLOCK_CHECKED 2
 
-    redis_alive();
+/**
+ * A chunk of a file which is about to be stored as a block: its index,
+ * contents, & new digest, along with the digest of the block it
+ * replaces, if any.
+ */
+typedef struct block_chunk
+{
+    long idx;
+    char *data;
+    size_t len;
+    const char *old;
+    char digest[SHA256_HEX_LEN + 1];
+} block_chunk;
 
-    /**
-     * append the deletion commands, in a batch.
-     */
-    while (names[i] != NULL)
-    {
-        redisAppendCommand(_g_redis, names[i], _g_prefix, inode);
-        i += 1;
-    }
 
-    /**
-     * Fetch the results back.
-     */
-    i = 0;
-    while (names[i] != NULL)
-    {
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
-        i += 1;
-    }
-}
+/**
+ * The schemas in which the meta-data of an inode may be stored: either
+ * a key per field, or a single hash.
+ */
+#define SCHEMA_KEYS 0
+#define SCHEMA_HASH 1
 
+/**
+ * The schema used by this filesystem.
+ */
+int _g_schema = SCHEMA_KEYS;
 
 /**
- * Find the inode for a filesystem entry, by path.
+ * Are the keys of each inode named with a hash tag, "{INODE:<n>}", so
+ * that a Redis Cluster keeps them all in a single slot?  The chunks of
+ * files are never tagged, so that large files are spread across the
+ * cluster.  This is chosen when a new filesystem is first mounted with
+ * --cluster, and recorded in GLOBAL:HASHTAGS.
  */
-int
-find_inode(const char *path)
-{
-    int val = -1;
-    int parent_inode = 0;
-    char *parent;
-    char *entry;
-    redisReply *reply = NULL;
+int _g_tags = 0;
 
-    if (_g_debug)
-        fprintf(stderr, "find_inode(%s)\n", path);
+/**
+ * The buffers in which each thread builds key names.
+ */
+#define KEY_BUFFERS 8
+#define KEY_LENGTH 128
+__thread char _g_key_buffers[KEY_BUFFERS][KEY_LENGTH];
+__thread int _g_key_next = 0;
 
-    /**
-     * Special Case "/" is 99.
-     */
-    if ((strcmp(path, "/") == 0) && strlen(path) == 1)
-        return -99;
+/**
+ * The meta-data fields, in the order fill_stat() expects them.
+ */
+#define STAT_FIELDS "TYPE MODE SIZE UID GID LINK ATIME MTIME CTIME"
 
-    redis_alive();
 
-  /**
-   * OK we have a directory entry.
-   *
-   * We need to find the entries in the parent directory
-   * and then we can lookup the entry itself.
-   */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
-    entry = get_basename(path);
+/**
+ * Does the server support SSCAN?  If so directories are read in batches
+ * of roughly this many entries.
+ */
+int _g_sscan = 0;
 
 
-  /**
-   * For each entry in the set we need to add the name.
-   */
-    reply =
-        redisCommand(_g_redis, "SMEMBERS %s:DIRENT:%d", _g_prefix,
-                     parent_inode);
+/**
+ * The keys of an inode, with a key per field.
+ */
+char *_g_fields[] = {
+    "NAME",                     /* basename of file/dir */
+    "TYPE",                     /* "FILE", "DIR", or "LINK" */
+    "MODE",                     /* file mode */
+    "GID",                      /* GID of owner */
+    "UID",                      /* UID of owner */
+    "ATIME",                    /* access-time */
+    "CTIME",                    /* create time */
+    "MTIME",                    /* modification time */
+    "SIZE",                     /* size of a file */
+    "LINK",                     /* link-count */
+    "TARGET",                   /* destination of symlink */
+    "GEN",                      /* generation of the last change */
+    "CODEC",                    /* compression of the contents */
+    "SPILL",                    /* file holding the contents, on disk */
+    NULL
+};
 
-    char *memcommand = malloc(1048576);
-    sprintf(memcommand, "MGET");
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
-    {
-        int i;
-        for (i = 0; i < reply->elements; i++)
-        {
-            sprintf(memcommand + strlen(memcommand), " %s:INODE:%s:NAME",
-                    _g_prefix, reply->element[i]->str);
-        }
-        redisReply *r = NULL;
-        r = redisCommand(_g_redis, memcommand);
-        for (i = 0; i < reply->elements; i++)
-        {
-            if ((r->element[i] != NULL)
-                && (strcmp(r->element[i]->str, entry) == 0))
-            {
-                val = atoi(reply->element[i]->str);
-            }
-        }
-        freeReplyObject(r);
-    }
 
-    freeReplyObject(reply);
+/**
+ * Copy-on-write snapshots.
+ *
+ * GLOBAL:GENERATION counts the snapshots taken of the live filesystem,
+ * and the GEN field of each inode records the generation in which it
+ * last changed.  The first change to an inode after a snapshot copies
+ * its keys beneath "prefix:VERSION:<n>", where n is the generation the
+ * snapshot captured, and adds n to the sorted set INODE:<inode>:VERSIONS.
+ *
+ * A snapshot is mounted by its own prefix, which holds the prefix of
+ * the live filesystem in GLOBAL:PARENT and the generation it captured
+ * in GLOBAL:SNAPSHOT.  Each inode is read from the oldest version
+ * preserved at, or after, that generation - or the live keys if it has
+ * not changed since.
+ */
+long long _g_snapshot = -1;
 
-    free(memcommand);
-    free(parent);
-    free(entry);
+/**
+ * The generation of the live filesystem, and when we last read it.  A
+ * new snapshot is noticed within COW_REFRESH milliseconds.
+ */
+#define COW_REFRESH 1000
+long long _g_generation = 0;
+long long _g_generation_read = -COW_REFRESH;
 
-    if (_g_debug)
-        fprintf(stderr, "find_inode(%s) -> %d\n", path, val);
+/**
+ * What we know about the versions of recently used inodes: on the live
+ * filesystem the generation each has been preserved for, and on a
+ * snapshot the version each is read from (-1 for the live keys).
+ */
+#define COW_SLOTS 4096
+typedef struct cow_slot
+{
+    long long inode;
+    long long generation;
+    long long expires;
+} cow_slot;
 
-    return (val);
-}
+cow_slot _g_cow_slots[COW_SLOTS];
 
+/**
+ * The number of keys we copy with a single pipeline.
+ */
+#define COW_BATCH 64
 
 /**
- * Is the given "thing" a directory?
+ * The prefixes of the versions we've seen, the number of times a live
+ * inode has been forgotten, and the mutex protecting all of the above.
  */
-int
-is_directory(const char *path)
+typedef struct cow_prefix
 {
-    int ret = 0;
-    redisReply *reply = NULL;
+    long long generation;
+    char *prefix;
+    struct cow_prefix *next;
+} cow_prefix;
 
-    if (_g_debug)
-        fprintf(stderr, "is_directory(%s)\n", path);
+cow_prefix *_g_cow_prefixes = NULL;
+long long _g_cow_forgotten = 0;
+pthread_mutex_t _g_cow_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    redis_alive();
+/**
+ * The free connections used to find versions on a snapshot, or sets of
+ * them on a cluster, which must not disturb whatever the calling thread
+ * has pipelined.  A lookup takes one for itself, so that it never waits
+ * on the round trip of another, and more are made when none is free.
+ */
+#define COW_CONNECTIONS 16
+redisContext *_g_cow_redis[COW_CONNECTIONS];
+cluster *_g_cow_cluster[COW_CONNECTIONS];
+int _g_cow_free = 0;
+pthread_mutex_t _g_cow_pool_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  /**
-   * Find the inode.
-   */
-    int inode = find_inode(path);
-    if (inode == -1)
-        return -1;
+/**
+ * Serialise the preservation of each inode.
+ */
+pthread_mutex_t _g_cow_stripes[LOCK_STRIPES];
+#define DIRENT_BATCH 256
 
-    reply = redisCommand(_g_redis, "GET %s:INODE:%d:TYPE", _g_prefix, inode);
+/**
+ * The offsets we give to readdir() entries.
+ *
+ * Each offset names the entry which follows: 1 is "..", and the others
+ * record the SSCAN cursor of a batch and a position within it, so that
+ * a listing can be resumed wherever the kernel left off.
+ */
+#define READDIR_OFFSET(cursor, idx) ((off_t)(((cursor) + 1) << 20) | (idx))
+#define READDIR_CURSOR(offset) ((unsigned long long)((offset) >> 20) - 1)
+#define READDIR_INDEX(offset) ((int)((offset) & 0xfffff))
+#define READDIR_END ((off_t)0x7fffffffffffffffLL)
 
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING)
-        && (strcmp(reply->str, "DIR") == 0))
-        ret = 1;
 
-    freeReplyObject(reply);
+/**
+ * Are the server-side scripts available, and if so what are their
+ * SHA1 digests?
+ */
+int _g_scripts = 0;
+char _g_script_sha[SCRIPT_COUNT][41];
 
-    return (ret);
-}
+/**
+ * Should we avoid using scripts, even if the server supports them?
+ */
+int _g_no_scripts = 0;
+
+
+/**
+ * The size of the write buffer given to each open file, or zero to
+ * write through, and the number of milliseconds data may wait in one.
+ */
+long _g_write_buffer = 0;
+long _g_write_delay = 1000;
+
+/**
+ * How the access times of files are kept: always, only when they would
+ * otherwise be older than the modification time or a day old, or never.
+ */
+#define ATIME_STRICT   0
+#define ATIME_RELATIVE 1
+#define ATIME_NEVER    2
+int _g_atime = ATIME_STRICT;
+
+/**
+ * The number of milliseconds new timestamps may wait before they are
+ * written, or zero to write them as they change.
+ */
+long _g_time_delay = 0;
+
+/**
+ * Held while timestamps are being written out, so that they can't land
+ * upon an inode as it is removed.
+ */
+pthread_mutex_t _g_times_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Directories removed along with everything beneath them are detached
+ * at once, and recorded in GLOBAL:RECLAIM until a background thread has
+ * freed their contents.  It is woken when there is more to do.
+ */
+pthread_mutex_t _g_reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _g_reclaim_wake = PTHREAD_COND_INITIALIZER;
+int _g_reclaim_wanted = 0;
+
+/**
+ * The command used to free what is reclaimed: UNLINK, which frees the
+ * memory in the background of the server, if it has it, else DEL.
+ */
+const char *_g_unlink = "UNLINK";
+
+/**
+ * The extended attribute which, when set upon a directory, removes it
+ * and everything beneath it.
+ */
+#define RMTREE_XATTR "user.redisfs.rmtree"
+
+/**
+ * The extended attributes beginning with this are ours, describing how
+ * each inode is stored, rather than any kept for it.
+ */
+#define VIRTUAL_XATTRS "user.redisfs."
+
+/**
+ * The thread freeing the directories in GLOBAL:RECLAIM, defined below.
+ */
+void *reclaimer(void *arg);
+
+/**
+ * Invoke one of our scripts with the given arguments, defined below.
+ */
+redisReply *run_script_argv(int which, int argc, const char **args);
+
+/**
+ * The most we'll read ahead of a sequential reader, and the size of the
+ * cache holding what we've read, in bytes.  Both are zero by default.
+ */
+long _g_readahead = 0;
+long _g_read_cache = 0;
+
+/**
+ * The size of the pages in the read cache.
+ */
+#define READ_PAGE_SIZE 65536
+
+/**
+ * The read cache used when --readahead is given without --read-cache.
+ */
+#define READ_CACHE_DEFAULT (64 * 1024 * 1024)
+
+/**
+ * A file which is open, with its write buffer and the state used to
+ * detect sequential reads.
+ *
+ * A pointer to this is stored in the "fh" member of the fuse_file_info
+ * structure, and every open file is also kept on a list so that data
+ * can be flushed when it has waited too long, or when the file is read
+ * or truncated via another handle.
+ */
+typedef struct open_file
+{
+    long long inode;
+    write_buffer wb;
+    off_t next_read;            /* where a sequential read would start */
+    size_t window;              /* how far ahead we're reading */
+    long prefetched;            /* the page we've fetched up to */
+    unsigned long hits;         /* pages found in the read cache */
+    unsigned long misses;       /* pages which weren't */
+    pthread_mutex_t lock;
+    struct open_file *next;
+} open_file;
+
+/**
+ * The list of open files, and the lock protecting it.
+ *
+ * Whenever both are needed this lock is taken before the lock of any
+ * open file.
+ */
+open_file *_g_open_files = NULL;
+pthread_mutex_t _g_open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * How long do we cache lookups & attributes for, in milliseconds?
+ */
+long _g_cache_ttl = 0;
+
+
+/**
+ * Ranges waiting to be read ahead, by the prefetch thread.
+ */
+#define PREFETCH_QUEUE 64
+
+typedef struct prefetch_request
+{
+    long long inode;
+    long first;
+    long count;
+} prefetch_request;
+
+prefetch_request _g_prefetch[PREFETCH_QUEUE];
+int _g_prefetch_head = 0;
+int _g_prefetch_count = 0;
+pthread_mutex_t _g_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _g_prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * Do we listen for keyspace notifications to keep our cache coherent
+ * with other mounts of the same prefix?
+ */
+int _g_cache_notify = 0;
+
+
+/**
+ * How long may the kernel keep the lookups, attributes and pages we've
+ * given it?
+ *
+ *  COHERENCE_DEFAULT leaves FUSE's own timeouts of one second.
+ *  COHERENCE_STRICT hands every lookup to us, so that the changes of
+ * other mounts are seen as soon as our own cache sees them.
+ *  COHERENCE_RELAXED lets the kernel keep what we give it for as long as
+ * our own cache would, and keep pages between opens unless the size or
+ * mtime of the file changed.
+ *  COHERENCE_READONLY is for a read-only mount of a tree which nothing
+ * changes, such as a snapshot: the kernel keeps everything for an hour.
+ */
+#define COHERENCE_DEFAULT  0
+#define COHERENCE_STRICT   1
+#define COHERENCE_RELAXED  2
+#define COHERENCE_READONLY 3
+
+int _g_coherence = COHERENCE_DEFAULT;
+
+
+/**
+ * The largest read and write the kernel sends us at once, and how long
+ * COHERENCE_READONLY lets it cache everything, in seconds.
+ */
+#define KERNEL_IO_SIZE (128 * 1024)
+#define KERNEL_READONLY_TTL 3600
+
+
+/**
+ * Are we driven by the low-level API of FUSE, with --lowlevel?
+ */
+int _g_lowlevel = 0;
+
+
+/**
+ * The owner of the request this thread is serving, when we're driven by
+ * the low-level API, which leaves the context of FUSE empty.
+ */
+__thread int _g_caller_known = 0;
+__thread uid_t _g_caller_uid = 0;
+__thread gid_t _g_caller_gid = 0;
+
+
+
+/**
+ * The user, and group, on whose behalf we're creating something.
+ */
+uid_t
+caller_uid()
+{
+    return (_g_caller_known ? _g_caller_uid : fuse_get_context()->uid);
+}
+
+gid_t
+caller_gid()
+{
+    return (_g_caller_known ? _g_caller_gid : fuse_get_context()->gid);
+}
+
+
+
+
+/**
+ * Free the arena of a thread which is exiting.
+ */
+void
+arena_destroy(void *ptr)
+{
+    arena_free((arena *) ptr);
+}
+
+void
+arena_key_create()
+{
+    pthread_key_create(&_g_arena_key, arena_destroy);
+}
+
+
+/**
+ * The arena of the current thread, which is setup on first use.
+ */
+arena *
+reply_arena()
+{
+    if (_g_reply_arena.block_size == 0)
+    {
+        arena_init(&_g_reply_arena, REPLY_ARENA_BLOCK);
+        pthread_once(&_g_arena_once, arena_key_create);
+        pthread_setspecific(_g_arena_key, &_g_reply_arena);
+    }
+    return (&_g_reply_arena);
+}
+
+
+/**
+ * Allocate a reply object from the arena of the current thread, and
+ * link it into the array which contains it, if any.
+ */
+redisReply *
+arena_reply(const redisReadTask * task, int type, size_t extra)
+{
+    redisReply *r = arena_alloc(reply_arena(), sizeof(redisReply) + extra);
+
+    if (r == NULL)
+    {
+        fprintf(stderr, "Out of memory reading a reply from redis.\n");
+        exit(1);
+    }
+    r->type = type;
+
+    if (task->parent)
+    {
+        redisReply *parent = task->parent->obj;
+        parent->element[task->idx] = r;
+    }
+    return (r);
+}
+
+
+/**
+ * The functions hiredis uses to build replies, mirroring its own.
+ *
+ * Strings and arrays live in the same allocation as their reply, and
+ * nothing is freed individually.
+ */
+void *
+arena_string(const redisReadTask * task, char *str, size_t len)
+{
+    redisReply *r = arena_reply(task, task->type, len + 1);
+
+    r->str = (char *)(r + 1);
+    r->len = len;
+    memcpy(r->str, str, len);
+    r->str[len] = '\0';
+    return (r);
+}
+
+void *
+arena_array(const redisReadTask * task, int elements)
+{
+    redisReply *r =
+        arena_reply(task, REDIS_REPLY_ARRAY, sizeof(redisReply *) * elements);
+
+    r->elements = elements;
+    r->element = (redisReply **) (r + 1);
+    memset(r->element, 0, sizeof(redisReply *) * elements);
+    return (r);
+}
+
+void *
+arena_integer(const redisReadTask * task, long long value)
+{
+    redisReply *r = arena_reply(task, REDIS_REPLY_INTEGER, 0);
+
+    r->integer = value;
+    return (r);
+}
+
+void *
+arena_nil(const redisReadTask * task)
+{
+    return (arena_reply(task, REDIS_REPLY_NIL, 0));
+}
+
+void
+arena_free_reply(void *reply)
+{
+}
+
+redisReplyObjectFunctions _g_arena_functions = {
+    arena_string,
+    arena_array,
+    arena_integer,
+    arena_nil,
+    arena_free_reply
+};
+
+
+/**
+ * The current (monotonic) time in milliseconds.
+ */
+long long
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * Free a reply, whether it came from the arena or not.
+ */
+void
+redis_free_reply(redisReply * reply)
+{
+    if (reply == NULL)
+        return;
+
+    if (arena_owns(&_g_reply_arena, reply))
+        return;
+
+    freeReplyObject(reply);
+}
+
+void
+cluster_free_reply(void *reply)
+{
+    redis_free_reply(reply);
+}
+
+
+/**
+ * Connect to the given server, returning NULL on failure.
+ */
+redisContext *
+redis_connect(const char *host, int port, struct timeval timeout)
+{
+    redisContext *c = redisConnectWithTimeout(host, port, timeout);
+
+    if ((c == NULL) || (c->err))
+    {
+        if (c != NULL)
+            redisFree(c);
+        return NULL;
+    }
+
+    if (_g_debug)
+        fprintf(stderr, "Reconnected to redis server on [%s:%d]\n", host,
+                port);
+
+    if (!_g_no_arena)
+        redisSetReplyObjectFunctions(c, &_g_arena_functions);
+
+    return (c);
+}
+
+
+/**
+ * If our service isn't alive then connect to it.
+ *
+ * hiredis records any I/O or protocol failure in the context, so we
+ * only need to reconnect if that has happened - there is no need to
+ * PING the server before every operation.
+ */
+void
+redis_alive()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+
+    /**
+     * The engine reconnects by itself, and a backend needs no connection.
+     */
+    if (engine_running() || backend_running())
+        return;
+
+    /**
+     * The connections to the nodes of a cluster are made as they're
+     * needed, so we only start again if one of them has failed.
+     */
+    if (_g_cluster_mode)
+    {
+        if ((_g_cluster != NULL) && !cluster_failed(_g_cluster))
+            return;
+
+        if (_g_cluster != NULL)
+        {
+            if (_g_debug)
+                fprintf(stderr, "Lost connection to the redis cluster.\n");
+            cluster_free(_g_cluster);
+        }
+
+        _g_cluster = cluster_new(_g_no_arena ? NULL : &_g_arena_functions,
+                                 cluster_free_reply);
+        if (_g_cluster == NULL)
+        {
+            fprintf(stderr, "Failed to allocate cluster connections.\n");
+            exit(1);
+        }
+        return;
+    }
+
+    if ((_g_redis != NULL) && (_g_redis->err == 0))
+        return;
+
+    if (_g_redis != NULL)
+    {
+        if (_g_debug)
+            fprintf(stderr, "Lost connection to redis: %s\n",
+                    _g_redis->errstr);
+        redisFree(_g_redis);
+        _g_redis = NULL;
+    }
+
+    /**
+     * A replica we can't reach is passed over, for the primary.
+     */
+    if (_g_reading)
+    {
+        replica *r = &_g_replicas[_g_replica_index];
+
+        _g_replica = _g_redis = redis_connect(r->host, r->port, timeout);
+        if (_g_redis != NULL)
+            return;
+
+        fprintf(stderr, "Failed to connect to the replica on [%s:%d].\n",
+                r->host, r->port);
+
+        _g_reading = 0;
+        _g_redis = _g_primary;
+        if ((_g_redis != NULL) && (_g_redis->err == 0))
+            return;
+        if (_g_redis != NULL)
+            redisFree(_g_redis);
+    }
+
+    /**
+     * OK we have no handle, create a connection to the server.
+     */
+    _g_primary = _g_redis = redis_connect(_g_redis_host, _g_redis_port,
+                                          timeout);
+    if (_g_redis == NULL)
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        exit(1);
+    }
+}
+
+
+/**
+ * Create our (empty) pool of connections, and our stripe locks.
+ */
+void
+pool_init()
+{
+    int i;
+
+    if (_g_connections < 1)
+        _g_connections = 1;
+
+    _g_pool = calloc(_g_connections, sizeof(redisContext *));
+    if (_g_pool == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the connection pool.\n");
+        exit(1);
+    }
+    _g_pool_free = _g_connections;
+
+    if (_g_cluster_mode)
+    {
+        _g_cluster_pool = calloc(_g_connections, sizeof(cluster *));
+        if (_g_cluster_pool == NULL)
+        {
+            fprintf(stderr, "Failed to allocate the connection pool.\n");
+            exit(1);
+        }
+    }
+
+    if (_g_replica_count > 0)
+    {
+        _g_replica_pool = calloc(_g_connections, sizeof(redisContext *));
+        _g_replica_of = calloc(_g_connections, sizeof(int));
+        if ((_g_replica_pool == NULL) || (_g_replica_of == NULL))
+        {
+            fprintf(stderr, "Failed to allocate the connection pool.\n");
+            exit(1);
+        }
+
+        for (i = 0; i < _g_connections; i++)
+            _g_replica_of[i] = i % _g_replica_count;
+    }
+
+    for (i = 0; i < LOCK_STRIPES; i++)
+    {
+        pthread_mutex_init(&_g_stripes[i], NULL);
+        pthread_mutex_init(&_g_cow_stripes[i], NULL);
+    }
+}
+
+
+/**
+ * Take a connection from the pool for the current thread, waiting
+ * until one is free, and use either the primary or its replica.
+ */
+void
+pool_take(int reader)
+{
+    long long last;
+
+    if (engine_running() || backend_running())
+        return;
+
+    pthread_mutex_lock(&_g_pool_lock);
+
+    while (_g_pool_free == 0)
+        pthread_cond_wait(&_g_pool_cond, &_g_pool_lock);
+
+    _g_pool_free -= 1;
+    _g_redis = _g_pool[_g_pool_free];
+    if (_g_cluster_pool != NULL)
+        _g_cluster = _g_cluster_pool[_g_pool_free];
+
+    _g_primary = _g_redis;
+    if (_g_replica_pool != NULL)
+    {
+        _g_replica = _g_replica_pool[_g_pool_free];
+        _g_replica_index = _g_replica_of[_g_pool_free];
+    }
+
+    last = _g_last_write;
+
+    pthread_mutex_unlock(&_g_pool_lock);
+
+    /**
+     * Reads only go to a replica if nothing we've written recently may
+     * be missing there.  Buffered writes may be flushed by a read, so
+     * those must go to the primary too.
+     */
+    _g_reader = reader;
+    _g_reading = reader && (_g_replica_pool != NULL) &&
+        (_g_read_only || (_g_write_buffer <= 0)) &&
+        (now_ms() - last >= REPLICA_GUARD);
+    if (_g_reading)
+        _g_redis = _g_replica;
+
+    redis_alive();
+}
+
+
+/**
+ * Take a connection from the pool, for an operation which may change
+ * something.
+ */
+void
+redis_acquire()
+{
+    pool_take(0);
+}
+
+
+/**
+ * Take a connection from the pool, for an operation which only reads,
+ * and which may therefore be served by a replica.
+ */
+void
+redis_acquire_reader()
+{
+    pool_take(1);
+}
+
+
+/**
+ * Move the current operation from its replica to the primary, before
+ * it writes anything.
+ */
+void
+redis_use_primary()
+{
+    if (!_g_reading)
+        return;
+
+    _g_replica = _g_redis;
+    _g_reading = 0;
+    _g_reader = 0;
+    _g_redis = _g_primary;
+
+    redis_alive();
+}
+
+
+/**
+ * Return the connection of the current thread to the pool.
+ */
+void
+redis_release()
+{
+    if (engine_running() || backend_running())
+        return;
+
+    if (_g_reading)
+        _g_replica = _g_redis;
+    else
+        _g_primary = _g_redis;
+
+    pthread_mutex_lock(&_g_pool_lock);
+
+    _g_pool[_g_pool_free] = _g_primary;
+    if (_g_cluster_pool != NULL)
+        _g_cluster_pool[_g_pool_free] = _g_cluster;
+    if (_g_replica_pool != NULL)
+    {
+        _g_replica_pool[_g_pool_free] = _g_replica;
+        _g_replica_of[_g_pool_free] = _g_replica_index;
+        if (!_g_reader)
+            _g_last_write = now_ms();
+    }
+    _g_pool_free += 1;
+    _g_redis = NULL;
+    _g_cluster = NULL;
+    _g_primary = NULL;
+    _g_replica = NULL;
+
+    pthread_cond_signal(&_g_pool_cond);
+    pthread_mutex_unlock(&_g_pool_lock);
+
+    /**
+     * Every reply read during this operation is released together.
+     */
+    arena_reset(&_g_reply_arena);
+}
+
+
+/**
+ * The number of decimal digits of a length.
+ */
+size_t
+digits(size_t n)
+{
+    size_t d = 1;
+
+    while (n >= 10)
+    {
+        n /= 10;
+        d += 1;
+    }
+
+    return (d);
+}
+
+
+/**
+ * Note a command given as a vector of arguments being queued.
+ */
+void
+usage_append_argv(int argc, const char **argv, const size_t * argvlen)
+{
+    size_t bytes = 3 + digits(argc);
+    int i;
+
+    for (i = 0; i < argc; i++)
+    {
+        size_t len = argvlen ? argvlen[i] : strlen(argv[i]);
+        bytes += len + digits(len) + 5;
+    }
+
+    stats_sent(&_g_usage, bytes, argv[0],
+               argvlen ? argvlen[0] : strlen(argv[0]));
+}
+
+
+/**
+ * The size a reply had upon the wire.
+ */
+size_t
+reply_size(redisReply * reply)
+{
+    size_t size;
+    size_t i;
+
+    if (reply == NULL)
+        return 0;
+
+    switch (reply->type)
+    {
+    case REDIS_REPLY_STRING:
+        return (reply->len + digits(reply->len) + 5);
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        return (reply->len + 3);
+    case REDIS_REPLY_INTEGER:
+        return (digits((reply->integer < 0) ? -reply->integer :
+                       reply->integer) + 3);
+    case REDIS_REPLY_ARRAY:
+        size = digits(reply->elements) + 3;
+        for (i = 0; i < reply->elements; i++)
+            size += reply_size(reply->element[i]);
+        return (size);
+    default:
+        return 5;
+    }
+}
+
+
+/**
+ * Queue a command, on the connection of the current thread, on the
+ * nodes of a cluster, via the engine, or for a backend.
+ *
+ * These wrap the hiredis functions of the same shape, and every command
+ * we send goes through them.
+ */
+int
+redis_vappend(const char *fmt, va_list ap)
+{
+    char *cmd = NULL;
+    size_t sent = 0;
+    int len;
+    int ret;
+
+    /**
+     * Commands are formatted once, here, so that their size is known
+     * for our statistics; the engine formats its own.
+     */
+    if (engine_running() && !backend_running())
+    {
+        ret = engine_vappend(fmt, ap, &sent);
+    }
+    else
+    {
+        len = redisvFormatCommand(&cmd, fmt, ap);
+        if (len < 0)
+            return REDIS_ERR;
+
+        sent = len;
+
+        if (backend_running())
+        {
+            ret = backend_append(cmd, len);
+        }
+        else if (_g_cluster != NULL)
+        {
+            ret = cluster_append_formatted(_g_cluster, cmd, len);
+            cmd = NULL;
+        }
+        else
+        {
+            __redisAppendCommand(_g_redis, cmd, len);
+            ret = (_g_redis->err == 0) ? REDIS_OK : REDIS_ERR;
+        }
+
+        free(cmd);
+    }
+
+    if (stats_enabled())
+        stats_sent(&_g_usage, sent, fmt, strcspn(fmt, " "));
+
+    return (ret);
+}
+
+int
+redis_append(const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = redis_vappend(fmt, ap);
+    va_end(ap);
+
+    return (ret);
+}
+
+int
+redis_append_argv(int argc, const char **argv, const size_t * argvlen)
+{
+    if (stats_enabled())
+        usage_append_argv(argc, argv, argvlen);
+
+    if (backend_running())
+        return (backend_append_argv(argc, argv, argvlen));
+
+    if (engine_running())
+        return (engine_append_argv(argc, argv, argvlen));
+
+    if (_g_cluster != NULL)
+        return (cluster_append_argv(_g_cluster, argc, argv, argvlen));
+
+    redisAppendCommandArgv(_g_redis, argc, argv, argvlen);
+    return ((_g_redis->err == 0) ? REDIS_OK : REDIS_ERR);
+}
+
+
+/**
+ * Queue a command given as a vector of arguments, any large ones of
+ * which are sent straight from the caller's memory rather than copied.
+ * They must stay untouched until the reply has been read.
+ */
+int
+redis_append_argv_ref(int argc, const char **argv, const size_t * argvlen)
+{
+    if (stats_enabled())
+        usage_append_argv(argc, argv, argvlen);
+
+    if (backend_running())
+        return (backend_append_argv(argc, argv, argvlen));
+
+    if (engine_running())
+        return (engine_append_argv(argc, argv, argvlen));
+
+    if (_g_cluster != NULL)
+        return (cluster_append_argv(_g_cluster, argc, argv, argvlen));
+
+    redisAppendCommandArgvRef(_g_redis, argc, argv, argvlen);
+    return ((_g_redis->err == 0) ? REDIS_OK : REDIS_ERR);
+}
+
+
+/**
+ * Read the reply to the oldest command we've queued.
+ */
+int
+redis_get_reply(redisReply ** reply)
+{
+    int ret;
+
+    if (backend_running())
+        ret = backend_get_reply((void **)reply);
+    else if (engine_running())
+        ret = engine_get_reply((void **)reply);
+    else if (_g_cluster != NULL)
+        ret = cluster_get_reply(_g_cluster, (void **)reply);
+    else
+        ret = redisGetReply(_g_redis, (void **)reply);
+
+    if (stats_enabled())
+        stats_received(&_g_usage, reply_size(*reply));
+
+    return (ret);
+}
+
+
+/**
+ * Send a command and wait for its reply.
+ */
+redisReply *
+redis_vcommand(const char *fmt, va_list ap)
+{
+    redisReply *reply = NULL;
+
+    if (redis_vappend(fmt, ap) == REDIS_OK)
+        redis_get_reply(&reply);
+    else if (engine_running())
+        engine_get_reply((void **)&reply);
+
+    return (reply);
+}
+
+redisReply *
+redis_command(const char *fmt, ...)
+{
+    redisReply *reply = NULL;
+    va_list ap;
+
+    va_start(ap, fmt);
+    reply = redis_vcommand(fmt, ap);
+    va_end(ap);
+
+    return (reply);
+}
+
+redisReply *
+redis_command_argv(int argc, const char **argv, const size_t * argvlen)
+{
+    redisReply *reply = NULL;
+
+    if (redis_append_argv(argc, argv, argvlen) == REDIS_OK)
+        redis_get_reply(&reply);
+    else if (engine_running())
+        engine_get_reply((void **)&reply);
+
+    return (reply);
+}
+
+
+/**
+ * Lock the stripe which protects the given inode.
+ */
+void
+lock_inode(long long inode)
+{
+    pthread_mutex_lock(&_g_stripes[(unsigned int)inode % LOCK_STRIPES]);
+}
+
+
+/**
+ * Unlock the stripe which protects the given inode.
+ */
+void
+unlock_inode(long long inode)
+{
+    pthread_mutex_unlock(&_g_stripes[(unsigned int)inode % LOCK_STRIPES]);
+}
+
+
+/**
+ * Lock the stripes protecting two inodes, always in the same order so
+ * that two threads can't deadlock.
+ */
+void
+lock_inodes(long long a, long long b)
+{
+    unsigned int sa = (unsigned int)a % LOCK_STRIPES;
+    unsigned int sb = (unsigned int)b % LOCK_STRIPES;
+
+    if (sa == sb)
+    {
+        pthread_mutex_lock(&_g_stripes[sa]);
+        return;
+    }
+
+    pthread_mutex_lock(&_g_stripes[(sa < sb) ? sa : sb]);
+    pthread_mutex_lock(&_g_stripes[(sa < sb) ? sb : sa]);
+}
+
+
+/**
+ * Unlock the stripes locked by lock_inodes().
+ */
+void
+unlock_inodes(long long a, long long b)
+{
+    unsigned int sa = (unsigned int)a % LOCK_STRIPES;
+    unsigned int sb = (unsigned int)b % LOCK_STRIPES;
+
+    pthread_mutex_unlock(&_g_stripes[sa]);
+    if (sa != sb)
+        pthread_mutex_unlock(&_g_stripes[sb]);
+}
+
+
+/**
+ * One of the buffers used to build key names, which belong to the
+ * calling thread and are reused in turn.
+ */
+char *
+key_buffer()
+{
+    char *buf = _g_key_buffers[_g_key_next];
+
+    _g_key_next = (_g_key_next + 1) % KEY_BUFFERS;
+    return (buf);
+}
+
+
+/**
+ * The name of the keys of the given inode beneath the given prefix, or
+ * relative to it if that is NULL: "prefix:INODE:<n>", or with hash
+ * tags "prefix:{INODE:<n>}".
+ *
+ * The result is only valid until a few more names have been built.
+ */
+const char *
+inode_key(const char *prefix, long long inode)
+{
+    char *buf = key_buffer();
+
+    snprintf(buf, KEY_LENGTH, _g_tags ? "%s%s{INODE:%lld}" : "%s%sINODE:%lld",
+             prefix ? prefix : "", prefix ? ":" : "", inode);
+    return (buf);
+}
+
+
+/**
+ * The name of the DIRENT set, or DIRNAME hash, of the given directory:
+ * "prefix:DIRENT:<n>", or with hash tags "prefix:{INODE:<n>}:DIRENT" so
+ * that it lives in the same slot as the directory itself.
+ */
+const char *
+dir_key(const char *prefix, const char *kind, long long inode)
+{
+    char *buf = key_buffer();
+
+    if (_g_tags)
+        snprintf(buf, KEY_LENGTH, "%s%s{INODE:%lld}:%s", prefix ? prefix : "",
+                 prefix ? ":" : "", inode, kind);
+    else
+        snprintf(buf, KEY_LENGTH, "%s%s%s:%lld", prefix ? prefix : "",
+                 prefix ? ":" : "", kind, inode);
+    return (buf);
+}
+
+
+/**
+ * The prefix of the keys of the given version, which lives as long as
+ * we do.  Must be called with _g_cow_lock held.
+ */
+const char *
+version_prefix(long long generation)
+{
+    cow_prefix *v;
+    char buf[64];
+
+    for (v = _g_cow_prefixes; v != NULL; v = v->next)
+    {
+        if (v->generation == generation)
+            return (v->prefix);
+    }
+
+    v = malloc(sizeof(cow_prefix));
+    snprintf(buf, sizeof(buf), "%s:VERSION:%lld", _g_prefix, generation);
+    if ((v == NULL) || ((v->prefix = strdup(buf)) == NULL))
+    {
+        fprintf(stderr, "Out of memory finding a snapshot version.\n");
+        exit(1);
+    }
+
+    v->generation = generation;
+    v->next = _g_cow_prefixes;
+    _g_cow_prefixes = v;
+
+    return (v->prefix);
+}
+
+
+/**
+ * Ask which version of the given inode a snapshot reads, on one of the
+ * connections kept for that.  Nothing may be held while we wait.
+ *
+ * Returns the generation of the version, -1 for the live keys, or -2 if
+ * we couldn't ask.
+ */
+long long
+find_version(long long inode)
+{
+    redisContext *c = NULL;
+    cluster *cc = NULL;
+    redisReply *reply = NULL;
+    long long version = -2;
+
+    pthread_mutex_lock(&_g_cow_pool_lock);
+    if (_g_cow_free > 0)
+    {
+        _g_cow_free -= 1;
+        c = _g_cow_redis[_g_cow_free];
+        cc = _g_cow_cluster[_g_cow_free];
+    }
+    pthread_mutex_unlock(&_g_cow_pool_lock);
+
+    if (_g_cluster_mode)
+    {
+        if ((cc == NULL) || cluster_failed(cc))
+        {
+            cluster_free(cc);
+            cc = cluster_new(NULL, cluster_free_reply);
+        }
+
+        if ((cc != NULL) &&
+            (cluster_append(cc, "ZRANGEBYSCORE %s:VERSIONS %lld +inf LIMIT 0 1",
+                            inode_key(_g_prefix, inode),
+                            _g_snapshot) == REDIS_OK))
+            cluster_get_reply(cc, (void **)&reply);
+    }
+    else
+    {
+        if ((c == NULL) || (c->err))
+        {
+            struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+
+            if (c != NULL)
+                redisFree(c);
+            c = redisConnectWithTimeout(_g_redis_host, _g_redis_port,
+                                        timeout);
+        }
+
+        if ((c != NULL) && (c->err == 0))
+            reply = redisCommand(c,
+                                 "ZRANGEBYSCORE %s:VERSIONS %lld +inf LIMIT 0 1",
+                                 inode_key(_g_prefix, inode), _g_snapshot);
+    }
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+        version = (reply->elements == 1) ? atoll(reply->element[0]->str) : -1;
+    redis_free_reply(reply);
+
+    /**
+     * Keep the connection for the next lookup, unless we have enough.
+     */
+    pthread_mutex_lock(&_g_cow_pool_lock);
+    if (_g_cow_free < COW_CONNECTIONS)
+    {
+        _g_cow_redis[_g_cow_free] = c;
+        _g_cow_cluster[_g_cow_free] = cc;
+        _g_cow_free += 1;
+        c = NULL;
+        cc = NULL;
+    }
+    pthread_mutex_unlock(&_g_cow_pool_lock);
+
+    if (c != NULL)
+        redisFree(c);
+    cluster_free(cc);
+
+    return (version);
+}
+
+
+/**
+ * The prefix of the keys holding the given inode.
+ *
+ * On the live filesystem this is always our prefix.  On a snapshot we
+ * look for the oldest version preserved since the snapshot was taken,
+ * and remember it.  Versions never change, but an inode read from the
+ * live keys may be preserved at any moment.  With --cache-notify that
+ * is remembered until its GEN or VERSIONS change, and otherwise only for
+ * as long as the rest of our cache.
+ */
+const char *
+inode_prefix(long long inode)
+{
+    cow_slot *slot = &_g_cow_slots[(unsigned int)inode % COW_SLOTS];
+    long long version;
+    long long forgotten;
+    const char *prefix;
+
+    if (_g_snapshot < 0)
+        return (_g_prefix);
+
+    pthread_mutex_lock(&_g_cow_lock);
+
+    if ((slot->inode == inode) &&
+        ((slot->generation >= 0) || (slot->expires > now_ms())))
+    {
+        prefix = (slot->generation >= 0) ?
+            version_prefix(slot->generation) : _g_prefix;
+        pthread_mutex_unlock(&_g_cow_lock);
+        return (prefix);
+    }
+
+    forgotten = _g_cow_forgotten;
+    pthread_mutex_unlock(&_g_cow_lock);
+
+    version = find_version(inode);
+
+    pthread_mutex_lock(&_g_cow_lock);
+
+    /**
+     * Don't remember a failed lookup, or the live keys if the inode may
+     * have been preserved while we were asking.
+     */
+    if ((version >= 0) ||
+        ((version == -1) && (forgotten == _g_cow_forgotten)))
+    {
+        slot->inode = inode;
+        slot->generation = version;
+        slot->expires = (cache_enabled() && _g_cache_notify) ?
+            LLONG_MAX : now_ms() + _g_cache_ttl;
+    }
+
+    prefix = (version >= 0) ? version_prefix(version) : _g_prefix;
+    pthread_mutex_unlock(&_g_cow_lock);
+
+    return (prefix);
+}
+
+
+/**
+ * Forget the version an inode is read from, because it has just been
+ * preserved.
+ */
+void
+cow_forget(long long inode)
+{
+    cow_slot *slot = &_g_cow_slots[(unsigned int)inode % COW_SLOTS];
+
+    pthread_mutex_lock(&_g_cow_lock);
+    if ((slot->inode == inode) && (slot->generation < 0))
+        slot->inode = 0;
+    _g_cow_forgotten += 1;
+    pthread_mutex_unlock(&_g_cow_lock);
+}
+
+
+/**
+ * Forget every inode read from the live keys, because we may have
+ * missed their being preserved.
+ */
+void
+cow_forget_live()
+{
+    int i;
+
+    pthread_mutex_lock(&_g_cow_lock);
+    for (i = 0; i < COW_SLOTS; i++)
+    {
+        if (_g_cow_slots[i].generation < 0)
+            _g_cow_slots[i].inode = 0;
+    }
+    _g_cow_forgotten += 1;
+    pthread_mutex_unlock(&_g_cow_lock);
+}
+
+
+/**
+ * Discard whatever cached state a keyspace notification invalidates.
+ *
+ * The channel names the key which changed, for example:
+ *
+ *   __keyspace@0__:skx:INODE:6:MTIME
+ *   __keyspace@0__:skx:INODE:6
+ *   __keyspace@0__:skx:{INODE:6}:DIRENT
+ */
+void
+handle_notification(const char *channel)
+{
+    const char *key;
+    char name[KEY_LENGTH];
+    char field[20] = { "" };
+    long long inode = 0;
+    size_t len = strlen(_g_prefix);
+    size_t n = 0;
+
+    if ((key = strstr(channel, "__:")) == NULL)
+        return;
+    key += 3;
+
+    if ((strncmp(key, _g_prefix, len) != 0) || (key[len] != ':'))
+        return;
+    key += len + 1;
+
+    /**
+     * Hash tags aside the names are the same.
+     */
+    for (; *key && (n < sizeof(name) - 1); key++)
+    {
+        if ((*key != '{') && (*key != '}'))
+            name[n++] = *key;
+    }
+    name[n] = '\0';
+    key = name;
+
+    if (sscanf(key, "INODE:%lld:%19s", &inode, field) == 2)
+    {
+        if ((strcmp(field, "DIRENT") == 0) || (strcmp(field, "DIRNAME") == 0))
+        {
+            cache_invalidate_children(inode);
+            return;
+        }
+
+        cache_invalidate_stat(inode);
+
+        if (strcmp(field, "NAME") == 0)
+            cache_invalidate_entry(inode);
+
+        if ((strcmp(field, "DATA") == 0) || (strcmp(field, "SIZE") == 0) ||
+            (strncmp(field, "CHUNK:", 6) == 0))
+            pagecache_invalidate(inode);
+
+        /**
+         * A snapshot must now read the version which was preserved.
+         */
+        if (strcmp(field, "GEN") == 0)
+            cow_forget(inode);
+
+        if (strcmp(field, "VERSIONS") == 0)
+        {
+            cow_forget(inode);
+            pagecache_invalidate(inode);
+            cache_invalidate_children(inode);
+        }
+    }
+    else if (sscanf(key, "INODE:%lld", &inode) == 1)
+    {
+        /**
+         * With the hash schema we can't tell which field changed.
+         */
+        cache_invalidate_stat(inode);
+        cache_invalidate_entry(inode);
+        pagecache_invalidate(inode);
+        cow_forget(inode);
+    }
+    else if ((sscanf(key, "DIRNAME:%lld", &inode) == 1) ||
+             (sscanf(key, "DIRENT:%lld", &inode) == 1))
+    {
+        cache_invalidate_children(inode);
+    }
+}
+
+
+/**
+ * Listen for keyspace notifications concerning our prefix, so that
+ * changes made by other mounts invalidate our cache.
+ *
+ * This runs in its own thread, with its own connection, because a
+ * subscribed connection cannot be used for anything else.
+ */
+void *
+cache_listener(void *arg)
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c = NULL;
+    redisReply *reply = NULL;
+    char pattern[64];
+
+    snprintf(pattern, sizeof(pattern) - 1, "__keyspace@*__:%s:*", _g_prefix);
+
+    while (1)
+    {
+        /**
+         * (Re)connect and subscribe.
+         */
+        if (c == NULL)
+        {
+            c = redisConnectWithTimeout(_g_redis_host, _g_redis_port,
+                                        timeout);
+            if ((c == NULL) || c->err)
+            {
+                if (c != NULL)
+                    redisFree(c);
+                c = NULL;
+                sleep(1);
+                continue;
+            }
+
+            reply = redisCommand(c, "CONFIG GET notify-keyspace-events");
+            if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+                (reply->elements == 2) &&
+                (strchr(reply->element[1]->str, 'K') == NULL))
+            {
+                fprintf(stderr,
+                        "Keyspace notifications are disabled; set notify-keyspace-events to 'KA' for --cache-notify to work.\n");
+            }
+            if (reply != NULL)
+                redis_free_reply(reply);
+
+            reply = redisCommand(c, "PSUBSCRIBE %s", pattern);
+            if (reply != NULL)
+                redis_free_reply(reply);
+
+            /**
+             * We might have missed changes while disconnected.
+             */
+            cache_flush();
+            cow_forget_live();
+        }
+
+        if (redisGetReply(c, (void **)&reply) != REDIS_OK)
+        {
+            redisFree(c);
+            c = NULL;
+            continue;
+        }
+
+        /**
+         * [ "pmessage", pattern, channel, event ]
+         */
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+            (reply->elements == 4) &&
+            (reply->element[2]->type == REDIS_REPLY_STRING))
+        {
+            if (_g_debug)
+                fprintf(stderr, "notification: %s\n",
+                        reply->element[2]->str);
+
+            handle_notification(reply->element[2]->str);
+        }
+
+        if (reply != NULL)
+            redis_free_reply(reply);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Get the next INODE number to be used for a new file/directory.
+ *
+ * Numbers come from our lease, so only one in INODE_LEASE costs a
+ * round-trip.  Any left when we're unmounted are simply never used.
+ *
+ * Returns -1 on failure.
+ */
+long long
+get_next_inode()
+{
+    redisReply *reply = NULL;
+    long long lease;
+    long long val = -1;
+
+    while (1)
+    {
+        lease = _g_inode_lease;
+        if ((lease & INODE_LEASE_MASK) >= INODE_LEASE)
+            break;
+
+        if (__sync_bool_compare_and_swap(&_g_inode_lease, lease, lease + 1))
+            return ((lease >> INODE_LEASE_BITS) - INODE_LEASE + 1 +
+                    (lease & INODE_LEASE_MASK));
+    }
+
+    /**
+     * The lease is used up, so take another - unless some other thread
+     * did so while we waited.
+     */
+    pthread_mutex_lock(&_g_inode_lock);
+
+    if ((_g_inode_lease & INODE_LEASE_MASK) < INODE_LEASE)
+    {
+        pthread_mutex_unlock(&_g_inode_lock);
+        return (get_next_inode());
+    }
+
+    redis_alive();
+
+    reply = redis_command("INCRBY %s:GLOBAL:INODE %d", _g_prefix,
+                          INODE_LEASE);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+    {
+        val = reply->integer - INODE_LEASE + 1;
+        __sync_lock_test_and_set(&_g_inode_lease,
+                                 (reply->integer << INODE_LEASE_BITS) | 1);
+    }
+    redis_free_reply(reply);
+
+    pthread_mutex_unlock(&_g_inode_lock);
+
+    return (val);
+}
+
+
+/**
+ * Build a command which reads, or writes, meta-data fields of an inode
+ * in whichever schema is in use.
+ *
+ * The fields are given as a space-separated list, e.g. "MODE MTIME",
+ * and when writing each is followed by its value, e.g. "MODE %d MTIME
+ * %d".  With the hash schema the list is used as-is, after the name of
+ * the hash, otherwise each field is expanded into a key of its own.
+ *
+ * Returns 0 on success, -1 if the result doesn't fit.
+ */
+int
+meta_format(char *buf, size_t len, const char *keys_cmd,
+            const char *hash_cmd, long long inode, const char *fields, int values)
+{
+    char key[KEY_LENGTH * 2];
+    const char *p;
+    size_t used = 0;
+    int n = 0;
+    int token = 0;
+
+    /**
+     * The name of the inode, with any '%' in the prefix escaped as the
+     * result is used as a format string.
+     */
+    for (p = inode_key(inode_prefix(inode), inode);
+         *p && (n < sizeof(key) - 2); p++)
+    {
+        if (*p == '%')
+            key[n++] = '%';
+        key[n++] = *p;
+    }
+    key[n] = '\0';
+
+    if (_g_schema == SCHEMA_HASH)
+    {
+        used = snprintf(buf, len, "%s %s %s", hash_cmd, key, fields);
+        return ((used < len) ? 0 : -1);
+    }
+
+    used = snprintf(buf, len, "%s", keys_cmd);
+
+    for (p = fields; *p && (used < len); token++)
+    {
+        size_t word = strcspn(p, " ");
+
+        if (values && (token % 2 == 1))
+            used += snprintf(buf + used, len - used, " %.*s", (int)word, p);
+        else
+            used += snprintf(buf + used, len - used, " %s:%.*s", key,
+                             (int)word, p);
+
+        p += word;
+        while (*p == ' ')
+            p++;
+    }
+
+    return ((used < len) ? 0 : -1);
+}
+
+
+/**
+ * Append a command fetching the given fields of an inode.
+ *
+ * A single field is fetched with GET/HGET, and the reply is a string,
+ * otherwise the reply is an array of values in the order requested.
+ */
+void
+append_get_meta(long long inode, const char *fields)
+{
+    char fmt[512];
+    int one = (strchr(fields, ' ') == NULL);
+
+    if (meta_format(fmt, sizeof(fmt), one ? "GET" : "MGET",
+                    one ? "HGET" : "HMGET", inode, fields, 0) != 0)
+    {
+        fprintf(stderr, "meta-data request too long: %s\n", fields);
+        return;
+    }
+
+    redis_append(fmt);
+}
+
+
+/**
+ * Append a command storing fields of an inode, from a list of field
+ * names & value formats.
+ */
+void
+append_set_meta(long long inode, const char *fields, ...)
+{
+    char fmt[512];
+    va_list ap;
+
+    if (meta_format(fmt, sizeof(fmt), "MSET", "HMSET", inode, fields, 1) !=
+        0)
+    {
+        fprintf(stderr, "meta-data request too long: %s\n", fields);
+        return;
+    }
+
+    va_start(ap, fields);
+    redis_vappend(fmt, ap);
+    va_end(ap);
+}
+
+
+/**
+ * Fetch the given fields of an inode.
+ */
+redisReply *
+get_meta(long long inode, const char *fields)
+{
+    redisReply *reply = NULL;
+
+    append_get_meta(inode, fields);
+    redis_get_reply(&reply);
+
+    return (reply);
+}
+
+
+/**
+ * Store fields of an inode, from a list of field names & value formats.
+ */
+void
+set_meta(long long inode, const char *fields, ...)
+{
+    redisReply *reply = NULL;
+    char fmt[512];
+    va_list ap;
+
+    if (meta_format(fmt, sizeof(fmt), "MSET", "HMSET", inode, fields, 1) !=
+        0)
+    {
+        fprintf(stderr, "meta-data request too long: %s\n", fields);
+        return;
+    }
+
+    va_start(ap, fields);
+    reply = redis_vcommand(fmt, ap);
+    va_end(ap);
+
+    redis_free_reply(reply);
+}
+
+
+/**
+ * Return the string value at the given index of a multi-field reply,
+ * or NULL if it isn't set.
+ */
+const char *
+meta_value(redisReply *reply, int i)
+{
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY) ||
+        (i >= reply->elements) || (reply->element[i] == NULL) ||
+        (reply->element[i]->type != REDIS_REPLY_STRING))
+        return NULL;
+
+    return (reply->element[i]->str);
+}
+
+
+/**
+ * Fill in a stat structure from the reply to a request for the fields
+ * listed in STAT_FIELDS.
+ *
+ * Returns 0 on success, -1 if the inode has no type.
+ */
+int
+fill_stat(redisReply *reply, struct stat *stbuf)
+{
+    const char *type = meta_value(reply, 0);
+    const char *val;
+
+    if (type == NULL)
+        return -1;
+
+    if ((val = meta_value(reply, 1)) != NULL)
+        stbuf->st_mode = atoi(val);
+    if ((val = meta_value(reply, 3)) != NULL)
+        stbuf->st_uid = atoi(val);
+    if ((val = meta_value(reply, 4)) != NULL)
+        stbuf->st_gid = atoi(val);
+    if ((val = meta_value(reply, 5)) != NULL)
+        stbuf->st_nlink = atoi(val);
+    if ((val = meta_value(reply, 6)) != NULL)
+        stbuf->st_atime = atoi(val);
+    if ((val = meta_value(reply, 7)) != NULL)
+        stbuf->st_mtime = atoi(val);
+    if ((val = meta_value(reply, 8)) != NULL)
+        stbuf->st_ctime = atoi(val);
+
+    if (strcmp(type, "DIR") == 0)
+    {
+        stbuf->st_mode |= S_IFDIR;
+    }
+    else if (strcmp(type, "LINK") == 0)
+    {
+        stbuf->st_mode |= S_IFLNK;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = 0;
+    }
+    else if (strcmp(type, "FILE") == 0)
+    {
+        if ((val = meta_value(reply, 2)) != NULL)
+            stbuf->st_size = atoll(val);
+    }
+    else
+    {
+        if (_g_debug)
+            fprintf(stderr, "UNKNOWN ENTRY TYPE: %s\n", type);
+    }
+
+    return 0;
+}
+
+
+/**
+ * The key holding chunk "idx" of the given inode.
+ */
+void
+chunk_key(char *buf, size_t len, long long inode, long idx)
+{
+    snprintf(buf, len, "%s:INODE:%lld:CHUNK:%ld", inode_prefix(inode), inode,
+             idx);
+}
+
+
+/**
+ * Append the commands deleting the chunks [first, last] of the given
+ * inode, in batches, with the given command - DEL or UNLINK.
+ *
+ * Returns the number of commands appended.
+ */
+int
+append_delete_chunks(const char *cmd, long long inode, long first, long last)
+{
+    const char *argv[CHUNK_BATCH + 1];
+    char keys[CHUNK_BATCH][64];
+    long idx = first;
+    int count = 0;
+
+    while (idx <= last)
+    {
+        int argc = 1;
+
+        /**
+         * The chunks of a file live in different slots of a cluster, so
+         * must be deleted one at a time - pipelined all the same.
+         */
+        argv[0] = cmd;
+        while ((argc <= (_g_cluster_mode ? 1 : CHUNK_BATCH)) && (idx <= last))
+        {
+            chunk_key(keys[argc - 1], sizeof(keys[0]), inode, idx);
+            argv[argc] = keys[argc - 1];
+            argc += 1;
+            idx += 1;
+        }
+
+        redis_append_argv(argc, argv, NULL);
+        count += 1;
+    }
+
+    return (count);
+}
+
+
+/**
+ * Delete the chunks [first, last] of the given inode, in batches.
+ */
+void
+delete_chunks(long long inode, long first, long last)
+{
+    redisReply *reply = NULL;
+    int count = append_delete_chunks("DEL", inode, first, last);
+
+    while (count-- > 0)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+}
+
+
+/**
+ * Get the size of the given inode.
+ */
+long long
+get_size(long long inode)
+{
+    redisReply *reply = NULL;
+    long long sz = 0;
+
+    reply = get_meta(inode, "SIZE");
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        sz = atoll(reply->str);
+    redis_free_reply(reply);
+
+    return (sz);
+}
+
+
+/**
+ * Queue a SETRANGE of the given key.
+ *
+ * The data is written to the socket directly from the caller's buffer,
+ * rather than being copied into a command first.
+ */
+void
+append_setrange(const char *key, long long offset, const char *buf,
+                size_t size)
+{
+    char off[32];
+    const char *argv[4];
+    size_t argvlen[4];
+
+    snprintf(off, sizeof(off), "%lld", offset);
+
+    argv[0] = "SETRANGE";
+    argvlen[0] = 8;
+    argv[1] = key;
+    argvlen[1] = strlen(key);
+    argv[2] = off;
+    argvlen[2] = strlen(off);
+    argv[3] = buf;
+    argvlen[3] = size;
+
+    redis_append_argv_ref(4, argv, argvlen);
+}
+
+
+/**
+ * Is the given buffer entirely zeros?
+ */
+int
+is_zeros(const char *buf, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        if (buf[i] != '\0')
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * The key holding the block with the given digest.
+ */
+void
+block_key(char *buf, size_t len, const char *digest)
+{
+    snprintf(buf, len, _g_tags ? "%s:{BLOCK:%s}" : "%s:BLOCK:%s", _g_prefix,
+             digest);
+}
+
+
+/**
+ * Append a command fetching the digests of the blocks which hold the
+ * chunks [first, last] of the given inode.  The reply is an array, with
+ * a nil entry for each chunk which has never been written.
+ *
+ * Returns 0 on success, and appends nothing if we're out of memory.
+ */
+int
+append_get_blocks(long long inode, long first, long last)
+{
+    long count = last - first + 1;
+    const char **argv = calloc(count + 2, sizeof(char *));
+    char *fields = calloc(count, 24);
+    char key[128];
+    long i;
+
+    if ((argv == NULL) || (fields == NULL))
+    {
+        free(argv);
+        free(fields);
+        return -1;
+    }
+
+    snprintf(key, sizeof(key), "%s:BLOCKS",
+             inode_key(inode_prefix(inode), inode));
+
+    argv[0] = "HMGET";
+    argv[1] = key;
+    for (i = 0; i < count; i++)
+    {
+        snprintf(fields + i * 24, 24, "%ld", first + i);
+        argv[i + 2] = fields + i * 24;
+    }
+
+    redis_append_argv(count + 2, argv, NULL);
+
+    free(argv);
+    free(fields);
+    return 0;
+}
+
+
+/**
+ * Drop a reference to each of the given blocks, removing those which
+ * are no longer used by any file.
+ *
+ * A script drops the count, and removes an unused block, in a single
+ * step, so that no other file can take it up in between.  This is why
+ * shared blocks are only written with server-side scripts; see
+ * setup_dedup().
+ */
+void
+release_blocks(const char **digests, int count)
+{
+    redisReply *reply = NULL;
+    int first;
+
+    for (first = 0; first < count; first += BLOCK_BATCH)
+    {
+        int n = ((count - first) < BLOCK_BATCH) ? (count - first) :
+            BLOCK_BATCH;
+
+        reply = run_script_argv(SCRIPT_RELEASE, n, digests + first);
+        redis_free_reply(reply);
+    }
+}
+
+
+/**
+ * Take another reference to every block held by the given inode, as a
+ * copy of it has just been preserved for a snapshot.
+ */
+void
+hold_blocks(long long inode)
+{
+    redisReply *reply = NULL;
+    redisReply *r = NULL;
+    size_t i;
+
+    reply = redis_command("HVALS %s:BLOCKS", inode_key(_g_prefix, inode));
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+    {
+        for (i = 0; i < reply->elements; i++)
+        {
+            char key[128];
+
+            block_key(key, sizeof(key), reply->element[i]->str);
+            redis_append("INCR %s:REFS", key);
+        }
+
+        for (i = 0; i < reply->elements; i++)
+        {
+            redis_get_reply(&r);
+            redis_free_reply(r);
+        }
+    }
+    redis_free_reply(reply);
+}
+
+
+/**
+ * The current generation of the live filesystem, or zero if it has
+ * never had a snapshot taken.
+ */
+long long
+cow_generation()
+{
+    redisReply *reply = NULL;
+    long long generation;
+
+    if (_g_snapshot >= 0)
+        return 0;
+
+    pthread_mutex_lock(&_g_cow_lock);
+    generation = _g_generation;
+    if (now_ms() - _g_generation_read < COW_REFRESH)
+    {
+        pthread_mutex_unlock(&_g_cow_lock);
+        return (generation);
+    }
+    pthread_mutex_unlock(&_g_cow_lock);
+
+    reply = redis_command("GET %s:GLOBAL:GENERATION", _g_prefix);
+    if (reply != NULL)
+    {
+        generation = (reply->type == REDIS_REPLY_STRING) ?
+            atoll(reply->str) : 0;
+
+        pthread_mutex_lock(&_g_cow_lock);
+        _g_generation = generation;
+        _g_generation_read = now_ms();
+        pthread_mutex_unlock(&_g_cow_lock);
+    }
+    redis_free_reply(reply);
+
+    return (generation);
+}
+
+
+/**
+ * Copy the given keys, relative to our prefix, into a version with
+ * DUMP & RESTORE, a batch at a time.
+ *
+ * Keys which don't exist are skipped.  Returns 0 on success.
+ */
+int
+copy_to_version(char **keys, int count, const char *version)
+{
+    redisReply *dumps[COW_BATCH];
+    redisReply *reply = NULL;
+    int ret = 0;
+    int first;
+    int i;
+
+    for (first = 0; first < count; first += COW_BATCH)
+    {
+        int n = ((count - first) < COW_BATCH) ? (count - first) : COW_BATCH;
+        int replies = 0;
+
+        for (i = 0; i < n; i++)
+            redis_append("DUMP %s:%s", _g_prefix, keys[first + i]);
+
+        for (i = 0; i < n; i++)
+        {
+            dumps[i] = NULL;
+            redis_get_reply(&dumps[i]);
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            const char *argv[4];
+            size_t argvlen[4];
+            char key[128];
+
+            if ((dumps[i] == NULL) || (dumps[i]->type != REDIS_REPLY_STRING))
+            {
+                if ((dumps[i] != NULL) && (dumps[i]->type == REDIS_REPLY_ERROR))
+                    ret = -1;
+                continue;
+            }
+
+            snprintf(key, sizeof(key), "%s:%s", version, keys[first + i]);
+            redis_append("DEL %s", key);
+
+            argv[0] = "RESTORE";
+            argvlen[0] = 7;
+            argv[1] = key;
+            argvlen[1] = strlen(key);
+            argv[2] = "0";
+            argvlen[2] = 1;
+            argv[3] = dumps[i]->str;
+            argvlen[3] = dumps[i]->len;
+
+            redis_append_argv(4, argv, argvlen);
+            replies += 2;
+        }
+
+        while (replies-- > 0)
+        {
+            redis_get_reply(&reply);
+            if ((reply == NULL) || (reply->type == REDIS_REPLY_ERROR))
+                ret = -1;
+            redis_free_reply(reply);
+        }
+
+        for (i = 0; i < n; i++)
+            redis_free_reply(dumps[i]);
+    }
+
+    return (ret);
+}
+
+
+/**
+ * Preserve the current state of an inode, if it is about to change for
+ * the first time since a snapshot was taken.
+ *
+ * This must be called before the change is made, with no commands
+ * pipelined on our connection.
+ */
+void
+preserve_inode(long long inode)
+{
+    cow_slot *slot = &_g_cow_slots[(unsigned int)inode % COW_SLOTS];
+    pthread_mutex_t *stripe;
+    redisReply *reply = NULL;
+    long long generation;
+    long long preserved = 0;
+    long long size = 0;
+    const char *val;
+    char *type = NULL;
+    char **keys = NULL;
+    int count = 0;
+    int done = 1;
+    int i;
+
+    if (inode == -1)
+        return;
+
+    generation = cow_generation();
+    if (generation == 0)
+        return;
+
+    pthread_mutex_lock(&_g_cow_lock);
+    if ((slot->inode == inode) && (slot->generation >= generation))
+    {
+        pthread_mutex_unlock(&_g_cow_lock);
+        return;
+    }
+    pthread_mutex_unlock(&_g_cow_lock);
+
+    stripe = &_g_cow_stripes[(unsigned int)inode % LOCK_STRIPES];
+    pthread_mutex_lock(stripe);
+
+    reply = get_meta(inode, "GEN TYPE SIZE");
+    if ((val = meta_value(reply, 0)) != NULL)
+        preserved = atoll(val);
+    if ((val = meta_value(reply, 1)) != NULL)
+        type = strdup(val);
+    if ((val = meta_value(reply, 2)) != NULL)
+        size = atoll(val);
+    redis_free_reply(reply);
+
+    if ((type != NULL) && (preserved < generation))
+    {
+        long chunks = 0;
+        long idx;
+        char buf[64];
+
+        if ((strcmp(type, "FILE") == 0) && (_g_chunk_size > 0) &&
+            (size > 0) && !_g_dedup)
+            chunks = ((size - 1) / _g_chunk_size) + 1;
+
+        keys = calloc(17 + chunks, sizeof(char *));
+        if (keys == NULL)
+        {
+            free(type);
+            pthread_mutex_unlock(stripe);
+            return;
+        }
+
+        if (_g_schema == SCHEMA_HASH)
+        {
+            keys[count++] = strdup(inode_key(NULL, inode));
+        }
+        else
+        {
+            for (i = 0; _g_fields[i] != NULL; i++)
+            {
+                snprintf(buf, sizeof(buf), "%s:%s", inode_key(NULL, inode),
+                         _g_fields[i]);
+                keys[count++] = strdup(buf);
+            }
+        }
+
+        snprintf(buf, sizeof(buf), "%s:XATTR", inode_key(NULL, inode));
+        keys[count++] = strdup(buf);
+
+        if (strcmp(type, "DIR") == 0)
+        {
+            keys[count++] = strdup(dir_key(NULL, "DIRENT", inode));
+            keys[count++] = strdup(dir_key(NULL, "DIRNAME", inode));
+        }
+        else if (strcmp(type, "FILE") == 0)
+        {
+            snprintf(buf, sizeof(buf), "%s:DATA", inode_key(NULL, inode));
+            keys[count++] = strdup(buf);
+            snprintf(buf, sizeof(buf), "%s:BLOCKS", inode_key(NULL, inode));
+            keys[count++] = strdup(buf);
+
+            for (idx = 0; idx < chunks; idx++)
+            {
+                snprintf(buf, sizeof(buf), "INODE:%lld:CHUNK:%ld", inode, idx);
+                keys[count++] = strdup(buf);
+            }
+        }
+
+        if (_g_debug)
+            fprintf(stderr, "preserve_inode(%lld) -> version %lld\n", inode,
+                    generation - 1);
+
+        /**
+         * Only once the copy is complete do we record it, so that an
+         * interrupted copy is simply made again.
+         */
+        pthread_mutex_lock(&_g_cow_lock);
+        val = version_prefix(generation - 1);
+        pthread_mutex_unlock(&_g_cow_lock);
+
+        if (copy_to_version(keys, count, val) == 0)
+        {
+            /**
+             * The preserved copy shares the blocks of the file.
+             */
+            if (_g_dedup && (strcmp(type, "FILE") == 0))
+                hold_blocks(inode);
+
+            redis_append("ZADD %s:VERSIONS %lld %lld",
+                         inode_key(_g_prefix, inode), generation - 1,
+                         generation - 1);
+            append_set_meta(inode, "GEN %lld", generation);
+
+            for (i = 0; i < 2; i++)
+            {
+                redis_get_reply(&reply);
+                redis_free_reply(reply);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Failed to preserve inode %lld for a snapshot.\n",
+                    inode);
+            done = 0;
+        }
+
+        for (i = 0; i < count; i++)
+            free(keys[i]);
+        free(keys);
+    }
+
+    if (done)
+    {
+        pthread_mutex_lock(&_g_cow_lock);
+        slot->inode = inode;
+        slot->generation = generation;
+        pthread_mutex_unlock(&_g_cow_lock);
+    }
+
+    free(type);
+    pthread_mutex_unlock(stripe);
+}
+
+
+/**
+ * The most inodes whose timestamps are written by a single pipeline.
+ */
+#define TIMES_BATCH 256
+
+
+/**
+ * Leave new timestamps of an inode to be written later, if --time-delay
+ * is in use.
+ *
+ * Returns 1 if they were left pending, 0 if the caller must store them.
+ */
+int
+defer_times(long long inode, int fields, time_t when)
+{
+    if (_g_time_delay <= 0)
+        return 0;
+
+    return (times_set(inode, fields, when, now_ms()) == 0);
+}
+
+
+/**
+ * Write out the timestamps which have waited too long, or all of them,
+ * with a single command for each inode.
+ */
+void
+flush_times(int due_only)
+{
+    pending_times batch[TIMES_BATCH];
+    redisReply *reply = NULL;
+    int count;
+    int i;
+
+    pthread_mutex_lock(&_g_times_lock);
+
+    while ((count = times_take(batch, TIMES_BATCH, now_ms(),
+                               due_only ? _g_time_delay : 0)) > 0)
+    {
+        /**
+         * A snapshot may still need the old values.
+         */
+        for (i = 0; i < count; i++)
+            preserve_inode(batch[i].inode);
+
+        for (i = 0; i < count; i++)
+        {
+            pending_times *t = &batch[i];
+
+            if (t->fields == (TIMES_ATIME | TIMES_MTIME))
+                append_set_meta(t->inode, "ATIME %ld MTIME %ld",
+                                (long)t->atime, (long)t->mtime);
+            else if (t->fields & TIMES_ATIME)
+                append_set_meta(t->inode, "ATIME %ld", (long)t->atime);
+            else
+                append_set_meta(t->inode, "MTIME %ld", (long)t->mtime);
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            redis_get_reply(&reply);
+            redis_free_reply(reply);
+            cache_invalidate_stat(batch[i].inode);
+        }
+    }
+
+    pthread_mutex_unlock(&_g_times_lock);
+}
+
+
+/**
+ * Forget the timestamps pending for an inode which is being removed,
+ * waiting for any which are being written out.
+ */
+void
+discard_times(long long inode)
+{
+    if (_g_time_delay <= 0)
+        return;
+
+    pthread_mutex_lock(&_g_times_lock);
+    times_clear(inode);
+    pthread_mutex_unlock(&_g_times_lock);
+}
+
+
+/**
+ * Periodically write out timestamps which have waited too long.
+ */
+void *
+time_flusher(void *arg)
+{
+    long interval = _g_time_delay / 2;
+
+    if (interval < 10)
+        interval = 10;
+
+    while (1)
+    {
+        usleep(interval * 1000);
+
+        if (times_count() == 0)
+            continue;
+
+        redis_acquire();
+        flush_times(1);
+        redis_release();
+    }
+
+    return NULL;
+}
+
+
+/**
+ * The codec named by a CODEC field, which is unset for files stored
+ * as-is.
+ */
+int
+codec_of(const char *name)
+{
+    int codec = codec_lookup(name);
+
+    return ((codec < 0) ? CODEC_NONE : codec);
+}
+
+
+/**
+ * Write data to the given inode, on a filesystem whose files may be
+ * compressed.  The inode must be locked.
+ *
+ * A compressed chunk can't be updated in place, so the chunks which
+ * are only partly overwritten are fetched along with the size & codec
+ * of the file, and every chunk touched is then encoded and stored whole.
+ * Files which aren't compressed are updated with SETRANGE as usual.
+ *
+ * New files are compressed if we've been asked to.
+ */
+void
+write_framed(long long inode, const char *buf, size_t size, off_t offset)
+{
+    redisReply *reply = NULL;
+    redisReply **chunks = NULL;
+    long long old_size = 0;
+    long long end = offset + size;
+    long first = offset / _g_chunk_size;
+    long last = (end - 1) / _g_chunk_size;
+    long idx;
+    size_t done = 0;
+    int count = 0;
+    int fresh = 0;
+    int codec;
+
+    chunks = calloc(last - first + 1, sizeof(redisReply *));
+    if (chunks == NULL)
+        return;
+
+    append_get_meta(inode, "SIZE CODEC");
+
+    for (idx = first; idx <= last; idx++)
+    {
+        long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+        long stop = (idx == last) ? ((end - 1) % _g_chunk_size) :
+            (_g_chunk_size - 1);
+        char key[128];
+
+        if ((start == 0) && (stop == _g_chunk_size - 1))
+            continue;
+
+        chunk_key(key, sizeof(key), inode, idx);
+        redis_append("GET %s", key);
+    }
+
+    reply = NULL;
+    redis_get_reply(&reply);
+    if (meta_value(reply, 0) != NULL)
+        old_size = atoll(meta_value(reply, 0));
+    codec = codec_of(meta_value(reply, 1));
+    redis_free_reply(reply);
+
+    for (idx = first; idx <= last; idx++)
+    {
+        long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+        long stop = (idx == last) ? ((end - 1) % _g_chunk_size) :
+            (_g_chunk_size - 1);
+
+        if ((start != 0) || (stop != _g_chunk_size - 1))
+            redis_get_reply(&chunks[idx - first]);
+    }
+
+    /**
+     * An empty file takes on our codec.
+     */
+    if ((codec == CODEC_NONE) && (old_size == 0) &&
+        (_g_compress != CODEC_NONE))
+    {
+        codec = _g_compress;
+        fresh = 1;
+    }
+
+    for (idx = first; idx <= last; idx++)
+    {
+        redisReply *old = chunks[idx - first];
+        long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+        size_t len = _g_chunk_size - start;
+        char key[128];
+
+        if (len > size - done)
+            len = size - done;
+
+        chunk_key(key, sizeof(key), inode, idx);
+
+        if (codec == CODEC_NONE)
+        {
+            append_setrange(key, start, buf + done, len);
+            count += 1;
+        }
+        else
+        {
+            const char *argv[3];
+            size_t argvlen[3];
+            char *data = NULL;
+            char *chunk = NULL;
+            char *frame = NULL;
+            size_t have = 0;
+            size_t want = start + len;
+            size_t flen = 0;
+
+            /**
+             * Merge our data into the decoded chunk, and store the
+             * result as a new frame.
+             */
+            if ((old != NULL) && (old->type == REDIS_REPLY_STRING))
+                data = codec_decode(old->str, old->len, _g_chunk_size, &have);
+
+            if (have > want)
+                want = have;
+
+            chunk = calloc(1, want);
+            if (chunk != NULL)
+            {
+                if (data != NULL)
+                    memcpy(chunk, data, have);
+                memcpy(chunk + start, buf + done, len);
+                frame = codec_encode(codec, chunk, want, _g_compress_min,
+                                     &flen);
+            }
+
+            if (frame != NULL)
+            {
+                argv[0] = "SET";
+                argvlen[0] = 3;
+                argv[1] = key;
+                argvlen[1] = strlen(key);
+                argv[2] = frame;
+                argvlen[2] = flen;
+
+                redis_append_argv(3, argv, argvlen);
+                count += 1;
+            }
+
+            free(frame);
+            free(chunk);
+            free(data);
+        }
+
+        done += len;
+    }
+
+    if (fresh)
+    {
+        append_set_meta(inode, "CODEC %s", codec_name(codec));
+        count += 1;
+    }
+
+    if (!_g_fast && !defer_times(inode, TIMES_MTIME, time(NULL)))
+    {
+        append_set_meta(inode, "MTIME %d", time(NULL));
+        count += 1;
+    }
+
+    if (end > old_size)
+    {
+        append_set_meta(inode, "SIZE %lld", end);
+        count += 1;
+    }
+
+    while (count-- > 0)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    for (idx = first; idx <= last; idx++)
+        redis_free_reply(chunks[idx - first]);
+    free(chunks);
+}
+
+
+/**
+ * Append a command uploading the block holding the given chunk, with
+ * "SET", or "SETNX" to leave one which is already stored alone.
+ *
+ * Returns 1 if a command was appended, 0 if we're out of memory.
+ */
+int
+append_block(const char *cmd, block_chunk *c)
+{
+    const char *argv[3];
+    size_t argvlen[3];
+    char key[128];
+    size_t flen = 0;
+    char *frame = codec_encode(_g_compress, c->data, c->len,
+                               _g_compress_min, &flen);
+
+    if (frame == NULL)
+        return 0;
+
+    block_key(key, sizeof(key), c->digest);
+
+    argv[0] = cmd;
+    argvlen[0] = strlen(cmd);
+    argv[1] = key;
+    argvlen[1] = strlen(key);
+    argv[2] = frame;
+    argvlen[2] = flen;
+
+    redis_append_argv(3, argv, argvlen);
+    free(frame);
+
+    return 1;
+}
+
+
+/**
+ * Store the given chunks of an inode as blocks, in place of the blocks
+ * which held them before.
+ *
+ * A block is only uploaded if no other chunk already holds it, and the
+ * inode only points at the new blocks once they're stored.  A block
+ * whose count we didn't start may not have arrived yet, as the file
+ * which started it may still be uploading it, so we check that it
+ * exists and upload it ourselves if not.
+ */
+void
+store_blocks(long long inode, block_chunk *chunks, int count)
+{
+    const char **argv = calloc(count * 2 + 2, sizeof(char *));
+    const char **released = calloc(count, sizeof(char *));
+    char *fields = calloc(count, 24);
+    int *state = calloc(count, sizeof(int));
+    redisReply *reply = NULL;
+    char key[128];
+    int replies = 0;
+    int dropped = 0;
+    int argc = 2;
+    int i;
+
+    if ((argv == NULL) || (released == NULL) || (fields == NULL) ||
+        (state == NULL))
+        goto done;
+
+    /**
+     * Take a reference to each new block.
+     */
+    for (i = 0; i < count; i++)
+    {
+        block_chunk *c = &chunks[i];
+
+        sha256_hex(c->data, c->len, c->digest);
+        if ((c->old != NULL) && (strcmp(c->old, c->digest) == 0))
+            continue;
+
+        block_key(key, sizeof(key), c->digest);
+        redis_append("INCR %s:REFS", key);
+        state[i] = BLOCK_HELD;
+    }
+
+    /**
+     * Then upload those which we're the first to hold, and ask whether
+     * the others are stored.
+     */
+    for (i = 0; i < count; i++)
+    {
+        block_chunk *c = &chunks[i];
+
+        if (state[i] != BLOCK_HELD)
+            continue;
+
+        redis_get_reply(&reply);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER) &&
+            (reply->integer == 1))
+        {
+            replies += append_block("SET", c);
+        }
+        else
+        {
+            block_key(key, sizeof(key), c->digest);
+            redis_append("EXISTS %s", key);
+            state[i] = BLOCK_CHECKED;
+        }
+        redis_free_reply(reply);
+    }
+
+    /**
+     * Upload any which aren't, leaving alone one which arrived since.
+     */
+    for (i = 0; i < count; i++)
+    {
+        if (state[i] != BLOCK_CHECKED)
+            continue;
+
+        redis_get_reply(&reply);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER) &&
+            (reply->integer == 0))
+            replies += append_block("SETNX", &chunks[i]);
+        redis_free_reply(reply);
+    }
+
+    while (replies-- > 0)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    /**
+     * Every block is now stored, so the inode may point at them.
+     */
+    for (i = 0; i < count; i++)
+    {
+        block_chunk *c = &chunks[i];
+
+        if (state[i] == 0)
+            continue;
+
+        snprintf(fields + i * 24, 24, "%ld", c->idx);
+        argv[argc++] = fields + i * 24;
+        argv[argc++] = c->digest;
+
+        if (c->old != NULL)
+            released[dropped++] = c->old;
+    }
+
+    if (argc > 2)
+    {
+        snprintf(key, sizeof(key), "%s:BLOCKS", inode_key(_g_prefix, inode));
+        argv[0] = "HMSET";
+        argv[1] = key;
+
+        reply = redis_command_argv(argc, argv, NULL);
+        redis_free_reply(reply);
+    }
+
+    release_blocks(released, dropped);
+
+  done:
+    free(argv);
+    free(released);
+    free(fields);
+    free(state);
+}
+
+
+/**
+ * Write data to the given inode, on a filesystem whose files are stored
+ * as shared blocks.  The inode must be locked.
+ *
+ * The blocks of the chunks which are only partly overwritten are
+ * fetched, and merged with the new data, and every chunk touched is
+ * then stored as a block of its own.
+ */
+void
+write_dedup(long long inode, const char *buf, size_t size, off_t offset)
+{
+    redisReply *blocks = NULL;
+    redisReply *reply = NULL;
+    redisReply **old = NULL;
+    block_chunk *chunks = NULL;
+    long long old_size = 0;
+    long long end = offset + size;
+    long first = offset / _g_chunk_size;
+    long last = (end - 1) / _g_chunk_size;
+    long count = last - first + 1;
+    size_t done = 0;
+    int replies = 0;
+    long i;
+
+    /**
+     * Everything we need is allocated up front, so that we can't fail
+     * with commands in flight.  A merged chunk is never larger than the
+     * chunk size.
+     */
+    chunks = calloc(count, sizeof(block_chunk));
+    old = calloc(count, sizeof(redisReply *));
+    if ((chunks == NULL) || (old == NULL))
+        goto done;
+
+    for (i = 0; i < count; i++)
+    {
+        chunks[i].data = calloc(1, _g_chunk_size);
+        if (chunks[i].data == NULL)
+            goto done;
+    }
+
+    if (append_get_blocks(inode, first, last) != 0)
+        goto done;
+    append_get_meta(inode, "SIZE");
+
+    redis_get_reply(&blocks);
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        old_size = atoll(reply->str);
+    redis_free_reply(reply);
+
+    /**
+     * Fetch the blocks of the chunks we only partly overwrite.
+     */
+    for (i = 0; i < count; i++)
+    {
+        long start = (i == 0) ? (offset % _g_chunk_size) : 0;
+        size_t len = _g_chunk_size - start;
+
+        if (len > size - done)
+            len = size - done;
+        done += len;
+
+        chunks[i].idx = first + i;
+        chunks[i].old = meta_value(blocks, i);
+
+        if ((chunks[i].old != NULL) &&
+            ((start != 0) || (len != _g_chunk_size)))
+        {
+            char key[128];
+
+            block_key(key, sizeof(key), chunks[i].old);
+            redis_append("GET %s", key);
+        }
+    }
+
+    /**
+     * Then merge our data into them.
+     */
+    done = 0;
+    for (i = 0; i < count; i++)
+    {
+        long start = (i == 0) ? (offset % _g_chunk_size) : 0;
+        size_t len = _g_chunk_size - start;
+        size_t have = 0;
+        char *data = NULL;
+
+        if (len > size - done)
+            len = size - done;
+
+        if ((chunks[i].old != NULL) &&
+            ((start != 0) || (len != _g_chunk_size)))
+        {
+            redis_get_reply(&old[i]);
+            if ((old[i] != NULL) && (old[i]->type == REDIS_REPLY_STRING))
+                data = codec_decode(old[i]->str, old[i]->len, _g_chunk_size,
+                                    &have);
+        }
+
+        if (data != NULL)
+            memcpy(chunks[i].data, data, have);
+        memcpy(chunks[i].data + start, buf + done, len);
+        chunks[i].len = (have > start + len) ? have : (start + len);
+
+        free(data);
+        done += len;
+    }
+
+    store_blocks(inode, chunks, count);
+
+    /**
+     * Don't store mtime if --fast is used, and leave it for later if
+     * --time-delay is.
+     */
+    if (!_g_fast && !defer_times(inode, TIMES_MTIME, time(NULL)))
+    {
+        append_set_meta(inode, "MTIME %d", time(NULL));
+        replies += 1;
+    }
+
+    if (end > old_size)
+    {
+        append_set_meta(inode, "SIZE %lld", end);
+        replies += 1;
+    }
+
+    while (replies-- > 0)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+  done:
+    for (i = 0; i < count; i++)
+    {
+        if (chunks != NULL)
+            free(chunks[i].data);
+        if (old != NULL)
+            redis_free_reply(old[i]);
+    }
+    free(chunks);
+    free(old);
+    redis_free_reply(blocks);
+}
+
+
+/**
+ * The name of the file holding the spilled contents of an inode, or
+ * NULL if they're in redis.  The caller must free it.
+ */
+char *
+get_spill(long long inode)
+{
+    redisReply *reply = get_meta(inode, "SPILL");
+    char *name = NULL;
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        name = strdup(reply->str);
+    redis_free_reply(reply);
+
+    return (name);
+}
+
+
+/**
+ * Is the named file ours to change or remove?  It isn't if a snapshot
+ * may see it, or if it came with keys copied from another filesystem.
+ */
+int
+owns_spill(long long inode, const char *name)
+{
+    long long generation = spill_generation(name);
+    char own[SPILL_NAME];
+
+    if ((generation < 0) || (generation < cow_generation()))
+        return 0;
+
+    if (spill_name(own, sizeof(own), _g_prefix, inode, generation) != 0)
+        return 0;
+
+    return (strcmp(own, name) == 0);
+}
+
+
+/**
+ * Make the spilled contents of an inode ours to change, copying the
+ * file holding them if need be, or starting afresh with an empty file
+ * if the contents are about to be thrown away.
+ *
+ * Returns the name of the file, which the caller must free, or NULL on
+ * failure.  The name given is freed.
+ */
+char *
+own_spill(long long inode, char *name, int copy)
+{
+    char fresh[SPILL_NAME];
+    int ret;
+
+    if (owns_spill(inode, name))
+        return (name);
+
+    if (spill_name(fresh, sizeof(fresh), _g_prefix, inode,
+                   cow_generation()) != 0)
+    {
+        free(name);
+        return (NULL);
+    }
+
+    if (_g_debug)
+        fprintf(stderr, "own_spill(%lld) %s -> %s\n", inode, name, fresh);
+
+    if (copy)
+        ret = spill_copy(_g_spill_dir, name, fresh);
+    else if ((ret = spill_remove(_g_spill_dir, fresh)) == 0)
+        ret = spill_write(_g_spill_dir, fresh, "", 0, 0);
+
+    if (ret < 0)
+    {
+        fprintf(stderr, "Failed to copy %s/%s: %s\n", _g_spill_dir, name,
+                strerror(-ret));
+        free(name);
+        return (NULL);
+    }
+
+    set_meta(inode, "SPILL %s", fresh);
+    free(name);
+
+    return (strdup(fresh));
+}
+
+
+/**
+ * Move the contents of an inode out of redis, into a file of its own.
+ *
+ * Returns the name of the file, which the caller must free, or NULL on
+ * failure.
+ */
+char *
+spill_data(long long inode)
+{
+    redisReply *reply = NULL;
+    char name[SPILL_NAME];
+    ssize_t ret;
+
+    if (spill_name(name, sizeof(name), _g_prefix, inode,
+                   cow_generation()) != 0)
+        return (NULL);
+
+    if (_g_debug)
+        fprintf(stderr, "spill_data(%lld) -> %s\n", inode, name);
+
+    reply = redis_command("GET %s:DATA", inode_key(_g_prefix, inode));
+
+    spill_remove(_g_spill_dir, name);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        ret = spill_write(_g_spill_dir, name, reply->str, reply->len, 0);
+    else
+        ret = spill_write(_g_spill_dir, name, "", 0, 0);
+    redis_free_reply(reply);
+
+    if (ret < 0)
+    {
+        fprintf(stderr, "Failed to write %s/%s: %s\n", _g_spill_dir, name,
+                strerror(-ret));
+        return (NULL);
+    }
+
+    /**
+     * Only once the file is complete does the inode point to it.
+     */
+    append_set_meta(inode, "SPILL %s", name);
+    redis_append("DEL %s:DATA", inode_key(_g_prefix, inode));
+
+    redis_get_reply(&reply);
+    redis_free_reply(reply);
+    redis_get_reply(&reply);
+    redis_free_reply(reply);
+
+    return (strdup(name));
+}
+
+
+/**
+ * Write data to an inode whose contents are, or are about to be, kept
+ * on disk.
+ *
+ * Returns 1 if the contents are in redis, and should be written there,
+ * otherwise 0.
+ */
+int
+write_spilled(long long inode, const char *buf, size_t size, off_t offset)
+{
+    redisReply *reply = NULL;
+    long long old_size = 0;
+    long long end = offset + size;
+    const char *val;
+    char *name = NULL;
+    ssize_t ret;
+    int mtime;
+
+    reply = get_meta(inode, "SIZE SPILL");
+    if ((val = meta_value(reply, 0)) != NULL)
+        old_size = atoll(val);
+    if ((val = meta_value(reply, 1)) != NULL)
+        name = strdup(val);
+    redis_free_reply(reply);
+
+    if (name == NULL)
+    {
+        if (end <= _g_spill_size)
+            return 1;
+
+        name = spill_data(inode);
+    }
+    else
+    {
+        name = own_spill(inode, name, 1);
+    }
+
+    if (name == NULL)
+        return 0;
+
+    ret = spill_write(_g_spill_dir, name, buf, size, offset);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Failed to write %s/%s: %s\n", _g_spill_dir, name,
+                strerror(-ret));
+        free(name);
+        return 0;
+    }
+    free(name);
+
+    /**
+     * Update the size, if we grew, and the mtime unless --fast is used
+     * or it is left for later.
+     */
+    mtime = !_g_fast && !defer_times(inode, TIMES_MTIME, time(NULL));
+
+    if ((end > old_size) && mtime)
+        set_meta(inode, "SIZE %lld MTIME %d", end, time(NULL));
+    else if (end > old_size)
+        set_meta(inode, "SIZE %lld", end);
+    else if (mtime)
+        set_meta(inode, "MTIME %d", time(NULL));
+
+    return 0;
+}
+
+
+/**
+ * Write data to the given inode.
+ *
+ * With the chunked layout each affected chunk is updated via SETRANGE,
+ * along with a fetch of the current size, in a single round-trip.
+ * Otherwise the single DATA value is updated in the same way.  A second
+ * round-trip is only needed when the file grows.
+ *
+ * Files which are kept on disk, or which have grown large enough to be,
+ * are written there instead.
+ */
+void
+write_data(long long inode, const char *buf, size_t size, off_t offset)
+{
+    redisReply *reply = NULL;
+    long long old_size = 0;
+    long long end = offset + size;
+    int count = 0;
+
+    if (size == 0)
+        return;
+
+    /**
+     * Concurrent writers to the same file must not race when they
+     * update its size.
+     */
+    lock_inode(inode);
+    preserve_inode(inode);
+
+    if (_g_dedup || _g_compressed)
+    {
+        if (_g_dedup)
+            write_dedup(inode, buf, size, offset);
+        else
+            write_framed(inode, buf, size, offset);
+
+        cache_invalidate_stat(inode);
+        pagecache_invalidate(inode);
+        unlock_inode(inode);
+        return;
+    }
+
+    if (_g_spill && (write_spilled(inode, buf, size, offset) == 0))
+    {
+        cache_invalidate_stat(inode);
+        pagecache_invalidate(inode);
+        unlock_inode(inode);
+        return;
+    }
+
+    append_get_meta(inode, "SIZE");
+
+    if (_g_chunk_size > 0)
+    {
+        long first = offset / _g_chunk_size;
+        long last = (end - 1) / _g_chunk_size;
+        long idx;
+        size_t done = 0;
+
+        if (_g_debug)
+            fprintf(stderr, "write_data->chunked(%lld) [%ld-%ld];\n", inode,
+                    first, last);
+
+        for (idx = first; idx <= last; idx++)
+        {
+            long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+            size_t len = _g_chunk_size - start;
+            char key[128];
+
+            if (len > size - done)
+                len = size - done;
+
+            chunk_key(key, sizeof(key), inode, idx);
+
+            /**
+             * A whole chunk of zeros is left as a hole, which reads back
+             * as zeros without being stored.
+             */
+            if ((len == _g_chunk_size) && is_zeros(buf + done, len))
+                redis_append("DEL %s", key);
+            else
+                append_setrange(key, start, buf + done, len);
+            done += len;
+            count += 1;
+        }
+    }
+    else
+    {
+        char key[128];
+
+        if (_g_debug)
+            fprintf(stderr, "write_data->offsetted(%lld);\n", inode);
+
+        snprintf(key, sizeof(key), "%s:DATA", inode_key(_g_prefix, inode));
+        append_setrange(key, offset, buf, size);
+        count += 1;
+    }
+
+    /**
+     * Don't store mtime if --fast is used, and leave it for later if
+     * --time-delay is.
+     */
+    if (!_g_fast && !defer_times(inode, TIMES_MTIME, time(NULL)))
+    {
+        append_set_meta(inode, "MTIME %d", time(NULL));
+        count += 1;
+    }
+
+    /**
+     * The current size, followed by the replies to our updates.
+     */
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        old_size = atoll(reply->str);
+    redis_free_reply(reply);
+
+    while (count-- > 0)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    /**
+     * Now update the size, if we grew.
+     */
+    if (end > old_size)
+    {
+        set_meta(inode, "SIZE %lld", end);
+    }
+
+    cache_invalidate_stat(inode);
+    pagecache_invalidate(inode);
+
+    unlock_inode(inode);
+}
+
+
+/**
+ * Record a newly opened file in the given file information.
+ *
+ * Files opened for writing are given a write buffer, if those are in
+ * use, and every file is tracked if we're caching what we read.
+ */
+void
+attach_open_file(struct fuse_file_info *fi, long long inode)
+{
+    open_file *f = NULL;
+    int buffered = 0;
+
+    if (fi == NULL)
+        return;
+
+    if ((_g_write_buffer > 0) && ((fi->flags & O_ACCMODE) != O_RDONLY))
+        buffered = 1;
+
+    if (!buffered && !pagecache_enabled())
+        return;
+
+    f = malloc(sizeof(open_file));
+    if (f == NULL)
+        return;
+
+    memset(f, 0, sizeof(open_file));
+
+    if (buffered && (wbuf_init(&f->wb, _g_write_buffer) != 0))
+    {
+        free(f);
+        return;
+    }
+
+    f->inode = inode;
+    pthread_mutex_init(&f->lock, NULL);
+
+    pthread_mutex_lock(&_g_open_lock);
+    f->next = _g_open_files;
+    _g_open_files = f;
+    pthread_mutex_unlock(&_g_open_lock);
+
+    fi->fh = (uintptr_t) f;
+}
+
+
+/**
+ * Write out the buffered data of an open file, the lock of which must
+ * be held.
+ */
+void
+flush_open_file(open_file * f)
+{
+    if (wbuf_pending(&f->wb))
+    {
+        write_data(f->inode, f->wb.data, f->wb.len, f->wb.offset);
+        wbuf_clear(&f->wb);
+    }
+}
+
+
+/**
+ * Write out the buffered data of every open file, or those which have
+ * waited too long.
+ */
+void
+flush_open_files(int due_only)
+{
+    open_file *f;
+    long long now = now_ms();
+
+    pthread_mutex_lock(&_g_open_lock);
+
+    for (f = _g_open_files; f != NULL; f = f->next)
+    {
+        pthread_mutex_lock(&f->lock);
+        if (!due_only || wbuf_due(&f->wb, now, _g_write_delay))
+            flush_open_file(f);
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    pthread_mutex_unlock(&_g_open_lock);
+}
+
+
+/**
+ * Write out the buffered data of every handle open on the given inode,
+ * so that it may be read or truncated.
+ */
+void
+flush_inode(long long inode)
+{
+    open_file *f;
+
+    if (_g_write_buffer <= 0)
+        return;
+
+    pthread_mutex_lock(&_g_open_lock);
+
+    for (f = _g_open_files; f != NULL; f = f->next)
+    {
+        if (f->inode != inode)
+            continue;
+
+        pthread_mutex_lock(&f->lock);
+        flush_open_file(f);
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    pthread_mutex_unlock(&_g_open_lock);
+}
+
+
+/**
+ * Throw away the buffered data of every handle open on the given
+ * inode, and any of its contents we've cached, as it is being removed.
+ */
+void
+discard_writes(long long inode)
+{
+    open_file *f;
+
+    pagecache_invalidate(inode);
+
+    if (_g_write_buffer <= 0)
+        return;
+
+    pthread_mutex_lock(&_g_open_lock);
+
+    for (f = _g_open_files; f != NULL; f = f->next)
+    {
+        if (f->inode != inode)
+            continue;
+
+        pthread_mutex_lock(&f->lock);
+        wbuf_clear(&f->wb);
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    pthread_mutex_unlock(&_g_open_lock);
+}
+
+
+/**
+ * Grow the size reported for an inode to cover any data which is
+ * still buffered.
+ */
+void
+apply_pending_size(long long inode, struct stat *stbuf)
+{
+    open_file *f;
+
+    if (_g_write_buffer <= 0)
+        return;
+
+    pthread_mutex_lock(&_g_open_lock);
+
+    for (f = _g_open_files; f != NULL; f = f->next)
+    {
+        if (f->inode != inode)
+            continue;
+
+        pthread_mutex_lock(&f->lock);
+        if (wbuf_pending(&f->wb) && (wbuf_end(&f->wb) > stbuf->st_size))
+            stbuf->st_size = wbuf_end(&f->wb);
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    pthread_mutex_unlock(&_g_open_lock);
+}
+
+
+/**
+ * Periodically write out data which has waited too long in the buffers
+ * of open files.
+ */
+void *
+write_flusher(void *arg)
+{
+    long interval = _g_write_delay / 2;
+
+    if (interval < 10)
+        interval = 10;
+
+    while (1)
+    {
+        usleep(interval * 1000);
+
+        redis_acquire();
+        flush_open_files(1);
+        redis_release();
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Read data from the given inode, on a filesystem whose files may be
+ * compressed.
+ *
+ * Each chunk covering the range is fetched whole, along with the size
+ * and codec of the file, and decoded if need be.
+ */
+size_t
+read_framed(long long inode, char *buf, size_t size, off_t offset)
+{
+    redisReply *reply = NULL;
+    long first = offset / _g_chunk_size;
+    long last = (offset + size - 1) / _g_chunk_size;
+    long long sz = 0;
+    size_t avail = 0;
+    size_t pos = 0;
+    long idx;
+    int codec;
+
+    append_get_meta(inode, "SIZE CODEC");
+
+    for (idx = first; idx <= last; idx++)
+    {
+        char key[128];
+
+        chunk_key(key, sizeof(key), inode, idx);
+        redis_append("GET %s", key);
+    }
+
+    redis_get_reply(&reply);
+    if (meta_value(reply, 0) != NULL)
+        sz = atoll(meta_value(reply, 0));
+    codec = codec_of(meta_value(reply, 1));
+    redis_free_reply(reply);
+
+    if (offset < sz)
+        avail = ((offset + size) > sz) ? (sz - offset) : size;
+    memset(buf, '\0', avail);
+
+    for (idx = first; idx <= last; idx++)
+    {
+        long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+        long stop = (idx == last) ?
+            ((offset + size - 1) % _g_chunk_size) : (_g_chunk_size - 1);
+        size_t len = stop - start + 1;
+        const char *data = NULL;
+        char *decoded = NULL;
+        size_t have = 0;
+
+        redis_get_reply(&reply);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        {
+            if (codec == CODEC_NONE)
+            {
+                data = reply->str;
+                have = reply->len;
+            }
+            else
+            {
+                decoded = codec_decode(reply->str, reply->len,
+                                       _g_chunk_size, &have);
+                data = decoded;
+
+                if ((decoded == NULL) && _g_debug)
+                    fprintf(stderr, "Corrupt chunk %ld of inode %lld\n", idx,
+                            inode);
+            }
+        }
+
+        if ((data != NULL) && (pos < avail) && (have > start))
+        {
+            size_t copy = have - start;
+
+            if (copy > len)
+                copy = len;
+            if (copy > avail - pos)
+                copy = avail - pos;
+            memcpy(buf + pos, data + start, copy);
+        }
+
+        free(decoded);
+        redis_free_reply(reply);
+        pos += len;
+    }
+
+    return avail;
+}
+
+
+/**
+ * Read data from the given inode, on a filesystem whose files are
+ * stored as shared blocks.
+ *
+ * The digests of the blocks covering the range are fetched along with
+ * the size of the file, and then the blocks themselves.
+ */
+size_t
+read_dedup(long long inode, char *buf, size_t size, off_t offset)
+{
+    redisReply *blocks = NULL;
+    redisReply *reply = NULL;
+    long first = offset / _g_chunk_size;
+    long last = (offset + size - 1) / _g_chunk_size;
+    long long sz = 0;
+    size_t avail = 0;
+    size_t pos = 0;
+    long i;
+
+    if (append_get_blocks(inode, first, last) != 0)
+        return 0;
+    append_get_meta(inode, "SIZE");
+
+    redis_get_reply(&blocks);
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        sz = atoll(reply->str);
+    redis_free_reply(reply);
+
+    if (offset < sz)
+        avail = ((offset + size) > sz) ? (sz - offset) : size;
+    memset(buf, '\0', avail);
+
+    if (avail == 0)
+    {
+        redis_free_reply(blocks);
+        return 0;
+    }
+
+    for (i = 0; i <= last - first; i++)
+    {
+        const char *digest = meta_value(blocks, i);
+        char key[128];
+
+        if (digest == NULL)
+            continue;
+
+        block_key(key, sizeof(key), digest);
+        redis_append("GET %s", key);
+    }
+
+    for (i = 0; i <= last - first; i++)
+    {
+        long start = (i == 0) ? (offset % _g_chunk_size) : 0;
+        long stop = (i == last - first) ?
+            ((offset + size - 1) % _g_chunk_size) : (_g_chunk_size - 1);
+        size_t len = stop - start + 1;
+        char *data = NULL;
+        size_t have = 0;
+
+        if (meta_value(blocks, i) == NULL)
+        {
+            pos += len;
+            continue;
+        }
+
+        redis_get_reply(&reply);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        {
+            data = codec_decode(reply->str, reply->len, _g_chunk_size,
+                                &have);
+            if ((data == NULL) && _g_debug)
+                fprintf(stderr, "Corrupt block %s\n", meta_value(blocks, i));
+        }
+
+        if ((data != NULL) && (pos < avail) && (have > start))
+        {
+            size_t copy = have - start;
+
+            if (copy > len)
+                copy = len;
+            if (copy > avail - pos)
+                copy = avail - pos;
+            memcpy(buf + pos, data + start, copy);
+        }
+
+        free(data);
+        redis_free_reply(reply);
+        pos += len;
+    }
+
+    redis_free_reply(blocks);
+    return avail;
+}
+
+
+/**
+ * Read from the given inode.
+ *
+ * The size of the file is fetched in the same round-trip as the data,
+ * and with the chunked layout only the chunks covering the requested
+ * range are fetched.  Anything which isn't stored reads as zeros.
+ *
+ * Returns the number of bytes read, which is short at the end of the
+ * file.
+ */
+size_t
+read_data(long long inode, char *buf, size_t size, off_t offset)
+{
+    redisReply *reply = NULL;
+    long long sz = 0;
+    size_t avail = 0;
+    char *spilled = NULL;
+
+    if (_g_dedup)
+        return (read_dedup(inode, buf, size, offset));
+    if (_g_compressed)
+        return (read_framed(inode, buf, size, offset));
+
+    /**
+     * Get the current file size, and where the contents are if they've
+     * been spilled to disk.
+     */
+    append_get_meta(inode, _g_spill ? "SIZE SPILL" : "SIZE");
+
+    if (_g_chunk_size > 0)
+    {
+        long first = offset / _g_chunk_size;
+        long last = (offset + size - 1) / _g_chunk_size;
+        long idx;
+        size_t pos = 0;
+
+        for (idx = first; idx <= last; idx++)
+        {
+            long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+            long stop = (idx == last) ?
+                ((offset + size - 1) % _g_chunk_size) : (_g_chunk_size - 1);
+
+            redis_append("GETRANGE %s:INODE:%lld:CHUNK:%ld %ld %ld",
+                         inode_prefix(inode), inode, idx, start, stop);
+        }
+
+        redis_get_reply(&reply);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            sz = atoll(reply->str);
+        redis_free_reply(reply);
+
+        if (offset < sz)
+            avail = ((offset + size) > sz) ? (sz - offset) : size;
+        memset(buf, '\0', avail);
+
+        /**
+         * Copy the data into the callee's buffer.
+         */
+        for (idx = first; idx <= last; idx++)
+        {
+            long start = (idx == first) ? (offset % _g_chunk_size) : 0;
+            long stop = (idx == last) ?
+                ((offset + size - 1) % _g_chunk_size) : (_g_chunk_size - 1);
+            size_t len = stop - start + 1;
+
+            redis_get_reply(&reply);
+            if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
+                (pos < avail))
+            {
+                size_t copy = reply->len;
+                if (copy > avail - pos)
+                    copy = avail - pos;
+                memcpy(buf + pos, reply->str, copy);
+            }
+            redis_free_reply(reply);
+
+            pos += len;
+        }
+    }
+    else
+    {
+        redis_append("GETRANGE %s:DATA %lld %lld",
+                     inode_key(inode_prefix(inode), inode),
+                     (long long)offset, (long long)(offset + size - 1));
+
+        redis_get_reply(&reply);
+        if (_g_spill)
+        {
+            const char *val;
+
+            if ((val = meta_value(reply, 0)) != NULL)
+                sz = atoll(val);
+            if ((val = meta_value(reply, 1)) != NULL)
+                spilled = strdup(val);
+        }
+        else if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            sz = atoll(reply->str);
+        redis_free_reply(reply);
+
+        redis_get_reply(&reply);
+
+        /**
+         * Spilled contents are read from their file, and there is nothing
+         * in redis.
+         */
+        if (spilled != NULL)
+        {
+            ssize_t got;
+
+            redis_free_reply(reply);
+
+            if (offset < sz)
+                avail = ((offset + size) > sz) ? (sz - offset) : size;
+            memset(buf, '\0', avail);
+
+            got = spill_read(_g_spill_dir, spilled, buf, avail, offset);
+            if (got < 0)
+                fprintf(stderr, "Failed to read %s/%s: %s\n", _g_spill_dir,
+                        spilled, strerror(-got));
+
+            free(spilled);
+            return avail;
+        }
+
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR))
+        {
+            /**
+             * GETRANGE was renamed - so we'll free the previous command
+             * and retry under the old name.
+             */
+            redis_free_reply(reply);
+
+            reply =
+                redis_command("SUBSTR %s:DATA %lld %lld",
+                              inode_key(inode_prefix(inode), inode),
+                              (long long)offset,
+                              (long long)(offset + size - 1));
+        }
+
+        if (offset < sz)
+            avail = ((offset + size) > sz) ? (sz - offset) : size;
+        memset(buf, '\0', avail);
+
+        /**
+         * Copy the data into the callee's buffer.
+         */
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            memcpy(buf, reply->str, (reply->len < avail) ? reply->len : avail);
+
+        redis_free_reply(reply);
+    }
+
+    return avail;
+}
+
+
+/**
+ * Read a run of pages of the given inode into the read cache.
+ *
+ * This is done beneath the lock of the inode, so that a write can't
+ * slip in between our read and the pages being stored.
+ */
+void
+fetch_pages(long long inode, long first, long count)
+{
+    size_t page = pagecache_page_size();
+    size_t got;
+    long i;
+    char *buf;
+
+    if (count <= 0)
+        return;
+
+    buf = malloc(page * count);
+    if (buf == NULL)
+        return;
+
+    if (_g_debug)
+        fprintf(stderr, "fetch_pages(%lld) [%ld+%ld];\n", inode, first, count);
+
+    lock_inode(inode);
+
+    got = read_data(inode, buf, page * count, (off_t)first * page);
+
+    /**
+     * A short page, perhaps empty, marks the end of the file.
+     */
+    for (i = 0; (i < count) && ((size_t)i * page <= got); i++)
+    {
+        size_t len = got - i * page;
+        if (len > page)
+            len = page;
+
+        pagecache_put(inode, first + i, buf + i * page, len);
+
+        if (len < page)
+            break;
+    }
+
+    unlock_inode(inode);
+
+    free(buf);
+}
+
+
+/**
+ * Queue a run of pages to be read ahead by the prefetch thread.
+ *
+ * If the queue is full the request is dropped; the reader will fetch
+ * the pages itself when it gets to them.
+ */
+void
+queue_prefetch(long long inode, long first, long count)
+{
+    pthread_mutex_lock(&_g_prefetch_lock);
+
+    if (_g_prefetch_count < PREFETCH_QUEUE)
+    {
+        prefetch_request *r =
+            &_g_prefetch[(_g_prefetch_head + _g_prefetch_count) %
+                         PREFETCH_QUEUE];
+        r->inode = inode;
+        r->first = first;
+        r->count = count;
+        _g_prefetch_count += 1;
+        pthread_cond_signal(&_g_prefetch_cond);
+    }
+
+    pthread_mutex_unlock(&_g_prefetch_lock);
+}
+
+
+/**
+ * Read ahead of sequential readers, in the background.
+ */
+void *
+prefetcher(void *arg)
+{
+    prefetch_request r;
+
+    while (1)
+    {
+        pthread_mutex_lock(&_g_prefetch_lock);
+        while (_g_prefetch_count == 0)
+            pthread_cond_wait(&_g_prefetch_cond, &_g_prefetch_lock);
+
+        r = _g_prefetch[_g_prefetch_head];
+        _g_prefetch_head = (_g_prefetch_head + 1) % PREFETCH_QUEUE;
+        _g_prefetch_count -= 1;
+        pthread_mutex_unlock(&_g_prefetch_lock);
+
+        /**
+         * Skip anything the reader has already fetched.
+         */
+        while ((r.count > 0) && pagecache_contains(r.inode, r.first))
+        {
+            r.first += 1;
+            r.count -= 1;
+        }
+
+        if (r.count == 0)
+            continue;
+
+        redis_acquire_reader();
+        redis_alive();
+        fetch_pages(r.inode, r.first, r.count);
+        redis_release();
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Read from the given inode via the read cache.
+ *
+ * Reads which follow on from the last one made through the same handle
+ * double the readahead window, up to the --readahead limit, and anything
+ * else resets it.  Cache misses fetch the whole window in one go, and
+ * sequential readers have the next window fetched in the background
+ * while they consume this one.
+ */
+size_t
+cached_read(open_file * f, long long inode, char *buf, size_t size, off_t offset)
+{
+    size_t page = pagecache_page_size();
+    size_t window = size;
+    size_t done = 0;
+    size_t len = 0;
+    off_t pos = offset;
+    long prefetched = 0;
+    long hits = 0;
+    long misses = 0;
+    long ahead;
+    int sequential = 0;
+    char *tmp;
+
+    if (f != NULL)
+    {
+        pthread_mutex_lock(&f->lock);
+
+        if ((offset == f->next_read) && (_g_readahead > 0))
+        {
+            sequential = 1;
+            f->window = (f->window < size) ? size : f->window * 2;
+            if (f->window > (size_t)_g_readahead)
+                f->window = _g_readahead;
+        }
+        else
+        {
+            f->window = size;
+            f->prefetched = 0;
+        }
+
+        f->next_read = offset + size;
+        if (f->window > window)
+            window = f->window;
+        prefetched = f->prefetched;
+
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    tmp = malloc(page);
+    if (tmp == NULL)
+        return (read_data(inode, buf, size, offset));
+
+    ahead = (window + page - 1) / page;
+
+    while (done < size)
+    {
+        long idx = pos / page;
+        size_t in = pos % page;
+        size_t n;
+
+        if (pagecache_get(inode, idx, tmp, &len))
+        {
+            stats_cache(STATS_CACHE_PAGE, 1);
+            hits += 1;
+        }
+        else
+        {
+            long count = (in + (size - done) + page - 1) / page;
+
+            stats_cache(STATS_CACHE_PAGE, 0);
+            misses += 1;
+            if (count < ahead)
+                count = ahead;
+
+            fetch_pages(inode, idx, count);
+            if (idx + count > prefetched)
+                prefetched = idx + count;
+
+            /**
+             * If the pages couldn't be cached read directly.
+             */
+            if (!pagecache_get(inode, idx, tmp, &len))
+            {
+                done += read_data(inode, buf + done, size - done, pos);
+                len = 0;
+                break;
+            }
+        }
+
+        if (in >= len)
+            break;
+
+        n = len - in;
+        if (n > size - done)
+            n = size - done;
+
+        memcpy(buf + done, tmp + in, n);
+        done += n;
+        pos += n;
+
+        if (len < page)
+            break;
+    }
+
+    free(tmp);
+
+    /**
+     * Keep a window ahead of a sequential reader, unless we've seen
+     * the end of the file.
+     */
+    if (sequential && (len == page))
+    {
+        long next = (pos + page - 1) / page;
+
+        if (prefetched < next)
+            prefetched = next;
+
+        if (prefetched < next + ahead)
+        {
+            queue_prefetch(inode, prefetched, next + ahead - prefetched);
+            prefetched = next + ahead;
+        }
+    }
+
+    if (f != NULL)
+    {
+        pthread_mutex_lock(&f->lock);
+        f->prefetched = prefetched;
+        f->hits += hits;
+        f->misses += misses;
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    return (done);
+}
+
+
+/**
+ * Called when our filesystem is created.
+ *
+ * Connections to redis are established lazily, by the threads which
+ * need them.
+ */
+void *
+fs_init()
+{
+    if (_g_debug)
+        fprintf(stderr, "fs_init()\n");
+
+    /**
+     * Start the event loop which drives our shared connection.  If we
+     * can't, we fall back to the pool.
+     */
+    if (_g_async)
+    {
+        if (engine_start(_g_redis_host, _g_redis_port) != 0)
+            fprintf(stderr, "Failed to start the async engine; using the connection pool.\n");
+    }
+
+    /**
+     * Start writing out buffered data which has waited too long.
+     */
+    if (_g_write_buffer > 0)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, write_flusher, NULL) == 0)
+            pthread_detach(tid);
+        else
+            fprintf(stderr, "Failed to start the write flusher.\n");
+    }
+
+    /**
+     * Start writing out timestamps which have waited too long.
+     */
+    if (_g_time_delay > 0)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, time_flusher, NULL) == 0)
+            pthread_detach(tid);
+        else
+            fprintf(stderr, "Failed to start the timestamp flusher.\n");
+    }
+
+    /**
+     * Start freeing the contents of directories which were removed
+     * whole, by us or by an earlier mount.
+     */
+    if (!_g_read_only)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, reclaimer, NULL) == 0)
+            pthread_detach(tid);
+        else
+            fprintf(stderr, "Failed to start the reclaim thread.\n");
+    }
+
+    /**
+     * Start reading ahead of sequential readers.
+     */
+    if (_g_readahead > 0)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, prefetcher, NULL) == 0)
+            pthread_detach(tid);
+        else
+            fprintf(stderr, "Failed to start the prefetch thread.\n");
+    }
+
+    /**
+     * Start listening for changes made by other mounts.
+     */
+    if (cache_enabled() && _g_cache_notify)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, cache_listener, NULL) == 0)
+            pthread_detach(tid);
+        else
+            fprintf(stderr, "Failed to start the notification listener.\n");
+    }
+
+    return 0;
+}
+
+
+/**
+ * This is called when our filesystem is destroyed.
+ *
+ * Close our connections, and destroy our locks.
+ */
+void
+fs_destroy()
+{
+    int i;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_destroy()\n");
+
+    /**
+     * Write out anything still buffered.
+     */
+    if (_g_write_buffer > 0)
+    {
+        redis_acquire();
+        flush_open_files(0);
+        redis_release();
+    }
+
+    /**
+     * And any timestamps left for later.
+     */
+    if (_g_time_delay > 0)
+    {
+        redis_acquire();
+        flush_times(0);
+        redis_release();
+    }
+
+    engine_stop();
+
+    pthread_mutex_lock(&_g_pool_lock);
+    for (i = 0; i < _g_pool_free; i++)
+    {
+        if (_g_pool[i] != NULL)
+            redisFree(_g_pool[i]);
+        _g_pool[i] = NULL;
+
+        if (_g_cluster_pool != NULL)
+        {
+            cluster_free(_g_cluster_pool[i]);
+            _g_cluster_pool[i] = NULL;
+        }
+
+        if ((_g_replica_pool != NULL) && (_g_replica_pool[i] != NULL))
+        {
+            redisFree(_g_replica_pool[i]);
+            _g_replica_pool[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_g_pool_lock);
+
+    for (i = 0; i < LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&_g_stripes[i]);
+
+    backend_stop();
+}
+
+
+/**
+ * Remove all meta-data associated with an INODE.
+ *
+ * e.g. size, owner, mtime, ctime.
+ */
+void
+remove_inode(long long inode)
+{
+    redisReply *reply = NULL;
+    char *spilled = NULL;
+
+    const char *argv[20];
+    size_t argvlen[20];
+    char keys[20][64];
+    int argc = 0;
+    int i = 0;
+
+
+    /**
+     * Can't happen.
+     */
+    if (inode < 0)
+    {
+        fprintf(stderr, "Tried to free an unset inode.\n");
+        return;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may still need it.
+     */
+    preserve_inode(inode);
+
+    /**
+     * Forget anything we've cached about it.
+     */
+    cache_invalidate_stat(inode);
+    cache_invalidate_entry(inode);
+
+    /**
+     * Anything still buffered for it must never be written.
+     */
+    discard_writes(inode);
+    discard_times(inode);
+
+    /**
+     * Remove the contents, if they're stored in chunks, or let go of
+     * them if they're shared.
+     */
+    if (_g_dedup)
+    {
+        reply = redis_command("HVALS %s:BLOCKS", inode_key(_g_prefix, inode));
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+            (reply->elements > 0))
+        {
+            const char **digests = calloc(reply->elements, sizeof(char *));
+
+            if (digests != NULL)
+            {
+                for (i = 0; i < reply->elements; i++)
+                    digests[i] = reply->element[i]->str;
+                release_blocks(digests, reply->elements);
+                free(digests);
+            }
+        }
+        redis_free_reply(reply);
+    }
+    else if (_g_chunk_size > 0)
+    {
+        long long size = get_size(inode);
+
+        if (size > 0)
+            delete_chunks(inode, 0, (size - 1) / _g_chunk_size);
+    }
+
+    /**
+     * Find any file holding the contents, before the meta-data naming
+     * it is removed.
+     */
+    if (_g_spill)
+        spilled = get_spill(inode);
+
+    /**
+     * Remove the meta-data, and the contents, with a single command.
+     */
+    argv[argc++] = "DEL";
+
+    if (_g_schema == SCHEMA_HASH)
+    {
+        snprintf(keys[argc], sizeof(keys[argc]), "%s",
+                 inode_key(_g_prefix, inode));
+        argv[argc] = keys[argc];
+        argc += 1;
+    }
+    else
+    {
+        for (i = 0; _g_fields[i] != NULL; i++)
+        {
+            snprintf(keys[argc], sizeof(keys[argc]), "%s:%s",
+                     inode_key(_g_prefix, inode), _g_fields[i]);
+            argv[argc] = keys[argc];
+            argc += 1;
+        }
+    }
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:DATA",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:BLOCKS",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:XATTR",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    for (i = 0; i < argc; i++)
+        argvlen[i] = strlen(argv[i]);
+
+    reply = redis_command_argv(argc, argv, argvlen);
+    redis_free_reply(reply);
+
+    /**
+     * A file which a snapshot may see is left for it.
+     */
+    if ((spilled != NULL) && owns_spill(inode, spilled))
+        spill_remove(_g_spill_dir, spilled);
+    free(spilled);
+}
+
+
+/**
+ * Bump the access-time of a cached inode, if present.
+ *
+ * Opening a file shouldn't throw away its cached attributes.
+ */
+void
+update_cached_atime(long long inode)
+{
+    struct stat st;
+
+    if (cache_get_stat(inode, &st))
+    {
+        st.st_atime = time(NULL);
+        cache_update_stat(inode, &st);
+    }
+}
+
+
+/**
+ * Has the access time of an inode fallen behind its modification time,
+ * or a day behind now?  Only then does --atime=relatime update it.
+ */
+int
+atime_stale(long long inode, time_t now)
+{
+    struct stat st;
+
+    memset(&st, 0, sizeof(st));
+
+    if ((times_apply(inode, &st) != (TIMES_ATIME | TIMES_MTIME)) &&
+        !cache_get_stat(inode, &st))
+    {
+        redisReply *reply = get_meta(inode, "ATIME MTIME");
+        const char *val;
+
+        if ((val = meta_value(reply, 0)) != NULL)
+            st.st_atime = atoi(val);
+        if ((val = meta_value(reply, 1)) != NULL)
+            st.st_mtime = atoi(val);
+        redis_free_reply(reply);
+    }
+
+    times_apply(inode, &st);
+
+    return ((st.st_atime <= st.st_mtime) ||
+            (now - st.st_atime >= 24 * 60 * 60));
+}
+
+
+/**
+ * Note that an inode has been accessed, as --atime asks.
+ */
+void
+touch_atime(long long inode)
+{
+    time_t now = time(NULL);
+
+    if (_g_read_only || (_g_atime == ATIME_NEVER))
+        return;
+
+    if ((_g_atime == ATIME_RELATIVE) && !atime_stale(inode, now))
+        return;
+
+    if (!defer_times(inode, TIMES_ATIME, now))
+        set_meta(inode, "ATIME %ld", (long)now);
+
+    update_cached_atime(inode);
+}
+
+
+/**
+ * Fetch a batch of the members of the DIRENT set of a directory,
+ * starting from the given SSCAN cursor.
+ *
+ * The cursor of the following batch, or zero if there are no more, is
+ * stored in *next.  Servers without SSCAN return every member at once.
+ *
+ * Returns the reply, which must be freed, and points *members at the
+ * array of inodes within it - or at NULL on failure.
+ */
+redisReply *
+get_dirents(long long inode, unsigned long long cursor, unsigned long long *next,
+            redisReply ** members)
+{
+    redisReply *reply = NULL;
+
+    *next = 0;
+    *members = NULL;
+
+    if (!_g_sscan)
+    {
+        reply = redis_command("SMEMBERS %s",
+                              dir_key(inode_prefix(inode), "DIRENT", inode));
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+            *members = reply;
+        return (reply);
+    }
+
+    reply = redis_command("SSCAN %s %llu COUNT %d",
+                          dir_key(inode_prefix(inode), "DIRENT", inode),
+                          cursor, DIRENT_BATCH);
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+        (reply->elements == 2) &&
+        (reply->element[0]->type == REDIS_REPLY_STRING) &&
+        (reply->element[1]->type == REDIS_REPLY_ARRAY))
+    {
+        *next = strtoull(reply->element[0]->str, NULL, 10);
+        *members = reply->element[1];
+    }
+
+    return (reply);
+}
+
+
+/**
+ * Fetch the names of the inodes in the given set of members, in a
+ * single round-trip.
+ *
+ * Returns an array with an entry per member, each of which is NULL if
+ * the name is unknown.  Free it with free_names().
+ */
+char **
+get_names(redisReply *members)
+{
+    redisReply *reply = NULL;
+    char **names = NULL;
+    int i;
+
+    if ((members == NULL) || (members->type != REDIS_REPLY_ARRAY) ||
+        (members->elements == 0))
+        return NULL;
+
+    names = calloc(members->elements, sizeof(char *));
+    if (names == NULL)
+        return NULL;
+
+    /**
+     * The names of tagged inodes live in different slots, so can't be
+     * fetched by a single command.
+     */
+    if ((_g_schema == SCHEMA_HASH) || _g_tags)
+    {
+        for (i = 0; i < members->elements; i++)
+        {
+            long long inode = atoll(members->element[i]->str);
+            const char *key = inode_key(inode_prefix(inode), inode);
+
+            if (_g_schema == SCHEMA_HASH)
+                redis_append("HGET %s NAME", key);
+            else
+                redis_append("GET %s:NAME", key);
+        }
+
+        for (i = 0; i < members->elements; i++)
+        {
+            redis_get_reply(&reply);
+            if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+                names[i] = strdup(reply->str);
+            redis_free_reply(reply);
+        }
+        return (names);
+    }
+
+    const char **argv = malloc(sizeof(char *) * (members->elements + 1));
+    size_t *argvlen = malloc(sizeof(size_t) * (members->elements + 1));
+
+    if ((argv == NULL) || (argvlen == NULL))
+    {
+        free(argv);
+        free(argvlen);
+        free(names);
+        return NULL;
+    }
+
+    argv[0] = "MGET";
+    argvlen[0] = 4;
+    for (i = 0; i < members->elements; i++)
+    {
+        long long inode = atoll(members->element[i]->str);
+        char key[KEY_LENGTH];
+
+        snprintf(key, sizeof(key), "%s:NAME",
+                 inode_key(inode_prefix(inode), inode));
+        argv[i + 1] = strdup(key);
+        argvlen[i + 1] = strlen(key);
+    }
+
+    reply = redis_command_argv(members->elements + 1, argv, argvlen);
+
+    for (i = 0; i < members->elements; i++)
+    {
+        free((char *)argv[i + 1]);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+            (i < reply->elements) && (reply->element[i] != NULL) &&
+            (reply->element[i]->type == REDIS_REPLY_STRING))
+            names[i] = strdup(reply->element[i]->str);
+    }
+
+    if (reply != NULL)
+        redis_free_reply(reply);
+    free(argv);
+    free(argvlen);
+
+    return (names);
+}
+
+
+/**
+ * Fetch the attributes of each member of a DIRENT set, in a single
+ * pipelined batch.
+ *
+ * Returns an array of attributes, in the same order as the members, in
+ * which st_ino is zero for any which couldn't be found.  The caller
+ * must free the array.
+ */
+struct stat *
+get_stats(redisReply *members)
+{
+    redisReply *reply = NULL;
+    struct stat *stats = NULL;
+    int i;
+
+    if ((members == NULL) || (members->type != REDIS_REPLY_ARRAY) ||
+        (members->elements == 0))
+        return NULL;
+
+    stats = calloc(members->elements, sizeof(struct stat));
+    if (stats == NULL)
+        return NULL;
+
+    for (i = 0; i < members->elements; i++)
+        append_get_meta(atoll(members->element[i]->str), STAT_FIELDS);
+
+    for (i = 0; i < members->elements; i++)
+    {
+        redis_get_reply(&reply);
+        if (fill_stat(reply, &stats[i]) == 0)
+            stats[i].st_ino = atoll(members->element[i]->str);
+        redis_free_reply(reply);
+    }
+
+    return (stats);
+}
+
+
+/**
+ * Free the result of get_names().
+ */
+void
+free_names(char **names, int count)
+{
+    int i;
+
+    if (names == NULL)
+        return;
+
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
+
+
+/**
+ * Rebuild the name-index of a directory from its DIRENT set.
+ *
+ * Filesystems created before the DIRNAME hash existed only have the
+ * DIRENT set, so the first lookup inside each such directory falls
+ * back to this scan and migrates the directory.
+ */
+void
+rebuild_directory_index(long long parent_inode)
+{
+    redisReply *reply = NULL;
+    redisReply *members = NULL;
+    unsigned long long cursor = 0;
+    char **names = NULL;
+    int count = 0;
+    int i;
+
+    if (_g_debug)
+        fprintf(stderr, "rebuild_directory_index(%lld)\n", parent_inode);
+
+    lock_inode(parent_inode);
+
+    /**
+     * Replace the index with the entries we find, a batch at a time.
+     */
+    reply = redis_command("DEL %s",
+                          dir_key(_g_prefix, "DIRNAME", parent_inode));
+    redis_free_reply(reply);
+
+    do
+    {
+        reply = get_dirents(parent_inode, cursor, &cursor, &members);
+        if (members == NULL)
+        {
+            redis_free_reply(reply);
+            break;
+        }
+
+        names = get_names(members);
+        count = 0;
+
+        for (i = 0; (names != NULL) && (i < members->elements); i++)
+        {
+            if (names[i] != NULL)
+            {
+                redis_append("HSET %s %s %s",
+                             dir_key(_g_prefix, "DIRNAME", parent_inode),
+                             names[i], members->element[i]->str);
+                count += 1;
+            }
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            redisReply *r = NULL;
+            redis_get_reply(&r);
+            redis_free_reply(r);
+        }
+
+        free_names(names, members->elements);
+        redis_free_reply(reply);
+    }
+    while (cursor != 0);
+
+    unlock_inode(parent_inode);
+}
+
+
+/**
+ * Find the inode of the entry with the given name within a directory.
+ *
+ * Returns -1 if there is no such entry.
+ */
+long long
+find_child(long long parent_inode, const char *entry)
+{
+    long long val = -1;
+    int indexed = 0;
+    int entries = 0;
+    const char *prefix;
+    redisReply *reply = NULL;
+
+    redis_alive();
+
+    /**
+     * Lookup the name, and in the same round-trip fetch the sizes
+     * of the index and of the directory set.  If they disagree the
+     * directory predates the index, and must be migrated.
+     */
+    prefix = inode_prefix(parent_inode);
+    redis_append("HGET %s %s", dir_key(prefix, "DIRNAME", parent_inode),
+                 entry);
+    redis_append("HLEN %s", dir_key(prefix, "DIRNAME", parent_inode));
+    redis_append("SCARD %s", dir_key(prefix, "DIRENT", parent_inode));
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        val = atoll(reply->str);
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        indexed = reply->integer;
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        entries = reply->integer;
+    redis_free_reply(reply);
+
+    /**
+     * A snapshot can't be changed, even to migrate it.
+     */
+    if ((val == -1) && (indexed != entries) && (_g_snapshot < 0))
+    {
+        redis_use_primary();
+        rebuild_directory_index(parent_inode);
+
+        reply = redis_command("HGET %s %s",
+                              dir_key(_g_prefix, "DIRNAME", parent_inode),
+                              entry);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            val = atoll(reply->str);
+        redis_free_reply(reply);
+    }
+
+    return (val);
+}
+
+
+/**
+ * Find the inode for a filesystem entry, by path.
+ *
+ * Each directory has a hash DIRNAME:<inode> mapping entry names to
+ * their inodes, so every path component costs a single HGET.
+ */
+long long
+find_inode(const char *path)
+{
+    long long val = -1;
+    long long parent_inode = 0;
+    char *parent;
+    char *entry;
+
+    if (_g_debug)
+        fprintf(stderr, "find_inode(%s)\n", path);
+
+    /**
+     * Special Case "/" is 99.
+     */
+    if ((strcmp(path, "/") == 0) && strlen(path) == 1)
+        return -99;
+
+    /**
+     * Perhaps we've seen it recently?
+     */
+    if ((val = cache_get_inode(path)) != -1)
+    {
+        stats_cache(STATS_CACHE_LOOKUP, 1);
+        return (val);
+    }
+    if (cache_enabled())
+        stats_cache(STATS_CACHE_LOOKUP, 0);
+
+    redis_alive();
+
+  /**
+   * OK we have a directory entry.
+   *
+   * We need to find the inode of the parent directory
+   * and then we can lookup the entry itself.
+   */
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+    free(parent);
+
+    if (parent_inode == -1)
+        return -1;
+
+    entry = get_basename(path);
+    val = find_child(parent_inode, entry);
+    free(entry);
+
+    if (val != -1)
+        cache_set_inode(path, parent_inode, val);
+
+    if (_g_debug)
+        fprintf(stderr, "find_inode(%s) -> %lld\n", path, val);
+
+    return (val);
+}
+
+
+/**
+ * Preserve the entry at the given path, if it exists, and optionally
+ * the directory containing it, before either is changed.
+ */
+void
+preserve_path(const char *path, long long parent)
+{
+    if (cow_generation() == 0)
+        return;
+
+    preserve_inode(find_inode(path));
+
+    if (parent)
+    {
+        char *dir = get_parent(path);
+
+        preserve_inode(find_inode(dir));
+        free(dir);
+    }
+}
+
+
+/**
+ * Build the source of the given script, specialised for our prefix,
+ * schema, chunk size, and use of shared blocks.
+ *
+ * The caller must free the result.
+ */
+char *
+script_source(int which)
+{
+    size_t len = strlen(script_prelude) + strlen(script_bodies[which]) + 256;
+    char *src = malloc(len);
+    char name[sizeof(_g_prefix) * 4 + 1] = { "" };
+    const char *p;
+
+    if (src == NULL)
+        return NULL;
+
+    /**
+     * Escape every byte of the prefix, so it can't break the quoting.
+     */
+    for (p = _g_prefix; *p; p++)
+        sprintf(name + strlen(name), "\\%d", (unsigned char)*p);
+
+    snprintf(src, len,
+             "local prefix = '%s'\nlocal schema = '%s'\nlocal chunk = %ld\n"
+             "local dedup = %d\n%s%s",
+             name, (_g_schema == SCHEMA_HASH) ? "hash" : "keys",
+             _g_chunk_size, _g_dedup, script_prelude, script_bodies[which]);
+
+    return (src);
+}
+
+
+/**
+ * Load the given script into the server, recording its digest.
+ *
+ * Returns 0 on success.
+ */
+int
+load_script(int which)
+{
+    redisReply *reply = NULL;
+    char *src = script_source(which);
+    int ret = -1;
+
+    if (src == NULL)
+        return -1;
+
+    reply = redis_command("SCRIPT LOAD %s", src);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
+        (reply->len == 40))
+    {
+        memcpy(_g_script_sha[which], reply->str, 41);
+        ret = 0;
+    }
+    else if (_g_debug)
+    {
+        fprintf(stderr, "Failed to load script %d: %s\n", which,
+                ((reply != NULL) && (reply->str != NULL)) ? reply->str : "?");
+    }
+
+    if (reply != NULL)
+        redis_free_reply(reply);
+    free(src);
+
+    return (ret);
+}
+
+
+/**
+ * Load all our scripts, if the server supports them.
+ */
+void
+setup_scripts()
+{
+    int i;
+
+    _g_scripts = 0;
+
+    /**
+     * Our scripts name the keys they touch themselves, which a cluster
+     * doesn't allow, and they know nothing of hash tags.
+     */
+    if (_g_no_scripts || _g_tags)
+        return;
+
+    redis_alive();
+
+    for (i = 0; i < SCRIPT_COUNT; i++)
+    {
+        if (load_script(i) != 0)
+            return;
+    }
+
+    _g_scripts = 1;
+}
+
+
+/**
+ * Invoke one of our scripts, with arguments given by a format string.
+ *
+ * If the server has forgotten the script, perhaps because it was
+ * restarted, it is loaded again and the call retried.
+ */
+redisReply *
+run_script(int which, const char *fmt, ...)
+{
+    redisReply *reply = NULL;
+    char cmd[256];
+    va_list ap;
+
+    snprintf(cmd, sizeof(cmd), "EVALSHA %s 0 %s", _g_script_sha[which], fmt);
+
+    va_start(ap, fmt);
+    reply = redis_vcommand(cmd, ap);
+    va_end(ap);
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR) &&
+        (strncmp(reply->str, "NOSCRIPT", 8) == 0))
+    {
+        redis_free_reply(reply);
+        reply = NULL;
+
+        if (load_script(which) == 0)
+        {
+            va_start(ap, fmt);
+            reply = redis_vcommand(cmd, ap);
+            va_end(ap);
+        }
+    }
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR))
+        fprintf(stderr, "Script %d failed: %s\n", which, reply->str);
+
+    return (reply);
+}
+
+
+/**
+ * Invoke one of our scripts, with the given arguments.
+ *
+ * As with run_script() it is loaded again if the server has forgotten
+ * it.
+ */
+redisReply *
+run_script_argv(int which, int argc, const char **args)
+{
+    const char **argv = calloc(argc + 3, sizeof(char *));
+    redisReply *reply = NULL;
+    int i;
+
+    if (argv == NULL)
+        return (NULL);
+
+    argv[0] = "EVALSHA";
+    argv[1] = _g_script_sha[which];
+    argv[2] = "0";
+    for (i = 0; i < argc; i++)
+        argv[i + 3] = args[i];
+
+    reply = redis_command_argv(argc + 3, argv, NULL);
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR) &&
+        (strncmp(reply->str, "NOSCRIPT", 8) == 0))
+    {
+        redis_free_reply(reply);
+        reply = NULL;
+
+        if (load_script(which) == 0)
+            reply = redis_command_argv(argc + 3, argv, NULL);
+    }
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR))
+        fprintf(stderr, "Script %d failed: %s\n", which, reply->str);
+
+    free(argv);
+    return (reply);
+}
+
+
+/**
+ * Create a new entry, with a single script invocation.
+ *
+ * Returns the new inode, or a negative errno value.
+ */
+long long
+script_create(const char *path, const char *type, mode_t mode,
+              const char *target)
+{
+    redisReply *reply = NULL;
+    char *parent = get_parent(path);
+    char *entry = get_basename(path);
+    long long parent_inode = find_inode(parent);
+    long long ret = -EIO;
+
+    if (parent_inode == -1)
+    {
+        free(parent);
+        free(entry);
+        return -ENOENT;
+    }
+
+    reply = run_script(SCRIPT_CREATE, "%lld %s %s %d %d %d %d %s",
+                       parent_inode, entry, type, mode,
+                       caller_uid(), caller_gid(),
+                       time(NULL), (target != NULL) ? target : "-");
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        ret = reply->integer;
+    if (reply != NULL)
+        redis_free_reply(reply);
+
+    if (ret >= 0)
+        cache_set_inode(path, parent_inode, ret);
+
+    free(parent);
+    free(entry);
+
+    return (ret);
+}
+
+
+/**
+ * Remove an entry, with a single script invocation.
+ *
+ * Returns 0 on success, or a negative errno value.
+ */
+int
+script_remove(const char *path, int directory)
+{
+    redisReply *reply = NULL;
+    char *parent = get_parent(path);
+    char *entry = get_basename(path);
+    long long parent_inode = find_inode(parent);
+    long long inode;
+    long long removed = -EIO;
+    char *spilled = NULL;
+    int ret = 0;
+
+    /**
+     * Resolving the entry itself makes sure its parent is indexed.
+     */
+    if ((parent_inode == -1) || ((inode = find_inode(path)) == -1))
+    {
+        free(parent);
+        free(entry);
+        return -ENOENT;
+    }
+
+    /**
+     * Timestamps left for later mustn't be written after it is gone.
+     */
+    discard_times(inode);
+
+    /**
+     * The script can't remove a file holding the contents, so find it
+     * first.
+     */
+    if (_g_spill && !directory)
+        spilled = get_spill(inode);
+
+    reply = run_script(SCRIPT_REMOVE, "%lld %s %s", parent_inode, entry,
+                       directory ? "DIR" : "FILE");
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        removed = reply->integer;
+    if (reply != NULL)
+        redis_free_reply(reply);
+
+    if (removed >= 0)
+    {
+        cache_invalidate_stat(removed);
+        cache_invalidate_entry(removed);
+        discard_writes(removed);
+        cache_invalidate_path(path);
+
+        if ((spilled != NULL) && (removed == inode) &&
+            owns_spill(removed, spilled))
+            spill_remove(_g_spill_dir, spilled);
+    }
+    else
+    {
+        ret = removed;
+    }
+    free(spilled);
+
+    free(parent);
+    free(entry);
+
+    return (ret);
+}
+
+
+/**
+ * Rename an entry, with a single script invocation.
+ *
+ * Returns 0 on success, or a negative errno value.
+ */
+int
+script_rename(const char *old, const char *path)
+{
+    redisReply *reply = NULL;
+    char *old_dir = get_parent(old);
+    char *old_name = get_basename(old);
+    char *new_dir = get_parent(path);
+    char *new_name = get_basename(path);
+    long long old_parent = find_inode(old_dir);
+    long long new_parent = find_inode(new_dir);
+    long long existing;
+    char *spilled = NULL;
+    int ret = -EIO;
+
+    if ((old_parent == -1) || (new_parent == -1) || (find_inode(old) == -1))
+    {
+        free(old_dir);
+        free(old_name);
+        free(new_dir);
+        free(new_name);
+        return -ENOENT;
+    }
+
+    /**
+     * Resolving the destination makes sure its directory is indexed, and
+     * finds any file holding the contents of an entry it replaces.
+     */
+    existing = find_inode(path);
+    if (_g_spill && (existing != -1))
+        spilled = get_spill(existing);
+
+    reply = run_script(SCRIPT_RENAME, "%lld %s %lld %s", old_parent, old_name,
+                       new_parent, new_name);
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY) &&
+        (reply->elements == 2) &&
+        (reply->element[0]->type == REDIS_REPLY_INTEGER))
+    {
+        long long inode = reply->element[0]->integer;
+        long long replaced = reply->element[1]->integer;
+
+        ret = (inode < 0) ? inode : 0;
+
+        if (inode >= 0)
+        {
+            if (replaced > 0)
+            {
+                cache_invalidate_stat(replaced);
+                cache_invalidate_entry(replaced);
+                discard_writes(replaced);
+                discard_times(replaced);
+
+                if ((spilled != NULL) && (replaced == existing) &&
+                    owns_spill(replaced, spilled))
+                    spill_remove(_g_spill_dir, spilled);
+            }
+            cache_invalidate_stat(inode);
+            cache_invalidate_path(old);
+            cache_invalidate_path(path);
+            cache_set_inode(path, new_parent, inode);
+        }
+    }
+    if (reply != NULL)
+        redis_free_reply(reply);
+
+    free(spilled);
+    free(old_dir);
+    free(old_name);
+    free(new_dir);
+    free(new_name);
+
+    return (ret);
+}
+
+
+/**
+ * Is the given "thing" a directory?
+ */
+int
+is_directory(const char *path)
+{
+    int ret = 0;
+    redisReply *reply = NULL;
+
+    if (_g_debug)
+        fprintf(stderr, "is_directory(%s)\n", path);
+
+    redis_alive();
+
+  /**
+   * Find the inode.
+   */
+    long long inode = find_inode(path);
+    if (inode == -1)
+        return -1;
+
+    reply = get_meta(inode, "TYPE");
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING)
+        && (strcmp(reply->str, "DIR") == 0))
+        ret = 1;
+
+    redis_free_reply(reply);
+
+    return (ret);
+}
 
 
 /**
  * Return the number of directory entries a directory has.
  */
-int
-count_directory_entries(const char *path)
+int
+count_directory_entries(const char *path)
+{
+    int ret = 0;
+    long long inode = 0;
+    redisReply *reply = NULL;
+
+    if (_g_debug)
+        fprintf(stderr, "count_directory_entries(%s)\n", path);
+
+    redis_alive();
+
+  /**
+   * Find the inode of the directory.
+   */
+    inode = find_inode(path);
+
+  /**
+   * Now count the entries.
+   */
+    reply = redis_command("SCARD %s",
+                          dir_key(inode_prefix(inode), "DIRENT", inode));
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+    {
+        ret = reply->integer;
+    }
+    redis_free_reply(reply);
+
+    return (ret);
+}
+
+
+/**
+ * The virtual files which show our statistics, when --stats is used.
+ */
+#define VIRTUAL_DIR   1
+#define VIRTUAL_STATS 2
+#define VIRTUAL_SLOW  3
+
+
+/**
+ * Is the given path one of our virtual entries: "/.redisfs", or the
+ * "stats" and "slow" files within it?
+ *
+ * Returns which it is, or 0 for anything else.
+ */
+int
+virtual_entry(const char *path)
+{
+    if (!stats_enabled() || (strncmp(path, "/.redisfs", 9) != 0))
+        return 0;
+
+    if (path[9] == '\0')
+        return VIRTUAL_DIR;
+    if (strcmp(path + 9, "/stats") == 0)
+        return VIRTUAL_STATS;
+    if (strcmp(path + 9, "/slow") == 0)
+        return VIRTUAL_SLOW;
+
+    return 0;
+}
+
+
+/**
+ * The current contents of a virtual file, which the caller must free.
+ */
+char *
+virtual_contents(int which, size_t * len)
+{
+    size_t (*format) (char *, size_t) =
+        (which == VIRTUAL_SLOW) ? stats_format_slow : stats_format;
+    size_t size = format(NULL, 0) + 4096;
+    char *buf = malloc(size);
+
+    *len = 0;
+    if (buf == NULL)
+        return NULL;
+
+    /**
+     * More may have happened since we measured.
+     */
+    *len = format(buf, size);
+    if (*len >= size)
+        *len = size - 1;
+
+    return (buf);
+}
+
+
+/**
+ * The attributes of a virtual entry.
+ */
+int
+virtual_getattr(int which, struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+
+    stbuf->st_atime = time(NULL);
+    stbuf->st_mtime = stbuf->st_atime;
+    stbuf->st_ctime = stbuf->st_atime;
+
+    if (which == VIRTUAL_DIR)
+    {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+    }
+    else
+    {
+        size_t len = 0;
+
+        free(virtual_contents(which, &len));
+
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = len;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Read from a virtual file.
+ */
+int
+virtual_read(int which, char *buf, size_t size, off_t offset)
+{
+    size_t len = 0;
+    char *contents;
+
+    if (which == VIRTUAL_DIR)
+        return -EISDIR;
+
+    contents = virtual_contents(which, &len);
+
+    if (contents == NULL)
+        return -ENOMEM;
+
+    if (offset >= (off_t) len)
+        size = 0;
+    else if (offset + size > len)
+        size = len - offset;
+
+    memcpy(buf, contents + offset, size);
+    free(contents);
+
+    return (size);
+}
+
+
+/**
+ * List the directory with the given inode, from the given offset.
+ *
+ * We have a SET of entries for each directory, named "DIRENT:$INODE",
+ * which we walk with SSCAN a batch at a time.  Each entry is given an
+ * offset which identifies its batch, so that the kernel can page through
+ * huge directories and we never hold more than a batch in memory.
+ *
+ * The names and attributes of each batch are fetched in one go, and the
+ * attributes handed to the kernel, and our cache, along with the names.
+ * The lookups of the entries are only cached when we know the path of
+ * the directory.
+ *
+ */
+int
+list_directory(long long inode, const char *path, void *buf,
+               fuse_fill_dir_t filler, off_t offset)
+{
+    redisReply *reply = NULL;
+    redisReply *members = NULL;
+    unsigned long long cursor = 0;
+    unsigned long long next = 0;
+    int skip = 0;
+    int full = 0;
+    int i;
+
+    /**
+     * Without SSCAN everything is returned in one go, without offsets.
+     */
+    if (!_g_sscan)
+        offset = 0;
+
+    if (offset == READDIR_END)
+        return 0;
+
+    /**
+     * Add the filesystem entries which always exist.
+     */
+    if (offset == 0)
+    {
+        if (filler(buf, ".", NULL, _g_sscan ? 1 : 0))
+            return 0;
+        offset = 1;
+    }
+    if (offset == 1)
+    {
+        if (filler(buf, "..", NULL, _g_sscan ? READDIR_OFFSET(0, 0) : 0))
+            return 0;
+        offset = READDIR_OFFSET(0, 0);
+    }
+
+    cursor = READDIR_CURSOR(offset);
+    skip = READDIR_INDEX(offset);
+
+    /**
+     * For each entry in the set ..
+     */
+    do
+    {
+        char **names = NULL;
+        struct stat *stats = NULL;
+
+        reply = get_dirents(inode, cursor, &next, &members);
+        if (members == NULL)
+        {
+            redis_free_reply(reply);
+            break;
+        }
+
+        /**
+         * We need to get the name of each directory entry, and its
+         * attributes.
+         */
+        names = get_names(members);
+        stats = get_stats(members);
+
+        for (i = skip; (names != NULL) && !full && (i < members->elements);
+             i++)
+        {
+            struct stat *st = NULL;
+            off_t off = 0;
+
+            if (names[i] == NULL)
+                continue;
+
+            /**
+             * Hand over the attributes too, and remember them, so that
+             * "ls -l" needn't look up each entry again.
+             */
+            if ((stats != NULL) && (stats[i].st_ino != 0))
+            {
+                long long child = stats[i].st_ino;
+
+                st = &stats[i];
+
+                if (cache_enabled() && (path != NULL))
+                {
+                    size_t len = strlen(path) + strlen(names[i]) + 2;
+                    char *entry = malloc(len);
+
+                    if (entry != NULL)
+                    {
+                        snprintf(entry, len, "%s/%s",
+                                 (strcmp(path, "/") == 0) ? "" : path,
+                                 names[i]);
+                        cache_set_inode(entry, inode, child);
+                        cache_set_stat(child, st);
+                        free(entry);
+                    }
+                }
+
+                apply_pending_size(child, st);
+                times_apply(child, st);
+            }
+
+            /**
+             * The offset of the entry which follows this one.
+             */
+            if (_g_sscan)
+            {
+                if (i + 1 < members->elements)
+                    off = READDIR_OFFSET(cursor, i + 1);
+                else if (next != 0)
+                    off = READDIR_OFFSET(next, 0);
+                else
+                    off = READDIR_END;
+            }
+
+            if (filler(buf, names[i], st, off))
+                full = 1;
+        }
+
+        free_names(names, members->elements);
+        free(stats);
+        redis_free_reply(reply);
+
+        cursor = next;
+        skip = 0;
+    }
+    while (!full && (cursor != 0));
+
+    return 0;
+}
+
+
+/**
+ * Our readdir implementation.
+ */
+static int
+fs_readdir(const char *path,
+           void *buf,
+           fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+    long long inode;
+    int ret;
+
+
+    /**
+     * Our statistics are listed without asking the server.
+     */
+    if (virtual_entry(path) == VIRTUAL_DIR)
+    {
+        if (offset == 0)
+        {
+            filler(buf, ".", NULL, 0);
+            filler(buf, "..", NULL, 0);
+            filler(buf, "stats", NULL, 0);
+            filler(buf, "slow", NULL, 0);
+        }
+        return 0;
+    }
+
+    redis_acquire_reader();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_readdir(%s) [%lld]\n", path, (long long)offset);
+
+    redis_alive();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return 0;
+    }
+
+    ret = list_directory(inode, path, buf, filler, offset);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Fill in the attributes of an inode, from our cache or the server.
+ *
+ * Returns 0 on success, or -ENOENT if the inode no longer exists.
+ */
+int
+stat_inode(long long inode, struct stat *stbuf)
+{
+    redisReply *reply = NULL;
+
+    memset(stbuf, 0, sizeof(struct stat));
+
+    /**
+     * The root directory has no meta-data.
+     */
+    if (inode == -99)
+    {
+        stbuf->st_atime = time(NULL);
+        stbuf->st_mtime = stbuf->st_atime;
+        stbuf->st_ctime = stbuf->st_atime;
+        stbuf->st_uid = getuid();
+        stbuf->st_gid = getgid();
+
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 1;
+        return 0;
+    }
+
+    /**
+     * Perhaps we've seen it recently?
+     */
+    if (cache_get_stat(inode, stbuf))
+    {
+        stats_cache(STATS_CACHE_ATTR, 1);
+        apply_pending_size(inode, stbuf);
+        times_apply(inode, stbuf);
+        return 0;
+    }
+    if (cache_enabled())
+        stats_cache(STATS_CACHE_ATTR, 0);
+
+
+    /**
+     * Fetch all the attributes at once.
+     */
+    reply = get_meta(inode, STAT_FIELDS);
+    if (fill_stat(reply, stbuf) != 0)
+    {
+        redis_free_reply(reply);
+        return -ENOENT;
+    }
+    redis_free_reply(reply);
+
+    cache_set_stat(inode, stbuf);
+
+    apply_pending_size(inode, stbuf);
+    times_apply(inode, stbuf);
+    return 0;
+}
+
+
+/**
+ * Get the attributes of each file.
+ */
+static int
+fs_getattr(const char *path, struct stat *stbuf)
+{
+    long long inode;
+    int ret;
+
+    redis_acquire_reader();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_getattr(%s);\n", path);
+
+    redis_alive();
+
+    memset(stbuf, 0, sizeof(struct stat));
+
+    /**
+     * Our statistics.
+     */
+    if (virtual_entry(path))
+    {
+        redis_release();
+        return (virtual_getattr(virtual_entry(path), stbuf));
+    }
+
+
+    /**
+     * OK a real lookup.
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+      /**
+       * File/Directory not found.
+       */
+        redis_release();
+        return -ENOENT;
+    }
+
+    ret = stat_inode(inode, stbuf);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Make a directory.
+ */
+static int
+fs_mkdir(const char *path, mode_t mode)
+{
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    long long new_inode = 0;
+    long long parent_inode = 0;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_mkdir(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        long long ret = script_create(path, "DIR", mode, NULL);
+        redis_release();
+        return ((ret < 0) ? ret : 0);
+    }
+
+    /**
+     * We need to create a new INODE number & entry.
+     *
+     * Once that is done we can create the new entry
+     * in the set for the parent directory.
+     */
+    parent = get_parent(path);
+    entry = get_basename(path);
+    new_inode = get_next_inode();
+    parent_inode = find_inode(parent);
+
+    /**
+     * Add the entry to the parent directory.
+     */
+    lock_inode(parent_inode);
+    redis_append("SADD %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 new_inode);
+    redis_append("HSET %s %s %lld", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry, new_inode);
+
+    /**
+     * Now populate the new entry.
+     */
+    append_set_meta(new_inode,
+                    "NAME %s TYPE DIR MODE %d UID %d GID %d SIZE %d CTIME %d MTIME %d ATIME %d LINK 1",
+                    entry, mode, caller_uid(),
+                    caller_gid(), 0, time(NULL), time(NULL),
+                    time(NULL));
+    int i = 0;
+    for (i = 0; i < 3; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    unlock_inode(parent_inode);
+
+    cache_set_inode(path, parent_inode, new_inode);
+
+    free(parent);
+    free(entry);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Append a command freeing every key of an inode, which must be empty
+ * if it is a directory, followed by those freeing any chunks holding
+ * the given size of contents.
+ *
+ * Returns the number of commands appended.
+ */
+int
+append_free_inode(long long inode, long long size)
+{
+    const char *argv[24];
+    char keys[24][64];
+    int argc = 0;
+    int count = 1;
+    int i;
+
+    argv[argc++] = _g_unlink;
+
+    if (_g_schema == SCHEMA_HASH)
+    {
+        snprintf(keys[argc], sizeof(keys[argc]), "%s",
+                 inode_key(_g_prefix, inode));
+        argv[argc] = keys[argc];
+        argc += 1;
+    }
+    else
+    {
+        for (i = 0; _g_fields[i] != NULL; i++)
+        {
+            snprintf(keys[argc], sizeof(keys[argc]), "%s:%s",
+                     inode_key(_g_prefix, inode), _g_fields[i]);
+            argv[argc] = keys[argc];
+            argc += 1;
+        }
+    }
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:DATA",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:BLOCKS",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s:XATTR",
+             inode_key(_g_prefix, inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s",
+             dir_key(_g_prefix, "DIRENT", inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    snprintf(keys[argc], sizeof(keys[argc]), "%s",
+             dir_key(_g_prefix, "DIRNAME", inode));
+    argv[argc] = keys[argc];
+    argc += 1;
+
+    redis_append_argv(argc, argv, NULL);
+
+    if ((_g_chunk_size > 0) && (size > 0))
+        count += append_delete_chunks(_g_unlink, inode, 0,
+                                      (size - 1) / _g_chunk_size);
+
+    return (count);
+}
+
+
+/**
+ * Forget what we've cached, buffered or left pending for an inode which
+ * is about to be freed, and keep it for any snapshot which needs it.
+ */
+void
+forget_inode(long long inode)
+{
+    preserve_inode(inode);
+    cache_invalidate_stat(inode);
+    cache_invalidate_entry(inode);
+    discard_writes(inode);
+    discard_times(inode);
+}
+
+
+/**
+ * Free a batch of the entries of a directory being reclaimed, or the
+ * directory itself once it is empty.
+ *
+ * Subdirectories are added to GLOBAL:RECLAIM, to be emptied in turn,
+ * and everything else is freed with pipelined UNLINKs - or one at a
+ * time, by remove_inode(), if the contents may be shared or spilled.
+ * Only what is done is removed from the directory, so that if we stop
+ * part-way through another mount may carry on.
+ */
+void
+reclaim_batch(long long dir)
+{
+    redisReply *reply = NULL;
+    redisReply *members = NULL;
+    unsigned long long next;
+    const char **argv = NULL;
+    long long *inodes = NULL;
+    long long *sizes = NULL;
+    int *dirs = NULL;
+    int replies = 0;
+    int count;
+    int i;
+
+    if (_g_debug)
+        fprintf(stderr, "reclaim_batch(%lld);\n", dir);
+
+    preserve_inode(dir);
+
+    reply = get_dirents(dir, 0, &next, &members);
+    if ((members == NULL) || (members->elements == 0))
+    {
+        redis_free_reply(reply);
+
+        forget_inode(dir);
+        replies = append_free_inode(dir, 0);
+        redis_append("SREM %s:GLOBAL:RECLAIM %lld", _g_prefix, dir);
+        replies += 1;
+
+        while (replies-- > 0)
+        {
+            redis_get_reply(&reply);
+            redis_free_reply(reply);
+        }
+        return;
+    }
+
+    count = members->elements;
+    inodes = calloc(count, sizeof(long long));
+    sizes = calloc(count, sizeof(long long));
+    dirs = calloc(count, sizeof(int));
+    argv = calloc(count + 2, sizeof(char *));
+    if ((inodes == NULL) || (sizes == NULL) || (dirs == NULL) || (argv == NULL))
+        goto done;
+
+    for (i = 0; i < count; i++)
+        inodes[i] = strtoll(members->element[i]->str, NULL, 10);
+
+    /**
+     * The type & size of each entry, in a single round-trip.
+     */
+    for (i = 0; i < count; i++)
+        append_get_meta(inodes[i], "TYPE SIZE");
+
+    for (i = 0; i < count; i++)
+    {
+        redisReply *meta = NULL;
+        const char *val;
+
+        redis_get_reply(&meta);
+        if (((val = meta_value(meta, 0)) != NULL) && (strcmp(val, "DIR") == 0))
+            dirs[i] = 1;
+        if ((val = meta_value(meta, 1)) != NULL)
+            sizes[i] = atoll(val);
+        redis_free_reply(meta);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (dirs[i])
+            continue;
+
+        if (_g_dedup || _g_spill)
+            remove_inode(inodes[i]);
+        else
+            forget_inode(inodes[i]);
+    }
+
+    /**
+     * Then free them, and remove them from the directory, in a single
+     * pipeline.
+     */
+    for (i = 0; i < count; i++)
+    {
+        if (dirs[i])
+        {
+            redis_append("SADD %s:GLOBAL:RECLAIM %lld", _g_prefix, inodes[i]);
+            replies += 1;
+        }
+        else if (!_g_dedup && !_g_spill)
+        {
+            replies += append_free_inode(inodes[i], sizes[i]);
+        }
+    }
+
+    argv[0] = "SREM";
+    argv[1] = dir_key(_g_prefix, "DIRENT", dir);
+    for (i = 0; i < count; i++)
+        argv[i + 2] = members->element[i]->str;
+    redis_append_argv(count + 2, argv, NULL);
+    replies += 1;
+
+    while (replies-- > 0)
+    {
+        redisReply *r = NULL;
+
+        redis_get_reply(&r);
+        redis_free_reply(r);
+    }
+
+  done:
+    free(argv);
+    free(dirs);
+    free(sizes);
+    free(inodes);
+    redis_free_reply(reply);
+}
+
+
+/**
+ * Free the contents of directories in GLOBAL:RECLAIM, a batch at a
+ * time, sleeping when there are none.
+ */
+void *
+reclaimer(void *arg)
+{
+    redisReply *reply = NULL;
+
+    /**
+     * Servers before 4.0 have no UNLINK.
+     */
+    redis_acquire();
+    reply = redis_command("UNLINK %s:GLOBAL:RECLAIM:PROBE", _g_prefix);
+    if ((reply == NULL) || (reply->type == REDIS_REPLY_ERROR))
+        _g_unlink = "DEL";
+    redis_free_reply(reply);
+    redis_release();
+
+    while (1)
+    {
+        long long dir = -1;
+
+        redis_acquire();
+
+        reply = redis_command("SRANDMEMBER %s:GLOBAL:RECLAIM", _g_prefix);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            dir = strtoll(reply->str, NULL, 10);
+        redis_free_reply(reply);
+
+        if (dir != -1)
+            reclaim_batch(dir);
+
+        redis_release();
+
+        if (dir != -1)
+            continue;
+
+        pthread_mutex_lock(&_g_reclaim_lock);
+        while (!_g_reclaim_wanted)
+            pthread_cond_wait(&_g_reclaim_wake, &_g_reclaim_lock);
+        _g_reclaim_wanted = 0;
+        pthread_mutex_unlock(&_g_reclaim_lock);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Remove a directory and everything beneath it.
+ *
+ * The directory is detached from its parent at once, so that it is
+ * gone as far as anybody can see, and its contents are freed in the
+ * background.
+ */
+int
+remove_tree(const char *path)
+{
+    long long parent_inode = 0;
+    long long inode = 0;
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    int i;
+
+    if (_g_read_only)
+        return -EPERM;
+
+    if (strcmp(path, "/") == 0)
+        return -EBUSY;
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+    inode = find_inode(path);
+    free(parent);
+
+    if ((inode == -1) || (parent_inode == -1))
+        return -ENOENT;
+
+    reply = get_meta(inode, "TYPE");
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_STRING) ||
+        (strcmp(reply->str, "DIR") != 0))
+    {
+        redis_free_reply(reply);
+        return -ENOTDIR;
+    }
+    redis_free_reply(reply);
+
+    /**
+     * Record it as needing to be reclaimed, before it is detached, so
+     * that it can't be lost.
+     */
+    entry = get_basename(path);
+
+    lock_inode(parent_inode);
+    redis_append("SADD %s:GLOBAL:RECLAIM %lld", _g_prefix, inode);
+    redis_append("SREM %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 inode);
+    redis_append("HDEL %s %s", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry);
+    for (i = 0; i < 3; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+    unlock_inode(parent_inode);
+
+    free(entry);
+
+    cache_invalidate_path(path);
+
+    pthread_mutex_lock(&_g_reclaim_lock);
+    _g_reclaim_wanted = 1;
+    pthread_cond_signal(&_g_reclaim_wake);
+    pthread_mutex_unlock(&_g_reclaim_lock);
+
+    return 0;
+}
+
+
+/**
+ * Remove a directory entry.
+ */
+static int
+fs_rmdir(const char *path)
+{
+    long long parent_inode = 0;
+    long long inode = 0;
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    int ret = 0;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_rmdir(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        int ret = script_remove(path, 1);
+        redis_release();
+        return (ret);
+    }
+
+
+    /**
+     * To remove the entry we need to :
+     *
+     * [1/4] Find the inode for this entry.
+     *
+     */
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+    inode = find_inode(path);
+
+    if (inode == -1)
+    {
+        free(parent);
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/4] Make sure it is a directory, and that it is empty, with a
+     * single round-trip.
+     */
+    append_get_meta(inode, "TYPE");
+    redis_append("SCARD %s", dir_key(inode_prefix(inode), "DIRENT", inode));
+
+    redis_get_reply(&reply);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_STRING) ||
+        (strcmp(reply->str, "DIR") != 0))
+        ret = -ENOENT;
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((ret == 0) && (reply != NULL) &&
+        (reply->type == REDIS_REPLY_INTEGER) && (reply->integer != 0))
+        ret = -ENOTEMPTY;
+    redis_free_reply(reply);
+
+    if (ret != 0)
+    {
+        free(parent);
+        redis_release();
+        return (ret);
+    }
+
+    /**
+     * [3/4] Remove from the directory of the parent, and its index.
+     */
+    entry = get_basename(path);
+
+    lock_inode(parent_inode);
+    redis_append("SREM %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 inode);
+    redis_append("HDEL %s %s", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry);
+    redis_append("DEL %s", dir_key(_g_prefix, "DIRNAME", inode));
+
+    int i = 0;
+    for (i = 0; i < 3; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    unlock_inode(parent_inode);
+
+    free(parent);
+    free(entry);
+
+    /**
+     * [4/4] Remove all meta-data.
+     */
+    remove_inode(inode);
+
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Write to an inode, through the buffer of the open file if we have one.
+ */
+void
+write_inode(open_file * f, long long inode, const char *buf, size_t size,
+            off_t offset)
+{
+    if (size == 0)
+        return;
+
+    if (f == NULL)
+    {
+        write_data(inode, buf, size, offset);
+        return;
+    }
+
+    /**
+     * Buffer the data if we can, otherwise write out what we have
+     * and try again - writing directly if it is too large.
+     */
+    pthread_mutex_lock(&f->lock);
+
+    if (!wbuf_add(&f->wb, buf, size, offset, now_ms()))
+    {
+        if (wbuf_pending(&f->wb))
+        {
+            write_data(inode, f->wb.data, f->wb.len, f->wb.offset);
+            wbuf_clear(&f->wb);
+        }
+
+        if (!wbuf_add(&f->wb, buf, size, offset, now_ms()))
+            write_data(inode, buf, size, offset);
+    }
+
+    pthread_mutex_unlock(&f->lock);
+}
+
+
+/**
+ * Write to a file or path.
+ *
+ * If the file was opened with a write buffer small writes are gathered
+ * together in it, and written in one go later.
+ */
+static int
+fs_write(const char *path,
+         const char *buf,
+         size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    open_file *f = NULL;
+    long long inode;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_write(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * An open file knows its inode.
+     */
+    if ((fi != NULL) && (fi->fh != 0))
+    {
+        f = (open_file *) (uintptr_t) fi->fh;
+        inode = f->inode;
+    }
+    else
+    {
+        inode = find_inode(path);
+    }
+
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    write_inode(f, inode, buf, size, offset);
+
+    redis_release();
+    return size;
+}
+
+
+/**
+ * Read from an inode, through the read cache if it is in use.
+ */
+size_t
+read_inode(open_file * f, long long inode, char *buf, size_t size,
+           off_t offset)
+{
+    if (size == 0)
+        return 0;
+
+    /**
+     * Make sure we read anything written through an open file.
+     */
+    flush_inode(inode);
+
+    if (pagecache_enabled())
+        return (cached_read(f, inode, buf, size, offset));
+
+    return (read_data(inode, buf, size, offset));
+}
+
+
+/**
+ * Read from a file.
+ *
+ * When the read cache is in use reads are served from it, otherwise
+ * the requested range is fetched directly.
+ */
+static int
+fs_read(const char *path, char *buf, size_t size, off_t offset,
+        struct fuse_file_info *fi)
+{
+    open_file *f = NULL;
+    size_t avail = 0;
+    long long inode;
+
+    if (virtual_entry(path))
+        return (virtual_read(virtual_entry(path), buf, size, offset));
+
+    redis_acquire_reader();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_read(%s);\n", path);
+
+    redis_alive();
+
+    /**
+     * Find the inode - an open file knows it already.
+     */
+    if ((fi != NULL) && (fi->fh != 0))
+    {
+        f = (open_file *) (uintptr_t) fi->fh;
+        inode = f->inode;
+    }
+    else
+    {
+        inode = find_inode(path);
+    }
+
+    if (inode == -1)
+    {
+      /**
+       * File/Directory not found.
+       */
+        redis_release();
+        return -ENOENT;
+
+    }
+
+    avail = read_inode(f, inode, buf, size, offset);
+
+    redis_release();
+    return avail;
+}
+
+
+/**
+ * Create a symlink
+ */
+static int
+fs_symlink(const char *target, const char *path)
+{
+
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    long long key = 0;
+    long long parent_inode = 0;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_symlink(target:%s -> %s);\n", target, path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        long long ret = script_create(path, "LINK", 0444, target);
+        redis_release();
+        return ((ret < 0) ? ret : 0);
+    }
+
+    /**
+     * We need to create a new INODE number & entry.
+     *
+     * Once that is done we can create the new entry
+     * in the set for the parent directory.
+     */
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+
+    entry = get_basename(path);
+    key = get_next_inode();
+
+
+    /**
+     * Add the entry to the parent directory.
+     */
+    lock_inode(parent_inode);
+    redis_append("SADD %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 key);
+    redis_append("HSET %s %s %lld", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry, key);
+
+    /**
+     * Now populate the new entry.
+     */
+    append_set_meta(key,
+                    "NAME %s TYPE LINK TARGET %s MODE %d UID %d GID %d SIZE %d CTIME %d MTIME %d ATIME %d LINK 1",
+                    entry, target, 0444, caller_uid(),
+                    caller_gid(), 0, time(NULL), time(NULL),
+                    time(NULL));
+
+    int i = 0;
+    for (i = 0; i < 3; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    unlock_inode(parent_inode);
+
+    cache_set_inode(path, parent_inode, key);
+
+    free(parent);
+    free(entry);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Copy the target of a symlink into the given buffer, shortening it if
+ * need be.
+ */
+int
+read_link(long long inode, char *buf, size_t size)
+{
+    redisReply *reply = get_meta(inode, "TARGET");
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
+        (reply->str != NULL) && (size > 0))
+    {
+        snprintf(buf, size, "%s", reply->str);
+        redis_free_reply(reply);
+        return 0;
+    }
+    redis_free_reply(reply);
+
+    return (-ENOENT);
+}
+
+
+/**
+ * Read the target of a symlink.
+ */
+static int
+fs_readlink(const char *path, char *buf, size_t size)
+{
+    long long inode;
+    int ret;
+
+    redis_acquire_reader();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_readlink(%s);\n", path);
+
+    redis_alive();
+
+    /**
+     * To resolve the symlink we must:
+     *
+     * [1/2] Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/2] Lookup the "TARGET" data item.
+     */
+    ret = read_link(inode, buf, size);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Open an inode, unless we're running with --fast and have no need to
+ * remember open files.
+ */
+void
+open_inode(long long inode, struct fuse_file_info *fi)
+{
+    if (_g_fast && (_g_write_buffer <= 0) && !pagecache_enabled())
+        return;
+
+    attach_open_file(fi, inode);
+
+    /**
+     * Update the access time of a file, unless --fast is used.
+     */
+    if (!_g_fast)
+        touch_atime(inode);
+}
+
+
+/**
+ * This cheats and always returns true.
+ *
+ * (Without the ability to open you cannot read/write to a file.)
+ *
+ */
+static int
+fs_open(const char *path, struct fuse_file_info *fi)
+{
+
+    long long inode;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_open(%s);\n", path);
+
+    /**
+     * Our statistics may only be read, and are read afresh each time
+     * without regard to their size.
+     */
+    if (virtual_entry(path))
+    {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+            return -EACCES;
+
+        fi->direct_io = 1;
+        return 0;
+    }
+
+
+    /**
+     * If we're running with --fast, and aren't buffering writes or
+     * caching reads, just return.
+     */
+    if (_g_fast && (_g_write_buffer <= 0) && !pagecache_enabled())
+        return 0;
+
+    redis_acquire();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return 0;
+    }
+
+    open_inode(inode, fi);
+
+    redis_release();
+
+    return 0;
+}
+
+
+/**
+ * Write out anything buffered for an open file, when it is closed or
+ * synced.
+ */
+static int
+fs_flush(const char *path, struct fuse_file_info *fi)
+{
+    open_file *f = NULL;
+
+    if ((fi == NULL) || (fi->fh == 0))
+        return 0;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_flush(%s);\n", path);
+
+    f = (open_file *) (uintptr_t) fi->fh;
+
+    redis_acquire();
+
+    pthread_mutex_lock(&f->lock);
+    flush_open_file(f);
+    pthread_mutex_unlock(&f->lock);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Sync an open file.
+ *
+ * Our writes are durable once redis has them, so we need only write
+ * out anything we have buffered.
+ */
+static int
+fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return (fs_flush(path, fi));
+}
+
+
+/**
+ * Write out, and free, an open file, once the last reference to it has
+ * gone.
+ */
+void
+close_open_file(open_file * f)
+{
+    open_file **cur = NULL;
+
+    /**
+     * Remove it from the list, so nothing else can find it.
+     */
+    pthread_mutex_lock(&_g_open_lock);
+    for (cur = &_g_open_files; *cur != NULL; cur = &(*cur)->next)
+    {
+        if (*cur == f)
+        {
+            *cur = f->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_g_open_lock);
+
+    pthread_mutex_lock(&f->lock);
+    flush_open_file(f);
+    pthread_mutex_unlock(&f->lock);
+
+    pthread_mutex_destroy(&f->lock);
+    wbuf_free(&f->wb);
+    free(f);
+}
+
+
+/**
+ * Release an open file, once the last reference to it has gone.
+ */
+static int
+fs_release(const char *path, struct fuse_file_info *fi)
+{
+    open_file *f = NULL;
+
+    if ((fi == NULL) || (fi->fh == 0))
+        return 0;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_release(%s);\n", path);
+
+    f = (open_file *) (uintptr_t) fi->fh;
+    fi->fh = 0;
+
+    redis_acquire();
+    close_open_file(f);
+    redis_release();
+
+    return 0;
+}
+
+
+/**
+ * Create a new entry with the specified mode.
+ */
+static int
+fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    long long key = 0;
+    long long parent_inode = 0;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_create(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        long long ret = script_create(path, "FILE", mode, NULL);
+        if (ret >= 0)
+            attach_open_file(fi, ret);
+        redis_release();
+        return ((ret < 0) ? ret : 0);
+    }
+
+    /**
+     * We need to create a new INODE number & entry.
+     *
+     * Once that is done we can create the new entry
+     * in the set for the parent directory.
+     */
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+
+    entry = get_basename(path);
+    key = get_next_inode();
+
+
+    /**
+     * Add the entry to the parent directory.
+     */
+    lock_inode(parent_inode);
+    redis_append("SADD %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 key);
+    redis_append("HSET %s %s %lld", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry, key);
+
+    /**
+     * Now populate the new entry, using MSET
+     */
+    append_set_meta(key,
+                    "NAME %s TYPE FILE MODE %d UID %d GID %d SIZE %d CTIME %d MTIME %d ATIME %d LINK 1",
+                    entry, mode, caller_uid(),
+                    caller_gid(), 0, time(NULL), time(NULL),
+                    time(NULL));
+
+    int i = 0;
+    for (i = 0; i < 3; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    unlock_inode(parent_inode);
+
+    cache_set_inode(path, parent_inode, key);
+    attach_open_file(fi, key);
+
+    free(parent);
+    free(entry);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Change the owner of an inode.
+ */
+void
+chown_inode(long long inode, uid_t uid, gid_t gid)
+{
+    preserve_inode(inode);
+    if (defer_times(inode, TIMES_MTIME, time(NULL)))
+        set_meta(inode, "UID %d GID %d", uid, gid);
+    else
+        set_meta(inode, "UID %d GID %d MTIME %d", uid, gid, time(NULL));
+
+    cache_invalidate_stat(inode);
+}
+
+
+/**
+ * Change the owner of a file/directory.
+ */
+static int
+fs_chown(const char *path, uid_t uid, gid_t gid)
+{
+    long long inode;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_chown(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * To change the ownership of this file we need to :
+     *
+     * [1/2] Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/2] Change the UID, GID, mtime
+     */
+    chown_inode(inode, uid, gid);
+
+    /**
+     * All done.
+     */
+    redis_release();
+    return 0;
+
+}
+
+
+/**
+ * Change the mode of an inode.
+ */
+void
+chmod_inode(long long inode, mode_t mode)
+{
+    preserve_inode(inode);
+    if (defer_times(inode, TIMES_MTIME, time(NULL)))
+        set_meta(inode, "MODE %d", mode);
+    else
+        set_meta(inode, "MODE %d MTIME %d", mode, time(NULL));
+
+    cache_invalidate_stat(inode);
+}
+
+
+/**
+ * Change the permission(s) of a file/directory.
+ */
+static int
+fs_chmod(const char *path, mode_t mode)
+{
+    long long inode;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_chmod(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * To change the owner of this file we need to:
+     *
+     * [1/2] Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/2] Change the mode
+     */
+    chmod_inode(inode, mode);
+
+    /**
+     * All done.
+     */
+    redis_release();
+    return 0;
+
+}
+
+
+/**
+ * Change the times of an inode, replacing any left for later which
+ * would otherwise be written over them.
+ */
+void
+utimens_inode(long long inode, const struct timespec tv[2])
+{
+    preserve_inode(inode);
+    pthread_mutex_lock(&_g_times_lock);
+    times_clear(inode);
+    set_meta(inode, "ATIME %d MTIME %d", tv[0].tv_sec, tv[1].tv_sec);
+    pthread_mutex_unlock(&_g_times_lock);
+
+    cache_invalidate_stat(inode);
+}
+
+
+/**
+ * Change the access time of a file.
+ */
+static int
+fs_utimens(const char *path, const struct timespec tv[2])
+{
+    long long inode;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_utimens(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     *
+     * 1/2 Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/2] Change the time.
+     */
+    utimens_inode(inode, tv);
+
+    /**
+     * All done.
+     */
+    redis_release();
+    return 0;
+
+}
+
+
+/**
+ * The extended attributes of an inode, which are kept in the hash
+ * "INODE:<n>:XATTR".
+ *
+ * They're fetched all at once, and cached alongside its attributes, as
+ * a buffer holding each name, nul-terminated, followed by the length of
+ * its value and the value.  The caller must free the result.
+ *
+ * Returns NULL if we're out of memory.
+ */
+char *
+load_xattrs(long long inode, size_t * len)
+{
+    redisReply *reply = NULL;
+    char *data = NULL;
+    size_t size = 1;
+    int i;
+
+    *len = 0;
+
+    if (cache_get_xattrs(inode, &data, len))
+    {
+        stats_cache(STATS_CACHE_ATTR, 1);
+        return (data);
+    }
+    if (cache_enabled())
+        stats_cache(STATS_CACHE_ATTR, 0);
+
+    reply = redis_command("HGETALL %s:XATTR",
+                          inode_key(inode_prefix(inode), inode));
+
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+    {
+        for (i = 0; i + 1 < reply->elements; i += 2)
+            size += strlen(reply->element[i]->str) + 1 + sizeof(uint32_t) +
+                reply->element[i + 1]->len;
+    }
+
+    data = malloc(size);
+    if ((data != NULL) && (reply != NULL) &&
+        (reply->type == REDIS_REPLY_ARRAY))
+    {
+        for (i = 0; i + 1 < reply->elements; i += 2)
+        {
+            size_t n = strlen(reply->element[i]->str) + 1;
+            uint32_t vlen = reply->element[i + 1]->len;
+
+            memcpy(data + *len, reply->element[i]->str, n);
+            *len += n;
+            memcpy(data + *len, &vlen, sizeof(vlen));
+            *len += sizeof(vlen);
+            memcpy(data + *len, reply->element[i + 1]->str, vlen);
+            *len += vlen;
+        }
+
+        cache_set_xattrs(inode, data, *len);
+    }
+    redis_free_reply(reply);
+
+    return (data);
+}
+
+
+/**
+ * Step over the attributes returned by load_xattrs().
+ *
+ * Returns the name of the next, or NULL once there are no more.
+ */
+const char *
+next_xattr(const char *data, size_t len, size_t * pos, const char **value,
+           uint32_t * vlen)
+{
+    const char *name;
+
+    if (*pos >= len)
+        return NULL;
+
+    name = data + *pos;
+    *pos += strlen(name) + 1;
+
+    memcpy(vlen, data + *pos, sizeof(uint32_t));
+    *pos += sizeof(uint32_t);
+
+    *value = data + *pos;
+    *pos += *vlen;
+
+    return (name);
+}
+
+
+/**
+ * Copy an attribute to the buffer of our caller, who may just be asking
+ * how large it is.
+ *
+ * Returns the size of the attribute, or -ERANGE if it doesn't fit.
+ */
+int
+copy_xattr(const char *value, size_t vlen, char *buf, size_t size)
+{
+    if (size == 0)
+        return (vlen);
+
+    if (vlen > size)
+        return -ERANGE;
+
+    memcpy(buf, value, vlen);
+    return (vlen);
+}
+
+
+/**
+ * The number of chunks holding the contents of an inode, as "stored/all"
+ * where chunks of zeros needn't be stored.
+ */
+void
+describe_chunks(long long inode, char *buf, size_t len)
+{
+    redisReply *reply = NULL;
+    const char *val;
+    long long size = 0;
+    long total = 0;
+    long stored = 0;
+    long idx;
+
+    reply = get_meta(inode, "SIZE SPILL");
+    if ((val = meta_value(reply, 0)) != NULL)
+        size = atoll(val);
+    if (((val = meta_value(reply, 1)) != NULL) && (*val != '\0'))
+    {
+        redis_free_reply(reply);
+        snprintf(buf, len, "spilled");
+        return;
+    }
+    redis_free_reply(reply);
+
+    if (_g_chunk_size <= 0)
+    {
+        total = (size > 0) ? 1 : 0;
+        reply = redis_command("EXISTS %s:DATA",
+                              inode_key(inode_prefix(inode), inode));
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+            stored = reply->integer;
+        redis_free_reply(reply);
+    }
+    else if (size > 0)
+    {
+        total = ((size - 1) / _g_chunk_size) + 1;
+
+        if (_g_dedup)
+        {
+            reply = redis_command("HLEN %s:BLOCKS",
+                                  inode_key(inode_prefix(inode), inode));
+            if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+                stored = reply->integer;
+            redis_free_reply(reply);
+        }
+        else
+        {
+            for (idx = 0; idx < total; idx += 256)
+            {
+                long last = (idx + 256 < total) ? idx + 256 : total;
+                long i;
+
+                for (i = idx; i < last; i++)
+                {
+                    char key[KEY_LENGTH];
+
+                    chunk_key(key, sizeof(key), inode, i);
+                    redis_append("EXISTS %s", key);
+                }
+
+                for (i = idx; i < last; i++)
+                {
+                    redis_get_reply(&reply);
+                    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+                        stored += reply->integer;
+                    redis_free_reply(reply);
+                }
+            }
+        }
+    }
+
+    snprintf(buf, len, "%ld/%ld", stored, total);
+}
+
+
+/**
+ * One of the attributes we make up, within VIRTUAL_XATTRS:
+ *
+ *   user.redisfs.inode     - the inode, as named in our keys.
+ *   user.redisfs.chunks    - how many chunks hold the contents.
+ *   user.redisfs.cache_hit - how many of the pages read by open handles
+ *                            were found in the read cache, as "hits/all".
+ *
+ * Returns the length of the value, or -ENODATA.
+ */
+int
+virtual_xattr(long long inode, const char *name, char *buf, size_t len)
+{
+    const char *field = name + strlen(VIRTUAL_XATTRS);
+
+    if (strcmp(field, "inode") == 0)
+    {
+        snprintf(buf, len, "%lld", inode);
+    }
+    else if (strcmp(field, "chunks") == 0)
+    {
+        describe_chunks(inode, buf, len);
+    }
+    else if (strcmp(field, "cache_hit") == 0)
+    {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        open_file *f;
+
+        pthread_mutex_lock(&_g_open_lock);
+        for (f = _g_open_files; f != NULL; f = f->next)
+        {
+            if (f->inode != inode)
+                continue;
+
+            pthread_mutex_lock(&f->lock);
+            hits += f->hits;
+            misses += f->misses;
+            pthread_mutex_unlock(&f->lock);
+        }
+        pthread_mutex_unlock(&_g_open_lock);
+
+        snprintf(buf, len, "%lu/%lu", hits, hits + misses);
+    }
+    else
+    {
+        return -ENODATA;
+    }
+
+    return (strlen(buf));
+}
+
+
+/**
+ * Read one extended attribute of an inode.
+ */
+int
+get_xattr(long long inode, const char *name, char *value, size_t size)
+{
+    const char *found = NULL;
+    const char *val = NULL;
+    uint32_t vlen = 0;
+    size_t pos = 0;
+    size_t len = 0;
+    char *data;
+    int ret;
+
+    if (strncmp(name, VIRTUAL_XATTRS, strlen(VIRTUAL_XATTRS)) == 0)
+    {
+        char buf[64];
+
+        ret = virtual_xattr(inode, name, buf, sizeof(buf));
+        return ((ret < 0) ? ret : copy_xattr(buf, ret, value, size));
+    }
+
+    /**
+     * We never keep access-control lists, and such.
+     */
+    if (strncmp(name, "system.", 7) == 0)
+        return -ENODATA;
+
+    data = load_xattrs(inode, &len);
+    if (data == NULL)
+        return -ENOMEM;
+
+    while ((found = next_xattr(data, len, &pos, &val, &vlen)) != NULL)
+    {
+        if (strcmp(found, name) == 0)
+            break;
+    }
+
+    ret = (found != NULL) ? copy_xattr(val, vlen, value, size) : -ENODATA;
+
+    free(data);
+    return (ret);
+}
+
+
+/**
+ * List the names of the extended attributes of an inode.
+ */
+int
+list_xattrs(long long inode, char *list, size_t size)
+{
+    const char *name;
+    const char *val;
+    uint32_t vlen;
+    size_t total = 0;
+    size_t pos = 0;
+    size_t len = 0;
+    char *data;
+
+    data = load_xattrs(inode, &len);
+    if (data == NULL)
+        return -ENOMEM;
+
+    while ((name = next_xattr(data, len, &pos, &val, &vlen)) != NULL)
+    {
+        size_t n = strlen(name) + 1;
+
+        if ((size > 0) && (total + n > size))
+        {
+            free(data);
+            return -ERANGE;
+        }
+        if (size > 0)
+            memcpy(list + total, name, n);
+        total += n;
+    }
+
+    free(data);
+    return (total);
+}
+
+
+/**
+ * Set an extended attribute of an inode, in the hash "INODE:<n>:XATTR".
+ *
+ * Returns 0 on success, or -ERRNO.
+ */
+int
+set_xattr(long long inode, const char *name, const char *value,
+          size_t size, int flags)
+{
+    redisReply *reply = NULL;
+    const char *argv[4];
+    size_t argvlen[4];
+    char key[KEY_LENGTH];
+    int ret = 0;
+
+    if (strncmp(name, VIRTUAL_XATTRS, strlen(VIRTUAL_XATTRS)) == 0)
+        return -EPERM;
+    if (strncmp(name, "system.", 7) == 0)
+        return -ENOTSUP;
+
+    snprintf(key, sizeof(key), "%s:XATTR", inode_key(_g_prefix, inode));
+
+    lock_inode(inode);
+
+    /**
+     * Honour XATTR_CREATE and XATTR_REPLACE.
+     */
+    if (flags & (XATTR_CREATE | XATTR_REPLACE))
+    {
+        int exists;
+
+        argv[0] = "HGET";
+        argv[1] = key;
+        argv[2] = name;
+        reply = redis_command_argv(3, argv, NULL);
+        exists = ((reply != NULL) && (reply->type == REDIS_REPLY_STRING));
+        redis_free_reply(reply);
+
+        if ((flags & XATTR_CREATE) && exists)
+            ret = -EEXIST;
+        if ((flags & XATTR_REPLACE) && !exists)
+            ret = -ENODATA;
+    }
+
+    if (ret == 0)
+    {
+        preserve_inode(inode);
+
+        argv[0] = "HSET";
+        argvlen[0] = 4;
+        argv[1] = key;
+        argvlen[1] = strlen(key);
+        argv[2] = name;
+        argvlen[2] = strlen(name);
+        argv[3] = value;
+        argvlen[3] = size;
+
+        reply = redis_command_argv(4, argv, argvlen);
+        if ((reply == NULL) || (reply->type == REDIS_REPLY_ERROR))
+            ret = -EIO;
+        redis_free_reply(reply);
+    }
+
+    unlock_inode(inode);
+
+    cache_invalidate_xattrs(inode);
+
+    return (ret);
+}
+
+
+/**
+ * Set an extended attribute of a file or directory.
+ *
+ * These are stored with the inode, except for RMTREE_XATTR, which
+ * removes a directory along with everything beneath it, e.g.:
+ *
+ *   setfattr -n user.redisfs.rmtree -v 1 /mnt/redis/workspace
+ */
+static int
+fs_setxattr(const char *path, const char *name, const char *value,
+            size_t size, int flags)
+{
+    long long inode;
+    int ret;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_setxattr(%s,%s);\n", path, name);
+
+    if (strcmp(name, RMTREE_XATTR) == 0)
+    {
+        redis_acquire();
+        ret = remove_tree(path);
+        redis_release();
+
+        return (ret);
+    }
+
+    redis_acquire();
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    ret = set_xattr(inode, name, value, size, flags);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Get an extended attribute of a file or directory.
+ */
+static int
+fs_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+    long long inode;
+    int ret;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_getxattr(%s,%s);\n", path, name);
+
+    if (virtual_entry(path))
+        return -ENODATA;
+
+    redis_acquire_reader();
+    redis_alive();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    ret = get_xattr(inode, name, value, size);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * List the extended attributes of a file or directory.
+ *
+ * Those we make up aren't listed, so that they're not copied elsewhere.
+ */
+static int
+fs_listxattr(const char *path, char *list, size_t size)
+{
+    long long inode;
+    int ret;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_listxattr(%s);\n", path);
+
+    if (virtual_entry(path))
+        return 0;
+
+    redis_acquire_reader();
+    redis_alive();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    ret = list_xattrs(inode, list, size);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Remove an extended attribute of an inode.
+ *
+ * Returns 0 on success, or -ERRNO.
+ */
+int
+remove_xattr(long long inode, const char *name)
+{
+    redisReply *reply = NULL;
+    const char *argv[3];
+    char key[KEY_LENGTH];
+    int ret = 0;
+
+    if (strncmp(name, VIRTUAL_XATTRS, strlen(VIRTUAL_XATTRS)) == 0)
+        return -EPERM;
+
+    snprintf(key, sizeof(key), "%s:XATTR", inode_key(_g_prefix, inode));
+
+    preserve_inode(inode);
+
+    argv[0] = "HDEL";
+    argv[1] = key;
+    argv[2] = name;
+    reply = redis_command_argv(3, argv, NULL);
+    if ((reply == NULL) || (reply->type != REDIS_REPLY_INTEGER))
+        ret = -EIO;
+    else if (reply->integer == 0)
+        ret = -ENODATA;
+    redis_free_reply(reply);
+
+    cache_invalidate_xattrs(inode);
+
+    return (ret);
+}
+
+
+/**
+ * Remove an extended attribute of a file or directory.
+ */
+static int
+fs_removexattr(const char *path, const char *name)
+{
+    long long inode;
+    int ret;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_removexattr(%s,%s);\n", path, name);
+
+    redis_acquire();
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    ret = remove_xattr(inode, name);
+
+    redis_release();
+    return (ret);
+}
+
+
+/**
+ * Access-test a file.
+ *
+ * NOP
+ */
+static int
+fs_access(const char *path, int mode)
+{
+    long long inode;
+
+    if (_g_debug)
+        fprintf(stderr, "fs_access(%s);\n", path);
+
+    /**
+     * If we're running with --fast, or --atime=noatime, just return,
+     * and don't update the atime.
+     */
+    if (_g_fast || (_g_atime == ATIME_NEVER))
+        return 0;
+
+
+    redis_acquire();
+
+  /**
+   * Update the access time of a file.
+   */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return 0;
+    }
+
+    touch_atime(inode);
+
+
+    redis_release();
+
+    return 0;
+}
+
+
+/**
+ * Remove a directory entry.
+ */
+static int
+fs_unlink(const char *path)
+{
+    long long inode;
+    redisReply *reply = NULL;
+    char *parent = NULL;
+    char *entry = NULL;
+    long long parent_inode = 0;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_unlink(%s);\n", path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        int ret = script_remove(path, 0);
+        redis_release();
+        return (ret);
+    }
+
+    /**
+     * To remove the entry we need to :
+     *
+     * [1/4] Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     * [2/4] Remove from the parent set.
+     */
+    parent = get_parent(path);
+    parent_inode = find_inode(parent);
+    entry = get_basename(path);
+
+    lock_inode(parent_inode);
+    redis_append("SREM %s %lld", dir_key(_g_prefix, "DIRENT", parent_inode),
+                 inode);
+
+    /**
+     * [3/4] Remove from the name-index of the parent.
+     */
+    redis_append("HDEL %s %s", dir_key(_g_prefix, "DIRNAME", parent_inode),
+                 entry);
+
+    redis_get_reply(&reply);
+    redis_free_reply(reply);
+    redis_get_reply(&reply);
+    redis_free_reply(reply);
+
+    unlock_inode(parent_inode);
+
+    free(parent);
+    free(entry);
+
+    /**
+     * [4/4] Remove all meta-data.
+     */
+    remove_inode(inode);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Rename a directory entry.
+ */
+int
+fs_rename(const char *old, const char *path)
+{
+    long long old_inode = -1;
+    long long existing = -1;
+    long long old_parent = 0;
+    long long new_parent = 0;
+    redisReply *reply = NULL;
+
+    redis_acquire();
+
+    if (_g_debug)
+        fprintf(stderr, "fs_rename(%s,%s);\n", old, path);
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
+
+    redis_alive();
+
+    /**
+     * A snapshot may need the entries we're about to change.
+     */
+    preserve_path(old, 1);
+    preserve_path(path, 1);
+
+    /**
+     * Do it all in one atomic step, if we can.
+     */
+    if (_g_scripts)
+    {
+        int ret = script_rename(old, path);
+        redis_release();
+        return (ret);
+    }
+
+    /**
+     * To rename the entry we need to :
+     *
+     *  1. Find the inode for the entry.
+     *
+     */
+    old_inode = find_inode(old);
+    if (old_inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
+
+    /**
+     *  2. Replace any existing destination, as rename(2) does.
+     *
+     * Otherwise the name-index would point at the renamed entry while
+     * the old destination lingered in the DIRENT set.
+     */
+    existing = find_inode(path);
+    if (existing == old_inode)
+    {
+        redis_release();
+        return 0;
+    }
+    if (existing != -1)
+    {
+        if (is_directory(path) && (count_directory_entries(path) != 0))
+        {
+            redis_release();
+            return -ENOTEMPTY;
+        }
+    }
+
+    char *old_name = get_basename(old);
+    char *new_name = get_basename(path);
+    char *parent = get_parent(old);
+    old_parent = find_inode(parent);
+    free(parent);
+    parent = get_parent(path);
+    new_parent = find_inode(parent);
+    free(parent);
+
+    /**
+     * Both directories are locked while their entries are updated.
+     */
+    lock_inodes(old_parent, new_parent);
+
+    int count = 0;
+    if (existing != -1)
+    {
+        redis_append("SREM %s %lld", dir_key(_g_prefix, "DIRENT", new_parent),
+                     existing);
+        count += 1;
+    }
+
+    /**
+     *  3. Update the name of the key, which is the filename of the
+     * directory entry - minus directory suffix.
+     */
+    append_set_meta(old_inode, "NAME %s", new_name);
+
+    /**
+     *  4. Remove the entry from the old parent, and its index.
+     */
+    redis_append("SREM %s %lld", dir_key(_g_prefix, "DIRENT", old_parent),
+                 old_inode);
+    redis_append("HDEL %s %s", dir_key(_g_prefix, "DIRNAME", old_parent),
+                 old_name);
+
+    /**
+     *  5. Add the member to the new parent, and its index.
+     */
+    redis_append("SADD %s %lld", dir_key(_g_prefix, "DIRENT", new_parent),
+                 old_inode);
+    redis_append("HSET %s %s %lld", dir_key(_g_prefix, "DIRNAME", new_parent),
+                 new_name, old_inode);
+    count += 5;
+
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        redis_get_reply(&reply);
+        redis_free_reply(reply);
+    }
+
+    unlock_inodes(old_parent, new_parent);
+
+    if (existing != -1)
+        remove_inode(existing);
+
+    cache_invalidate_path(old);
+    cache_invalidate_path(path);
+    cache_set_inode(path, new_parent, old_inode);
+
+    free(old_name);
+    free(new_name);
+
+    redis_release();
+
+    return 0;
+}
+
+
+/**
+ * Drop the blocks holding chunks [keep, last] of an inode, on a
+ * filesystem whose files are stored as shared blocks, and cut the chunk
+ * before them down to "tail" bytes, unless that is zero.
+ */
+void
+truncate_dedup(long long inode, long keep, long last, long tail)
+{
+    redisReply *blocks = NULL;
+    redisReply *reply = NULL;
+    long first = (tail != 0) ? (keep - 1) : keep;
+    long count = last - first + 1;
+    const char **argv = calloc(count + 2, sizeof(char *));
+    const char **dropped = calloc(count, sizeof(char *));
+    char *fields = calloc(count, 24);
+    const char *digest;
+    char key[128];
+    int argc = 2;
+    int n = 0;
+    long i;
+
+    if ((argv == NULL) || (dropped == NULL) || (fields == NULL) ||
+        (append_get_blocks(inode, first, last) != 0))
+        goto done;
+
+    redis_get_reply(&blocks);
+
+    /**
+     * The chunk which straddles the new size becomes a new block.
+     */
+    if ((tail != 0) && ((digest = meta_value(blocks, 0)) != NULL))
+    {
+        char *data = NULL;
+        size_t have = 0;
+
+        block_key(key, sizeof(key), digest);
+        reply = redis_command("GET %s", key);
+        if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+            data = codec_decode(reply->str, reply->len, _g_chunk_size,
+                                &have);
+        redis_free_reply(reply);
+
+        if ((data != NULL) && (have > tail))
+        {
+            block_chunk c;
+
+            memset(&c, 0, sizeof(c));
+            c.idx = keep - 1;
+            c.data = data;
+            c.len = tail;
+            c.old = digest;
+            store_blocks(inode, &c, 1);
+        }
+        free(data);
+    }
+
+    /**
+     * Those beyond it are forgotten, then released.
+     */
+    for (i = keep; i <= last; i++)
+    {
+        if ((digest = meta_value(blocks, i - first)) == NULL)
+            continue;
+
+        snprintf(fields + (i - first) * 24, 24, "%ld", i);
+        argv[argc++] = fields + (i - first) * 24;
+        dropped[n++] = digest;
+    }
+
+    if (argc > 2)
+    {
+        snprintf(key, sizeof(key), "%s:BLOCKS", inode_key(_g_prefix, inode));
+        argv[0] = "HDEL";
+        argv[1] = key;
+
+        reply = redis_command_argv(argc, argv, NULL);
+        redis_free_reply(reply);
+
+        release_blocks(dropped, n);
+    }
+
+  done:
+    redis_free_reply(blocks);
+    free(argv);
+    free(dropped);
+    free(fields);
+}
+
+
+/**
+ * Cut the given chunk of a file which may be compressed down to the
+ * given length.
+ */
+void
+truncate_framed(long long inode, long idx, long len)
+{
+    redisReply *reply = NULL;
+    redisReply *data = NULL;
+    char key[128];
+    int codec;
+
+    chunk_key(key, sizeof(key), inode, idx);
+
+    append_get_meta(inode, "CODEC");
+    redis_append("GET %s", key);
+
+    redis_get_reply(&reply);
+    codec = ((reply != NULL) && (reply->type == REDIS_REPLY_STRING)) ?
+        codec_of(reply->str) : CODEC_NONE;
+    redis_free_reply(reply);
+
+    redis_get_reply(&data);
+
+    if ((data != NULL) && (data->type == REDIS_REPLY_STRING))
+    {
+        const char *argv[3];
+        size_t argvlen[3];
+        char *raw = NULL;
+        char *frame = NULL;
+        size_t have = data->len;
+        size_t flen = 0;
+
+        if (codec == CODEC_NONE)
+        {
+            flen = (have < len) ? have : len;
+            frame = malloc(flen + 1);
+            if (frame != NULL)
+                memcpy(frame, data->str, flen);
+        }
+        else if ((raw = codec_decode(data->str, data->len, _g_chunk_size,
+                                     &have)) != NULL)
+        {
+            frame = codec_encode(codec, raw, (have < len) ? have : len,
+                                 _g_compress_min, &flen);
+        }
+
+        if (frame != NULL)
+        {
+            argv[0] = "SET";
+            argvlen[0] = 3;
+            argv[1] = key;
+            argvlen[1] = strlen(key);
+            argv[2] = frame;
+            argvlen[2] = flen;
+
+            reply = NULL;
+            redis_append_argv(3, argv, argvlen);
+            redis_get_reply(&reply);
+            redis_free_reply(reply);
+        }
+
+        free(frame);
+        free(raw);
+    }
+
+    redis_free_reply(data);
+}
+
+
+/**
+ * Truncate an inode to the given size, with any layout.
+ *
+ * Only the data beyond the new size is removed, and the size and MTIME
+ * are reset.  A file which grows stores nothing for the hole, which
+ * reads back as zeros.
+ */
+void
+truncate_inode(long long inode, off_t size)
+{
+    redisReply *reply = NULL;
+
+    /**
+     * Buffered writes must land before we cut the file down.
+     */
+    flush_inode(inode);
+    preserve_inode(inode);
+
+    lock_inode(inode);
+
+    /**
+     * Remove the data beyond the new size.
+     *
+     * With the chunked layout we only drop the chunks beyond the new
+     * size, and trim the one which straddles it.  A file which grows is
+     * left sparse: nothing is stored for the hole.
+     */
+    if (_g_chunk_size > 0)
+    {
+        long long old_size = get_size(inode);
+
+        if (size < old_size)
+        {
+            long keep = (size + _g_chunk_size - 1) / _g_chunk_size;
+            long last = (old_size - 1) / _g_chunk_size;
+            long tail = size % _g_chunk_size;
+
+            if (_g_dedup)
+            {
+                truncate_dedup(inode, keep, last, tail);
+            }
+            else
+            {
+                delete_chunks(inode, keep, last);
+
+                if ((tail != 0) && _g_compressed)
+                {
+                    truncate_framed(inode, keep - 1, tail);
+                }
+                else if (tail != 0)
+                {
+                    char key[64];
+
+                    chunk_key(key, sizeof(key), inode, keep - 1);
+                    reply = redis_command("GETRANGE %s 0 %ld", key, tail - 1);
+                    if ((reply != NULL) &&
+                        (reply->type == REDIS_REPLY_STRING) &&
+                        (reply->len > 0))
+                    {
+                        redisReply *r = NULL;
+                        r = redis_command("SET %s %b", key, reply->str,
+                                          (size_t)reply->len);
+                        redis_free_reply(r);
+                    }
+                    redis_free_reply(reply);
+                }
+            }
+        }
+    }
+    else
+    {
+        char *spilled = _g_spill ? get_spill(inode) : NULL;
+
+        /**
+         * Spilled contents are cut down within their file.
+         */
+        if ((spilled != NULL) &&
+            ((spilled = own_spill(inode, spilled, size > 0)) != NULL))
+        {
+            int ret = spill_truncate(_g_spill_dir, spilled, size);
+
+            if (ret != 0)
+                fprintf(stderr, "Failed to truncate %s/%s: %s\n",
+                        _g_spill_dir, spilled, strerror(-ret));
+            free(spilled);
+        }
+        else
+        {
+            long long old_size = get_size(inode);
+            char key[128];
+
+            /**
+             * Growing the file only changes its size, and what lies
+             * beyond the stored value reads as zeros.
+             */
+            snprintf(key, sizeof(key), "%s:DATA",
+                     inode_key(_g_prefix, inode));
+
+            if (size == 0)
+            {
+                reply = redis_command("DEL %s", key);
+                redis_free_reply(reply);
+            }
+            else if (size < old_size)
+            {
+                reply = redis_command("GETRANGE %s 0 %lld", key,
+                                      (long long)size - 1);
+                if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+                {
+                    redisReply *r = NULL;
+
+                    if (reply->len > 0)
+                        r = redis_command("SET %s %b", key, reply->str,
+                                          (size_t)reply->len);
+                    else
+                        r = redis_command("DEL %s", key);
+                    redis_free_reply(r);
+                }
+                redis_free_reply(reply);
+            }
+        }
+    }
+
+    /**
+     * Reset the size & mtime.
+     */
+    if (defer_times(inode, TIMES_MTIME, time(NULL)))
+        set_meta(inode, "SIZE %lld", (long long)size);
+    else
+        set_meta(inode, "SIZE %lld MTIME %d", (long long)size, time(NULL));
+
+    cache_invalidate_stat(inode);
+    pagecache_invalidate(inode);
+
+    unlock_inode(inode);
+}
+
+
+/**
+ * Truncate an entry, shrinking or growing it to the given size.
+ */
+static int
+fs_truncate(const char *path, off_t size)
 {
-    int ret = 0;
-    int inode = 0;
-    redisReply *reply = NULL;
+    long long inode;
+
+    redis_acquire();
 
     if (_g_debug)
-        fprintf(stderr, "count_directory_entries(%s)\n", path);
+        fprintf(stderr, "fs_truncate(%s);\n", path);
+
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only)
+    {
+        redis_release();
+        return -EPERM;
+    }
 
     redis_alive();
 
-  /**
-   * Find the inode of the directory.
-   */
-    inode = find_inode(path);
+    /**
+     * Ensure we're working on a file, not a directory.
+     */
+    if (is_directory(path))
+    {
+        redis_release();
+        return -ENOENT;
+    }
 
-  /**
-   * Now retrieve the entries.
-   */
-    reply = redisCommand(_g_redis, "SMEMBERS %s:DIRENT:%d", _g_prefix, inode);
+    /**
+     * To truncate the entry we need to :
+     *
+     * [1/2] Find the inode for this entry.
+     *
+     */
+    inode = find_inode(path);
+    if (inode == -1)
+    {
+        redis_release();
+        return -ENOENT;
+    }
 
     /**
-     * If that worked we know the number of elements.
+     * [2/2] Remove the data beyond the new size, and reset the size and
+     * mtime.
      */
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+    truncate_inode(inode, size);
+
+    redis_release();
+    return 0;
+}
+
+
+/**
+ * Parse a size such as "4096", "64k" or "4M" into bytes.
+ */
+long long
+parse_size(const char *str)
+{
+    char *end = NULL;
+    long long val = strtoll(str, &end, 10);
+
+    switch (*end)
     {
-        ret = reply->elements;
+    case 'g':
+    case 'G':
+        val *= 1024;
+        /* fall through */
+    case 'm':
+    case 'M':
+        val *= 1024;
+        /* fall through */
+    case 'k':
+    case 'K':
+        val *= 1024;
     }
-    freeReplyObject(reply);
 
-    return (ret);
+    return (val);
 }
 
 
 /**
- * Our readdir implementation.
+ * Add a replica, given as "host:port" or "host", to those we read from.
+ */
+int
+add_replica(const char *str)
+{
+    replica *r;
+    const char *colon = strrchr(str, ':');
+    size_t len = (colon != NULL) ? (size_t) (colon - str) : strlen(str);
+
+    if (_g_replica_count == MAX_REPLICAS)
+    {
+        fprintf(stderr, "At most %d replicas may be used.\n", MAX_REPLICAS);
+        return -1;
+    }
+
+    if ((len == 0) || (len >= sizeof(r->host)))
+    {
+        fprintf(stderr, "Invalid replica '%s'; use host:port.\n", str);
+        return -1;
+    }
+
+    r = &_g_replicas[_g_replica_count];
+    memcpy(r->host, str, len);
+    r->host[len] = '\0';
+    r->port = (colon != NULL) ? atoi(colon + 1) : 6379;
+
+    if (r->port <= 0)
+    {
+        fprintf(stderr, "Invalid replica '%s'; use host:port.\n", str);
+        return -1;
+    }
+
+    _g_replica_count += 1;
+    return 0;
+}
+
+
+/**
+ * Is our prefix that of a snapshot?  If so we read from the filesystem
+ * it was taken of, and may not change anything.
  *
- * We have a SET of entries for each directory, stored under a key which
- * is named "$PREFIX:/$PATH".
+ * Returns 0 on success.
+ */
+int
+setup_snapshot()
+{
+    redisReply *reply = NULL;
+    char parent[sizeof(_g_prefix)] = { "" };
+    int ret = 0;
+
+    redis_alive();
+
+    redis_append("GET %s:GLOBAL:PARENT", _g_prefix);
+    redis_append("GET %s:GLOBAL:SNAPSHOT", _g_prefix);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+    {
+        if (reply->len < sizeof(parent))
+            snprintf(parent, sizeof(parent), "%s", reply->str);
+        else
+        {
+            fprintf(stderr,
+                    "The parent of the snapshot '%s' has too long a prefix.\n",
+                    _g_prefix);
+            ret = -1;
+        }
+    }
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) && parent[0])
+    {
+        _g_snapshot = atoll(reply->str);
+        snprintf(_g_prefix, sizeof(_g_prefix), "%s", parent);
+        _g_read_only = 1;
+    }
+    redis_free_reply(reply);
+
+    return (ret);
+}
+
+
+/**
+ * Decide whether the keys of inodes carry hash tags.
  *
- * So to read all file entries beneath "/" we'd look for members of the
- * set "SKX:/", and to look for entries stored beneath /tmp we'd search
- * for members of the set "SKX:/tmp".
+ * A new filesystem mounted with --cluster is tagged, so that the keys
+ * of each inode share a slot, but one which already exists without
+ * tags can't be used on a cluster.  A tagged filesystem may also be
+ * mounted from a single server.
  *
+ * Returns 0 on success.
  */
-static int
-fs_readdir(const char *path,
-           void *buf,
-           fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+int
+setup_tags()
 {
     redisReply *reply = NULL;
-    int i;
-    int inode;
+    int existing = 0;
 
+    redis_alive();
 
-    pthread_mutex_lock(&_g_lock);
+    redis_append("GET %s:GLOBAL:HASHTAGS", _g_prefix);
+    redis_append("EXISTS %s:GLOBAL:INODE", _g_prefix);
 
-    if (_g_debug)
-        fprintf(stderr, "fs_readdir(%s)\n", path);
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        _g_tags = (atoi(reply->str) == 1);
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        existing = reply->integer;
+    redis_free_reply(reply);
+
+    if (_g_tags || !_g_cluster_mode)
+        return 0;
+
+    if (existing || _g_read_only)
+    {
+        fprintf(stderr,
+                "A filesystem created without hash tags can't be used on a cluster.\n");
+        return -1;
+    }
+
+    reply = redis_command("SET %s:GLOBAL:HASHTAGS 1", _g_prefix);
+    redis_free_reply(reply);
+    _g_tags = 1;
+
+    return 0;
+}
+
+
+/**
+ * Decide upon the layout used by the filesystem: the schema in which
+ * meta-data is stored, and the size of the chunks holding the contents
+ * of files.
+ *
+ * These are properties of the filesystem rather than of the mount, so
+ * they're recorded beneath our prefix when a new filesystem is first
+ * mounted, and used by every later mount.
+ *
+ * Returns 0 on success.
+ */
+int
+setup_layout()
+{
+    redisReply *reply = NULL;
+    long stored = 0;
+    int schema = -1;
+    int existing = 0;
 
     redis_alive();
 
+    redis_append("GET %s:GLOBAL:CHUNKSIZE", _g_prefix);
+    redis_append("GET %s:GLOBAL:SCHEMA", _g_prefix);
+    redis_append("EXISTS %s:GLOBAL:INODE", _g_prefix);
+    redis_append("SSCAN %s 0 COUNT 1", dir_key(_g_prefix, "DIRENT", -99));
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        stored = atol(reply->str);
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        schema = (strcmp(reply->str, "hash") == 0) ? SCHEMA_HASH : SCHEMA_KEYS;
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        existing = reply->integer;
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+        _g_sscan = 1;
+    redis_free_reply(reply);
+
     /**
-     * Add the filesystem entries which always exist.
+     * The schema.  Filesystems which predate the choice use a key
+     * per field.
      */
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
+    if (schema != -1)
+    {
+        if ((_g_schema != SCHEMA_KEYS) && (_g_schema != schema))
+            fprintf(stderr,
+                    "This filesystem uses the '%s' schema; ignoring --schema.\n",
+                    (schema == SCHEMA_HASH) ? "hash" : "keys");
+        _g_schema = schema;
+    }
+    else if (existing)
+    {
+        if (_g_schema != SCHEMA_KEYS)
+        {
+            fprintf(stderr,
+                    "The prefix '%s' holds a filesystem using the 'keys' schema; use redisfs-convert to change it.\n",
+                    _g_prefix);
+            return -1;
+        }
+    }
+    else
+    {
+        reply = redis_command("SETNX %s:GLOBAL:SCHEMA %s",
+                              _g_prefix,
+                              (_g_schema == SCHEMA_HASH) ? "hash" : "keys");
+        redis_free_reply(reply);
+    }
 
     /**
-     * For each entry in the set ..
+     * The chunk size.
      */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (stored > 0)
+    {
+        if ((_g_chunk_size > 0) && (_g_chunk_size != stored))
+            fprintf(stderr,
+                    "This filesystem uses %ld byte chunks; ignoring --chunk-size.\n",
+                    stored);
+        _g_chunk_size = stored;
+        return 0;
+    }
+
+    if (_g_chunk_size <= 0)
     {
-        pthread_mutex_unlock(&_g_lock);
+        _g_chunk_size = 0;
         return 0;
     }
 
+    if (existing)
+    {
+        fprintf(stderr,
+                "The prefix '%s' holds a filesystem which doesn't use chunks; refusing --chunk-size.\n",
+                _g_prefix);
+        return -1;
+    }
 
-    reply = redisCommand(_g_redis, "SMEMBERS %s:DIRENT:%d", _g_prefix, inode);
+    reply = redis_command("SETNX %s:GLOBAL:CHUNKSIZE %ld",
+                          _g_prefix, _g_chunk_size);
+    redis_free_reply(reply);
 
-    char *memcommand = malloc(1048576);
-    sprintf(memcommand, "MGET");
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_ARRAY))
+    return 0;
+}
+
+
+/**
+ * Decide whether file contents are stored as shared blocks.
+ *
+ * Like the chunk size this is a property of the filesystem, so it may
+ * only be chosen when a new filesystem is first mounted.  Blocks are
+ * released by a server-side script, so it can't be chosen where those
+ * aren't used.
+ *
+ * Returns 0 on success.
+ */
+int
+setup_dedup()
+{
+    redisReply *reply = NULL;
+    int asked = _g_dedup;
+    int existing = 0;
+
+    redis_alive();
+
+    redis_append("GET %s:GLOBAL:DEDUP", _g_prefix);
+    redis_append("EXISTS %s:GLOBAL:INODE", _g_prefix);
+
+    _g_dedup = 0;
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        _g_dedup = (atoi(reply->str) == 1);
+    redis_free_reply(reply);
+
+    redis_get_reply(&reply);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_INTEGER))
+        existing = reply->integer;
+    redis_free_reply(reply);
+
+    if (_g_dedup || !asked)
+        return 0;
+
+    if (_g_chunk_size == 0)
     {
-      /**
-       * OK the set exists and has members.
-       *
-       * We need to iterate over each one, and get the name of the
-       * directory entry.
-       */
-        for (i = 0; i < reply->elements; i++)
-        {
-            char *name = reply->element[i]->str;
-            sprintf(memcommand + strlen(memcommand), " %s:INODE:%s:NAME",
-                    _g_prefix, name);
-        }
-        redisReply *r = NULL;
-        r = redisCommand(_g_redis, memcommand);
-        for (i = 0; i < reply->elements; i++)
-        {
+        fprintf(stderr,
+                "Deduplication needs the chunked layout; use --chunk-size.\n");
+        return -1;
+    }
 
-            if ((r->element[i] != NULL))
-                filler(buf, strdup(r->element[i]->str), NULL, 0);
+    if (existing || _g_read_only)
+    {
+        fprintf(stderr,
+                "Only a new filesystem may use deduplication; ignoring --dedup.\n");
+        return 0;
+    }
 
-        }
-        freeReplyObject(r);
+    if (_g_no_scripts || _g_tags)
+    {
+        fprintf(stderr,
+                "Deduplication needs server-side scripts, which can't be used with %s.\n",
+                _g_tags ? "hash tags" : "--no-scripts");
+        return -1;
+    }
+
+    reply = redis_command("SET %s:GLOBAL:DEDUP 1", _g_prefix);
+    redis_free_reply(reply);
+    _g_dedup = 1;
+
+    return 0;
+}
+
+
+/**
+ * Decide whether file contents may be compressed.
+ *
+ * Files are only compressed if we've been asked to, but once that has
+ * happened the filesystem is marked as holding compressed data, so that
+ * later mounts know to decode it.
+ *
+ * Returns 0 on success.
+ */
+int
+setup_compression()
+{
+    redisReply *reply = NULL;
+
+    if ((_g_compress != CODEC_NONE) && (_g_chunk_size == 0))
+    {
+        fprintf(stderr,
+                "Compression needs the chunked layout; use --chunk-size.\n");
+        return -1;
+    }
+
+    if ((_g_compress != CODEC_NONE) && _g_read_only)
+    {
+        fprintf(stderr, "Ignoring --compress on a read-only mount.\n");
+        _g_compress = CODEC_NONE;
     }
 
-    free(memcommand);
+    redis_alive();
+
+    if (_g_compress != CODEC_NONE)
+    {
+        reply = redis_command("SET %s:GLOBAL:COMPRESS %s", _g_prefix,
+                              codec_name(_g_compress));
+        redis_free_reply(reply);
+        _g_compressed = 1;
+        return 0;
+    }
 
-    freeReplyObject(reply);
+    reply = redis_command("GET %s:GLOBAL:COMPRESS", _g_prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        _g_compressed = (_g_chunk_size > 0);
+    redis_free_reply(reply);
 
-    pthread_mutex_unlock(&_g_lock);
     return 0;
 }
 
 
 /**
- * Get the attributes of each file.
+ * Decide whether the contents of large files may be kept on disk.
+ *
+ * Once a filesystem has spilled a file it is marked as having done so,
+ * so that later mounts know they need the directory holding them.
+ *
+ * Returns 0 on success.
  */
-static int
-fs_getattr(const char *path, struct stat *stbuf)
+int
+setup_spill()
 {
-    int inode;
     redisReply *reply = NULL;
-
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_getattr(%s);\n", path);
+    char name[SPILL_NAME];
+    struct stat st;
 
     redis_alive();
 
-    memset(stbuf, 0, sizeof(struct stat));
+    reply = redis_command("GET %s:GLOBAL:SPILL", _g_prefix);
+    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING))
+        _g_spill = (atoi(reply->str) == 1);
+    redis_free_reply(reply);
 
-    /**
-     * Handle root directory first, as a special-case.
-     */
-    if (strcmp(path, "/") == 0)
+    if (_g_spill_dir[0] == '\0')
     {
-        stbuf->st_atime = time(NULL);
-        stbuf->st_mtime = stbuf->st_atime;
-        stbuf->st_ctime = stbuf->st_atime;
-        stbuf->st_uid = getuid();
-        stbuf->st_gid = getgid();
-
-        stbuf->st_mode = S_IFDIR | 0755;
-        stbuf->st_nlink = 1;
-
-        pthread_mutex_unlock(&_g_lock);
+        if (_g_spill)
+        {
+            fprintf(stderr,
+                    "This filesystem keeps large files on disk; give their directory with --spill-dir.\n");
+            return -1;
+        }
         return 0;
     }
 
-
-    /**
-     * OK a real lookup.
-     */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (_g_chunk_size > 0)
     {
-      /**
-       * File/Directory not found.
-       */
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        fprintf(stderr,
+                "Only files stored as a single value may be spilled; --spill-dir can't be used with chunks.\n");
+        return -1;
     }
 
-
-    /**
-     * Setup atime, mtime, ctime, and owner/gid.
-     */
-    redisAppendCommand(_g_redis,
-                       "MGET %s:INODE:%d:CTIME %s:INODE:%d:ATIME %s:INODE:%d:MTIME %s:INODE:%d:GID %s:INODE:%d:UID %s:INODE:%d:LINK",
-                       _g_prefix, inode, _g_prefix, inode, _g_prefix, inode,
-                       _g_prefix, inode, _g_prefix, inode, _g_prefix, inode,
-                       _g_prefix, inode);
-    redisGetReply(_g_redis, (void **)&reply);
-    if ((reply->element[0] != NULL)
-        && (reply->element[0]->type == REDIS_REPLY_STRING))
-        stbuf->st_ctime = atoi(reply->element[0]->str);
-    if ((reply->element[1] != NULL)
-        && (reply->element[1]->type == REDIS_REPLY_STRING))
-        stbuf->st_atime = atoi(reply->element[1]->str);
-    if ((reply->element[2] != NULL)
-        && (reply->element[2]->type == REDIS_REPLY_STRING))
-        stbuf->st_mtime = atoi(reply->element[2]->str);
-    if ((reply->element[3] != NULL)
-        && (reply->element[3]->type == REDIS_REPLY_STRING))
-        stbuf->st_gid = atoi(reply->element[3]->str);
-    if ((reply->element[4] != NULL)
-        && (reply->element[4]->type == REDIS_REPLY_STRING))
-        stbuf->st_uid = atoi(reply->element[3]->str);
-    if ((reply->element[5] != NULL)
-        && (reply->element[5]->type == REDIS_REPLY_STRING))
-        stbuf->st_nlink = atoi(reply->element[4]->str);
-    if ((reply->element[6] != NULL)
-        && (reply->element[6]->type == REDIS_REPLY_STRING))
-        stbuf->st_ctime = atoi(reply->element[5]->str);
-    freeReplyObject(reply);
-
-    /**
-     *  Type - batch up some commands here for later use
-     */
-    reply =
-        redisCommand(_g_redis,
-                     "MGET %s:INODE:%d:TYPE %s:INODE:%d:MODE %s:INODE:%d:SIZE",
-                     _g_prefix, inode, _g_prefix, inode, _g_prefix, inode);
-    if ((reply != NULL) && (reply->element[0] != NULL)
-        && (reply->element[0]->type == REDIS_REPLY_STRING))
+    if ((stat(_g_spill_dir, &st) != 0) || ((st.st_mode & S_IFMT) != S_IFDIR))
     {
+        fprintf(stderr, "%s doesn't exist or isn't a directory!\n",
+                _g_spill_dir);
+        return -1;
+    }
 
-        if ((reply->element[1] != NULL)
-            && (reply->element[1]->type == REDIS_REPLY_STRING))
-        {
-            stbuf->st_mode = atoi(reply->element[1]->str);
-        }
-
-        if (strcmp(reply->element[0]->str, "DIR") == 0)
-        {
-            stbuf->st_mode |= S_IFDIR;
-        }
-        else if (strcmp(reply->element[0]->str, "LINK") == 0)
-        {
-            stbuf->st_mode |= S_IFLNK;
-            stbuf->st_nlink = 1;
-            stbuf->st_size = 0;
-        }
-        else if (strcmp(reply->element[0]->str, "FILE") == 0)
-        {
-            if ((reply->element[2] != NULL)
-                && (reply->element[2]->type == REDIS_REPLY_STRING))
-            {
-                if (_g_debug)
-                    fprintf(stderr, "found file\n");
-                stbuf->st_size = atoi(reply->element[2]->str);
-            }
-        }
-        else
-        {
-            if (_g_debug)
-                fprintf(stderr, "UNKNOWN ENTRY TYPE: %s\n",
-                        reply->element[0]->str);
-        }
+    if ((spill_name(name, sizeof(name), _g_prefix, 0, 0) != 0) ||
+        (strchr(_g_prefix, '/') != NULL) || (_g_prefix[0] == '.'))
+    {
+        fprintf(stderr, "The prefix '%s' can't be used to name files.\n",
+                _g_prefix);
+        return -1;
     }
-    freeReplyObject(reply);
 
+    if (!_g_spill && !_g_read_only)
+    {
+        reply = redis_command("SET %s:GLOBAL:SPILL 1", _g_prefix);
+        redis_free_reply(reply);
+    }
+    _g_spill = 1;
 
-    pthread_mutex_unlock(&_g_lock);
     return 0;
+}
 
 
+/**
+ * Show minimal usage information.
+ */
+int
+usage(int argc, char *argv[])
+{
+    printf("%s - version %s - Filesystem based upon FUSE\n", argv[0],
+           VERSION);
+    printf("\nOptions:\n\n");
+    printf("\t--async      - Share one pipelined connection between all threads.\n");
+    printf("\t--atime      - Keep access times 'strict', by 'relatime', or 'noatime' [strict].\n");
+    printf("\t--backend    - Keep the filesystem in 'redis', or in memory with 'mock' [redis].\n");
+    printf("\t--cache-ttl  - Cache lookups & attributes for this many seconds [0].\n");
+    printf("\t--cache-notify - Use keyspace notifications to keep the cache coherent.\n");
+    printf("\t--chunk-size - Store new filesystems in chunks of this size, e.g. 64k.\n");
+    printf("\t--coherence - How long the kernel may cache: 'strict', 'relaxed' or 'readonly'.\n");
+    printf("\t--cluster    - Use a Redis Cluster, reached via the given host.\n");
+    printf("\t--compress   - Compress the chunks of new files with 'zlib'.\n");
+    printf("\t--compress-min - Store chunks smaller than this uncompressed [512].\n");
+    printf("\t--connections - The number of connections to the redis server [8].\n");
+    printf("\t--debug      - Launch with debugging information.\n");
+    printf("\t--dedup      - Store each distinct chunk of a new filesystem only once; not on a cluster.\n");
+    printf("\t--help       - Show this minimal help information.\n");
+    printf("\t--host       - The hostname of the redis server [localhost]\n");
+    printf("\t--lowlevel   - Use the low-level API of FUSE, which works by inode.\n");
+    printf
+        ("\t--mount      - The directory to mount our filesystem under [/mnt/redis].\n");
+    printf("\t--no-arena  - Allocate each reply from redis individually.\n");
+    printf("\t--no-scripts - Don't use server-side scripts, even if available.\n");
+    printf("\t--port       - The port of the redis server [6389].\n");
+    printf("\t--prefix     - A string prepended to any Redis key names.\n");
+    printf("\t--read-cache - Cache up to this much file content, e.g. 64m.\n");
+    printf("\t--read-only  - Mount the filesystem read-only.\n");
+    printf("\t--readahead  - Read up to this far ahead of sequential readers, e.g. 4m.\n");
+    printf("\t--replica    - Serve reads from this replica, host:port; may be repeated.\n");
+    printf("\t--schema     - Store the meta-data of new filesystems as 'keys' or a 'hash' [keys].\n");
+    printf("\t--spill-dir  - Keep the contents of large files in this directory.\n");
+    printf("\t--spill-size - Files larger than this are kept in the --spill-dir [16m].\n");
+    printf("\t--stats      - Keep statistics, shown in /.redisfs/stats.\n");
+    printf("\t--stats-slow - Log operations taking this many milliseconds to /.redisfs/slow.\n");
+    printf("\t--time-delay - Write out changed timestamps after this many seconds [0].\n");
+    printf("\t--write-buffer - Gather writes to each open file in a buffer of this size, e.g. 1m.\n");
+    printf("\t--write-delay - Write out buffered data after this many seconds [1].\n");
+    printf("\n");
+
+    return 1;
 }
 
 
 /**
- * Make a directory.
+ * The operations we keep statistics for, with --stats.
  */
-static int
-fs_mkdir(const char *path, mode_t mode)
+enum
 {
-    redisReply *reply = NULL;
-    char *parent = NULL;
-    char *entry = NULL;
-    int new_inode = 0;
-    int parent_inode = 0;
+    OP_ACCESS, OP_CHMOD, OP_CHOWN, OP_CREATE, OP_FLUSH, OP_FSYNC,
+    OP_GETATTR, OP_GETXATTR, OP_LISTXATTR, OP_LOOKUP, OP_MKDIR, OP_OPEN,
+    OP_READ, OP_READDIR, OP_READLINK, OP_RELEASE, OP_REMOVEXATTR,
+    OP_RENAME, OP_RMDIR, OP_SETXATTR, OP_SYMLINK, OP_TRUNCATE, OP_UNLINK,
+    OP_UTIMENS, OP_WRITE, OP_COUNT
+};
 
-    pthread_mutex_lock(&_g_lock);
+const char *_g_op_names[OP_COUNT] = {
+    "access", "chmod", "chown", "create", "flush", "fsync",
+    "getattr", "getxattr", "listxattr", "lookup", "mkdir", "open",
+    "read", "readdir", "readlink", "release", "removexattr",
+    "rename", "rmdir", "setxattr", "symlink", "truncate", "unlink",
+    "utimens", "write"
+};
 
-    if (_g_debug)
-        fprintf(stderr, "fs_mkdir(%s);\n", path);
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+/**
+ * Wrap an operation so that, if we're keeping statistics, the time it
+ * takes and what it asks of the server are recorded.
+ */
+#define TIMED(op, name, params, args)                                   \
+    static int                                                          \
+    timed_##name params                                                 \
+    {                                                                   \
+        long long start;                                                \
+        int ret;                                                        \
+                                                                        \
+        if (!stats_enabled())                                           \
+            return (fs_##name args);                                    \
+                                                                        \
+        stats_begin(&_g_usage);                                         \
+        start = stats_now();                                            \
+        ret = fs_##name args;                                           \
+        stats_record(op, path, stats_now() - start, (ret < 0), &_g_usage); \
+        return (ret);                                                   \
     }
 
-    redis_alive();
+TIMED(OP_ACCESS, access, (const char *path, int mode), (path, mode))
+TIMED(OP_CHMOD, chmod, (const char *path, mode_t mode), (path, mode))
+TIMED(OP_CHOWN, chown, (const char *path, uid_t uid, gid_t gid),
+      (path, uid, gid))
+TIMED(OP_CREATE, create,
+      (const char *path, mode_t mode, struct fuse_file_info *fi),
+      (path, mode, fi))
+TIMED(OP_FLUSH, flush, (const char *path, struct fuse_file_info *fi),
+      (path, fi))
+TIMED(OP_FSYNC, fsync,
+      (const char *path, int datasync, struct fuse_file_info *fi),
+      (path, datasync, fi))
+TIMED(OP_GETATTR, getattr, (const char *path, struct stat *stbuf),
+      (path, stbuf))
+TIMED(OP_GETXATTR, getxattr,
+      (const char *path, const char *name, char *value, size_t size),
+      (path, name, value, size))
+TIMED(OP_LISTXATTR, listxattr, (const char *path, char *list, size_t size),
+      (path, list, size))
+TIMED(OP_MKDIR, mkdir, (const char *path, mode_t mode), (path, mode))
+TIMED(OP_OPEN, open, (const char *path, struct fuse_file_info *fi),
+      (path, fi))
+TIMED(OP_READ, read,
+      (const char *path, char *buf, size_t size, off_t offset,
+       struct fuse_file_info *fi), (path, buf, size, offset, fi))
+TIMED(OP_READDIR, readdir,
+      (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+       struct fuse_file_info *fi), (path, buf, filler, offset, fi))
+TIMED(OP_READLINK, readlink, (const char *path, char *buf, size_t size),
+      (path, buf, size))
+TIMED(OP_RELEASE, release, (const char *path, struct fuse_file_info *fi),
+      (path, fi))
+TIMED(OP_REMOVEXATTR, removexattr, (const char *path, const char *name),
+      (path, name))
+TIMED(OP_RENAME, rename, (const char *old, const char *path), (old, path))
+TIMED(OP_RMDIR, rmdir, (const char *path), (path))
+TIMED(OP_SETXATTR, setxattr,
+      (const char *path, const char *name, const char *value, size_t size,
+       int flags), (path, name, value, size, flags))
+TIMED(OP_SYMLINK, symlink, (const char *target, const char *path),
+      (target, path))
+TIMED(OP_TRUNCATE, truncate, (const char *path, off_t size), (path, size))
+TIMED(OP_UNLINK, unlink, (const char *path), (path))
+TIMED(OP_UTIMENS, utimens, (const char *path, const struct timespec tv[2]),
+      (path, tv))
+TIMED(OP_WRITE, write,
+      (const char *path, const char *buf, size_t size, off_t offset,
+       struct fuse_file_info *fi), (path, buf, size, offset, fi))
+
+
+struct fuse_operations redisfs_operations = {
+    .chmod = timed_chmod,
+    .chown = timed_chown,
+    .create = timed_create,
+    .getattr = timed_getattr,
+    .mkdir = timed_mkdir,
+    .read = timed_read,
+    .readdir = timed_readdir,
+    .readlink = timed_readlink,
+    .rename = timed_rename,
+    .rmdir = timed_rmdir,
+    .setxattr = timed_setxattr,
+    .getxattr = timed_getxattr,
+    .listxattr = timed_listxattr,
+    .removexattr = timed_removexattr,
+    .symlink = timed_symlink,
+    .truncate = timed_truncate,
+    .unlink = timed_unlink,
+    .utimens = timed_utimens,
+    .write = timed_write,
 
-    /**
-     * We need to create a new INODE number & entry.
-     *
-     * Once that is done we can create the new entry
-     * in the set for the parent directory.
+
+    /*
+     *  FAKE: Only update access-time.
      */
-    parent = get_parent(path);
-    entry = get_basename(path);
-    new_inode = get_next_inode();
-    parent_inode = find_inode(parent);
+    .access = timed_access,
+    .open = timed_open,
 
-    /**
-     * Add the entry to the parent directory.
+    /*
+     * Write buffering.
      */
-    redisAppendCommand(_g_redis, "SADD %s:DIRENT:%d %d", _g_prefix,
-                       parent_inode, new_inode);
+    .flush = timed_flush,
+    .fsync = timed_fsync,
+    .release = timed_release,
 
-    /**
-     * Now populate the new entry.
+
+    /*
+     * Connection & lock setup/cleanup.
      */
-    redisAppendCommand(_g_redis,
-                       "MSET %s:INODE:%d:NAME %s %s:INODE:%d:TYPE DIR %s:INODE:%d:MODE %d %s:INODE:%d:UID %d %s:INODE:%d:GID %d %s:INODE:%d:SIZE %d %s:INODE:%d:CTIME %d %s:INODE:%d:MTIME %d %s:INODE:%d:ATIME %d %s:INODE:%d:LINK 1",
-                       _g_prefix, new_inode, entry, _g_prefix, new_inode,
-                       _g_prefix, new_inode, mode, _g_prefix, new_inode,
-                       fuse_get_context()->uid, _g_prefix, new_inode,
-                       fuse_get_context()->gid, _g_prefix, new_inode, 0,
-                       _g_prefix, new_inode, time(NULL), _g_prefix, new_inode,
-                       time(NULL), _g_prefix, new_inode, time(NULL),
-                       _g_prefix, new_inode);
-    int i = 0;
-    for (i = 0; i < 2; i++)
-    {
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
-    }
+    .init = fs_init,
+    .destroy = fs_destroy,
+};
 
 
-    free(parent);
-    free(entry);
 
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
-}
+/**
+ *  The low-level API of FUSE, used with --lowlevel.
+ *
+ *  Here the kernel names everything by inode, which saves us walking the
+ * path of each entry for each operation: lookups, attributes, reads,
+ * writes and listings all go straight to their inode.  The inodes the
+ * kernel knows of are remembered by nodes.c, so that those operations
+ * which change the tree may still be handed to the operations above, by
+ * path, and share their scripts, snapshots and caches.
+ *
+ *  The inodes we give the kernel are ours plus one, so that the root is
+ * FUSE_ROOT_ID, with our virtual entries far above any real inode.
+ */
+#define LL_VIRTUAL_INO ((fuse_ino_t) 1 << 62)
+#define LL_UNKNOWN_INO 0xffffffff
+
+#define VIRTUAL_INODE(which) (NODES_ROOT - 1 - (which))
 
 
 /**
- * Remove a directory entry.
+ * A listing of a directory, being built for the kernel.
+ *
+ * Without SSCAN a directory is listed in one go, when it is first read,
+ * and handed over a page at a time from the "fh" of the open directory.
  */
-static int
-fs_rmdir(const char *path)
+typedef struct ll_dir
 {
-    int parent_inode = 0;
-    int inode = 0;
-    redisReply *reply = NULL;
-    char *parent = NULL;
+    fuse_req_t req;
+    char *data;
+    size_t len;
+    size_t size;
+    int grow;
+} ll_dir;
 
-    pthread_mutex_lock(&_g_lock);
 
-    if (_g_debug)
-        fprintf(stderr, "fs_rmdir(%s);\n", path);
+/**
+ * Convert between the inodes of the kernel, and our own.
+ */
+static fuse_ino_t
+to_ino(long long inode)
+{
+    if (inode == NODES_ROOT)
+        return FUSE_ROOT_ID;
+    if (inode < NODES_ROOT)
+        return (LL_VIRTUAL_INO + (NODES_ROOT - 1 - inode));
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
-    }
+    return ((fuse_ino_t) inode + 1);
+}
 
-    redis_alive();
+static long long
+from_ino(fuse_ino_t ino)
+{
+    if (ino == FUSE_ROOT_ID)
+        return NODES_ROOT;
+    if (ino > LL_VIRTUAL_INO)
+        return (VIRTUAL_INODE((long long)(ino - LL_VIRTUAL_INO)));
 
+    return ((long long)ino - 1);
+}
 
-    /**
-     * Ensure we're working on a directory.
-     */
-    if (!is_directory(path))
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
-    }
 
+/**
+ * Which of our virtual entries an inode is, or 0 for a real one.
+ */
+static int
+virtual_inode(long long inode)
+{
+    return ((inode < NODES_ROOT) ? (int)(NODES_ROOT - 1 - inode) : 0);
+}
 
-    /**
-     * [1/4] Make sure the directory isn't empty.
-     */
-    if (count_directory_entries(path) != 0)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOTEMPTY;
-    }
 
-    /**
-     * To remove the entry we need to :
-     *
-     * [2/4] Find the inode for this entry.
-     *
-     */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
-    inode = find_inode(path);
+/**
+ * How long, in seconds, the kernel may keep whatever we reply with.
+ */
+static long
+kernel_ttl()
+{
+    long ttl = (_g_cache_ttl + 999) / 1000;
 
-    if (inode == -1)
+    return ((ttl < 1) ? 1 : ttl);
+}
+
+static double
+kernel_timeout()
+{
+    switch (_g_coherence)
     {
-        free(parent);
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+    case COHERENCE_STRICT:
+        return 0;
+    case COHERENCE_RELAXED:
+        return (kernel_ttl());
+    case COHERENCE_READONLY:
+        return (KERNEL_READONLY_TTL);
+    default:
+        return 1.0;
     }
+}
 
-    /**
-     * [3/4] Remove from the directory of the parent.
-     */
-    reply =
-        redisCommand(_g_redis, "SREM %s:DIRENT:%d %d", _g_prefix,
-                     parent_inode, inode);
-    freeReplyObject(reply);
-    free(parent);
-
-    /**
-     * [4/4] Remove all meta-data.
-     */
-    remove_inode(inode);
 
+/**
+ * Note who is asking, so that what they create is theirs.
+ */
+static void
+ll_caller(fuse_req_t req)
+{
+    const struct fuse_ctx *ctx = fuse_req_ctx(req);
 
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    _g_caller_known = 1;
+    _g_caller_uid = ctx->uid;
+    _g_caller_gid = ctx->gid;
 }
 
 
 /**
- * Write to a file or path.
+ * Build the path of an inode, or of the named entry within it.
+ *
+ * Returns 0 on success, or -ESTALE if the kernel asked about an inode it
+ * had forgotten.
  */
 static int
-fs_write(const char *path,
-         const char *buf,
-         size_t size, off_t offset, struct fuse_file_info *fi)
+ll_path(long long dir, const char *name, char *buf, size_t len)
 {
-    redisReply *reply = NULL;
-
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_write(%s);\n", path);
-
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
-    }
-
-    redis_alive();
+    size_t used;
 
-    int inode = find_inode(path);
+    if (nodes_path(dir, buf, len) != 0)
+        return -ESTALE;
 
-    /**
-     * Simplest case first.
-     */
-    if (offset == 0)
-    {
-        char *mem = malloc(size + 1);
-        memcpy(mem, buf, size);
+    if (name == NULL)
+        return 0;
 
-        if (_g_debug)
-            fprintf(stderr, "fs_write->simple(%s);\n", path);
+    used = (dir == NODES_ROOT) ? 0 : strlen(buf);
+    if (used + strlen(name) + 2 > len)
+        return -ENAMETOOLONG;
 
-      /**
-       * MSET inode's size and mtime, delete, set new data
-       */
-        redisAppendCommand(_g_redis,
-                           "MSET %s:INODE:%d:SIZE %d %s:INODE:%d:MTIME %d %s:INODE:%d:DATA %b",
-                           _g_prefix, inode, size, _g_prefix, inode,
-                           time(NULL), _g_prefix, inode, mem, size);
+    snprintf(buf + used, len - used, "/%s", name);
+    return 0;
+}
 
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
 
-        free(mem);
-    }
-    else
-    {
-        if (_g_debug)
-            fprintf(stderr, "fs_write->offsetted(%s);\n", path);
+/**
+ * Start, and finish, timing an operation, with --stats.
+ */
+static long long
+ll_begin()
+{
+    if (!stats_enabled())
+        return 0;
 
-        /**
-         * Copy the new data.
-         */
-        char *mem = malloc(size);
-        memcpy(mem, buf, size);
+    stats_begin(&_g_usage);
+    return (stats_now());
+}
 
-        /**
-         * Now increment the size record and store contents.
-         */
-        redisAppendCommand(_g_redis, "INCRBY %s:INODE:%d:SIZE %d",
-                           _g_prefix, inode, size);
+static void
+ll_end(int op, long long inode, const char *name, long long start,
+       int failed)
+{
+    char path[PATH_MAX];
 
-        redisAppendCommand(_g_redis, "APPEND %s:INODE:%d:DATA %b",
-                           _g_prefix, inode, mem, size);
+    if (!stats_enabled())
+        return;
 
-        //don't store mtime if fast used
-        if (!_g_fast)
-        {
-            redisAppendCommand(_g_redis, "SET %s:INODE:%d:MTIME %d",
-                               _g_prefix, inode, time(NULL));
-            redisGetReply(_g_redis, (void **)&reply);
-            freeReplyObject(reply);
-        }
+    if (ll_path(inode, name, path, sizeof(path)) != 0)
+        snprintf(path, sizeof(path), "#%lld", inode);
 
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
+    stats_record(op, path, stats_now() - start, failed, &_g_usage);
+}
 
 
-        /**
-         * Free the memory.
-         */
-        free(mem);
+/**
+ * The attributes of an inode.
+ *
+ * Returns 0 on success, or -ENOENT if it has been removed.
+ */
+static int
+ll_stat(long long inode, struct stat *stbuf)
+{
+    int ret;
 
+    if (virtual_inode(inode))
+    {
+        ret = virtual_getattr(virtual_inode(inode), stbuf);
+    }
+    else
+    {
+        redis_acquire_reader();
+        redis_alive();
+        ret = stat_inode(inode, stbuf);
+        redis_release();
     }
 
-    pthread_mutex_unlock(&_g_lock);
-    return size;
+    stbuf->st_ino = to_ino(inode);
+    return (ret);
 }
 
 
 /**
- * Read from a file.
+ * Look up the named entry of a directory, remembering it for the kernel.
+ *
+ * Returns 0 on success, or -ERRNO.
  */
 static int
-fs_read(const char *path, char *buf, size_t size, off_t offset,
-        struct fuse_file_info *fi)
+ll_entry(long long dir, const char *name, struct fuse_entry_param *e)
 {
-    redisReply *reply = NULL;
-    size_t sz;
-
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_read(%s);\n", path);
+    long long inode = -1;
+    int which = 0;
 
-    redis_alive();
+    memset(e, 0, sizeof(struct fuse_entry_param));
 
     /**
-     * Find the inode.
+     * Our statistics live beneath the root.
      */
-    int inode = find_inode(path);
-    if (inode == -1)
+    if (stats_enabled() &&
+        ((dir == NODES_ROOT) || (virtual_inode(dir) == VIRTUAL_DIR)))
     {
-      /**
-       * File/Directory not found.
-       */
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        char path[PATH_MAX];
 
+        snprintf(path, sizeof(path), "%s/%s",
+                 (dir == NODES_ROOT) ? "" : "/.redisfs", name);
+        which = virtual_entry(path);
     }
 
-    /**
-     * Get the current file size.
-     */
-    reply = redisCommand(_g_redis, "GET %s:INODE:%d:SIZE",
-                         _g_prefix, inode, size);
-    sz = atoi(reply->str);
-    freeReplyObject(reply);
-
-    if (sz < size)
-        size = sz;
-    if (offset + size > sz)
-        size = sz - offset;
-
-    /**
-     * Get the file contents.
-     * this is a pretty bad bottleneck here - it grabs the entire contents and then memcpy's the bit it likes
-     *
-     */
-    reply =
-        redisCommand(_g_redis, "GETRANGE %s:INODE:%d:DATA %lu %lu", _g_prefix,
-                     inode, offset, size + offset);
-
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_ERROR))
+    if (which)
     {
-        /**
-         * GETRANGE was renamed - so we'll free the previous command
-         * and retry under the old name.
-         */
-        freeReplyObject(reply);
-
-        reply =
-            redisCommand(_g_redis, "SUBSTR %s:INODE:%d:DATA %lu %lu",
-                         _g_prefix, inode, offset, size + offset);
-
+        inode = VIRTUAL_INODE(which);
+    }
+    else if (!virtual_inode(dir))
+    {
+        redis_acquire_reader();
+        redis_alive();
+        inode = find_child(dir, name);
+        redis_release();
     }
 
+    if (inode == -1)
+        return -ENOENT;
+
     /**
-     * Copy the data into the callee's buffer.
+     * The entry may have been removed, by another mount, since we found
+     * it.
      */
-    if (size > 0)
-        memcpy(buf, reply->str, size);
+    if (ll_stat(inode, &e->attr) != 0)
+        return -ENOENT;
 
-    freeReplyObject(reply);
+    if (nodes_remember(inode, dir, name) != 0)
+        return -ENOMEM;
 
-    pthread_mutex_unlock(&_g_lock);
-    return size;
+    e->ino = e->attr.st_ino;
+    e->attr_timeout = kernel_timeout();
+    e->entry_timeout = kernel_timeout();
+    return 0;
 }
 
 
 /**
- * Create a symlink
+ * Reply with an entry, or the error which stopped us finding it.
  */
-static int
-fs_symlink(const char *target, const char *path)
+static void
+ll_reply_entry(fuse_req_t req, int ret, struct fuse_entry_param *e)
 {
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_entry(req, e);
+}
 
-    redisReply *reply = NULL;
-    char *parent = NULL;
-    char *entry = NULL;
-    int key = 0;
-    int parent_inode = 0;
 
-    pthread_mutex_lock(&_g_lock);
+/**
+ * Close the file in the "fh" of an open file, if there is one.
+ */
+static void
+ll_close(struct fuse_file_info *fi)
+{
+    open_file *f = (open_file *) (uintptr_t) fi->fh;
+
+    if (f == NULL)
+        return;
 
-    if (_g_debug)
-        fprintf(stderr, "fs_symlink(target:%s -> %s);\n", target, path);
+    fi->fh = 0;
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
-    }
+    redis_acquire();
+    close_open_file(f);
+    redis_release();
+}
 
-    redis_alive();
 
-    /**
-     * We need to create a new INODE number & entry.
-     *
-     * Once that is done we can create the new entry
-     * in the set for the parent directory.
-     */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
+/**
+ * Add an entry to a listing, growing it if we're listing in one go.
+ */
+static int
+ll_fill(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+    ll_dir *d = (ll_dir *) buf;
+    size_t need = fuse_add_direntry(d->req, NULL, 0, name, NULL, 0);
+    struct stat st;
 
-    entry = get_basename(path);
-    key = get_next_inode();
+    memset(&st, 0, sizeof(st));
+    st.st_ino = LL_UNKNOWN_INO;
+    if (stbuf != NULL)
+    {
+        st.st_ino = to_ino(stbuf->st_ino);
+        st.st_mode = stbuf->st_mode;
+    }
 
+    if (d->grow)
+    {
+        if (d->len + need > d->size)
+        {
+            size_t size = (d->size * 2 > d->len + need) ?
+                d->size * 2 : d->len + need + 4096;
+            char *data = realloc(d->data, size);
 
-    /**
-     * Add the entry to the parent directory.
-     */
-    redisAppendCommand(_g_redis, "SADD %s:DIRENT:%d %d", _g_prefix,
-                       parent_inode, key);
+            if (data == NULL)
+                return 1;
 
-    /**
-     * Now populate the new entry.
-     */
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:NAME %s",
-                       _g_prefix, key, entry);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:TYPE LINK", _g_prefix, key);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:TARGET %s",
-                       _g_prefix, key, target);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:MODE %d",
-                       _g_prefix, key, 0444);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:UID %d",
-                       _g_prefix, key, fuse_get_context()->uid);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:GID %d",
-                       _g_prefix, key, fuse_get_context()->gid);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:SIZE %d",
-                       _g_prefix, key, 0);
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:CTIME %d",
-                       _g_prefix, key, time(NULL));
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:MTIME %d",
-                       _g_prefix, key, time(NULL));
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:ATIME %d",
-                       _g_prefix, key, time(NULL));
-    redisAppendCommand(_g_redis, "SET %s:INODE:%d:LINK 1", _g_prefix, key);
+            d->data = data;
+            d->size = size;
+        }
 
-    int i = 0;
-    for (i = 0; i < 11; i++)
+        off = d->len + need;
+    }
+    else if (d->len + need > d->size)
     {
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
+        return 1;
     }
 
-    free(parent);
-    free(entry);
-
-    pthread_mutex_unlock(&_g_lock);
+    fuse_add_direntry(d->req, d->data + d->len, d->size - d->len, name, &st,
+                      off);
+    d->len += need;
     return 0;
 }
 
 
 /**
- * Read the target of a symlink.
+ * List a directory in one go.
  */
-static int
-fs_readlink(const char *path, char *buf, size_t size)
+static void
+ll_list(ll_dir * d, long long inode)
 {
-    int inode;
-    redisReply *reply = NULL;
+    struct stat st;
 
-    pthread_mutex_lock(&_g_lock);
+    d->len = 0;
+    d->grow = 1;
 
-    if (_g_debug)
-        fprintf(stderr, "fs_readlink(%s);\n", path);
-
-    redis_alive();
-
-    /**
-     * To resolve the symlink we must:
-     *
-     * [1/2] Find the inode for this entry.
-     *
-     */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
-    }
+        memset(&st, 0, sizeof(st));
+        st.st_mode = S_IFREG | 0444;
 
-    /**
-     * [2/2] Lookup the "TARGET" data item.
-     */
-    reply = redisCommand(_g_redis, "GET %s:INODE:%d:TARGET",
-                         _g_prefix, inode);
+        ll_fill(d, ".", NULL, 0);
+        ll_fill(d, "..", NULL, 0);
 
-    if ((reply != NULL) && (reply->type == REDIS_REPLY_STRING) &&
-        (reply->str != NULL))
-    {
-        strcpy(buf, (char *)reply->str);
-        freeReplyObject(reply);
-        pthread_mutex_unlock(&_g_lock);
-        return 0;
+        st.st_ino = VIRTUAL_INODE(VIRTUAL_STATS);
+        ll_fill(d, "stats", &st, 0);
+        st.st_ino = VIRTUAL_INODE(VIRTUAL_SLOW);
+        ll_fill(d, "slow", &st, 0);
+        return;
     }
-    freeReplyObject(reply);
-    pthread_mutex_unlock(&_g_lock);
 
-    return (-ENOENT);
+    redis_acquire_reader();
+    redis_alive();
+    list_directory(inode, NULL, d, ll_fill, 0);
+    redis_release();
 }
 
 
-/**
- * This cheats and always returns true.
- *
- * (Without the ability to open you cannot read/write to a file.)
- *
- */
-static int
-fs_open(const char *path, struct fuse_file_info *fi)
+static void
+ll_init(void *userdata, struct fuse_conn_info *conn)
 {
+    fs_init();
+}
 
-    int inode;
-    redisReply *reply = NULL;
+static void
+ll_destroy(void *userdata)
+{
+    fs_destroy();
+}
+
+
+static void
+ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param e;
+    long long start = ll_begin();
+    int ret;
 
     if (_g_debug)
-        fprintf(stderr, "fs_open(%s);\n", path);
+        fprintf(stderr, "ll_lookup(%lu, %s);\n", (unsigned long)parent, name);
+
+    ret = ll_entry(from_ino(parent), name, &e);
 
+    ll_end(OP_LOOKUP, from_ino(parent), name, start, (ret < 0));
 
     /**
-     * If we're running with --fast just return, and don't
-     * update the atime.
+     * Missing entries may be remembered too, when nothing changes.
      */
-    if (_g_fast)
-        return 0;
-
-    pthread_mutex_lock(&_g_lock);
-
-  /**
-   * Update the access time of a file.
-   */
-    inode = find_inode(path);
-    if (inode == -1)
+    if ((ret == -ENOENT) && (_g_coherence == COHERENCE_READONLY))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return 0;
+        memset(&e, 0, sizeof(e));
+        e.entry_timeout = KERNEL_READONLY_TTL;
+        ret = 0;
     }
 
+    ll_reply_entry(req, ret, &e);
+}
 
-    reply = redisCommand(_g_redis, "SET %s:INODE:%d:ATIME %d",
-                         _g_prefix, inode, time(NULL));
-    freeReplyObject(reply);
 
+static void
+ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    nodes_forget(from_ino(ino), nlookup);
+    fuse_reply_none(req);
+}
 
-    pthread_mutex_unlock(&_g_lock);
 
-    return 0;
+static void
+ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat st;
+    long long start = ll_begin();
+    int ret;
+
+    ret = ll_stat(from_ino(ino), &st);
+
+    ll_end(OP_GETATTR, from_ino(ino), NULL, start, (ret < 0));
+
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_attr(req, &st, kernel_timeout());
 }
 
 
 /**
- * Create a new entry with the specified mode.
+ * Change the mode, owner, size or times of an inode.
+ *
+ * Nothing is changed once the inode has been removed, lest its
+ * meta-data be brought back.
  */
-static int
-fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static void
+ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+           struct fuse_file_info *fi)
 {
-
-    redisReply *reply = NULL;
-    char *parent = NULL;
-    char *entry = NULL;
-    int key = 0;
-    int parent_inode = 0;
-
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_create(%s);\n", path);
+    long long inode = from_ino(ino);
+    long long start;
+    struct stat st;
+    int ret;
 
     /**
      * If read-only mode is set this must fail.
      */
-    if (_g_read_only)
+    if (_g_read_only || virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        fuse_reply_err(req, EPERM);
+        return;
     }
 
+    redis_acquire();
     redis_alive();
 
-    /**
-     * We need to create a new INODE number & entry.
-     *
-     * Once that is done we can create the new entry
-     * in the set for the parent directory.
-     */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
-
-    entry = get_basename(path);
-    key = get_next_inode();
+    ret = stat_inode(inode, &st);
+    if ((ret == 0) && (to_set & FUSE_SET_ATTR_SIZE) && S_ISDIR(st.st_mode))
+        ret = -EISDIR;
 
+    if ((ret == 0) && (to_set & FUSE_SET_ATTR_MODE))
+    {
+        start = ll_begin();
+        chmod_inode(inode, attr->st_mode);
+        ll_end(OP_CHMOD, inode, NULL, start, 0);
+    }
 
-    /**
-     * Add the entry to the parent directory.
-     */
-    redisAppendCommand(_g_redis, "SADD %s:DIRENT:%d %d", _g_prefix,
-                       parent_inode, key);
+    if ((ret == 0) && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+    {
+        start = ll_begin();
+        chown_inode(inode,
+                    (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : st.st_uid,
+                    (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : st.st_gid);
+        ll_end(OP_CHOWN, inode, NULL, start, 0);
+    }
 
-    /**
-     * Now populate the new entry, using MSET
-     */
-    redisAppendCommand(_g_redis,
-                       "MSET %s:INODE:%d:NAME %s %s:INODE:%d:TYPE FILE %s:INODE:%d:MODE %d %s:INODE:%d:UID %d %s:INODE:%d:GID %d %s:INODE:%d:SIZE %d %s:INODE:%d:CTIME %d %s:INODE:%d:MTIME %d %s:INODE:%d:ATIME %d %s:INODE:%d:LINK 1",
-                       _g_prefix, key, entry, _g_prefix, key, _g_prefix, key,
-                       mode, _g_prefix, key, fuse_get_context()->uid,
-                       _g_prefix, key, fuse_get_context()->gid, _g_prefix,
-                       key, 0, _g_prefix, key, time(NULL), _g_prefix, key,
-                       time(NULL), _g_prefix, key, time(NULL), _g_prefix,
-                       key);
+    if ((ret == 0) && (to_set & FUSE_SET_ATTR_SIZE))
+    {
+        start = ll_begin();
+        truncate_inode(inode, attr->st_size);
+        ll_end(OP_TRUNCATE, inode, NULL, start, 0);
+    }
 
-    int i = 0;
-    for (i = 0; i < 2; i++)
+    if ((ret == 0) && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)))
     {
-        redisGetReply(_g_redis, (void **)&reply);
-        freeReplyObject(reply);
+        struct timespec tv[2];
+
+        memset(tv, 0, sizeof(tv));
+
+        tv[0].tv_sec = (to_set & FUSE_SET_ATTR_ATIME) ? attr->st_atime :
+            st.st_atime;
+        tv[1].tv_sec = (to_set & FUSE_SET_ATTR_MTIME) ? attr->st_mtime :
+            st.st_mtime;
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+            tv[0].tv_sec = time(NULL);
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+            tv[1].tv_sec = time(NULL);
+
+        start = ll_begin();
+        utimens_inode(inode, tv);
+        ll_end(OP_UTIMENS, inode, NULL, start, 0);
     }
 
-    free(parent);
-    free(entry);
+    if (ret == 0)
+        ret = stat_inode(inode, &st);
 
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    redis_release();
+
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    st.st_ino = ino;
+    fuse_reply_attr(req, &st, kernel_timeout());
 }
 
 
-/**
- * Change the owner of a file/directory.
- */
-static int
-fs_chown(const char *path, uid_t uid, gid_t gid)
+static void
+ll_readlink(fuse_req_t req, fuse_ino_t ino)
 {
-    int inode;
-    redisReply *reply = NULL;
+    char buf[PATH_MAX + 1];
+    long long start = ll_begin();
+    int ret;
 
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_chown(%s);\n", path);
+    redis_acquire_reader();
+    redis_alive();
+    ret = read_link(from_ino(ino), buf, sizeof(buf));
+    redis_release();
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
-    }
+    ll_end(OP_READLINK, from_ino(ino), NULL, start, (ret < 0));
 
-    redis_alive();
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_readlink(req, buf);
+}
 
-    /**
-     * To change the ownership of this file we need to :
-     *
-     * [1/2] Find the inode for this entry.
-     *
-     */
-    inode = find_inode(path);
-    if (inode == -1)
-    {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
-    }
 
-    /**
-     * [2/2] Change the UID, GID, mtime
-     */
-    reply =
-        redisCommand(_g_redis,
-                     "MSET %s:INODE:%d:UID %d %s:INODE:%d:GID %d %s:INODE:%d:MTIME %d",
-                     _g_prefix, inode, uid, _g_prefix, inode, gid, _g_prefix,
-                     inode, time(NULL));
-    freeReplyObject(reply);
+static void
+ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    struct fuse_entry_param e;
+    char path[PATH_MAX];
+    int ret;
 
-    /**
-     * All done.
-     */
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    ll_caller(req);
 
+    ret = ll_path(from_ino(parent), name, path, sizeof(path));
+    if (ret == 0)
+        ret = timed_mkdir(path, mode);
+    if (ret == 0)
+        ret = ll_entry(from_ino(parent), name, &e);
+
+    ll_reply_entry(req, ret, &e);
 }
 
 
 /**
- * Change the permission(s) of a file/directory.
+ * The inode of the named entry of a directory, or -1.
  */
-static int
-fs_chmod(const char *path, mode_t mode)
+static long long
+ll_child(long long dir, const char *name)
 {
-    int inode;
-    redisReply *reply = NULL;
+    long long inode = -1;
 
-    pthread_mutex_lock(&_g_lock);
+    if (!virtual_inode(dir))
+    {
+        redis_acquire_reader();
+        redis_alive();
+        inode = find_child(dir, name);
+        redis_release();
+    }
 
-    if (_g_debug)
-        fprintf(stderr, "fs_chmod(%s);\n", path);
+    return (inode);
+}
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
+
+/**
+ * Remove an entry, and its path from our table of inodes, so that
+ * nothing is later done by path to whatever takes its name.
+ */
+static void
+ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    char path[PATH_MAX];
+    long long inode = -1;
+    int ret;
+
+    ret = ll_path(from_ino(parent), name, path, sizeof(path));
+    if (ret == 0)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        inode = ll_child(from_ino(parent), name);
+        ret = timed_unlink(path);
     }
 
-    redis_alive();
+    if ((ret == 0) && (inode != -1))
+        nodes_remove(inode);
 
-    /**
-     * To change the owner of this file we need to:
-     *
-     * [1/2] Find the inode for this entry.
-     *
-     */
-    inode = find_inode(path);
-    if (inode == -1)
+    fuse_reply_err(req, -ret);
+}
+
+
+static void
+ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    char path[PATH_MAX];
+    long long inode = -1;
+    int ret;
+
+    ret = ll_path(from_ino(parent), name, path, sizeof(path));
+    if (ret == 0)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        inode = ll_child(from_ino(parent), name);
+        ret = timed_rmdir(path);
     }
 
-    /**
-     * [2/2] Change the mode
-     */
-    reply =
-        redisCommand(_g_redis,
-                     "MSET %s:INODE:%d:MODE %d %s:INODE:%d:MTIME %d",
-                     _g_prefix, inode, mode, _g_prefix, inode, time(NULL));
-    freeReplyObject(reply);
+    if ((ret == 0) && (inode != -1))
+        nodes_remove(inode);
 
-    /**
-     * All done.
-     */
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    fuse_reply_err(req, -ret);
+}
 
+
+static void
+ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
+           const char *name)
+{
+    struct fuse_entry_param e;
+    char path[PATH_MAX];
+    int ret;
+
+    ll_caller(req);
+
+    ret = ll_path(from_ino(parent), name, path, sizeof(path));
+    if (ret == 0)
+        ret = timed_symlink(link, path);
+    if (ret == 0)
+        ret = ll_entry(from_ino(parent), name, &e);
+
+    ll_reply_entry(req, ret, &e);
 }
 
 
 /**
- * Change the access time of a file.
+ * Rename an entry, and move it within our table of inodes too, along
+ * with removing any entry it replaced.
  */
-static int
-fs_utimens(const char *path, const struct timespec tv[2])
+static void
+ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+          fuse_ino_t newparent, const char *newname)
 {
-    int inode;
-    redisReply *reply = NULL;
-
-    pthread_mutex_lock(&_g_lock);
+    char old[PATH_MAX];
+    char path[PATH_MAX];
+    long long inode = -1;
+    long long replaced = -1;
+    int ret;
 
-    if (_g_debug)
-        fprintf(stderr, "fs_utimens(%s);\n", path);
+    ret = ll_path(from_ino(parent), name, old, sizeof(old));
+    if (ret == 0)
+        ret = ll_path(from_ino(newparent), newname, path, sizeof(path));
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
+    if (ret == 0)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        inode = ll_child(from_ino(parent), name);
+        replaced = ll_child(from_ino(newparent), newname);
+        ret = timed_rename(old, path);
     }
 
-    redis_alive();
+    if ((ret == 0) && (replaced != -1) && (replaced != inode))
+        nodes_remove(replaced);
+    if ((ret == 0) && (inode != -1))
+        nodes_move(inode, from_ino(newparent), newname);
+
+    fuse_reply_err(req, -ret);
+}
+
+
+static void
+ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
 
     /**
-     *
-     * 1/2 Find the inode for this entry.
-     *
+     * Our statistics may only be read, and are read afresh each time.
      */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+
+        fi->direct_io = 1;
     }
+    else
+    {
+        redis_acquire();
+        redis_alive();
+        open_inode(inode, fi);
+        redis_release();
 
-    /**
-     * [2/2] Change the time
-     */
-    reply =
-        redisCommand(_g_redis,
-                     "MSET %s:INODE:%d:ATIME %d %s:INODE:%d:MTIME %d",
-                     _g_prefix, inode, tv[0].tv_sec, _g_prefix, inode,
-                     tv[1].tv_sec);
-    freeReplyObject(reply);
+        if (_g_coherence == COHERENCE_READONLY)
+            fi->keep_cache = 1;
+    }
 
-    /**
-     * All done.
-     */
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    ll_end(OP_OPEN, inode, NULL, start, 0);
 
+    fuse_reply_open(req, fi);
 }
 
 
-/**
- * Access-test a file.
- *
- * NOP
- */
-static int
-fs_access(const char *path, int mode)
+static void
+ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+        struct fuse_file_info *fi)
 {
-    int inode;
-    redisReply *reply = NULL;
-
-    if (_g_debug)
-        fprintf(stderr, "fs_access(%s);\n", path);
-
-    /**
-     * If we're running with --fast just return, and don't
-     * update the atime.
-     */
-    if (_g_fast)
-        return 0;
-
+    open_file *f = (open_file *) (uintptr_t) fi->fh;
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
+    char *buf = malloc(size ? size : 1);
+    int ret;
 
-    pthread_mutex_lock(&_g_lock);
-
-  /**
-   * Update the access time of a file.
-   */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (buf == NULL)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return 0;
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
 
-    reply = redisCommand(_g_redis, "SET %s:INODE:%d:ATIME %d",
-                         _g_prefix, inode, time(NULL));
-    freeReplyObject(reply);
+    if (virtual_inode(inode))
+    {
+        ret = virtual_read(virtual_inode(inode), buf, size, off);
+    }
+    else
+    {
+        redis_acquire_reader();
+        redis_alive();
+        ret = read_inode(f, inode, buf, size, off);
+        redis_release();
+    }
 
+    ll_end(OP_READ, inode, NULL, start, (ret < 0));
 
-    pthread_mutex_unlock(&_g_lock);
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_buf(req, buf, ret);
 
-    return 0;
+    free(buf);
 }
 
 
-/**
- * Remove a directory entry.
- */
-static int
-fs_unlink(const char *path)
+static void
+ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+         off_t off, struct fuse_file_info *fi)
 {
-    int inode;
-    redisReply *reply = NULL;
-    char *parent = NULL;
-    int parent_inode = 0;
-
-    pthread_mutex_lock(&_g_lock);
-
-    if (_g_debug)
-        fprintf(stderr, "fs_unlink(%s);\n", path);
+    open_file *f = (open_file *) (uintptr_t) fi->fh;
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
 
     /**
      * If read-only mode is set this must fail.
      */
-    if (_g_read_only)
+    if (_g_read_only || virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        fuse_reply_err(req, EPERM);
+        return;
     }
 
+    redis_acquire();
     redis_alive();
+    write_inode(f, inode, buf, size, off);
+    redis_release();
 
-    /**
-     * To remove the entry we need to :
-     *
-     * [1/4] Find the inode for this entry.
-     *
-     */
-    inode = find_inode(path);
-    if (inode == -1)
+    ll_end(OP_WRITE, inode, NULL, start, 0);
+
+    fuse_reply_write(req, size);
+}
+
+
+static void
+ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    open_file *f = (open_file *) (uintptr_t) fi->fh;
+    long long start = ll_begin();
+
+    if (f != NULL)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        redis_acquire();
+
+        pthread_mutex_lock(&f->lock);
+        flush_open_file(f);
+        pthread_mutex_unlock(&f->lock);
+
+        redis_release();
     }
 
-    /**
-     * [2/4] Remove from the parent set.
-     */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
+    ll_end(OP_FLUSH, from_ino(ino), NULL, start, 0);
 
-    reply =
-        redisCommand(_g_redis, "SREM %s:DIRENT:%d %d", _g_prefix,
-                     parent_inode, inode);
-    freeReplyObject(reply);
-    free(parent);
+    fuse_reply_err(req, 0);
+}
 
-    /**
-     * [4/4] Remove all meta-data.
-     */
-    remove_inode(inode);
 
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+static void
+ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+         struct fuse_file_info *fi)
+{
+    ll_flush(req, ino, fi);
 }
 
 
-/**
- * Rename a directory entry.
- */
-int
-fs_rename(const char *old, const char *path)
+static void
+ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    int old_inode = -1;
-    int parent_inode = 0;
-    redisReply *reply = NULL;
+    long long start = ll_begin();
 
-    pthread_mutex_lock(&_g_lock);
+    ll_close(fi);
 
-    if (_g_debug)
-        fprintf(stderr, "fs_rename(%s,%s);\n", old, path);
+    ll_end(OP_RELEASE, from_ino(ino), NULL, start, 0);
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
+    fuse_reply_err(req, 0);
+}
+
+
+/**
+ * Open a directory, which will be listed in one go unless we may page
+ * through it with SSCAN.
+ */
+static void
+ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fi->fh = 0;
+
+    if (!_g_sscan || virtual_inode(from_ino(ino)))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        ll_dir *d = calloc(1, sizeof(ll_dir));
+
+        if (d == NULL)
+        {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        fi->fh = (uintptr_t) d;
     }
 
-    redis_alive();
+    fuse_reply_open(req, fi);
+}
+
+
+static void
+ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+           struct fuse_file_info *fi)
+{
+    ll_dir *d = (ll_dir *) (uintptr_t) fi->fh;
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
 
     /**
-     * To rename the entry we need to :
-     *
-     *  1. Find the inode for the entry.
-     *
+     * With SSCAN each page is fetched as the kernel asks for it.
      */
-    old_inode = find_inode(old);
-    if (old_inode == -1)
+    if (d == NULL)
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        ll_dir page;
+
+        memset(&page, 0, sizeof(page));
+        page.req = req;
+        page.size = size;
+        page.data = malloc(size);
+        if (page.data == NULL)
+        {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+
+        redis_acquire_reader();
+        redis_alive();
+        list_directory(inode, NULL, &page, ll_fill, off);
+        redis_release();
+
+        ll_end(OP_READDIR, inode, NULL, start, 0);
+
+        fuse_reply_buf(req, page.data, page.len);
+        free(page.data);
+        return;
     }
 
     /**
-     * Update the name of the key, which is the filename of the
-     * directory entry - minus directory suffix.
+     * Otherwise the listing is made afresh whenever it is read from the
+     * start, and handed over a page at a time.
      */
-    char *basename = get_basename(path);
-    redisReply *r = NULL;
-    r = redisCommand(_g_redis, "SET %s:INODE:%d:NAME %s", _g_prefix,
-                     old_inode, basename);
-    freeReplyObject(r);
-    free(basename);
+    d->req = req;
+    if (off == 0)
+        ll_list(d, inode);
 
+    ll_end(OP_READDIR, inode, NULL, start, 0);
 
-    /**
-     * Find the old parent and remove this file from the set.
-     */
-    char *parent = get_parent(old);
-    parent_inode = find_inode(parent);
-    reply =
-        redisCommand(_g_redis, "SREM %s:DIRENT:%d %d", _g_prefix,
-                     parent_inode, old_inode);
-    freeReplyObject(reply);
-    free(parent);
+    if (off < (off_t) d->len)
+        fuse_reply_buf(req, d->data + off,
+                       (d->len - off < size) ? d->len - off : size);
+    else
+        fuse_reply_buf(req, NULL, 0);
+}
 
-    /**
-     * Find the new parent - and add this member to the set.
-     */
-    parent = get_parent(path);
-    parent_inode = find_inode(parent);
-    reply =
-        redisCommand(_g_redis, "SADD %s:DIRENT:%d %d", _g_prefix,
-                     parent_inode, old_inode);
-    freeReplyObject(reply);
-    free(parent);
 
-    pthread_mutex_unlock(&_g_lock);
+static void
+ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    ll_dir *d = (ll_dir *) (uintptr_t) fi->fh;
 
-    return 0;
+    if (d != NULL)
+    {
+        free(d->data);
+        free(d);
+    }
+
+    fuse_reply_err(req, 0);
 }
 
 
 /**
- * Truncate an entry.
- *
- * This just needs to remove the data and reset the size to zero and the
- * MTIME to "now".
- *
+ * Extended attributes are changed by inode too, other than RMTREE_XATTR,
+ * which needs the path of the tree to remove.
  */
-static int
-fs_truncate(const char *path, off_t size)
+static void
+ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+            const char *value, size_t size, int flags)
 {
-    int inode;
-    redisReply *reply = NULL;
+    long long inode = from_ino(ino);
+    long long start;
+    char path[PATH_MAX];
+    struct stat st;
+    int ret;
+
+    if (strcmp(name, RMTREE_XATTR) == 0)
+    {
+        ret = ll_path(inode, NULL, path, sizeof(path));
+        if (ret == 0)
+            ret = timed_setxattr(path, name, value, size, flags);
+
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    /**
+     * If read-only mode is set this must fail.
+     */
+    if (_g_read_only || virtual_inode(inode))
+    {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
+
+    start = ll_begin();
+
+    redis_acquire();
+    redis_alive();
+    ret = stat_inode(inode, &st);
+    if (ret == 0)
+        ret = set_xattr(inode, name, value, size, flags);
+    redis_release();
+
+    ll_end(OP_SETXATTR, inode, NULL, start, (ret < 0));
+
+    fuse_reply_err(req, -ret);
+}
 
-    pthread_mutex_lock(&_g_lock);
 
-    if (_g_debug)
-        fprintf(stderr, "fs_truncate(%s);\n", path);
+/**
+ * Extended attributes are read straight from the inode.
+ */
+static void
+ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+{
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
+    char *buf = NULL;
+    int ret = -ENODATA;
 
+    if ((size > 0) && ((buf = malloc(size)) == NULL))
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-    /**
-     * If read-only mode is set this must fail.
-     */
-    if (_g_read_only)
+    if (!virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -EPERM;
+        redis_acquire_reader();
+        redis_alive();
+        ret = get_xattr(inode, name, buf, size);
+        redis_release();
     }
 
-    redis_alive();
+    ll_end(OP_GETXATTR, inode, NULL, start, (ret < 0));
 
-    /**
-     * Ensure we're working on a file, not a directory.
-     */
-    if (is_directory(path))
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else if (size == 0)
+        fuse_reply_xattr(req, ret);
+    else
+        fuse_reply_buf(req, buf, ret);
+
+    free(buf);
+}
+
+
+static void
+ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    long long inode = from_ino(ino);
+    long long start = ll_begin();
+    char *buf = NULL;
+    int ret = 0;
+
+    if ((size > 0) && ((buf = malloc(size)) == NULL))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
 
-    /**
-     * To truncate the entry we need to :
-     *
-     * 1/3 Find the inode for this entry.
-     *
-     */
-    inode = find_inode(path);
-    if (inode == -1)
+    if (!virtual_inode(inode))
     {
-        pthread_mutex_unlock(&_g_lock);
-        return -ENOENT;
+        redis_acquire_reader();
+        redis_alive();
+        ret = list_xattrs(inode, buf, size);
+        redis_release();
     }
 
-    /**
-     * [2/3] Remove the data associated with the file.
-     */
-    reply = redisCommand(_g_redis, "DEL %s:INODE:%d:DATA", _g_prefix, inode);
-    freeReplyObject(reply);
+    ll_end(OP_LISTXATTR, inode, NULL, start, (ret < 0));
 
-    /**
-     * [3/3] Reset the size & mtime.
-     */
-    reply =
-        redisCommand(_g_redis, "MSET %s:INODE:%d:SIZE 0 %s:INODE:%d:MTIME %d",
-                     _g_prefix, inode, _g_prefix, inode, time(NULL));
-    freeReplyObject(reply);
+    if (ret < 0)
+        fuse_reply_err(req, -ret);
+    else if (size == 0)
+        fuse_reply_xattr(req, ret);
+    else
+        fuse_reply_buf(req, buf, ret);
 
-    pthread_mutex_unlock(&_g_lock);
-    return 0;
+    free(buf);
 }
 
 
-/**
- * Write our current process ID to a file.
- */
-long
-writePID(const char *filename)
+static void
+ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
 {
-    char buf[20];
-    int fd;
-    long pid;
-
-    if ((fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1)
-        return -1;
+    long long inode = from_ino(ino);
+    long long start;
+    struct stat st;
+    int ret;
 
-    pid = getpid();
-    snprintf(buf, sizeof(buf), "%ld", (long)pid);
-    if (write(fd, buf, strlen(buf)) != strlen(buf))
+    if (_g_read_only || virtual_inode(inode))
     {
-        close(fd);
-        return -1;
+        fuse_reply_err(req, EPERM);
+        return;
     }
 
-    return pid;
+    start = ll_begin();
+
+    redis_acquire();
+    redis_alive();
+    ret = stat_inode(inode, &st);
+    if (ret == 0)
+        ret = remove_xattr(inode, name);
+    redis_release();
+
+    ll_end(OP_REMOVEXATTR, inode, NULL, start, (ret < 0));
+
+    fuse_reply_err(req, -ret);
 }
 
 
-/**
- * Show minimal usage information.
- */
-int
-usage(int argc, char *argv[])
+static void
+ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
 {
-    printf("%s - version %s - Filesystem based upon FUSE\n", argv[0],
-           VERSION);
-    printf("\nOptions:\n\n");
-    printf("\t--debug      - Launch with debugging information.\n");
-    printf("\t--help       - Show this minimal help information.\n");
-    printf("\t--host       - The hostname of the redis server [localhost]\n");
-    printf
-        ("\t--mount      - The directory to mount our filesystem under [/mnt/redis].\n");
-    printf("\t--port       - The port of the redis server [6389].\n");
-    printf("\t--prefix     - A string prepended to any Redis key names.\n");
-    printf("\t--read-only  - Mount the filesystem read-only.\n");
-    printf("\n");
+    char path[PATH_MAX];
+    int ret;
 
-    return 1;
+    ret = ll_path(from_ino(ino), NULL, path, sizeof(path));
+    if (ret == 0)
+        ret = timed_access(path, mask);
+
+    fuse_reply_err(req, -ret);
 }
 
 
-static struct fuse_operations redisfs_operations = {
-    .chmod = fs_chmod,
-    .chown = fs_chown,
-    .create = fs_create,
-    .getattr = fs_getattr,
-    .mkdir = fs_mkdir,
-    .read = fs_read,
-    .readdir = fs_readdir,
-    .readlink = fs_readlink,
-    .rename = fs_rename,
-    .rmdir = fs_rmdir,
-    .symlink = fs_symlink,
-    .truncate = fs_truncate,
-    .unlink = fs_unlink,
-    .utimens = fs_utimens,
-    .write = fs_write,
+static void
+ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+          struct fuse_file_info *fi)
+{
+    struct fuse_entry_param e;
+    char path[PATH_MAX];
+    int ret;
+
+    ll_caller(req);
+
+    ret = ll_path(from_ino(parent), name, path, sizeof(path));
+    if (ret == 0)
+        ret = timed_create(path, mode, fi);
+    if (ret == 0)
+        ret = ll_entry(from_ino(parent), name, &e);
+
+    if (ret < 0)
+    {
+        ll_close(fi);
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    fuse_reply_create(req, &e, fi);
+}
+
 
+struct fuse_lowlevel_ops redisfs_lowlevel_operations = {
+    .lookup = ll_lookup,
+    .forget = ll_forget,
+    .getattr = ll_getattr,
+    .readlink = ll_readlink,
+    .open = ll_open,
+    .read = ll_read,
+    .write = ll_write,
+    .opendir = ll_opendir,
+    .readdir = ll_readdir,
+    .releasedir = ll_releasedir,
+    .getxattr = ll_getxattr,
+    .listxattr = ll_listxattr,
 
     /*
-     *  FAKE: Only update access-time.
+     * Write buffering.
      */
-    .access = fs_access,
-    .open = fs_open,
+    .flush = ll_flush,
+    .fsync = ll_fsync,
+    .release = ll_release,
 
+    /*
+     * Changes to the tree, handed over by path.
+     */
+    .setattr = ll_setattr,
+    .mkdir = ll_mkdir,
+    .unlink = ll_unlink,
+    .rmdir = ll_rmdir,
+    .symlink = ll_symlink,
+    .rename = ll_rename,
+    .setxattr = ll_setxattr,
+    .removexattr = ll_removexattr,
+    .access = ll_access,
+    .create = ll_create,
 
     /*
-     * Mutex setup/cleanup.
+     * Connection & lock setup/cleanup.
      */
-    .init = fs_init,
-    .destroy = fs_destroy,
+    .init = ll_init,
+    .destroy = ll_destroy,
 };
 
 
 
 
 /**
- *  Entry point to our code.
- *
- *  We support minimal command line parsing, and mostly just perform tests
- * and checks before launching ourself under fuse control.
+ * Parse our command line, setting the options of the filesystem.
  *
+ * Returns 0 if we should carry on, or otherwise the status to exit with.
  */
 int
-main(int argc, char *argv[])
+parse_options(int argc, char *argv[])
 {
     int c;
-    struct stat statbuf;
-
-    /**
-     * Args. passed to FUSE's init.
-     */
-    char *args[] = {
-        "fuse-redisfs", _g_mount,
-        "-o", "allow_other",
-        "-o", "nonempty",
-        "-f",
-        "-o", "debug",
-        NULL
-    };
-
-
-    /**
-     * Here we're pointing to only the first few of the options
-     * passed to FUSE - ie. we don't count "-o" or "debug".
-     *
-     * The --debug parameter causes us to increment this counter
-     * by two, such that "-o debug" are included and passed to FUSE.
-     */
-    int args_c = 7;
 
     /**
      * Parse any command line arguments we might have.
@@ -1823,20 +10529,46 @@ main(int argc, char *argv[])
     while (1)
     {
         static struct option long_options[] = {
+            {"async", no_argument, 0, 'a'},
+            {"atime", required_argument, 0, 'i'},
+            {"backend", required_argument, 0, 'b'},
+            {"cache-notify", no_argument, 0, 'n'},
+            {"cache-ttl", required_argument, 0, 'c'},
+            {"chunk-size", required_argument, 0, 'C'},
+            {"cluster", no_argument, 0, 'K'},
+            {"coherence", required_argument, 0, 'k'},
+            {"compress", required_argument, 0, 'z'},
+            {"compress-min", required_argument, 0, 'Z'},
+            {"connections", required_argument, 0, 'N'},
             {"debug", no_argument, 0, 'd'},
+            {"dedup", no_argument, 0, 'D'},
             {"fast", no_argument, 0, 'f'},
             {"help", no_argument, 0, 'h'},
             {"host", required_argument, 0, 's'},
+            {"lowlevel", no_argument, 0, 'l'},
             {"mount", required_argument, 0, 'm'},
+            {"no-arena", no_argument, 0, 'A'},
+            {"no-scripts", no_argument, 0, 'L'},
             {"port", required_argument, 0, 'P'},
             {"prefix", required_argument, 0, 'p'},
+            {"read-cache", required_argument, 0, 'M'},
             {"read-only", no_argument, 0, 'r'},
+            {"readahead", required_argument, 0, 'R'},
+            {"replica", required_argument, 0, 'e'},
+            {"schema", required_argument, 0, 'S'},
+            {"spill-dir", required_argument, 0, 'x'},
+            {"spill-size", required_argument, 0, 'X'},
+            {"stats", no_argument, 0, 'T'},
+            {"stats-slow", required_argument, 0, 't'},
+            {"time-delay", required_argument, 0, 'y'},
             {"version", no_argument, 0, 'v'},
+            {"write-buffer", required_argument, 0, 'w'},
+            {"write-delay", required_argument, 0, 'W'},
             {0, 0, 0, 0}
         };
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "s:P:m:p:drhvf", long_options,
+        c = getopt_long(argc, argv, "s:P:m:p:c:C:N:S:w:W:R:M:z:Z:e:t:b:x:X:i:y:k:adrhvfnlLADKT", long_options,
                         &option_index);
 
         /*
@@ -1861,9 +10593,141 @@ main(int argc, char *argv[])
         case 'f':
             _g_fast = 1;
             break;
+        case 'a':
+            _g_async = 1;
+            break;
+        case 'b':
+            if (strcmp(optarg, "mock") == 0)
+                _g_mock = 1;
+            else if (strcmp(optarg, "redis") == 0)
+                _g_mock = 0;
+            else
+            {
+                fprintf(stderr, "Unknown backend '%s'; use 'redis' or 'mock'.\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case 'i':
+            if (strcmp(optarg, "strict") == 0)
+                _g_atime = ATIME_STRICT;
+            else if (strcmp(optarg, "relatime") == 0)
+                _g_atime = ATIME_RELATIVE;
+            else if (strcmp(optarg, "noatime") == 0)
+                _g_atime = ATIME_NEVER;
+            else
+            {
+                fprintf(stderr,
+                        "Unknown atime policy '%s'; use 'strict', 'relatime' or 'noatime'.\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case 'y':
+            _g_time_delay = (long)(atof(optarg) * 1000);
+            break;
+        case 'k':
+            if (strcmp(optarg, "strict") == 0)
+                _g_coherence = COHERENCE_STRICT;
+            else if (strcmp(optarg, "relaxed") == 0)
+                _g_coherence = COHERENCE_RELAXED;
+            else if (strcmp(optarg, "readonly") == 0)
+            {
+                _g_coherence = COHERENCE_READONLY;
+                _g_read_only = 1;
+            }
+            else
+            {
+                fprintf(stderr,
+                        "Unknown coherence '%s'; use 'strict', 'relaxed' or 'readonly'.\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case 'c':
+            _g_cache_ttl = (long)(atof(optarg) * 1000);
+            break;
+        case 'n':
+            _g_cache_notify = 1;
+            break;
+        case 'K':
+            _g_cluster_mode = 1;
+            break;
+        case 'C':
+            _g_chunk_size = (long)parse_size(optarg);
+            break;
+        case 'z':
+            _g_compress = codec_lookup(optarg);
+            if (_g_compress < 0)
+            {
+                fprintf(stderr,
+                        "Unsupported compression '%s'; use 'zlib' or 'none'.\n",
+                        optarg);
+                return -1;
+            }
+            break;
+        case 'Z':
+            _g_compress_min = (long)parse_size(optarg);
+            break;
+        case 'N':
+            _g_connections = atoi(optarg);
+            break;
+        case 'L':
+            _g_no_scripts = 1;
+            break;
+        case 'l':
+            _g_lowlevel = 1;
+            break;
+        case 'A':
+            _g_no_arena = 1;
+            break;
+        case 'D':
+            _g_dedup = 1;
+            break;
+        case 'w':
+            _g_write_buffer = (long)parse_size(optarg);
+            break;
+        case 'W':
+            _g_write_delay = (long)(atof(optarg) * 1000);
+            break;
         case 'r':
             _g_read_only = 1;
             break;
+        case 'R':
+            _g_readahead = (long)parse_size(optarg);
+            break;
+        case 'M':
+            _g_read_cache = (long)parse_size(optarg);
+            break;
+        case 'e':
+            if (add_replica(optarg) != 0)
+                return -1;
+            break;
+        case 'T':
+            _g_stats = 1;
+            break;
+        case 'x':
+            snprintf(_g_spill_dir, sizeof(_g_spill_dir), "%s", optarg);
+            break;
+        case 'X':
+            _g_spill_size = (long)parse_size(optarg);
+            break;
+        case 't':
+            _g_stats = 1;
+            _g_stats_slow = atof(optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "hash") == 0)
+                _g_schema = SCHEMA_HASH;
+            else if (strcmp(optarg, "keys") == 0)
+                _g_schema = SCHEMA_KEYS;
+            else
+            {
+                fprintf(stderr, "Unknown schema '%s'; use 'keys' or 'hash'.\n",
+                        optarg);
+                return -1;
+            }
+            break;
         case 's':
             snprintf(_g_redis_host, sizeof(_g_redis_host) - 1, "%s", optarg);
             break;
@@ -1871,10 +10735,6 @@ main(int argc, char *argv[])
             snprintf(_g_mount, sizeof(_g_mount) - 1, "%s", optarg);
             break;
         case 'd':
-          /**
-           * Now we're passing more args to fuse's init.
-           */
-            args_c = 9;
             _g_debug += 1;
             break;
         case 'h':
@@ -1885,51 +10745,293 @@ main(int argc, char *argv[])
         }
     }
 
+    return 0;
+}
+
+
+
+/**
+ * Write the options of FUSE which tell the kernel how long it may cache
+ * what we give it, as a comma-separated list, into the given buffer.
+ *
+ * Returns the length of the list, which is zero if there are none.
+ */
+int
+kernel_options(char *buf, size_t len)
+{
+    long ttl = kernel_ttl();
+    int used = 0;
+
+    buf[0] = '\0';
+
     /**
-     * Complain if we're not launched as root.
+     * The low-level API gives the kernel its timeouts, and whether to
+     * keep the pages of a file, with each reply instead.
      */
-    if (getuid() != 0)
+    if (_g_lowlevel)
     {
-        fprintf(stderr, "You must start this program as root.\n");
-        return -1;
+        if (_g_coherence == COHERENCE_READONLY)
+            used = snprintf(buf, len, "max_read=%d", KERNEL_IO_SIZE);
     }
-
-  /**
-   * Complain if our mount-point isn't a directory.
-   */
-    if ((stat(_g_mount, &statbuf) != 0) ||
-        ((statbuf.st_mode & S_IFMT) != S_IFDIR))
+    else
     {
-        fprintf(stderr, "%s doesn't exist or isn't a directory!\n", _g_mount);
-        return -1;
+        switch (_g_coherence)
+        {
+        case COHERENCE_STRICT:
+            used = snprintf(buf, len,
+                            "entry_timeout=0,attr_timeout=0,negative_timeout=0");
+            break;
+        case COHERENCE_RELAXED:
+            used = snprintf(buf, len,
+                            "entry_timeout=%ld,attr_timeout=%ld,auto_cache", ttl,
+                            ttl);
+            break;
+        case COHERENCE_READONLY:
+            used = snprintf(buf, len,
+                            "entry_timeout=%d,attr_timeout=%d,negative_timeout=%d,kernel_cache,max_read=%d",
+                            KERNEL_READONLY_TTL, KERNEL_READONLY_TTL,
+                            KERNEL_READONLY_TTL, KERNEL_IO_SIZE);
+            break;
+        default:
+            break;
+        }
     }
 
+    /**
+     * Writes are otherwise split into pages, each costing us a round-trip.
+     */
+    if (!_g_read_only && (used < (int)len))
+        used += snprintf(buf + used, len - used, "%sbig_writes,max_write=%d",
+                         used ? "," : "", KERNEL_IO_SIZE);
+
+    return ((used < (int)len) ? used : (int)len - 1);
+}
+
 
+/**
+ * Connect to the server, and prepare the filesystem for mounting.
+ *
+ * Returns 0 on success.
+ */
+int
+setup_filesystem()
+{
     /**
-     * Write out our pid.
+     * The in-memory store stands in for a single server, which is ours
+     * alone.  A backend may also have been chosen by our caller.
      */
-    if (!writePID("/var/run/redisfs.pid"))
+    if (_g_mock)
     {
-        fprintf(stderr, "Writing PID file failed\n");
-        return -1;
+        if (_g_cluster_mode || _g_async || (_g_replica_count > 0))
+        {
+            fprintf(stderr,
+                    "--backend=mock can't be used with --cluster, --async or --replica.\n");
+            return -1;
+        }
+
+        if (_g_cache_notify)
+        {
+            fprintf(stderr,
+                    "Nothing else changes the in-memory store; ignoring --cache-notify.\n");
+            _g_cache_notify = 0;
+        }
+
+        if (!backend_running())
+        {
+            backend *b = mock_new();
+
+            if (b == NULL)
+            {
+                fprintf(stderr, "Failed to allocate the in-memory store.\n");
+                return -1;
+            }
+            backend_start(b);
+        }
     }
 
     /**
      * Show our options.
      */
-    printf("Connecting to redis-server %s:%d and mounting at %s.\n",
-           _g_redis_host, _g_redis_port, _g_mount);
+    if (backend_running())
+        printf("Keeping the filesystem in memory, with the %s backend, and mounting at %s.\n",
+               backend_current()->name, _g_mount);
+    else
+        printf("Connecting to redis-server %s:%d and mounting at %s.\n",
+               _g_redis_host, _g_redis_port, _g_mount);
     printf("The prefix for all key-names is '%s'\n", _g_prefix);
 
+    /**
+     * Find the nodes of the cluster, if we're using one.
+     */
+    if (_g_cluster_mode)
+    {
+        if (_g_async)
+        {
+            fprintf(stderr, "--async can't be used with --cluster.\n");
+            return -1;
+        }
+
+        if (cluster_discover(_g_redis_host, _g_redis_port) != 0)
+        {
+            fprintf(stderr,
+                    "The redis server on [%s:%d] isn't part of a cluster.\n",
+                    _g_redis_host, _g_redis_port);
+            return -1;
+        }
+        printf("Sending each command to the node of the cluster serving its key.\n");
+
+        if (_g_cache_notify)
+        {
+            fprintf(stderr,
+                    "Keyspace notifications can't be followed across a cluster; ignoring --cache-notify.\n");
+            _g_cache_notify = 0;
+        }
+    }
+
+    /**
+     * Reads may be spread across replicas of a single server.
+     */
+    if (_g_replica_count > 0)
+    {
+        if (_g_cluster_mode || _g_async)
+        {
+            fprintf(stderr,
+                    "--replica can't be used with --cluster or --async.\n");
+            return -1;
+        }
+
+        printf("Reading from %d replica%s when nothing has changed recently.\n",
+               _g_replica_count, (_g_replica_count == 1) ? "" : "s");
+        if (!_g_read_only && (_g_write_buffer > 0))
+            printf("Buffered writes are enabled, so every read goes to the primary.\n");
+    }
+
+    /**
+     * Snapshots are mounted read-only, on top of their parent.
+     */
+    if (setup_snapshot() != 0)
+        return -1;
+    if (_g_snapshot >= 0)
+        printf("Mounting the snapshot of '%s' taken at generation %lld, read-only.\n",
+               _g_prefix, _g_snapshot);
+
+    if (setup_tags() != 0)
+        return -1;
+    if (_g_tags)
+        printf("The keys of each inode are tagged to share a cluster slot.\n");
+
+    /**
+     * Find out how file contents are stored.
+     */
+    if (setup_layout() != 0)
+        return -1;
+    if (_g_schema == SCHEMA_HASH)
+        printf("Meta-data is stored in a hash per inode.\n");
+    if (_g_chunk_size > 0)
+        printf("File contents are stored in %ld byte chunks.\n",
+               _g_chunk_size);
+
+    /**
+     * Find out whether they're shared, and whether they're compressed.
+     */
+    if (setup_dedup() != 0)
+        return -1;
+    if (_g_dedup)
+        printf("Identical chunks are stored once, as shared blocks.\n");
+
+    if (setup_compression() != 0)
+        return -1;
+    if (_g_compress != CODEC_NONE)
+        printf("New files are compressed with %s.\n",
+               codec_name(_g_compress));
+
+    /**
+     * Find out whether large files are kept on disk.
+     */
+    if (setup_spill() != 0)
+        return -1;
+    if (_g_spill)
+        printf("Files larger than %ld bytes are kept in %s.\n",
+               _g_spill_size, _g_spill_dir);
+
+    /**
+     * Load the scripts used for namespace operations.
+     */
+    setup_scripts();
+    if (_g_scripts)
+        printf("Namespace operations use server-side scripts.\n");
+
+    /**
+     * Shared blocks may only be released safely by a script.
+     */
+    if (_g_dedup && !_g_scripts && !_g_read_only)
+    {
+        fprintf(stderr,
+                "Shared blocks need server-side scripts, which aren't available; mount with --read-only.\n");
+        return -1;
+    }
+
+    /**
+     * That used a connection of its own; the filesystem uses a pool.
+     */
+    if (_g_redis != NULL)
+        redisFree(_g_redis);
+    _g_redis = NULL;
+    cluster_free(_g_cluster);
+    _g_cluster = NULL;
+    arena_reset(&_g_reply_arena);
+
+    pool_init();
+    if (_g_async)
+        printf("Sharing a single asynchronous connection to redis.\n");
+    else
+        printf("Using up to %d connections to redis.\n", _g_connections);
+
     /**
      * If we're read-only say so.
      */
     if (_g_read_only)
         printf("Filesystem is read-only.\n");
 
+    /**
+     * Setup our cache, which might be disabled.
+     */
+    cache_init(_g_cache_ttl);
+    if (cache_enabled())
+        printf("Caching lookups & attributes for %ld ms.\n", _g_cache_ttl);
+
+    if (_g_write_buffer > 0)
+        printf("Buffering up to %ld bytes of writes per file, for %ld ms.\n",
+               _g_write_buffer, _g_write_delay);
+
+    if (_g_time_delay > 0)
+        printf("Writing out changed timestamps after %ld ms.\n", _g_time_delay);
+
+    /**
+     * Setup the cache of file contents.  Pages live as long as cached
+     * attributes do, or for a second if they aren't cached.
+     */
+    if ((_g_readahead > 0) && (_g_read_cache <= 0))
+        _g_read_cache = READ_CACHE_DEFAULT;
+    pagecache_init(READ_PAGE_SIZE, _g_read_cache,
+                   (_g_cache_ttl > 0) ? _g_cache_ttl : 1000);
+    if (pagecache_enabled())
+        printf("Caching up to %ld bytes of file contents.\n", _g_read_cache);
+    if (_g_readahead > 0)
+        printf("Reading up to %ld bytes ahead.\n", _g_readahead);
 
     /**
-     * Launch fuse.
+     * Setup our statistics.
      */
-    return (fuse_main(args_c, args, &redisfs_operations, NULL));
+    if (_g_stats)
+    {
+        stats_init(_g_op_names, OP_COUNT,
+                   (long long)(_g_stats_slow * 1000));
+        printf("Keeping statistics, in %s/.redisfs/stats.\n", _g_mount);
+        if (_g_stats_slow > 0)
+            printf("Logging operations taking %g ms or more, in %s/.redisfs/slow.\n",
+                   _g_stats_slow, _g_mount);
+    }
+
+    return 0;
 }
@@ -0,0 +1,68 @@
+/* redisfs.h -- Simple redis-based filesystem.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _REDISFS_H
+#define _REDISFS_H 1
+
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+
+
+/**
+ * The mount-point of the filesystem, and the level of --debug.
+ */
+extern char _g_mount[200];
+extern int _g_debug;
+
+/**
+ * Do we keep the filesystem in memory, with --backend=mock?
+ */
+extern int _g_mock;
+
+/**
+ * Are we driven by the low-level API of FUSE, with --lowlevel?
+ */
+extern int _g_lowlevel;
+
+/**
+ * The operations of the filesystem, as given to FUSE.
+ */
+extern struct fuse_operations redisfs_operations;
+extern struct fuse_lowlevel_ops redisfs_lowlevel_operations;
+
+
+/**
+ * Parse our command line.
+ *
+ * Returns 0 if we should carry on, or otherwise the status to exit with.
+ */
+int parse_options(int argc, char *argv[]);
+
+/**
+ * Connect to the server, or start the backend, and prepare the
+ * filesystem for mounting.  If a backend has already been started it is
+ * used in place of redis.
+ *
+ * Returns 0 on success.
+ */
+int setup_filesystem();
+
+/**
+ * Write the options of FUSE which tell the kernel how long it may cache
+ * lookups, attributes and pages, as chosen by --coherence, into the
+ * given buffer.
+ *
+ * Returns the length of the list, which is zero if there are none.
+ */
+int kernel_options(char *buf, size_t len);
+
+
+#endif /* _REDISFS_H */
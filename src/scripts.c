@@ -0,0 +1,214 @@
+/* scripts.c -- Lua scripts which perform namespace operations atomically.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Creating, removing, or renaming a directory entry involves updating
+ * several keys.  Done from the client that costs a round-trip per step,
+ * and a crash part-way through leaves orphaned keys behind.
+ *
+ *  Instead these scripts are loaded with SCRIPT LOAD when we mount, and
+ * invoked with EVALSHA, so that each operation is atomic and costs a
+ * single round-trip.
+ *
+ *  Errors are returned as negative errno values.  A file holding the
+ * contents of a removed inode on disk is left for the caller, which
+ * must find it before the inode goes.
+ *
+ */
+
+#include "scripts.h"
+
+
+/**
+ * Helpers which understand both meta-data schemas.
+ */
+const char *script_prelude =
+    "local fields = { 'NAME', 'TYPE', 'MODE', 'GID', 'UID', 'ATIME',\n"
+    "                 'CTIME', 'MTIME', 'SIZE', 'LINK', 'TARGET', 'GEN',\n"
+    "                 'CODEC', 'SPILL' }\n"
+    "\n"
+    "local function inode(id)\n"
+    "  return prefix .. ':INODE:' .. id\n"
+    "end\n"
+    "\n"
+    "local function getf(id, f)\n"
+    "  if schema == 'hash' then\n"
+    "    return redis.call('HGET', inode(id), f)\n"
+    "  end\n"
+    "  return redis.call('GET', inode(id) .. ':' .. f)\n"
+    "end\n"
+    "\n"
+    "local function setf(id, t)\n"
+    "  if schema == 'hash' then\n"
+    "    return redis.call('HMSET', inode(id), unpack(t))\n"
+    "  end\n"
+    "  local args = {}\n"
+    "  for i = 1, #t, 2 do\n"
+    "    args[#args + 1] = inode(id) .. ':' .. t[i]\n"
+    "    args[#args + 1] = t[i + 1]\n"
+    "  end\n"
+    "  return redis.call('MSET', unpack(args))\n"
+    "end\n"
+    "\n"
+    "local function block(d)\n"
+    "  return prefix .. ':BLOCK:' .. d\n"
+    "end\n"
+    "\n"
+    "local function release(b)\n"
+    "  if redis.call('DECR', b .. ':REFS') <= 0 then\n"
+    "    redis.call('DEL', b, b .. ':REFS')\n"
+    "  end\n"
+    "end\n"
+    "\n"
+    "local function remove(id)\n"
+    "  if dedup == 1 then\n"
+    "    for _, d in ipairs(redis.call('HVALS', inode(id) .. ':BLOCKS')) do\n"
+    "      release(block(d))\n"
+    "    end\n"
+    "  end\n"
+    "  local size = tonumber(getf(id, 'SIZE')) or 0\n"
+    "  if chunk > 0 and size > 0 then\n"
+    "    local batch = {}\n"
+    "    for i = 0, math.floor((size - 1) / chunk) do\n"
+    "      batch[#batch + 1] = inode(id) .. ':CHUNK:' .. i\n"
+    "      if #batch == 256 then\n"
+    "        redis.call('DEL', unpack(batch))\n"
+    "        batch = {}\n"
+    "      end\n"
+    "    end\n"
+    "    if #batch > 0 then\n"
+    "      redis.call('DEL', unpack(batch))\n"
+    "    end\n"
+    "  end\n"
+    "  local keys = { inode(id) .. ':DATA', inode(id) .. ':BLOCKS',\n"
+    "                 inode(id) .. ':XATTR' }\n"
+    "  if schema == 'hash' then\n"
+    "    keys[4] = inode(id)\n"
+    "  else\n"
+    "    for _, f in ipairs(fields) do\n"
+    "      keys[#keys + 1] = inode(id) .. ':' .. f\n"
+    "    end\n"
+    "  end\n"
+    "  redis.call('DEL', unpack(keys))\n"
+    "end\n"
+    "\n"
+    "local function dirent(id)\n"
+    "  return prefix .. ':DIRENT:' .. id\n"
+    "end\n"
+    "\n"
+    "local function dirname(id)\n"
+    "  return prefix .. ':DIRNAME:' .. id\n"
+    "end\n";
+
+
+const char *script_bodies[SCRIPT_COUNT] = {
+
+    /**
+     * Create an entry.
+     *
+     * ARGV: parent, name, type, mode, uid, gid, time, target.
+     *
+     * Returns the new inode.
+     */
+    "local parent, name, kind = ARGV[1], ARGV[2], ARGV[3]\n"
+    "if redis.call('HEXISTS', dirname(parent), name) == 1 then\n"
+    "  return -17\n"
+    "end\n"
+    "local id = redis.call('INCR', prefix .. ':GLOBAL:INODE')\n"
+    "redis.call('SADD', dirent(parent), id)\n"
+    "redis.call('HSET', dirname(parent), name, id)\n"
+    "local t = { 'NAME', name, 'TYPE', kind, 'MODE', ARGV[4],\n"
+    "            'UID', ARGV[5], 'GID', ARGV[6], 'SIZE', 0,\n"
+    "            'CTIME', ARGV[7], 'MTIME', ARGV[7], 'ATIME', ARGV[7],\n"
+    "            'LINK', 1 }\n"
+    "if kind == 'LINK' then\n"
+    "  t[#t + 1] = 'TARGET'\n"
+    "  t[#t + 1] = ARGV[8]\n"
+    "end\n"
+    "setf(id, t)\n"
+    "return id\n",
+
+    /**
+     * Remove an entry, which must be an empty directory if the kind
+     * is "DIR", and must not be a directory otherwise.
+     *
+     * ARGV: parent, name, kind.
+     *
+     * Returns the inode which was removed.
+     */
+    "local parent, name, kind = ARGV[1], ARGV[2], ARGV[3]\n"
+    "local id = redis.call('HGET', dirname(parent), name)\n"
+    "if not id then\n"
+    "  return -2\n"
+    "end\n"
+    "local dir = (getf(id, 'TYPE') == 'DIR')\n"
+    "if kind == 'DIR' then\n"
+    "  if not dir then\n"
+    "    return -20\n"
+    "  end\n"
+    "  if redis.call('SCARD', dirent(id)) > 0 then\n"
+    "    return -39\n"
+    "  end\n"
+    "  redis.call('DEL', dirent(id), dirname(id))\n"
+    "elseif dir then\n"
+    "  return -21\n"
+    "end\n"
+    "redis.call('SREM', dirent(parent), id)\n"
+    "redis.call('HDEL', dirname(parent), name)\n"
+    "remove(id)\n"
+    "return tonumber(id)\n",
+
+    /**
+     * Rename an entry, replacing any existing destination.
+     *
+     * ARGV: old parent, old name, new parent, new name.
+     *
+     * Returns { inode renamed, inode replaced or 0 }.
+     */
+    "local op, on, np, nn = ARGV[1], ARGV[2], ARGV[3], ARGV[4]\n"
+    "local id = redis.call('HGET', dirname(op), on)\n"
+    "if not id then\n"
+    "  return { -2, 0 }\n"
+    "end\n"
+    "local existing = redis.call('HGET', dirname(np), nn)\n"
+    "if existing == id then\n"
+    "  return { tonumber(id), 0 }\n"
+    "end\n"
+    "if existing then\n"
+    "  if getf(existing, 'TYPE') == 'DIR' then\n"
+    "    if redis.call('SCARD', dirent(existing)) > 0 then\n"
+    "      return { -39, 0 }\n"
+    "    end\n"
+    "    redis.call('DEL', dirent(existing), dirname(existing))\n"
+    "  end\n"
+    "  redis.call('SREM', dirent(np), existing)\n"
+    "  remove(existing)\n"
+    "end\n"
+    "setf(id, { 'NAME', nn })\n"
+    "redis.call('SREM', dirent(op), id)\n"
+    "redis.call('HDEL', dirname(op), on)\n"
+    "redis.call('SADD', dirent(np), id)\n"
+    "redis.call('HSET', dirname(np), nn, id)\n"
+    "return { tonumber(id), tonumber(existing) or 0 }\n",
+
+    /**
+     * Drop a reference to each of the given blocks, removing those which
+     * are no longer used.
+     *
+     * ARGV: the digest of each block.
+     *
+     * Returns the number of blocks.
+     */
+    "for _, d in ipairs(ARGV) do\n"
+    "  release(block(d))\n"
+    "end\n"
+    "return #ARGV\n",
+};
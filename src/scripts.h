@@ -0,0 +1,40 @@
+/* scripts.h -- Lua scripts which perform namespace operations atomically.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _SCRIPTS_H
+#define _SCRIPTS_H 1
+
+
+/**
+ * The scripts we load into the server.
+ */
+#define SCRIPT_CREATE  0
+#define SCRIPT_REMOVE  1
+#define SCRIPT_RENAME  2
+#define SCRIPT_RELEASE 3
+#define SCRIPT_COUNT   4
+
+
+/**
+ * Definitions shared by every script.
+ *
+ * This expects the locals "prefix", "schema", "chunk" & "dedup" to
+ * have been defined before it.
+ */
+extern const char *script_prelude;
+
+/**
+ * The body of each script, indexed by the constants above.
+ */
+extern const char *script_bodies[SCRIPT_COUNT];
+
+
+#endif /* _SCRIPTS_H */
@@ -0,0 +1,215 @@
+/* sha256.c -- The SHA-256 digest, used to name blocks of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  This is a straightforward implementation of FIPS 180-2, which is
+ * all we need to name a block by its contents without depending upon
+ * an external crypto library.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sha256.h"
+
+
+/**
+ * The round constants.
+ */
+static const uint32_t _k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/**
+ * Process a single 64-byte block.
+ */
+static void
+sha256_block(sha256_ctx * ctx, const unsigned char *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+            ((uint32_t)p[i * 4 + 2] << 8) | (uint32_t)p[i * 4 + 3];
+
+    for (i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+            (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^
+            (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0];
+    b = ctx->state[1];
+    c = ctx->state[2];
+    d = ctx->state[3];
+    e = ctx->state[4];
+    f = ctx->state[5];
+    g = ctx->state[6];
+    h = ctx->state[7];
+
+    for (i = 0; i < 64; i++)
+    {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + _k[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+
+/**
+ * Start a new digest.
+ */
+void
+sha256_init(sha256_ctx * ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+
+/**
+ * Add data to the digest.
+ */
+void
+sha256_update(sha256_ctx * ctx, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t used = ctx->count % 64;
+
+    ctx->count += len;
+
+    /**
+     * Top up a partial block first.
+     */
+    if (used > 0)
+    {
+        size_t take = 64 - used;
+
+        if (take > len)
+            take = len;
+
+        memcpy(ctx->buf + used, p, take);
+        p += take;
+        len -= take;
+
+        if (used + take < 64)
+            return;
+
+        sha256_block(ctx, ctx->buf);
+    }
+
+    while (len >= 64)
+    {
+        sha256_block(ctx, p);
+        p += 64;
+        len -= 64;
+    }
+
+    if (len > 0)
+        memcpy(ctx->buf, p, len);
+}
+
+
+/**
+ * Finish the digest, storing it in the given buffer.
+ */
+void
+sha256_final(sha256_ctx * ctx, unsigned char out[SHA256_LEN])
+{
+    uint64_t bits = ctx->count * 8;
+    unsigned char pad[72];
+    size_t used = ctx->count % 64;
+    size_t padlen = (used < 56) ? (56 - used) : (120 - used);
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++)
+        pad[padlen + i] = (unsigned char)(bits >> (56 - i * 8));
+
+    sha256_update(ctx, pad, padlen + 8);
+
+    for (i = 0; i < 8; i++)
+    {
+        out[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        out[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        out[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        out[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+
+/**
+ * Calculate the digest of the given buffer, as a string of hex digits.
+ */
+void
+sha256_hex(const void *data, size_t len, char out[SHA256_HEX_LEN + 1])
+{
+    unsigned char digest[SHA256_LEN];
+    sha256_ctx ctx;
+    int i;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+
+    for (i = 0; i < SHA256_LEN; i++)
+        sprintf(out + i * 2, "%02x", digest[i]);
+}
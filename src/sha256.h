@@ -0,0 +1,60 @@
+/* sha256.h -- The SHA-256 digest, used to name blocks of file contents.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _SHA256_H
+#define _SHA256_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * The length of a digest, in bytes, and as a string of hex digits.
+ */
+#define SHA256_LEN 32
+#define SHA256_HEX_LEN 64
+
+
+/**
+ * The state of a digest being calculated.
+ */
+typedef struct sha256_ctx
+{
+    uint32_t state[8];
+    uint64_t count;
+    unsigned char buf[64];
+} sha256_ctx;
+
+
+/**
+ * Start a new digest.
+ */
+void sha256_init(sha256_ctx * ctx);
+
+/**
+ * Add data to the digest.
+ */
+void sha256_update(sha256_ctx * ctx, const void *data, size_t len);
+
+/**
+ * Finish the digest, storing it in the given buffer.
+ */
+void sha256_final(sha256_ctx * ctx, unsigned char out[SHA256_LEN]);
+
+
+/**
+ * Calculate the digest of the given buffer, as a NULL-terminated string
+ * of lower-case hex digits.
+ */
+void sha256_hex(const void *data, size_t len, char out[SHA256_HEX_LEN + 1]);
+
+
+#endif /* _SHA256_H */
@@ -0,0 +1,200 @@
+/* slots.c -- The hash slots of a Redis Cluster.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  A cluster divides keys between its nodes by the CRC16 of each key,
+ * and tells a client which sends a command to the wrong node where to
+ * go instead.  These helpers know nothing about connections; they only
+ * decide which slot each command belongs to.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "slots.h"
+
+
+/**
+ * The CRC16 (XMODEM) of a buffer.
+ */
+static unsigned int
+crc16(const char *buf, size_t len)
+{
+    unsigned int crc = 0;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= ((unsigned int)(unsigned char)buf[i]) << 8;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000)
+                crc = (crc << 1) ^ 0x1021;
+            else
+                crc <<= 1;
+            crc &= 0xffff;
+        }
+    }
+
+    return (crc);
+}
+
+
+/**
+ * The slot holding the given key.
+ */
+int
+slot_of(const char *key, size_t len)
+{
+    const char *open = memchr(key, '{', len);
+
+    /**
+     * A tag is the text between the first '{' and the following '}',
+     * as long as it isn't empty.
+     */
+    if (open != NULL)
+    {
+        size_t start = (open - key) + 1;
+        const char *close = memchr(key + start, '}', len - start);
+
+        if ((close != NULL) && (close - key > start))
+            return (crc16(key + start, (close - key) - start) %
+                    SLOT_COUNT);
+    }
+
+    return (crc16(key, len) % SLOT_COUNT);
+}
+
+
+/**
+ * Read one bulk argument of a command, at *p, advancing past it.
+ *
+ * Returns 0 on success.
+ */
+static int
+next_argument(const char **p, const char *end, const char **arg,
+              size_t *len)
+{
+    char *eol = NULL;
+    long n;
+
+    if ((*p >= end) || (**p != '$'))
+        return -1;
+
+    n = strtol(*p + 1, &eol, 10);
+    if ((eol == NULL) || (eol + 2 > end) || (eol[0] != '\r') || (n < 0) ||
+        (eol + 2 + n + 2 > end))
+        return -1;
+
+    *arg = eol + 2;
+    *len = n;
+    *p = eol + 2 + n + 2;
+
+    return 0;
+}
+
+
+/**
+ * Find the key which decides where a command is sent.
+ */
+int
+slot_command_key(const char *cmd, size_t cmdlen, const char **key,
+                 size_t *len)
+{
+    static const char *anywhere[] = {
+        "PING", "INFO", "SCRIPT", "CLUSTER", "CONFIG", "SCAN", "KEYS",
+        "PSUBSCRIBE", "SUBSCRIBE", "ASKING", NULL
+    };
+    const char *end = cmd + cmdlen;
+    const char *p = cmd;
+    const char *name;
+    size_t namelen;
+    char *eol = NULL;
+    long argc;
+    int i;
+
+    if ((cmdlen < 4) || (*p != '*'))
+        return 0;
+
+    argc = strtol(p + 1, &eol, 10);
+    if ((eol == NULL) || (eol + 2 > end) || (argc < 2))
+        return 0;
+    p = eol + 2;
+
+    if (next_argument(&p, end, &name, &namelen) != 0)
+        return 0;
+
+    for (i = 0; anywhere[i] != NULL; i++)
+    {
+        if ((strlen(anywhere[i]) == namelen) &&
+            (strncasecmp(anywhere[i], name, namelen) == 0))
+            return 0;
+    }
+
+    /**
+     * Scripts name their keys after the number of them.
+     */
+    if (((namelen == 4) && (strncasecmp(name, "EVAL", 4) == 0)) ||
+        ((namelen == 7) && (strncasecmp(name, "EVALSHA", 7) == 0)))
+    {
+        const char *arg;
+        size_t arglen;
+
+        if ((argc < 4) || (next_argument(&p, end, &arg, &arglen) != 0) ||
+            (next_argument(&p, end, &arg, &arglen) != 0) ||
+            (atoi(arg) < 1))
+            return 0;
+    }
+
+    return (next_argument(&p, end, key, len) == 0);
+}
+
+
+/**
+ * Parse a redirection.
+ */
+int
+slot_redirect(const char *err, int *slot, char *host, size_t hostlen,
+              int *port)
+{
+    const char *addr;
+    const char *colon;
+    int kind;
+
+    if (strncmp(err, "MOVED ", 6) == 0)
+        kind = SLOT_MOVED;
+    else if (strncmp(err, "ASK ", 4) == 0)
+        kind = SLOT_ASK;
+    else
+        return 0;
+
+    *slot = atoi(strchr(err, ' ') + 1);
+
+    addr = strchr(strchr(err, ' ') + 1, ' ');
+    if ((addr == NULL) || ((colon = strrchr(addr, ':')) == NULL) ||
+        (*slot < 0) || (*slot >= SLOT_COUNT))
+        return 0;
+    addr += 1;
+
+    if ((size_t)(colon - addr) >= hostlen)
+        return 0;
+
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+    *port = atoi(colon + 1);
+
+    return (kind);
+}
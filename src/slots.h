@@ -0,0 +1,58 @@
+/* slots.h -- The hash slots of a Redis Cluster.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _SLOTS_H
+#define _SLOTS_H 1
+
+#include <stddef.h>
+
+
+/**
+ * The number of slots a cluster divides its keys between.
+ */
+#define SLOT_COUNT 16384
+
+/**
+ * The kinds of redirection a node may reply with.
+ */
+#define SLOT_MOVED 1
+#define SLOT_ASK   2
+
+
+/**
+ * The slot holding the given key.
+ *
+ * If the key contains a hash tag, such as "skx:{INODE:6}:NAME", only
+ * the tag is hashed, so that related keys share a slot.
+ */
+int slot_of(const char *key, size_t len);
+
+/**
+ * Find the key which decides where a command is sent, given the command
+ * in the form it is written to the server.
+ *
+ * Returns 1 and sets *key & *len if there is one, or 0 for commands such
+ * as PING which may be sent anywhere.
+ */
+int slot_command_key(const char *cmd, size_t cmdlen, const char **key,
+                     size_t *len);
+
+/**
+ * Parse an error reply such as "MOVED 3999 127.0.0.1:6381".
+ *
+ * Returns SLOT_MOVED or SLOT_ASK, having filled in the slot and the
+ * address of the node, or 0 if the error isn't a redirection.
+ */
+int slot_redirect(const char *err, int *slot, char *host, size_t hostlen,
+                  int *port);
+
+
+#endif /* _SLOTS_H */
@@ -0,0 +1,317 @@
+/* spill.c -- Keep the contents of large files on disk, beside redis.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Once a file grows beyond --spill-size its contents are moved out of
+ * redis, into a file of the --spill-dir, and the SPILL field of the
+ * inode names that file.  The meta-data stays in redis, so only reads
+ * and writes of the contents touch the disk.
+ *
+ *  A spilled file is never changed once a snapshot may see it: the
+ * generation in which it was written is part of its name, and a file
+ * from an earlier generation is copied before it is changed.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spill.h"
+
+
+/**
+ * How much we copy at once.
+ */
+#define SPILL_COPY (1024 * 1024)
+
+
+
+/**
+ * The name of the file holding the contents of an inode.
+ */
+int
+spill_name(char *buf, size_t len, const char *prefix, long long inode,
+           long long generation)
+{
+    int n = snprintf(buf, len, "%s.%lld.%lld", prefix, inode, generation);
+
+    return (((n < 0) || (n >= len) || (n >= SPILL_NAME)) ? -1 : 0);
+}
+
+
+/**
+ * The generation in which the named file was spilled.
+ */
+long long
+spill_generation(const char *name)
+{
+    const char *dot;
+    char *end = NULL;
+    long long generation;
+
+    if ((name == NULL) || ((dot = strrchr(name, '.')) == NULL) ||
+        (dot[1] == '\0'))
+        return -1;
+
+    generation = strtoll(dot + 1, &end, 10);
+    if ((*end != '\0') || (generation < 0))
+        return -1;
+
+    return (generation);
+}
+
+
+/**
+ * Build the path of the named file, refusing names which could lead
+ * outside the directory.
+ */
+static int
+spill_path(char *buf, size_t len, const char *dir, const char *name)
+{
+    int n;
+
+    if ((name == NULL) || (name[0] == '\0') || (name[0] == '.') ||
+        (strchr(name, '/') != NULL) || (strlen(name) >= SPILL_NAME))
+        return -EINVAL;
+
+    n = snprintf(buf, len, "%s/%s", dir, name);
+    if ((n < 0) || (n >= len))
+        return -ENAMETOOLONG;
+
+    return 0;
+}
+
+
+/**
+ * Write to the named file, creating it if need be.
+ */
+ssize_t
+spill_write(const char *dir, const char *name, const char *buf,
+            size_t size, off_t offset)
+{
+    char path[4096];
+    size_t done = 0;
+    int ret;
+    int fd;
+
+    if ((ret = spill_path(path, sizeof(path), dir, name)) != 0)
+        return (ret);
+
+    fd = open(path, O_WRONLY | O_CREAT, 0600);
+    if (fd < 0)
+        return (-errno);
+
+    while (done < size)
+    {
+        ssize_t n = pwrite(fd, buf + done, size - done, offset + done);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            close(fd);
+            return (ret);
+        }
+        done += n;
+    }
+
+    close(fd);
+    return (done);
+}
+
+
+/**
+ * Read from the named file, via a mapping of the range asked for.
+ */
+ssize_t
+spill_read(const char *dir, const char *name, char *buf, size_t size,
+           off_t offset)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char path[4096];
+    struct stat st;
+    off_t start;
+    size_t avail;
+    size_t len;
+    void *map;
+    int ret;
+    int fd;
+
+    if ((ret = spill_path(path, sizeof(path), dir, name)) != 0)
+        return (ret);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (-errno);
+
+    if (fstat(fd, &st) != 0)
+    {
+        ret = -errno;
+        close(fd);
+        return (ret);
+    }
+
+    if ((size == 0) || (offset >= st.st_size))
+    {
+        close(fd);
+        return 0;
+    }
+
+    avail = ((offset + size) > st.st_size) ? (st.st_size - offset) : size;
+
+    /**
+     * Mappings must start upon a page.
+     */
+    start = offset - (offset % page);
+    len = avail + (offset - start);
+
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED)
+    {
+        ret = -errno;
+        close(fd);
+        return (ret);
+    }
+
+    memcpy(buf, (char *)map + (offset - start), avail);
+
+    munmap(map, len);
+    close(fd);
+
+    return (avail);
+}
+
+
+/**
+ * Cut the named file down, or extend it with zeros, to the given size.
+ */
+int
+spill_truncate(const char *dir, const char *name, off_t size)
+{
+    char path[4096];
+    int ret;
+
+    if ((ret = spill_path(path, sizeof(path), dir, name)) != 0)
+        return (ret);
+
+    if (truncate(path, size) != 0)
+        return (-errno);
+
+    return 0;
+}
+
+
+/**
+ * Copy one file to another, replacing it.
+ */
+int
+spill_copy(const char *dir, const char *from, const char *to)
+{
+    char src[4096];
+    char dst[4096];
+    char *buf;
+    off_t offset = 0;
+    int in;
+    int out;
+    int ret = 0;
+
+    if (((ret = spill_path(src, sizeof(src), dir, from)) != 0) ||
+        ((ret = spill_path(dst, sizeof(dst), dir, to)) != 0))
+        return (ret);
+
+    buf = malloc(SPILL_COPY);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    if ((in = open(src, O_RDONLY)) < 0)
+    {
+        ret = -errno;
+        free(buf);
+        return (ret);
+    }
+    if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+    {
+        ret = -errno;
+        close(in);
+        free(buf);
+        return (ret);
+    }
+
+    while (1)
+    {
+        ssize_t n = pread(in, buf, SPILL_COPY, offset);
+        ssize_t done = 0;
+
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n < 0)
+        {
+            ret = -errno;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        while (done < n)
+        {
+            ssize_t w = pwrite(out, buf + done, n - done, offset + done);
+
+            if ((w < 0) && (errno == EINTR))
+                continue;
+            if (w < 0)
+            {
+                ret = -errno;
+                break;
+            }
+            done += w;
+        }
+        if (ret != 0)
+            break;
+
+        offset += n;
+    }
+
+    close(in);
+    if ((close(out) != 0) && (ret == 0))
+        ret = -errno;
+    free(buf);
+
+    if (ret != 0)
+        unlink(dst);
+
+    return (ret);
+}
+
+
+/**
+ * Remove the named file.  One which is already gone isn't an error.
+ */
+int
+spill_remove(const char *dir, const char *name)
+{
+    char path[4096];
+    int ret;
+
+    if ((ret = spill_path(path, sizeof(path), dir, name)) != 0)
+        return (ret);
+
+    if ((unlink(path) != 0) && (errno != ENOENT))
+        return (-errno);
+
+    return 0;
+}
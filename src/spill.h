@@ -0,0 +1,60 @@
+/* spill.h -- Keep the contents of large files on disk, beside redis.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _SPILL_H
+#define _SPILL_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/**
+ * The longest name we give a spilled file.
+ */
+#define SPILL_NAME 128
+
+
+/**
+ * The name of the file holding the contents of the given inode, which
+ * were spilled in the given generation of the filesystem, e.g.
+ * "skx.6.0".  The name is stored in the SPILL field of the inode.
+ *
+ * Returns 0 on success, -1 if the name doesn't fit.
+ */
+int spill_name(char *buf, size_t len, const char *prefix, long long inode,
+               long long generation);
+
+/**
+ * The generation in which the named file was spilled, or -1 if the
+ * name isn't one which we could have given.
+ */
+long long spill_generation(const char *name);
+
+
+/**
+ * Write to, read from, cut down, copy and remove the named file within
+ * the given directory.  A file is created when it is first written.
+ *
+ * Reads are served from a mapping of the file, and are short at its
+ * end.  Each returns the bytes written or read, or 0, on success and
+ * -errno on failure.  A name which could lead outside the directory is
+ * refused with -EINVAL.
+ */
+ssize_t spill_write(const char *dir, const char *name, const char *buf,
+                    size_t size, off_t offset);
+ssize_t spill_read(const char *dir, const char *name, char *buf,
+                   size_t size, off_t offset);
+int spill_truncate(const char *dir, const char *name, off_t size);
+int spill_copy(const char *dir, const char *from, const char *to);
+int spill_remove(const char *dir, const char *name);
+
+
+#endif /* _SPILL_H */
@@ -0,0 +1,531 @@
+/* stats.c -- Counters & latency histograms of filesystem operations.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  For each operation we count the calls, the failures, and what they
+ * asked of the server, and keep a histogram of how long they took.
+ *
+ *  The histogram is log-linear, in the manner of HdrHistogram: each
+ * power of two of microseconds is split into eight buckets, so every
+ * latency is known to within an eighth, whatever its size, with a small
+ * fixed number of buckets.
+ *
+ *  Every counter is updated with an atomic add, so recording takes no
+ * lock; only the log of slow operations has one.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+
+/**
+ * The number of buckets each power of two is split into, as bits.
+ */
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+
+/**
+ * The number of slow operations we remember.
+ */
+#define SLOW_COUNT 64
+
+
+/**
+ * The statistics of one operation.
+ */
+typedef struct op_stats
+{
+    long long calls;
+    long long failures;
+    long long usec;
+    long long commands;
+    long long round_trips;
+    long long bytes_in;
+    long long bytes_out;
+    long long buckets[STATS_BUCKETS];
+} op_stats;
+
+
+/**
+ * A slow operation.
+ */
+typedef struct slow_op
+{
+    int op;
+    char path[256];
+    long long usec;
+    long long commands;
+    long long round_trips;
+    char trace[STATS_TRACE];
+} slow_op;
+
+
+/**
+ * Our operations, and their statistics.
+ */
+static const char **_names = NULL;
+static int _count = 0;
+static op_stats _ops[STATS_MAX_OPS];
+
+/**
+ * Cache hits & misses.
+ */
+static long long _hits[STATS_CACHES];
+static long long _misses[STATS_CACHES];
+
+/**
+ * The slow operations, the threshold for them, and the lock protecting
+ * them.
+ */
+static slow_op _slow[SLOW_COUNT];
+static long long _slow_next = 0;
+static long long _slow_usec = 0;
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * Setup the statistics.
+ */
+void
+stats_init(const char **names, int count, long long slow_usec)
+{
+    memset(_ops, 0, sizeof(_ops));
+    memset(_hits, 0, sizeof(_hits));
+    memset(_misses, 0, sizeof(_misses));
+
+    pthread_mutex_lock(&_lock);
+    _slow_next = 0;
+    _slow_usec = slow_usec;
+    pthread_mutex_unlock(&_lock);
+
+    _names = names;
+    _count = (count < STATS_MAX_OPS) ? count : STATS_MAX_OPS;
+}
+
+
+/**
+ * Are statistics being kept?
+ */
+int
+stats_enabled()
+{
+    return (_count > 0);
+}
+
+
+/**
+ * Should commands be traced?
+ */
+int
+stats_tracing()
+{
+    return (_slow_usec > 0);
+}
+
+
+/**
+ * The current (monotonic) time in microseconds.
+ */
+long long
+stats_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+/**
+ * The bucket of a latency: the first SUB_COUNT hold themselves, and
+ * after that the position of the top bit picks a group of SUB_COUNT
+ * buckets, and the bits below it pick one from the group.
+ */
+int
+stats_bucket(long long usec)
+{
+    int top;
+    int bucket;
+
+    if (usec < SUB_COUNT)
+        return ((usec < 0) ? 0 : (int)usec);
+
+    top = 63 - __builtin_clzll((unsigned long long)usec);
+    bucket = SUB_COUNT * (top - SUB_BITS + 1) +
+        (int)((usec >> (top - SUB_BITS)) & (SUB_COUNT - 1));
+
+    return ((bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1);
+}
+
+
+/**
+ * The largest latency held by a bucket.
+ */
+long long
+stats_bucket_max(int bucket)
+{
+    int shift;
+    long long sub;
+
+    if (bucket < SUB_COUNT)
+        return (bucket);
+
+    shift = (bucket / SUB_COUNT) - 1;
+    sub = SUB_COUNT + (bucket % SUB_COUNT);
+
+    return (((sub + 1) << shift) - 1);
+}
+
+
+/**
+ * Start a new operation.
+ */
+void
+stats_begin(stats_usage * u)
+{
+    u->commands = 0;
+    u->round_trips = 0;
+    u->bytes_in = 0;
+    u->bytes_out = 0;
+    u->sending = 0;
+    u->trace_len = 0;
+    u->trace[0] = '\0';
+}
+
+
+/**
+ * Add some text to a trace, if it fits.
+ */
+static void
+trace_add(stats_usage * u, const char *text, size_t len)
+{
+    if (u->trace_len + len + 2 >= STATS_TRACE)
+        return;
+
+    if (u->trace_len > 0)
+        u->trace[u->trace_len++] = ' ';
+
+    memcpy(u->trace + u->trace_len, text, len);
+    u->trace_len += len;
+    u->trace[u->trace_len] = '\0';
+}
+
+
+/**
+ * A command has been queued.
+ */
+void
+stats_sent(stats_usage * u, size_t bytes, const char *cmd, size_t len)
+{
+    u->commands += 1;
+    u->bytes_out += bytes;
+
+    /**
+     * A command sent after replies have been read starts another
+     * round-trip, which is marked in the trace.
+     */
+    if ((_slow_usec > 0) && (cmd != NULL))
+    {
+        if (!u->sending && (u->commands > 1))
+            trace_add(u, "|", 1);
+        trace_add(u, cmd, len);
+    }
+
+    u->sending = 1;
+}
+
+
+/**
+ * A reply has been read.
+ */
+void
+stats_received(stats_usage * u, size_t bytes)
+{
+    if (u->sending)
+    {
+        u->round_trips += 1;
+        u->sending = 0;
+    }
+
+    u->bytes_in += bytes;
+}
+
+
+/**
+ * An operation has completed.
+ */
+void
+stats_record(int op, const char *path, long long usec, int failed,
+             const stats_usage * u)
+{
+    op_stats *s;
+
+    if ((op < 0) || (op >= _count))
+        return;
+
+    s = &_ops[op];
+
+    __sync_fetch_and_add(&s->calls, 1);
+    if (failed)
+        __sync_fetch_and_add(&s->failures, 1);
+    __sync_fetch_and_add(&s->usec, usec);
+    __sync_fetch_and_add(&s->buckets[stats_bucket(usec)], 1);
+
+    if (u != NULL)
+    {
+        __sync_fetch_and_add(&s->commands, u->commands);
+        __sync_fetch_and_add(&s->round_trips, u->round_trips);
+        __sync_fetch_and_add(&s->bytes_in, u->bytes_in);
+        __sync_fetch_and_add(&s->bytes_out, u->bytes_out);
+    }
+
+    if ((_slow_usec > 0) && (usec >= _slow_usec))
+    {
+        slow_op *slow;
+
+        pthread_mutex_lock(&_lock);
+
+        slow = &_slow[_slow_next % SLOW_COUNT];
+        _slow_next += 1;
+
+        slow->op = op;
+        slow->usec = usec;
+        snprintf(slow->path, sizeof(slow->path), "%s", path ? path : "");
+        slow->commands = (u != NULL) ? u->commands : 0;
+        slow->round_trips = (u != NULL) ? u->round_trips : 0;
+        snprintf(slow->trace, sizeof(slow->trace), "%s",
+                 (u != NULL) ? u->trace : "");
+
+        pthread_mutex_unlock(&_lock);
+    }
+}
+
+
+/**
+ * A cache has been consulted.
+ */
+void
+stats_cache(int cache, int hit)
+{
+    if ((cache < 0) || (cache >= STATS_CACHES) || (_count == 0))
+        return;
+
+    if (hit)
+        __sync_fetch_and_add(&_hits[cache], 1);
+    else
+        __sync_fetch_and_add(&_misses[cache], 1);
+}
+
+
+/**
+ * The number of completed calls of an operation.
+ */
+long long
+stats_count(int op)
+{
+    if ((op < 0) || (op >= _count))
+        return 0;
+
+    return (_ops[op].calls);
+}
+
+
+/**
+ * The latency below which the given fraction of calls completed, which
+ * is the largest latency of the bucket it falls in.
+ */
+long long
+stats_percentile(int op, double fraction)
+{
+    long long total = 0;
+    long long want;
+    long long seen = 0;
+    int i;
+
+    if ((op < 0) || (op >= _count))
+        return 0;
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+        total += _ops[op].buckets[i];
+
+    if (total == 0)
+        return 0;
+
+    want = (long long)(fraction * total + 0.999999);
+    if (want < 1)
+        want = 1;
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += _ops[op].buckets[i];
+        if (seen >= want)
+            return (stats_bucket_max(i));
+    }
+
+    return (stats_bucket_max(STATS_BUCKETS - 1));
+}
+
+
+/**
+ * Append to a buffer, as snprintf() does, tracking the length the
+ * result would have.
+ */
+static void
+append(char *buf, size_t len, size_t * used, const char *fmt, ...)
+    __attribute__ ((format(printf, 4, 5)));
+
+static void
+append(char *buf, size_t len, size_t * used, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf((*used < len) ? buf + *used : NULL,
+                  (*used < len) ? len - *used : 0, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        *used += n;
+}
+
+
+/**
+ * Describe one counter of every operation which has been called.
+ */
+static void
+append_counter(char *buf, size_t len, size_t * used, const char *name,
+               const char *help, size_t offset)
+{
+    int i;
+
+    append(buf, len, used, "# HELP redisfs_%s %s\n", name, help);
+    append(buf, len, used, "# TYPE redisfs_%s counter\n", name);
+
+    for (i = 0; i < _count; i++)
+    {
+        if (_ops[i].calls > 0)
+            append(buf, len, used, "redisfs_%s{op=\"%s\"} %lld\n", name,
+                   _names[i], *(long long *)((char *)&_ops[i] + offset));
+    }
+}
+
+
+/**
+ * Describe every operation.
+ */
+size_t
+stats_format(char *buf, size_t len)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *caches[STATS_CACHES] = { "lookup", "attr", "page" };
+    size_t used = 0;
+    int i;
+    int q;
+
+    if (len > 0)
+        buf[0] = '\0';
+
+    append(buf, len, &used,
+           "# HELP redisfs_op_latency_seconds Time taken by each operation.\n");
+    append(buf, len, &used, "# TYPE redisfs_op_latency_seconds summary\n");
+
+    for (i = 0; i < _count; i++)
+    {
+        if (_ops[i].calls == 0)
+            continue;
+
+        for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            append(buf, len, &used,
+                   "redisfs_op_latency_seconds{op=\"%s\",quantile=\"%g\"} %.6f\n",
+                   _names[i], quantiles[q],
+                   stats_percentile(i, quantiles[q]) / 1000000.0);
+
+        append(buf, len, &used,
+               "redisfs_op_latency_seconds_sum{op=\"%s\"} %.6f\n", _names[i],
+               _ops[i].usec / 1000000.0);
+        append(buf, len, &used,
+               "redisfs_op_latency_seconds_count{op=\"%s\"} %lld\n",
+               _names[i], _ops[i].calls);
+    }
+
+    append_counter(buf, len, &used, "op_failures_total",
+                   "Operations which returned an error.",
+                   offsetof(op_stats, failures));
+    append_counter(buf, len, &used, "op_commands_total",
+                   "Commands sent to redis by each operation.",
+                   offsetof(op_stats, commands));
+    append_counter(buf, len, &used, "op_round_trips_total",
+                   "Round-trips to redis made by each operation.",
+                   offsetof(op_stats, round_trips));
+    append_counter(buf, len, &used, "op_sent_bytes_total",
+                   "Bytes of commands sent by each operation.",
+                   offsetof(op_stats, bytes_out));
+    append_counter(buf, len, &used, "op_received_bytes_total",
+                   "Bytes of replies received by each operation.",
+                   offsetof(op_stats, bytes_in));
+
+    append(buf, len, &used,
+           "# HELP redisfs_cache_hits_total Lookups answered by each cache.\n");
+    append(buf, len, &used, "# TYPE redisfs_cache_hits_total counter\n");
+    for (i = 0; i < STATS_CACHES; i++)
+        append(buf, len, &used, "redisfs_cache_hits_total{cache=\"%s\"} %lld\n",
+               caches[i], _hits[i]);
+
+    append(buf, len, &used,
+           "# HELP redisfs_cache_misses_total Lookups each cache couldn't answer.\n");
+    append(buf, len, &used, "# TYPE redisfs_cache_misses_total counter\n");
+    for (i = 0; i < STATS_CACHES; i++)
+        append(buf, len, &used,
+               "redisfs_cache_misses_total{cache=\"%s\"} %lld\n", caches[i],
+               _misses[i]);
+
+    return (used);
+}
+
+
+/**
+ * Describe the slow operations, newest first.
+ */
+size_t
+stats_format_slow(char *buf, size_t len)
+{
+    size_t used = 0;
+    long long i;
+
+    if (len > 0)
+        buf[0] = '\0';
+
+    pthread_mutex_lock(&_lock);
+
+    for (i = _slow_next - 1; (i >= 0) && (i >= _slow_next - SLOW_COUNT); i--)
+    {
+        slow_op *s = &_slow[i % SLOW_COUNT];
+
+        append(buf, len, &used,
+               "%.3fms %s %s [%lld commands, %lld round-trips] %s\n",
+               s->usec / 1000.0, _names[s->op], s->path, s->commands,
+               s->round_trips, s->trace);
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return (used);
+}
@@ -0,0 +1,141 @@
+/* stats.h -- Counters & latency histograms of filesystem operations.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _STATS_H
+#define _STATS_H 1
+
+#include <sys/types.h>
+
+
+/**
+ * The most operations we keep statistics for.
+ */
+#define STATS_MAX_OPS 32
+
+/**
+ * The number of buckets in each latency histogram.  Each covers an
+ * eighth of a power of two of microseconds, up to about twelve days.
+ */
+#define STATS_BUCKETS 312
+
+/**
+ * The length of the trace of the commands sent by a slow operation.
+ */
+#define STATS_TRACE 256
+
+/**
+ * The caches whose hits & misses we count.
+ */
+#define STATS_CACHE_LOOKUP 0
+#define STATS_CACHE_ATTR   1
+#define STATS_CACHE_PAGE   2
+#define STATS_CACHES       3
+
+
+/**
+ * What a single operation has asked of the server.
+ *
+ * Each thread has one of these, which is emptied when an operation
+ * starts, so it needs no locking.
+ */
+typedef struct stats_usage
+{
+    long long commands;
+    long long round_trips;
+    long long bytes_in;
+    long long bytes_out;
+    int sending;                /* sent commands since the last reply */
+    char trace[STATS_TRACE];
+    size_t trace_len;
+} stats_usage;
+
+
+/**
+ * Setup the statistics of the given operations, whose names must live
+ * as long as we do.  Operations taking at least slow_usec are logged,
+ * with the commands they sent; zero disables this.
+ */
+void stats_init(const char **names, int count, long long slow_usec);
+
+/**
+ * Are statistics being kept?
+ */
+int stats_enabled();
+
+/**
+ * Should the commands of each operation be traced?
+ */
+int stats_tracing();
+
+/**
+ * The current (monotonic) time in microseconds.
+ */
+long long stats_now();
+
+/**
+ * The histogram bucket holding the given latency, and the largest
+ * latency held by the given bucket.
+ */
+int stats_bucket(long long usec);
+long long stats_bucket_max(int bucket);
+
+/**
+ * Forget what the previous operation of this thread asked for.
+ */
+void stats_begin(stats_usage * u);
+
+/**
+ * Record a command of the given length being queued, and, if tracing,
+ * the name of the command.
+ */
+void stats_sent(stats_usage * u, size_t bytes, const char *cmd, size_t len);
+
+/**
+ * Record a reply of the given size being read.  The first reply read
+ * after commands have been sent costs a round-trip.
+ */
+void stats_received(stats_usage * u, size_t bytes);
+
+/**
+ * Record an operation completing after the given time, and log it if
+ * it was slow.
+ */
+void stats_record(int op, const char *path, long long usec, int failed,
+                  const stats_usage * u);
+
+/**
+ * Record a hit, or a miss, of the given cache.
+ */
+void stats_cache(int cache, int hit);
+
+/**
+ * The number of times the given operation has completed, and the
+ * latency below which the given fraction of them completed.
+ */
+long long stats_count(int op);
+long long stats_percentile(int op, double fraction);
+
+/**
+ * Describe every operation, in the Prometheus text format.
+ *
+ * As with snprintf() the result is truncated to fit, and the length it
+ * would have had is returned.
+ */
+size_t stats_format(char *buf, size_t len);
+
+/**
+ * Describe the most recent slow operations, newest first, in the same
+ * manner.
+ */
+size_t stats_format_slow(char *buf, size_t len);
+
+
+#endif /* _STATS_H */
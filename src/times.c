@@ -0,0 +1,211 @@
+/* times.c -- Timestamps of inodes which haven't yet been written.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  Rather than storing the mtime of a file with every write, or its
+ * atime with every open, these are noted here and written out a little
+ * later, by a single command for each inode.  However many times a file
+ * is written before then only its latest timestamps reach the server.
+ *
+ *  The table is a small hash of inodes, guarded by a single lock, which
+ * is only held for as long as it takes to update an entry.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "times.h"
+
+
+/**
+ * The number of chains in our table.
+ */
+#define TIMES_BUCKETS 1024
+
+
+typedef struct times_entry
+{
+    pending_times times;
+    struct times_entry *next;
+} times_entry;
+
+
+static times_entry *_buckets[TIMES_BUCKETS];
+static int _count = 0;
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * The chain holding the given inode.
+ */
+static times_entry **
+chain(long long inode)
+{
+    return (&_buckets[(unsigned long long)inode % TIMES_BUCKETS]);
+}
+
+
+/**
+ * Note new values for the given timestamps of an inode.
+ */
+int
+times_set(long long inode, int fields, time_t when, long long now)
+{
+    times_entry *e;
+
+    pthread_mutex_lock(&_lock);
+
+    for (e = *chain(inode); e != NULL; e = e->next)
+    {
+        if (e->times.inode == inode)
+            break;
+    }
+
+    if (e == NULL)
+    {
+        e = calloc(1, sizeof(times_entry));
+        if (e == NULL)
+        {
+            pthread_mutex_unlock(&_lock);
+            return -1;
+        }
+
+        e->times.inode = inode;
+        e->times.since = now;
+        e->next = *chain(inode);
+        *chain(inode) = e;
+        _count += 1;
+    }
+
+    if (fields & TIMES_ATIME)
+        e->times.atime = when;
+    if (fields & TIMES_MTIME)
+        e->times.mtime = when;
+    e->times.fields |= fields;
+
+    pthread_mutex_unlock(&_lock);
+
+    return 0;
+}
+
+
+/**
+ * Override the timestamps of a stat structure with those pending.
+ */
+int
+times_apply(long long inode, struct stat *st)
+{
+    times_entry *e;
+    int fields = 0;
+
+    pthread_mutex_lock(&_lock);
+
+    for (e = *chain(inode); e != NULL; e = e->next)
+    {
+        if (e->times.inode != inode)
+            continue;
+
+        fields = e->times.fields;
+        if (fields & TIMES_ATIME)
+            st->st_atime = e->times.atime;
+        if (fields & TIMES_MTIME)
+            st->st_mtime = e->times.mtime;
+        break;
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return (fields);
+}
+
+
+/**
+ * Forget the pending timestamps of an inode.
+ */
+void
+times_clear(long long inode)
+{
+    times_entry **p;
+
+    pthread_mutex_lock(&_lock);
+
+    for (p = chain(inode); *p != NULL; p = &(*p)->next)
+    {
+        if ((*p)->times.inode == inode)
+        {
+            times_entry *e = *p;
+
+            *p = e->next;
+            free(e);
+            _count -= 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+
+/**
+ * Remove up to max inodes whose timestamps are due to be written.
+ */
+int
+times_take(pending_times * out, int max, long long now, long delay)
+{
+    int taken = 0;
+    int i;
+
+    pthread_mutex_lock(&_lock);
+
+    for (i = 0; (i < TIMES_BUCKETS) && (taken < max) && (_count > 0); i++)
+    {
+        times_entry **p = &_buckets[i];
+
+        while ((*p != NULL) && (taken < max))
+        {
+            times_entry *e = *p;
+
+            if ((delay > 0) && (now - e->times.since < delay))
+            {
+                p = &e->next;
+                continue;
+            }
+
+            out[taken++] = e->times;
+            *p = e->next;
+            free(e);
+            _count -= 1;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return (taken);
+}
+
+
+/**
+ * The number of inodes with timestamps pending.
+ */
+int
+times_count()
+{
+    int count;
+
+    pthread_mutex_lock(&_lock);
+    count = _count;
+    pthread_mutex_unlock(&_lock);
+
+    return (count);
+}
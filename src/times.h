@@ -0,0 +1,77 @@
+/* times.h -- Timestamps of inodes which haven't yet been written.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _TIMES_H
+#define _TIMES_H 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+/**
+ * The timestamps which may be pending.
+ */
+#define TIMES_ATIME 1
+#define TIMES_MTIME 2
+
+
+/**
+ * The timestamps of one inode waiting to be written.
+ */
+typedef struct pending_times
+{
+    long long inode;
+    int fields;                 /* TIMES_ATIME | TIMES_MTIME */
+    time_t atime;
+    time_t mtime;
+    long long since;            /* when it was first left pending */
+} pending_times;
+
+
+/**
+ * Note new values for the given timestamps of an inode, replacing any
+ * already pending.
+ *
+ * Returns 0 on success, -1 if we're out of memory and the caller must
+ * write them itself.
+ */
+int times_set(long long inode, int fields, time_t when, long long now);
+
+/**
+ * Override the timestamps of the given stat structure with any pending
+ * for the inode.
+ *
+ * Returns the fields which were pending.
+ */
+int times_apply(long long inode, struct stat *st);
+
+/**
+ * Forget the pending timestamps of an inode, as it is being removed.
+ */
+void times_clear(long long inode);
+
+/**
+ * Remove up to max inodes whose timestamps have been pending for at
+ * least the given number of milliseconds, copying them to out.  A delay
+ * of zero takes every inode.
+ *
+ * Returns the number of inodes taken.
+ */
+int times_take(pending_times * out, int max, long long now, long delay);
+
+/**
+ * The number of inodes with timestamps pending.
+ */
+int times_count();
+
+
+#endif /* _TIMES_H */
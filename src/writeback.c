@@ -0,0 +1,144 @@
+/* writeback.c -- Buffers which coalesce small writes to an open file.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+/**
+ *  FUSE hands us writes a page or so at a time, and a program which
+ * writes a line at a time can produce far smaller ones.  Writing each
+ * to redis as it arrives costs a round-trip apiece.
+ *
+ *  Instead each open file may hold a buffer of a single contiguous run
+ * of data, which grows as long as the writes follow on from, or land
+ * inside, what is already buffered.  The filesystem writes the run in
+ * one go when it fills, when the file is flushed, or when it has been
+ * waiting too long.
+ *
+ *  These buffers carry no locking of their own; that is the job of the
+ * caller.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "writeback.h"
+
+
+
+/**
+ * Setup a buffer.
+ */
+int
+wbuf_init(write_buffer * b, size_t cap)
+{
+    memset(b, 0, sizeof(write_buffer));
+
+    b->data = malloc(cap);
+    if (b->data == NULL)
+        return -1;
+
+    b->cap = cap;
+    return 0;
+}
+
+
+/**
+ * Free the memory used by a buffer.
+ */
+void
+wbuf_free(write_buffer * b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(write_buffer));
+}
+
+
+/**
+ * Try to add a write to the buffer.
+ */
+int
+wbuf_add(write_buffer * b, const char *buf, size_t size, off_t offset,
+         long long now)
+{
+    size_t start;
+
+    if (b->data == NULL)
+        return 0;
+
+    if (b->len == 0)
+    {
+        if (size > b->cap)
+            return 0;
+
+        memcpy(b->data, buf, size);
+        b->offset = offset;
+        b->len = size;
+        b->dirty_since = now;
+        return 1;
+    }
+
+    /**
+     * The write must start within, or just after, the buffered run.
+     */
+    if ((offset < b->offset) || (offset > b->offset + (off_t) b->len))
+        return 0;
+
+    start = offset - b->offset;
+    if (start + size > b->cap)
+        return 0;
+
+    memcpy(b->data + start, buf, size);
+    if (start + size > b->len)
+        b->len = start + size;
+
+    return 1;
+}
+
+
+/**
+ * Is there data waiting to be written?
+ */
+int
+wbuf_pending(const write_buffer * b)
+{
+    return (b->len > 0);
+}
+
+
+/**
+ * The offset just beyond the buffered data.
+ */
+off_t
+wbuf_end(const write_buffer * b)
+{
+    return (b->offset + b->len);
+}
+
+
+/**
+ * Has the data been waiting long enough?
+ */
+int
+wbuf_due(const write_buffer * b, long long now, long delay)
+{
+    return ((b->len > 0) && (now - b->dirty_since >= delay));
+}
+
+
+/**
+ * Discard the buffered data.
+ */
+void
+wbuf_clear(write_buffer * b)
+{
+    b->len = 0;
+    b->offset = 0;
+    b->dirty_since = 0;
+}
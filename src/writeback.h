@@ -0,0 +1,76 @@
+/* writeback.h -- Buffers which coalesce small writes to an open file.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+#ifndef _WRITEBACK_H
+#define _WRITEBACK_H 1
+
+#include <sys/types.h>
+
+
+/**
+ * A single contiguous run of data which hasn't yet been written.
+ */
+typedef struct write_buffer
+{
+    char *data;
+    size_t len;
+    size_t cap;
+    off_t offset;
+    long long dirty_since;
+} write_buffer;
+
+
+/**
+ * Setup a buffer which may hold up to the given number of bytes.
+ *
+ * Returns 0 on success.
+ */
+int wbuf_init(write_buffer * b, size_t cap);
+
+/**
+ * Free the memory used by a buffer.
+ */
+void wbuf_free(write_buffer * b);
+
+/**
+ * Try to add a write to the buffer, which succeeds if the buffer is
+ * empty or the write overlaps or immediately follows the data already
+ * buffered, and the result fits.
+ *
+ * Returns 1 if the data was buffered, 0 if the caller must flush the
+ * buffer (or write the data directly) instead.
+ */
+int wbuf_add(write_buffer * b, const char *buf, size_t size, off_t offset,
+             long long now);
+
+/**
+ * Is there data waiting to be written?
+ */
+int wbuf_pending(const write_buffer * b);
+
+/**
+ * The offset just beyond the buffered data.
+ */
+off_t wbuf_end(const write_buffer * b);
+
+/**
+ * Has the data been waiting for at least the given number of
+ * milliseconds?
+ */
+int wbuf_due(const write_buffer * b, long long now, long delay);
+
+/**
+ * Discard the buffered data, once it has been written.
+ */
+void wbuf_clear(write_buffer * b);
+
+
+#endif /* _WRITEBACK_H */
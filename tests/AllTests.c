@@ -18,11 +18,51 @@
 #include "CuTest.h"
 #include "pathutil_test.h"
 #include "zlib_test.h"
+#include "cache_test.h"
+#include "writeback_test.h"
+#include "pagecache_test.h"
+#include "arena_test.h"
+#include "codec_test.h"
+#include "sha256_test.h"
+#include "slots_test.h"
+#include "stats_test.h"
+#include "mock_test.h"
+#include "record_test.h"
+#include "spill_test.h"
+#include "times_test.h"
+#include "nodes_test.h"
 
 /* defined in pathutil_test.c */
 CuSuite *pathutil_getsuite ();
 /* defined in zlib_test.c */
 CuSuite *zlib_getsuite ();
+/* defined in cache_test.c */
+CuSuite *cache_getsuite ();
+/* defined in writeback_test.c */
+CuSuite *writeback_getsuite ();
+/* defined in pagecache_test.c */
+CuSuite *pagecache_getsuite ();
+/* defined in arena_test.c */
+CuSuite *arena_getsuite ();
+/* defined in codec_test.c */
+CuSuite *codec_getsuite ();
+/* defined in sha256_test.c */
+CuSuite *sha256_getsuite ();
+/* defined in slots_test.c */
+CuSuite *slots_getsuite ();
+/* defined in stats_test.c */
+CuSuite *stats_getsuite ();
+/* defined in mock_test.c */
+CuSuite *mock_getsuite ();
+/* defined in record_test.c */
+CuSuite *record_getsuite ();
+/* defined in spill_test.c */
+CuSuite *spill_getsuite ();
+/* defined in times_test.c */
+CuSuite *times_getsuite ();
+
+/* defined in nodes_test.c */
+CuSuite *nodes_getsuite ();
 
 
 /**
@@ -39,6 +79,19 @@ RunAllTests (void)
 
     CuSuiteAddSuite (suite, pathutil_getsuite ());
     CuSuiteAddSuite (suite, zlib_getsuite ());
+    CuSuiteAddSuite (suite, cache_getsuite ());
+    CuSuiteAddSuite (suite, writeback_getsuite ());
+    CuSuiteAddSuite (suite, pagecache_getsuite ());
+    CuSuiteAddSuite (suite, arena_getsuite ());
+    CuSuiteAddSuite (suite, codec_getsuite ());
+    CuSuiteAddSuite (suite, sha256_getsuite ());
+    CuSuiteAddSuite (suite, slots_getsuite ());
+    CuSuiteAddSuite (suite, stats_getsuite ());
+    CuSuiteAddSuite (suite, mock_getsuite ());
+    CuSuiteAddSuite (suite, record_getsuite ());
+    CuSuiteAddSuite (suite, spill_getsuite ());
+    CuSuiteAddSuite (suite, times_getsuite ());
+    CuSuiteAddSuite (suite, nodes_getsuite ());
 
     CuSuiteRun (suite);
     CuSuiteSummary (suite, output);
@@ -0,0 +1,144 @@
+/**
+ * Test cases for the region allocator.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "arena_test.h"
+
+
+/**
+ * Test that allocations are aligned, distinct, and owned by the arena.
+ */
+void
+TestArenaAlloc(CuTest * tc)
+{
+    arena a;
+    char *one;
+    char *two;
+    int local = 0;
+
+    arena_init(&a, 1024);
+
+    one = arena_alloc(&a, 3);
+    two = arena_alloc(&a, 5);
+
+    CuAssertPtrNotNull(tc, one);
+    CuAssertPtrNotNull(tc, two);
+    CuAssertIntEquals(tc, 0, (int)((size_t)one % 16));
+    CuAssertIntEquals(tc, 0, (int)((size_t)two % 16));
+    CuAssertTrue(tc, two >= one + 3);
+
+    strcpy(one, "ab");
+    strcpy(two, "cdef");
+    CuAssertStrEquals(tc, "ab", one);
+    CuAssertStrEquals(tc, "cdef", two);
+
+    CuAssertIntEquals(tc, 1, arena_owns(&a, one));
+    CuAssertIntEquals(tc, 1, arena_owns(&a, two));
+    CuAssertIntEquals(tc, 0, arena_owns(&a, &local));
+    CuAssertIntEquals(tc, 32, (int)arena_used(&a));
+
+    arena_free(&a);
+    CuAssertIntEquals(tc, 0, arena_owns(&a, one));
+}
+
+
+/**
+ * Test that we grow beyond a single block, and that large requests
+ * don't waste the current block.
+ */
+void
+TestArenaGrowth(CuTest * tc)
+{
+    arena a;
+    char *small;
+    char *big;
+    char *next;
+    int i;
+
+    arena_init(&a, 256);
+
+    for (i = 0; i < 100; i++)
+    {
+        char *p = arena_alloc(&a, 16);
+        CuAssertPtrNotNull(tc, p);
+        memset(p, i, 16);
+    }
+    CuAssertIntEquals(tc, 1600, (int)arena_used(&a));
+
+    small = arena_alloc(&a, 16);
+    big = arena_alloc(&a, 4096);
+    next = arena_alloc(&a, 16);
+
+    CuAssertPtrNotNull(tc, big);
+    CuAssertIntEquals(tc, 1, arena_owns(&a, big));
+    CuAssertIntEquals(tc, 1, arena_owns(&a, big + 4095));
+    CuAssertTrue(tc, next == small + 16);
+
+    arena_free(&a);
+}
+
+
+/**
+ * Test that a reset releases everything, but reuses the memory.
+ */
+void
+TestArenaReset(CuTest * tc)
+{
+    arena a;
+    char *first;
+    char *big;
+    int i;
+
+    arena_init(&a, 256);
+
+    first = arena_alloc(&a, 16);
+    for (i = 0; i < 100; i++)
+        arena_alloc(&a, 16);
+    big = arena_alloc(&a, 4096);
+    CuAssertIntEquals(tc, 1, arena_owns(&a, big));
+
+    arena_reset(&a);
+    CuAssertIntEquals(tc, 0, (int)arena_used(&a));
+    CuAssertIntEquals(tc, 0, arena_owns(&a, big));
+
+    /**
+     * A reset of an empty arena is harmless.
+     */
+    arena_free(&a);
+    arena_reset(&a);
+    CuAssertIntEquals(tc, 0, (int)arena_used(&a));
+
+    first = arena_alloc(&a, 16);
+    arena_reset(&a);
+    CuAssertTrue(tc, first == arena_alloc(&a, 16));
+
+    arena_free(&a);
+}
+
+
+CuSuite *
+arena_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestArenaAlloc);
+    SUITE_ADD_TEST(suite, TestArenaGrowth);
+    SUITE_ADD_TEST(suite, TestArenaReset);
+
+    return suite;
+}
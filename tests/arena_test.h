@@ -0,0 +1,18 @@
+
+#ifndef _arena_test_h_
+#define _arena_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *arena_getsuite ();
+
+
+
+#endif /* _arena_test_h_ */
@@ -0,0 +1,1017 @@
+/* bench.c -- Reproducible benchmarks of a mounted filesystem.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  This driver measures a mounted filesystem, or one it mounts itself:
+ *
+ *   meta     - creating, stat'ing & unlinking files, against the size
+ *              and depth of the directory holding them.
+ *   io       - sequential & random reads & writes, against file size.
+ *   ls       - listing a directory, as "ls -l" does, against its size.
+ *   snapshot - running redisfs-snapshot, against the number of keys.
+ *
+ *  Each result is written to stdout as a single line of JSON, carrying
+ * the --label it was given, so that the results of several releases
+ * and configurations may be collected and compared:
+ *
+ *   {"label":"fast","bench":"meta","op":"create","depth":1,"entries":100,
+ *    "seconds":0.052,"ops_per_sec":1923.1}
+ *
+ *  Progress is reported to stderr.  The work is done inside a fresh
+ * directory beneath the mount, which is removed afterwards, and random
+ * offsets & contents come from a fixed seed so each run does the same.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+#include "hiredis.h"
+
+
+
+/**
+ * The directory the filesystem is mounted upon, and the directory
+ * beneath it which we work in.
+ */
+char _g_mount[1024] = { "/mnt/redis" };
+char _g_work[1100] = { "" };
+
+/**
+ * The label attached to each result, naming the configuration.
+ */
+char _g_label[256] = { "default" };
+
+/**
+ * If set the command we launch to mount the filesystem, and its pid.
+ */
+char _g_redisfs[1024] = { "" };
+pid_t _g_redisfs_pid = -1;
+
+/**
+ * The snapshot utility, and any options we pass it.
+ */
+char _g_snapshot[1024] = { "../src/redisfs-snapshot" };
+char _g_snapshot_args[1024] = { "" };
+
+/**
+ * The redis server, and the prefix of the filesystem, used to count
+ * keys and to remove snapshots.
+ */
+int _g_redis_port = 6379;
+char _g_redis_host[100] = { "localhost" };
+char _g_prefix[20] = { "skx" };
+
+/**
+ * The benchmarks we run, separated by commas.
+ */
+char _g_only[256] = { "meta,io,ls,snapshot" };
+
+/**
+ * Should we use smaller sizes, for a quick run?
+ */
+int _g_quick = 0;
+
+/**
+ * How many times each listing is repeated.
+ */
+int _g_repeat = 5;
+
+/**
+ * The state of our random number generator.
+ */
+unsigned long long _g_random = 1;
+
+
+
+/**
+ * A random number; the same sequence is produced on every platform.
+ */
+unsigned long long
+next_random()
+{
+    _g_random = _g_random * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (_g_random >> 33);
+}
+
+
+/**
+ * The current (monotonic) time, in seconds.
+ */
+double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+
+/**
+ * Write a single result, which is given as the remaining members of a
+ * JSON object.
+ */
+void
+report(const char *bench, const char *fmt, ...)
+{
+    va_list ap;
+    const char *p;
+
+    printf("{\"label\":\"");
+    for (p = _g_label; *p != '\0'; p++)
+    {
+        if ((*p == '"') || (*p == '\\'))
+            putchar('\\');
+        if ((unsigned char)*p >= ' ')
+            putchar(*p);
+    }
+    printf("\",\"bench\":\"%s\",", bench);
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+/**
+ * Report our progress.
+ */
+void
+progress(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+
+/**
+ * Should we run the named benchmark?
+ */
+int
+wanted(const char *bench)
+{
+    size_t len = strlen(bench);
+    const char *p = _g_only;
+
+    while ((p = strstr(p, bench)) != NULL)
+    {
+        if (((p == _g_only) || (p[-1] == ',')) &&
+            ((p[len] == '\0') || (p[len] == ',')))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+
+/**
+ * Remove the given file or directory, and everything beneath it.
+ */
+int
+remove_tree(const char *path)
+{
+    struct stat sb;
+    struct dirent *de;
+    char child[4096];
+    DIR *dir;
+
+    if (lstat(path, &sb) != 0)
+        return ((errno == ENOENT) ? 0 : -1);
+
+    if (!S_ISDIR(sb.st_mode))
+        return (unlink(path));
+
+    dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        remove_tree(child);
+    }
+    closedir(dir);
+
+    return (rmdir(path));
+}
+
+
+/**
+ * Create the given number of files, of the given size, in a directory.
+ */
+int
+populate(const char *dir, int count, size_t size)
+{
+    char path[4096];
+    char *buf = NULL;
+    int i;
+
+    if (size > 0)
+    {
+        buf = malloc(size);
+        if (buf == NULL)
+            return -1;
+        memset(buf, 'x', size);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            free(buf);
+            return -1;
+        }
+        if ((size > 0) && (write(fd, buf, size) != (ssize_t)size))
+        {
+            close(fd);
+            free(buf);
+            return -1;
+        }
+        close(fd);
+    }
+
+    free(buf);
+    return 0;
+}
+
+
+/**
+ * Time creating, stat'ing, and unlinking the given number of files in
+ * a directory nested to the given depth.
+ */
+int
+bench_meta_once(int depth, int entries)
+{
+    char dir[2048];
+    char path[4096];
+    struct stat sb;
+    double start, taken;
+    int i;
+
+    snprintf(dir, sizeof(dir), "%s/meta", _g_work);
+    if (mkdir(dir, 0755) != 0)
+        return -1;
+    for (i = 1; i < depth; i++)
+    {
+        size_t len = strlen(dir);
+
+        snprintf(dir + len, sizeof(dir) - len, "/d%d", i);
+        if (mkdir(dir, 0755) != 0)
+            return -1;
+    }
+
+    start = now();
+    for (i = 0; i < entries; i++)
+    {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0)
+            return -1;
+        close(fd);
+    }
+    taken = now() - start;
+    report("meta", "\"op\":\"create\",\"depth\":%d,\"entries\":%d,"
+           "\"seconds\":%.6f,\"ops_per_sec\":%.1f",
+           depth, entries, taken, entries / taken);
+
+    start = now();
+    for (i = 0; i < entries; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        if (stat(path, &sb) != 0)
+            return -1;
+    }
+    taken = now() - start;
+    report("meta", "\"op\":\"stat\",\"depth\":%d,\"entries\":%d,"
+           "\"seconds\":%.6f,\"ops_per_sec\":%.1f",
+           depth, entries, taken, entries / taken);
+
+    start = now();
+    for (i = 0; i < entries; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        if (unlink(path) != 0)
+            return -1;
+    }
+    taken = now() - start;
+    report("meta", "\"op\":\"unlink\",\"depth\":%d,\"entries\":%d,"
+           "\"seconds\":%.6f,\"ops_per_sec\":%.1f",
+           depth, entries, taken, entries / taken);
+
+    snprintf(dir, sizeof(dir), "%s/meta", _g_work);
+    return (remove_tree(dir));
+}
+
+
+/**
+ * Time meta-data operations against directory size & depth.
+ */
+int
+bench_meta()
+{
+    int sizes[] = { 10, 100, 1000, 10000 };
+    int depths[] = { 1, 4, 16 };
+    int nsizes = _g_quick ? 3 : 4;
+    int d, s;
+
+    for (d = 0; d < 3; d++)
+        for (s = 0; s < nsizes; s++)
+        {
+            progress("meta: %d entries at depth %d", sizes[s], depths[d]);
+            if (bench_meta_once(depths[d], sizes[s]) != 0)
+            {
+                perror("meta");
+                return -1;
+            }
+        }
+    return 0;
+}
+
+
+/**
+ * Report the throughput of a single I/O phase.
+ */
+void
+report_io(const char *op, size_t size, size_t block, size_t bytes,
+          double taken)
+{
+    report("io", "\"op\":\"%s\",\"size\":%lu,\"block\":%lu,"
+           "\"bytes\":%lu,\"seconds\":%.6f,\"mb_per_sec\":%.2f",
+           op, (unsigned long)size, (unsigned long)block,
+           (unsigned long)bytes, taken, bytes / taken / (1024.0 * 1024.0));
+}
+
+
+/**
+ * Time sequential & random I/O against a file of the given size.
+ *
+ * Sequential I/O uses blocks of 64k, and random I/O blocks of 4k at
+ * aligned offsets, up to a thousand of them.
+ */
+int
+bench_io_once(size_t size, char *buf)
+{
+    char path[4096];
+    size_t seq = (size < 65536) ? size : 65536;
+    size_t rnd = 4096;
+    size_t count = size / rnd;
+    size_t done, i;
+    unsigned long long seed;
+    double start;
+    int fd;
+
+    if (count > 1024)
+        count = 1024;
+
+    snprintf(path, sizeof(path), "%s/io", _g_work);
+
+    start = now();
+    fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0)
+        return -1;
+    for (done = 0; done < size; done += seq)
+        if (write(fd, buf, seq) != (ssize_t)seq)
+        {
+            close(fd);
+            return -1;
+        }
+    if ((fsync(fd) != 0) || (close(fd) != 0))
+        return -1;
+    report_io("seq_write", size, seq, size, now() - start);
+
+    start = now();
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    for (done = 0; done < size; done += seq)
+        if (read(fd, buf, seq) != (ssize_t)seq)
+        {
+            close(fd);
+            return -1;
+        }
+    close(fd);
+    report_io("seq_read", size, seq, size, now() - start);
+
+    /**
+     * The random reads visit the same offsets as the writes did.
+     */
+    seed = _g_random;
+
+    start = now();
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    for (i = 0; i < count; i++)
+    {
+        off_t offset = (off_t)(next_random() % (size / rnd)) * rnd;
+
+        if (pwrite(fd, buf, rnd, offset) != (ssize_t)rnd)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    if ((fsync(fd) != 0) || (close(fd) != 0))
+        return -1;
+    report_io("rand_write", size, rnd, count * rnd, now() - start);
+
+    _g_random = seed;
+
+    start = now();
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    for (i = 0; i < count; i++)
+    {
+        off_t offset = (off_t)(next_random() % (size / rnd)) * rnd;
+
+        if (pread(fd, buf, rnd, offset) != (ssize_t)rnd)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    report_io("rand_read", size, rnd, count * rnd, now() - start);
+
+    return (unlink(path));
+}
+
+
+/**
+ * Time I/O against file size.
+ */
+int
+bench_io()
+{
+    size_t sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+        64 * 1024 * 1024
+    };
+    int nsizes = _g_quick ? 2 : 4;
+    char buf[65536];
+    size_t i;
+    int s;
+
+    /**
+     * Incompressible contents, so that --compress doesn't flatter us.
+     */
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)next_random();
+
+    for (s = 0; s < nsizes; s++)
+    {
+        progress("io: %lu bytes", (unsigned long)sizes[s]);
+        if (bench_io_once(sizes[s], buf) != 0)
+        {
+            perror("io");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Compare two timings, for qsort().
+ */
+int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return ((x < y) ? -1 : (x > y) ? 1 : 0);
+}
+
+
+/**
+ * Time listing a directory of the given size, as "ls -l" does.
+ *
+ * The first listing is reported separately, as later ones may be
+ * helped by caches.
+ */
+int
+bench_ls_once(int entries)
+{
+    char dir[2048];
+    char path[4096];
+    double *taken;
+    double first;
+    struct stat sb;
+    struct dirent *de;
+    int found = 0;
+    int r;
+
+    snprintf(dir, sizeof(dir), "%s/ls", _g_work);
+    if ((mkdir(dir, 0755) != 0) || (populate(dir, entries, 0) != 0))
+        return -1;
+
+    taken = malloc(sizeof(double) * _g_repeat);
+    if (taken == NULL)
+        return -1;
+
+    for (r = 0; r < _g_repeat; r++)
+    {
+        double start = now();
+        DIR *d = opendir(dir);
+
+        if (d == NULL)
+        {
+            free(taken);
+            return -1;
+        }
+
+        found = 0;
+        while ((de = readdir(d)) != NULL)
+        {
+            if ((strcmp(de->d_name, ".") == 0) ||
+                (strcmp(de->d_name, "..") == 0))
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            if (lstat(path, &sb) == 0)
+                found += 1;
+        }
+        closedir(d);
+        taken[r] = now() - start;
+    }
+
+    first = taken[0];
+    qsort(taken, _g_repeat, sizeof(double), compare_double);
+
+    report("ls", "\"entries\":%d,\"found\":%d,\"repeat\":%d,"
+           "\"first_ms\":%.3f,\"min_ms\":%.3f,\"median_ms\":%.3f,"
+           "\"max_ms\":%.3f",
+           entries, found, _g_repeat, first * 1000, taken[0] * 1000,
+           taken[_g_repeat / 2] * 1000, taken[_g_repeat - 1] * 1000);
+
+    free(taken);
+    return (remove_tree(dir));
+}
+
+
+/**
+ * Time listings against directory size.
+ */
+int
+bench_ls()
+{
+    int sizes[] = { 100, 1000, 10000 };
+    int nsizes = _g_quick ? 2 : 3;
+    int s;
+
+    for (s = 0; s < nsizes; s++)
+    {
+        progress("ls: %d entries", sizes[s]);
+        if (bench_ls_once(sizes[s]) != 0)
+        {
+            perror("ls");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Connect to the redis server.
+ */
+redisContext *
+redis_connect()
+{
+    struct timeval timeout = { 1, 500000 };     // 1.5 seconds
+    redisContext *c;
+
+    c = redisConnectWithTimeout(_g_redis_host, _g_redis_port, timeout);
+    if ((c == NULL) || (c->err))
+    {
+        fprintf(stderr, "Failed to connect to redis on [%s:%d].\n",
+                _g_redis_host, _g_redis_port);
+        if (c != NULL)
+            redisFree(c);
+        return NULL;
+    }
+    return (c);
+}
+
+
+/**
+ * Count the keys whose names start with the given prefix, and remove
+ * them too if asked.
+ *
+ * Returns the number of keys, or -1 on error.
+ */
+long long
+count_keys(redisContext * c, const char *prefix, int remove)
+{
+    unsigned long long cursor = 0;
+    long long count = 0;
+    char pattern[64];
+
+    snprintf(pattern, sizeof(pattern), "%s:*", prefix);
+
+    do
+    {
+        char next[32];
+        const char *argv[6];
+        redisReply *reply;
+        size_t i;
+
+        snprintf(next, sizeof(next), "%llu", cursor);
+        argv[0] = "SCAN";
+        argv[1] = next;
+        argv[2] = "MATCH";
+        argv[3] = pattern;
+        argv[4] = "COUNT";
+        argv[5] = "1000";
+
+        reply = redisCommandArgv(c, 6, argv, NULL);
+        if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY) ||
+            (reply->elements != 2))
+        {
+            fprintf(stderr, "SCAN failed: %s\n",
+                    (reply == NULL) ? c->errstr :
+                    (reply->type == REDIS_REPLY_ERROR) ? reply->str :
+                    "unexpected reply");
+            if (reply != NULL)
+                freeReplyObject(reply);
+            return -1;
+        }
+
+        cursor = strtoull(reply->element[0]->str, NULL, 10);
+        count += reply->element[1]->elements;
+
+        if (remove)
+        {
+            for (i = 0; i < reply->element[1]->elements; i++)
+                redisAppendCommand(c, "DEL %b",
+                                   reply->element[1]->element[i]->str,
+                                   (size_t)reply->element[1]->element[i]->len);
+            for (i = 0; i < reply->element[1]->elements; i++)
+            {
+                redisReply *r = NULL;
+
+                if (redisGetReply(c, (void **)&r) != REDIS_OK)
+                {
+                    freeReplyObject(reply);
+                    return -1;
+                }
+                freeReplyObject(r);
+            }
+        }
+        freeReplyObject(reply);
+    }
+    while (cursor != 0);
+
+    return (count);
+}
+
+
+/**
+ * Time taking a snapshot of a filesystem holding the given number of
+ * files, which is then removed.
+ */
+int
+bench_snapshot_once(int entries)
+{
+    char dir[2048];
+    char cmd[4096];
+    const char *to = "bench-snapshot";
+    redisContext *c;
+    long long keys;
+    double start, taken;
+    int status;
+
+    snprintf(dir, sizeof(dir), "%s/snapshot", _g_work);
+    if ((mkdir(dir, 0755) != 0) || (populate(dir, entries, 16) != 0))
+        return -1;
+
+    c = redis_connect();
+    if (c == NULL)
+        return -1;
+
+    keys = count_keys(c, _g_prefix, 0);
+    if ((keys < 0) || (count_keys(c, to, 1) < 0))
+    {
+        redisFree(c);
+        return -1;
+    }
+
+    snprintf(cmd, sizeof(cmd),
+             "%s --host=%s --port=%d --from=%s --to=%s --quiet %s >/dev/null",
+             _g_snapshot, _g_redis_host, _g_redis_port, _g_prefix, to,
+             _g_snapshot_args);
+
+    start = now();
+    status = system(cmd);
+    taken = now() - start;
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to run: %s\n", cmd);
+        redisFree(c);
+        return -1;
+    }
+
+    report("snapshot", "\"entries\":%d,\"keys\":%lld,\"seconds\":%.6f,"
+           "\"keys_per_sec\":%.1f",
+           entries, keys, taken, keys / taken);
+
+    count_keys(c, to, 1);
+    redisFree(c);
+
+    return (remove_tree(dir));
+}
+
+
+/**
+ * Time snapshots against the number of keys.
+ */
+int
+bench_snapshot()
+{
+    int sizes[] = { 100, 1000, 10000 };
+    int nsizes = _g_quick ? 2 : 3;
+    int s;
+
+    for (s = 0; s < nsizes; s++)
+    {
+        progress("snapshot: %d entries", sizes[s]);
+        if (bench_snapshot_once(sizes[s]) != 0)
+        {
+            perror("snapshot");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Is the filesystem mounted?  We test whether the mount point lives on
+ * a different device to its parent.
+ */
+int
+mounted()
+{
+    char parent[1100];
+    struct stat a, b;
+
+    snprintf(parent, sizeof(parent), "%s/..", _g_mount);
+    if ((stat(_g_mount, &a) != 0) || (stat(parent, &b) != 0))
+        return 0;
+    return (a.st_dev != b.st_dev);
+}
+
+
+/**
+ * Launch the filesystem with the command we were given, and wait for
+ * it to be mounted.
+ */
+int
+mount_redisfs()
+{
+    char cmd[4096];
+    int i;
+
+    if (mounted())
+    {
+        fprintf(stderr, "Something is already mounted at %s.\n", _g_mount);
+        return -1;
+    }
+
+    snprintf(cmd, sizeof(cmd), "exec %s --mount=%s >/dev/null",
+             _g_redisfs, _g_mount);
+
+    _g_redisfs_pid = fork();
+    if (_g_redisfs_pid < 0)
+        return -1;
+    if (_g_redisfs_pid == 0)
+    {
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    /**
+     * Give it ten seconds.
+     */
+    for (i = 0; i < 100; i++)
+    {
+        if (mounted())
+            return 0;
+        if (waitpid(_g_redisfs_pid, NULL, WNOHANG) == _g_redisfs_pid)
+            break;
+        usleep(100000);
+    }
+
+    fprintf(stderr, "Failed to mount with: %s\n", cmd);
+    kill(_g_redisfs_pid, SIGTERM);
+    waitpid(_g_redisfs_pid, NULL, 0);
+    _g_redisfs_pid = -1;
+    return -1;
+}
+
+
+/**
+ * Unmount the filesystem we launched, and wait for it to exit.
+ */
+void
+unmount_redisfs()
+{
+    char cmd[4096];
+
+    if (_g_redisfs_pid < 0)
+        return;
+
+    snprintf(cmd, sizeof(cmd), "fusermount -u %s", _g_mount);
+    if (system(cmd) != 0)
+        kill(_g_redisfs_pid, SIGTERM);
+    waitpid(_g_redisfs_pid, NULL, 0);
+    _g_redisfs_pid = -1;
+}
+
+
+/**
+ * Show minimal usage information.
+ */
+int
+usage(int argc, char *argv[])
+{
+    printf("%s - Benchmark a redisfs filesystem\n", argv[0]);
+    printf("\nOptions:\n\n");
+    printf("\t--help          - Show this minimal help information.\n");
+    printf("\t--host          - The hostname of the redis server [localhost]\n");
+    printf("\t--label         - The label given to each result [default].\n");
+    printf("\t--mount         - The filesystem to measure [/mnt/redis].\n");
+    printf("\t--only          - The benchmarks to run [meta,io,ls,snapshot].\n");
+    printf("\t--port          - The port of the redis server [6379].\n");
+    printf("\t--prefix        - The prefix of the filesystem [skx].\n");
+    printf("\t--quick         - Use fewer, smaller, files.\n");
+    printf("\t--redisfs       - Mount the filesystem with this command first.\n");
+    printf("\t--repeat        - The number of times to list each directory [5].\n");
+    printf("\t--snapshot      - The snapshot utility [../src/redisfs-snapshot].\n");
+    printf("\t--snapshot-args - Further options for the snapshot utility.\n");
+    printf("\nFor example:\n\n");
+    printf("\t%s --label=fast --redisfs=\"../src/redisfs --fast\"\n",
+           argv[0]);
+    printf("\n");
+
+    return 1;
+}
+
+
+/**
+ *  Entry point to our code.
+ */
+int
+main(int argc, char *argv[])
+{
+    int failed = 0;
+    int c;
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"host", required_argument, 0, 's'},
+            {"label", required_argument, 0, 'l'},
+            {"mount", required_argument, 0, 'm'},
+            {"only", required_argument, 0, 'o'},
+            {"port", required_argument, 0, 'P'},
+            {"prefix", required_argument, 0, 'p'},
+            {"quick", no_argument, 0, 'q'},
+            {"redisfs", required_argument, 0, 'r'},
+            {"repeat", required_argument, 0, 'R'},
+            {"snapshot", required_argument, 0, 'S'},
+            {"snapshot-args", required_argument, 0, 'a'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "s:l:m:o:P:p:r:R:S:a:hq", long_options,
+                        &option_index);
+
+        /*
+         * Detect the end of the options.
+         */
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+        case 's':
+            snprintf(_g_redis_host, sizeof(_g_redis_host), "%s", optarg);
+            break;
+        case 'l':
+            snprintf(_g_label, sizeof(_g_label), "%s", optarg);
+            break;
+        case 'm':
+            snprintf(_g_mount, sizeof(_g_mount), "%s", optarg);
+            break;
+        case 'o':
+            snprintf(_g_only, sizeof(_g_only), "%s", optarg);
+            break;
+        case 'P':
+            _g_redis_port = atoi(optarg);
+            break;
+        case 'p':
+            snprintf(_g_prefix, sizeof(_g_prefix), "%s", optarg);
+            break;
+        case 'q':
+            _g_quick = 1;
+            break;
+        case 'r':
+            snprintf(_g_redisfs, sizeof(_g_redisfs), "%s", optarg);
+            break;
+        case 'R':
+            _g_repeat = atoi(optarg);
+            if (_g_repeat < 1)
+                _g_repeat = 1;
+            break;
+        case 'S':
+            snprintf(_g_snapshot, sizeof(_g_snapshot), "%s", optarg);
+            break;
+        case 'a':
+            snprintf(_g_snapshot_args, sizeof(_g_snapshot_args), "%s",
+                     optarg);
+            break;
+        case 'h':
+            return (usage(argc, argv));
+        default:
+            return 1;
+        }
+    }
+
+    if ((strlen(_g_redisfs) > 0) && (mount_redisfs() != 0))
+        return 1;
+
+    if (!mounted())
+    {
+        fprintf(stderr, "redisfs doesn't seem to be mounted at %s.\n",
+                _g_mount);
+        return 1;
+    }
+
+    /**
+     * Work in a directory of our own.
+     */
+    snprintf(_g_work, sizeof(_g_work), "%s/redisfs-bench", _g_mount);
+    remove_tree(_g_work);
+    if (mkdir(_g_work, 0755) != 0)
+    {
+        perror(_g_work);
+        unmount_redisfs();
+        return 1;
+    }
+
+    if (wanted("meta") && (bench_meta() != 0))
+        failed += 1;
+    if (wanted("io") && (bench_io() != 0))
+        failed += 1;
+    if (wanted("ls") && (bench_ls() != 0))
+        failed += 1;
+    if (wanted("snapshot") && (bench_snapshot() != 0))
+        failed += 1;
+
+    remove_tree(_g_work);
+    unmount_redisfs();
+
+    return (failed ? 1 : 0);
+}
@@ -0,0 +1,275 @@
+/**
+ * Test cases for the lookup & attribute cache.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_test.h"
+
+
+/**
+ * Test that a disabled cache never returns anything.
+ */
+void
+TestCacheDisabled(CuTest * tc)
+{
+    struct stat st;
+
+    cache_init(0);
+    CuAssertIntEquals(tc, 0, cache_enabled());
+
+    cache_set_inode("/etc", -99, 3);
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc"));
+
+    memset(&st, 0, sizeof(st));
+    cache_set_stat(3, &st);
+    CuAssertIntEquals(tc, 0, cache_get_stat(3, &st));
+}
+
+
+/**
+ * Test that we can store and retrieve lookups.
+ */
+void
+TestCacheLookup(CuTest * tc)
+{
+    cache_init(60000);
+    CuAssertIntEquals(tc, 1, cache_enabled());
+
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc"));
+
+    cache_set_inode("/etc", -99, 3);
+    cache_set_inode("/etc/passwd", 3, 6);
+    CuAssertIntEquals(tc, 3, cache_get_inode("/etc"));
+    CuAssertIntEquals(tc, 6, cache_get_inode("/etc/passwd"));
+
+    /**
+     * Updating replaces.
+     */
+    cache_set_inode("/etc/passwd", 3, 7);
+    CuAssertIntEquals(tc, 7, cache_get_inode("/etc/passwd"));
+
+    cache_flush();
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc"));
+}
+
+
+/**
+ * Test that invalidating a path also invalidates its children, but
+ * not siblings which merely share a prefix.
+ */
+void
+TestCacheInvalidatePath(CuTest * tc)
+{
+    cache_init(60000);
+
+    cache_set_inode("/etc", -99, 3);
+    cache_set_inode("/etc/passwd", 3, 6);
+    cache_set_inode("/etcetera", -99, 8);
+
+    cache_invalidate_path("/etc");
+
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc/passwd"));
+    CuAssertIntEquals(tc, 8, cache_get_inode("/etcetera"));
+}
+
+
+/**
+ * Test invalidation by parent directory, and by inode.
+ */
+void
+TestCacheInvalidateInode(CuTest * tc)
+{
+    cache_init(60000);
+
+    cache_set_inode("/etc", -99, 3);
+    cache_set_inode("/etc/passwd", 3, 6);
+    cache_set_inode("/etc/ssh", 3, 9);
+    cache_set_inode("/etc/ssh/sshd_config", 9, 10);
+    cache_set_inode("/tmp", -99, 4);
+
+    cache_invalidate_children(3);
+    CuAssertIntEquals(tc, 3, cache_get_inode("/etc"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc/passwd"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc/ssh/sshd_config"));
+    CuAssertIntEquals(tc, 4, cache_get_inode("/tmp"));
+
+    cache_invalidate_entry(4);
+    CuAssertIntEquals(tc, -1, cache_get_inode("/tmp"));
+    CuAssertIntEquals(tc, 3, cache_get_inode("/etc"));
+}
+
+
+/**
+ * Test that a path is only stored beneath a known directory, and that
+ * re-pointing a directory forgets what was beneath it.
+ */
+void
+TestCacheParents(CuTest * tc)
+{
+    cache_init(60000);
+
+    cache_set_inode("/srv/www", 5, 11);
+    CuAssertIntEquals(tc, -1, cache_get_inode("/srv/www"));
+
+    cache_set_inode("/srv", -99, 5);
+    cache_set_inode("/srv/www", 5, 11);
+    cache_set_inode("/srv/www/index.html", 11, 12);
+    cache_set_inode("/srv/ftp", 5, 13);
+    CuAssertIntEquals(tc, 12, cache_get_inode("/srv/www/index.html"));
+
+    cache_set_inode("/srv/www", 5, 14);
+    CuAssertIntEquals(tc, 14, cache_get_inode("/srv/www"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/srv/www/index.html"));
+    CuAssertIntEquals(tc, 13, cache_get_inode("/srv/ftp"));
+
+    /**
+     * Forgetting a directory forgets everything beneath it.
+     */
+    cache_set_inode("/srv/www/index.html", 14, 12);
+    cache_invalidate_entry(5);
+    CuAssertIntEquals(tc, -1, cache_get_inode("/srv"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/srv/www/index.html"));
+    CuAssertIntEquals(tc, -1, cache_get_inode("/srv/ftp"));
+}
+
+
+/**
+ * Test that attributes are stored, updated and invalidated.
+ */
+void
+TestCacheStat(CuTest * tc)
+{
+    struct stat in;
+    struct stat out;
+
+    cache_init(60000);
+
+    memset(&in, 0, sizeof(in));
+    in.st_size = 1688;
+    in.st_mode = 0644;
+
+    /**
+     * Updating something which isn't cached doesn't add it.
+     */
+    cache_update_stat(6, &in);
+    CuAssertIntEquals(tc, 0, cache_get_stat(6, &out));
+
+    cache_set_stat(6, &in);
+    CuAssertIntEquals(tc, 1, cache_get_stat(6, &out));
+    CuAssertIntEquals(tc, 1688, (int)out.st_size);
+
+    in.st_size = 42;
+    cache_update_stat(6, &in);
+    CuAssertIntEquals(tc, 1, cache_get_stat(6, &out));
+    CuAssertIntEquals(tc, 42, (int)out.st_size);
+
+    cache_invalidate_stat(6);
+    CuAssertIntEquals(tc, 0, cache_get_stat(6, &out));
+}
+
+
+/**
+ * Test that extended attributes are kept alongside the attributes, but
+ * may be dropped without them.
+ */
+void
+TestCacheXattrs(CuTest * tc)
+{
+    struct stat st;
+    char *data = NULL;
+    size_t len = 0;
+
+    cache_init(60000);
+
+    memset(&st, 0, sizeof(st));
+    CuAssertIntEquals(tc, 0, cache_get_xattrs(6, &data, &len));
+
+    /**
+     * Extended attributes alone don't make the attributes cached.
+     */
+    cache_set_xattrs(6, "user.a\0", 7);
+    CuAssertIntEquals(tc, 0, cache_get_stat(6, &st));
+    CuAssertIntEquals(tc, 1, cache_get_xattrs(6, &data, &len));
+    CuAssertIntEquals(tc, 7, (int)len);
+    CuAssertStrEquals(tc, "user.a", data);
+    free(data);
+
+    cache_update_stat(6, &st);
+    CuAssertIntEquals(tc, 0, cache_get_stat(6, &st));
+
+    cache_set_stat(6, &st);
+    cache_invalidate_xattrs(6);
+    CuAssertIntEquals(tc, 1, cache_get_stat(6, &st));
+    CuAssertIntEquals(tc, 0, cache_get_xattrs(6, &data, &len));
+
+    /**
+     * Forgetting the attributes forgets the extended ones too.
+     */
+    cache_set_xattrs(6, "", 0);
+    CuAssertIntEquals(tc, 1, cache_get_xattrs(6, &data, &len));
+    CuAssertIntEquals(tc, 0, (int)len);
+    free(data);
+
+    cache_invalidate_stat(6);
+    CuAssertIntEquals(tc, 0, cache_get_xattrs(6, &data, &len));
+}
+
+
+/**
+ * Test that entries expire.
+ */
+void
+TestCacheExpiry(CuTest * tc)
+{
+    struct stat st;
+
+    cache_init(20);
+
+    memset(&st, 0, sizeof(st));
+    cache_set_inode("/etc", -99, 3);
+    cache_set_stat(3, &st);
+
+    CuAssertIntEquals(tc, 3, cache_get_inode("/etc"));
+    CuAssertIntEquals(tc, 1, cache_get_stat(3, &st));
+
+    usleep(50000);
+
+    CuAssertIntEquals(tc, -1, cache_get_inode("/etc"));
+    CuAssertIntEquals(tc, 0, cache_get_stat(3, &st));
+
+    cache_init(0);
+}
+
+
+CuSuite *
+cache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestCacheDisabled);
+    SUITE_ADD_TEST(suite, TestCacheLookup);
+    SUITE_ADD_TEST(suite, TestCacheInvalidatePath);
+    SUITE_ADD_TEST(suite, TestCacheInvalidateInode);
+    SUITE_ADD_TEST(suite, TestCacheParents);
+    SUITE_ADD_TEST(suite, TestCacheStat);
+    SUITE_ADD_TEST(suite, TestCacheXattrs);
+    SUITE_ADD_TEST(suite, TestCacheExpiry);
+
+    return suite;
+}
@@ -0,0 +1,18 @@
+
+#ifndef _cache_test_h_
+#define _cache_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *cache_getsuite ();
+
+
+
+#endif /* _cache_test_h_ */
@@ -0,0 +1,141 @@
+/**
+ * Test cases for the compression of file contents.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "codec.h"
+#include "codec_test.h"
+
+
+/**
+ * Test that we know our codecs by name.
+ */
+void
+TestCodecLookup(CuTest * tc)
+{
+    CuAssertIntEquals(tc, CODEC_ZLIB, codec_lookup("zlib"));
+    CuAssertIntEquals(tc, CODEC_NONE, codec_lookup("none"));
+    CuAssertIntEquals(tc, CODEC_NONE, codec_lookup(NULL));
+    CuAssertIntEquals(tc, -1, codec_lookup("lzma"));
+    CuAssertStrEquals(tc, "zlib", codec_name(CODEC_ZLIB));
+}
+
+
+/**
+ * Test that text is compressed, and decoded again.
+ */
+void
+TestCodecRoundTrip(CuTest * tc)
+{
+    char input[4096];
+    char *frame;
+    char *output;
+    size_t frame_len = 0;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < sizeof(input); i++)
+        input[i] = "The quick brown fox. "[i % 21];
+
+    frame = codec_encode(CODEC_ZLIB, input, sizeof(input), 512, &frame_len);
+    CuAssertPtrNotNull(tc, frame);
+    CuAssertIntEquals(tc, CODEC_ZLIB, frame[0]);
+    CuAssertTrue(tc, frame_len < sizeof(input) / 4);
+
+    output = codec_decode(frame, frame_len, sizeof(input), &len);
+    CuAssertPtrNotNull(tc, output);
+    CuAssertIntEquals(tc, sizeof(input), (int)len);
+    CuAssertTrue(tc, memcmp(input, output, len) == 0);
+
+    /**
+     * The frame claims more than we're willing to accept.
+     */
+    CuAssertPtrEquals(tc, NULL, codec_decode(frame, frame_len, 100, &len));
+
+    free(output);
+    free(frame);
+}
+
+
+/**
+ * Test that small, and incompressible, chunks are stored as-is.
+ */
+void
+TestCodecBailout(CuTest * tc)
+{
+    char input[2048];
+    char *frame;
+    char *output;
+    size_t frame_len = 0;
+    size_t len = 0;
+    unsigned int seed = 42;
+    int i;
+
+    for (i = 0; i < sizeof(input); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (seed >> 16) & 0xff;
+    }
+
+    frame = codec_encode(CODEC_ZLIB, "tiny", 4, 512, &frame_len);
+    CuAssertIntEquals(tc, CODEC_NONE, frame[0]);
+    CuAssertIntEquals(tc, 5, (int)frame_len);
+    free(frame);
+
+    frame = codec_encode(CODEC_ZLIB, input, sizeof(input), 512, &frame_len);
+    CuAssertIntEquals(tc, CODEC_NONE, frame[0]);
+    CuAssertIntEquals(tc, sizeof(input) + 1, (int)frame_len);
+
+    output = codec_decode(frame, frame_len, sizeof(input), &len);
+    CuAssertIntEquals(tc, sizeof(input), (int)len);
+    CuAssertTrue(tc, memcmp(input, output, len) == 0);
+
+    free(output);
+    free(frame);
+}
+
+
+/**
+ * Test that corrupt frames are refused.
+ */
+void
+TestCodecCorrupt(CuTest * tc)
+{
+    char frame[] = { CODEC_ZLIB, 0, 0, 1, 0, 'x', 'y', 'z' };
+    size_t len = 0;
+
+    CuAssertPtrEquals(tc, NULL, codec_decode(frame, sizeof(frame), 4096,
+                                             &len));
+    CuAssertPtrEquals(tc, NULL, codec_decode(frame, 0, 4096, &len));
+
+    frame[0] = 9;
+    CuAssertPtrEquals(tc, NULL, codec_decode(frame, sizeof(frame), 4096,
+                                             &len));
+}
+
+
+CuSuite *
+codec_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestCodecLookup);
+    SUITE_ADD_TEST(suite, TestCodecRoundTrip);
+    SUITE_ADD_TEST(suite, TestCodecBailout);
+    SUITE_ADD_TEST(suite, TestCodecCorrupt);
+
+    return suite;
+}
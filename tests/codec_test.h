@@ -0,0 +1,18 @@
+
+#ifndef _codec_test_h_
+#define _codec_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *codec_getsuite ();
+
+
+
+#endif /* _codec_test_h_ */
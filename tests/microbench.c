@@ -0,0 +1,826 @@
+/* microbench.c -- Count what each operation of the filesystem costs.
+ *
+ *
+ * Copyright (c) 2010-2011, Steve Kemp <steve@steve.org.uk>
+ * All rights reserved.
+ *
+ * http://steve.org.uk/
+ *
+ */
+
+
+
+/**
+ *  This driver links the filesystem directly, keeps it in memory with
+ * the mock backend, and calls its operations as FUSE would - so neither
+ * FUSE nor a redis server is needed, and nothing is mounted.
+ *
+ *  Every command is passed through the recording backend, so for each
+ * operation we learn exactly how many commands it sent, how many round
+ * trips they took and how many bytes went each way, along with the
+ * number of allocations the filesystem made.  Since nothing is timed the
+ * results are the same on every run, and on every machine, so they may
+ * be compared exactly:
+ *
+ *   {"label":"default","op":"getattr","count":100,"commands":2.00,
+ *    "round_trips":2.00,"bytes_out":78.00,"bytes_in":61.00,
+ *    "allocations":9.00}
+ *
+ *  Each figure is the average for a single call.  Any options after
+ * "--" are given to the filesystem, as they would be to redisfs, e.g.
+ *
+ *   ./microbench --label hash -- --schema hash --cache-ttl 5
+ *
+ *  Allocations made while answering commands, by the store itself, are
+ * not counted.
+ *
+ */
+
+#define FUSE_USE_VERSION 26
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+#include "redisfs.h"
+#include "backend.h"
+#include "mock.h"
+#include "record.h"
+
+
+
+/**
+ * The label attached to each result, naming the configuration.
+ */
+char _g_label[256] = { "default" };
+
+/**
+ * How many times we call each operation, and which operations we try.
+ */
+int _g_count = 100;
+char _g_only[1024] = { "" };
+
+/**
+ * The recorder through which every command passes.
+ */
+backend *_g_recorder = NULL;
+
+
+/**
+ * The glibc allocator, which our own wraps.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/**
+ * Are we counting allocations, and are we inside the store?
+ */
+static __thread int _counting = 0;
+static __thread int _inside = 0;
+static __thread long long _allocations = 0;
+
+
+
+/**
+ * Count an allocation, if it is made by the filesystem.
+ */
+static void
+count_allocation()
+{
+    if (_counting && !_inside)
+        _allocations += 1;
+}
+
+void *
+malloc(size_t size)
+{
+    count_allocation();
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    count_allocation();
+    return (__libc_calloc(nmemb, size));
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    count_allocation();
+    return (__libc_realloc(ptr, size));
+}
+
+
+/**
+ * The filesystem asks who is calling it; we are.
+ */
+struct fuse_context *
+fuse_get_context(void)
+{
+    static struct fuse_context context;
+
+    context.uid = getuid();
+    context.gid = getgid();
+    context.pid = getpid();
+
+    return (&context);
+}
+
+
+/**
+ * The low-level API isn't driven from here, but its replies must link
+ * without the library.
+ */
+const struct fuse_ctx *
+fuse_req_ctx(fuse_req_t req)
+{
+    return NULL;
+}
+
+int
+fuse_reply_err(fuse_req_t req, int err)
+{
+    return 0;
+}
+
+void
+fuse_reply_none(fuse_req_t req)
+{
+}
+
+int
+fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e)
+{
+    return 0;
+}
+
+int
+fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                  const struct fuse_file_info *fi)
+{
+    return 0;
+}
+
+int
+fuse_reply_attr(fuse_req_t req, const struct stat *attr, double attr_timeout)
+{
+    return 0;
+}
+
+int
+fuse_reply_readlink(fuse_req_t req, const char *link)
+{
+    return 0;
+}
+
+int
+fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi)
+{
+    return 0;
+}
+
+int
+fuse_reply_write(fuse_req_t req, size_t count)
+{
+    return 0;
+}
+
+int
+fuse_reply_buf(fuse_req_t req, const char *buf, size_t size)
+{
+    return 0;
+}
+
+int
+fuse_reply_xattr(fuse_req_t req, size_t count)
+{
+    return 0;
+}
+
+size_t
+fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize,
+                  const char *name, const struct stat *stbuf, off_t off)
+{
+    return 0;
+}
+
+
+
+/**
+ * A backend which marks the time spent inside the one it wraps, so that
+ * allocations made there aren't counted.
+ */
+static int
+meter_append(backend * b, const char *cmd, size_t len)
+{
+    backend *inner = b->data;
+    int ret;
+
+    _inside = 1;
+    ret = inner->append(inner, cmd, len);
+    _inside = 0;
+
+    return (ret);
+}
+
+static int
+meter_get_reply(backend * b, void **reply)
+{
+    backend *inner = b->data;
+    int ret;
+
+    _inside = 1;
+    ret = inner->get_reply(inner, reply);
+    _inside = 0;
+
+    return (ret);
+}
+
+static void
+meter_destroy(backend * b)
+{
+    backend *inner = b->data;
+
+    inner->destroy(inner);
+    free(b);
+}
+
+static backend *
+meter_new(backend * inner)
+{
+    backend *b = calloc(1, sizeof(backend));
+
+    if (b == NULL)
+        return (NULL);
+
+    b->name = inner->name;
+    b->append = meter_append;
+    b->get_reply = meter_get_reply;
+    b->destroy = meter_destroy;
+    b->data = inner;
+
+    return (b);
+}
+
+
+
+/**
+ * The path of the i'th entry used when measuring an operation.
+ */
+static char *
+entry(const char *op, const char *kind, int i)
+{
+    static char path[1024];
+
+    snprintf(path, sizeof(path), "/mb/%s/%s%d", op, kind, i);
+    return (path);
+}
+
+
+/**
+ * Create a file, optionally with some contents.
+ */
+static void
+make_file(const char *path, size_t size)
+{
+    struct fuse_file_info fi;
+    char buf[4096];
+
+    memset(&fi, 0, sizeof(fi));
+    memset(buf, 'x', sizeof(buf));
+
+    fi.flags = O_WRONLY;
+    if (redisfs_operations.create(path, 0644, &fi) != 0)
+    {
+        fprintf(stderr, "Failed to create %s\n", path);
+        exit(1);
+    }
+    if (size > 0)
+        redisfs_operations.write(path, buf, (size > sizeof(buf)) ?
+                                 sizeof(buf) : size, 0, &fi);
+    redisfs_operations.release(path, &fi);
+}
+
+
+/**
+ * A filler for readdir which only counts what it is given.
+ */
+static int
+filler(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+    *(int *)buf += 1;
+    return 0;
+}
+
+
+/**
+ * The files held open while their reads & writes are measured.
+ */
+struct fuse_file_info *_g_open = NULL;
+char _g_buffer[4096];
+
+
+
+/**
+ * Each operation is prepared, unmeasured, then run and counted, then
+ * tidied away - once for each of the entries it uses.
+ */
+typedef struct microbench
+{
+    const char *name;
+    void (*prepare) (const char *name, int i);
+    int (*run) (const char *name, int i);
+    void (*finish) (const char *name, int i);
+} microbench;
+
+
+static void
+prepare_file(const char *name, int i)
+{
+    make_file(entry(name, "f", i), 0);
+}
+
+static void
+prepare_full_file(const char *name, int i)
+{
+    make_file(entry(name, "f", i), sizeof(_g_buffer));
+}
+
+static void
+prepare_dir(const char *name, int i)
+{
+    redisfs_operations.mkdir(entry(name, "d", i), 0755);
+}
+
+static void
+prepare_symlink(const char *name, int i)
+{
+    redisfs_operations.symlink("target", entry(name, "l", i));
+}
+
+static void
+prepare_open(const char *name, int i)
+{
+    prepare_full_file(name, i);
+
+    memset(&_g_open[i], 0, sizeof(struct fuse_file_info));
+    _g_open[i].flags = O_RDWR;
+    redisfs_operations.open(entry(name, "f", i), &_g_open[i]);
+}
+
+static void
+prepare_deep(const char *name, int i)
+{
+    char path[1024];
+    const char *dirs[] = { "a", "a/b", "a/b/c", "a/b/c/d", "a/b/c/d/e" };
+    int j;
+
+    if (i == 0)
+    {
+        for (j = 0; j < 5; j++)
+        {
+            snprintf(path, sizeof(path), "/mb/%s/%s", name, dirs[j]);
+            redisfs_operations.mkdir(path, 0755);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/a/b/c/d/e", name);
+    make_file(entry(path, "f", i), 0);
+}
+
+static void
+prepare_listing(const char *name, int i)
+{
+    if (i == 0)
+    {
+        int j;
+
+        for (j = 0; j < 100; j++)
+            make_file(entry(name, "f", j), 0);
+    }
+}
+
+static void
+finish_open(const char *name, int i)
+{
+    redisfs_operations.release(entry(name, "f", i), &_g_open[i]);
+}
+
+
+static int
+run_mkdir(const char *name, int i)
+{
+    return (redisfs_operations.mkdir(entry(name, "d", i), 0755));
+}
+
+static int
+run_rmdir(const char *name, int i)
+{
+    return (redisfs_operations.rmdir(entry(name, "d", i)));
+}
+
+static int
+run_create(const char *name, int i)
+{
+    struct fuse_file_info fi;
+    int ret;
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_WRONLY;
+    ret = redisfs_operations.create(entry(name, "f", i), 0644, &fi);
+    redisfs_operations.release(entry(name, "f", i), &fi);
+
+    return (ret);
+}
+
+static int
+run_open(const char *name, int i)
+{
+    struct fuse_file_info fi;
+    int ret;
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+    ret = redisfs_operations.open(entry(name, "f", i), &fi);
+    redisfs_operations.release(entry(name, "f", i), &fi);
+
+    return (ret);
+}
+
+static int
+run_unlink(const char *name, int i)
+{
+    return (redisfs_operations.unlink(entry(name, "f", i)));
+}
+
+static int
+run_getattr(const char *name, int i)
+{
+    struct stat st;
+
+    return (redisfs_operations.getattr(entry(name, "f", i), &st));
+}
+
+static int
+run_getattr_missing(const char *name, int i)
+{
+    struct stat st;
+
+    return ((redisfs_operations.getattr(entry(name, "f", i), &st) ==
+             -ENOENT) ? 0 : -EIO);
+}
+
+static int
+run_getattr_deep(const char *name, int i)
+{
+    char path[1024];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/a/b/c/d/e", name);
+    return (redisfs_operations.getattr(entry(path, "f", i), &st));
+}
+
+static int
+run_write(const char *name, int i)
+{
+    int ret = redisfs_operations.write(entry(name, "f", i), _g_buffer,
+                                       sizeof(_g_buffer), 0, &_g_open[i]);
+
+    return ((ret == sizeof(_g_buffer)) ? 0 : -EIO);
+}
+
+static int
+run_read(const char *name, int i)
+{
+    char buf[4096];
+    int ret = redisfs_operations.read(entry(name, "f", i), buf,
+                                      sizeof(buf), 0, &_g_open[i]);
+
+    return ((ret == sizeof(buf)) ? 0 : -EIO);
+}
+
+static int
+run_readdir(const char *name, int i)
+{
+    char path[1024];
+    int count = 0;
+    int ret;
+
+    snprintf(path, sizeof(path), "/mb/%s", name);
+    ret = redisfs_operations.readdir(path, &count, filler, 0, NULL);
+
+    return (((ret == 0) && (count == 102)) ? 0 : -EIO);
+}
+
+static int
+run_rename(const char *name, int i)
+{
+    char old[1024];
+
+    snprintf(old, sizeof(old), "%s", entry(name, "f", i));
+    return (redisfs_operations.rename(old, entry(name, "g", i)));
+}
+
+static int
+run_symlink(const char *name, int i)
+{
+    return (redisfs_operations.symlink("target", entry(name, "l", i)));
+}
+
+static int
+run_readlink(const char *name, int i)
+{
+    char buf[256];
+
+    return (redisfs_operations.readlink(entry(name, "l", i), buf,
+                                        sizeof(buf)));
+}
+
+static int
+run_truncate(const char *name, int i)
+{
+    return (redisfs_operations.truncate(entry(name, "f", i), 1000));
+}
+
+static int
+run_chmod(const char *name, int i)
+{
+    return (redisfs_operations.chmod(entry(name, "f", i), 0600));
+}
+
+static int
+run_utimens(const char *name, int i)
+{
+    struct timespec tv[2];
+
+    tv[0].tv_sec = tv[1].tv_sec = 1300000000;
+    tv[0].tv_nsec = tv[1].tv_nsec = 0;
+
+    return (redisfs_operations.utimens(entry(name, "f", i), tv));
+}
+
+
+microbench _g_benches[] = {
+    {"mkdir", NULL, run_mkdir, NULL},
+    {"rmdir", prepare_dir, run_rmdir, NULL},
+    {"create", NULL, run_create, NULL},
+    {"open", prepare_file, run_open, NULL},
+    {"unlink", prepare_file, run_unlink, NULL},
+    {"getattr", prepare_file, run_getattr, NULL},
+    {"getattr-missing", NULL, run_getattr_missing, NULL},
+    {"getattr-deep", prepare_deep, run_getattr_deep, NULL},
+    {"write", prepare_open, run_write, finish_open},
+    {"read", prepare_open, run_read, finish_open},
+    {"readdir", prepare_listing, run_readdir, NULL},
+    {"rename", prepare_file, run_rename, NULL},
+    {"symlink", NULL, run_symlink, NULL},
+    {"readlink", prepare_symlink, run_readlink, NULL},
+    {"truncate", prepare_full_file, run_truncate, NULL},
+    {"chmod", prepare_file, run_chmod, NULL},
+    {"utimens", prepare_file, run_utimens, NULL},
+    {NULL, NULL, NULL, NULL}
+};
+
+
+
+/**
+ * Is the named operation one we were asked to measure?
+ */
+int
+wanted(const char *name)
+{
+    char list[1026];
+    char item[256];
+
+    if (_g_only[0] == '\0')
+        return 1;
+
+    snprintf(list, sizeof(list), ",%s,", _g_only);
+    snprintf(item, sizeof(item), ",%s,", name);
+
+    return (strstr(list, item) != NULL);
+}
+
+
+/**
+ * Measure one operation, writing a line of JSON.
+ */
+void
+measure(microbench * b)
+{
+    record_counts total;
+    record_counts counts;
+    long long allocations = 0;
+    int failures = 0;
+    char dir[1024];
+    int i;
+
+    memset(&total, 0, sizeof(total));
+
+    snprintf(dir, sizeof(dir), "/mb/%s", b->name);
+    redisfs_operations.mkdir(dir, 0755);
+
+    /**
+     * Each call is counted on its own, so that preparing for it isn't.
+     */
+    for (i = 0; i < _g_count; i++)
+    {
+        if (b->prepare != NULL)
+            b->prepare(b->name, i);
+
+        record_reset(_g_recorder);
+        _allocations = 0;
+        _counting = 1;
+
+        if (b->run(b->name, i) != 0)
+            failures += 1;
+
+        _counting = 0;
+        allocations += _allocations;
+
+        record_get(_g_recorder, &counts);
+        total.commands += counts.commands;
+        total.round_trips += counts.round_trips;
+        total.bytes_out += counts.bytes_out;
+        total.bytes_in += counts.bytes_in;
+
+        if (b->finish != NULL)
+            b->finish(b->name, i);
+    }
+
+    if (failures > 0)
+        fprintf(stderr, "%s failed %d of %d times.\n", b->name, failures,
+                _g_count);
+
+    printf("{\"label\":\"%s\",\"op\":\"%s\",\"count\":%d,"
+           "\"commands\":%.2f,\"round_trips\":%.2f,"
+           "\"bytes_out\":%.2f,\"bytes_in\":%.2f,\"allocations\":%.2f}\n",
+           _g_label, b->name, _g_count,
+           (double)total.commands / _g_count,
+           (double)total.round_trips / _g_count,
+           (double)total.bytes_out / _g_count,
+           (double)total.bytes_in / _g_count,
+           (double)allocations / _g_count);
+    fflush(stdout);
+}
+
+
+/**
+ * Show minimal usage information.
+ */
+int
+show_usage(char *name)
+{
+    printf("%s - Count the commands & allocations of each operation.\n",
+           name);
+    printf("\nUsage: %s [options] [-- redisfs options]\n", name);
+    printf("\nOptions:\n\n");
+    printf("\t--count  - Call each operation this many times [100].\n");
+    printf("\t--label  - The label attached to each result [default].\n");
+    printf("\t--log    - Write each command sent to this file.\n");
+    printf("\t--only   - Only measure these operations, e.g. getattr,read.\n");
+    printf("\nOperations:\n\n\t");
+    {
+        int i;
+
+        for (i = 0; _g_benches[i].name != NULL; i++)
+            printf("%s%s", _g_benches[i].name,
+                   (_g_benches[i + 1].name != NULL) ? " " : "\n\n");
+    }
+
+    return 1;
+}
+
+
+/**
+ *  Entry point to our code.
+ */
+int
+main(int argc, char *argv[])
+{
+    FILE *log = NULL;
+    char **fs_argv;
+    int fs_argc;
+    backend *b;
+    int c;
+    int i;
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"count", required_argument, 0, 'c'},
+            {"help", no_argument, 0, 'h'},
+            {"label", required_argument, 0, 'l'},
+            {"log", required_argument, 0, 'L'},
+            {"only", required_argument, 0, 'o'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "c:hl:L:o:", long_options,
+                        &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+        case 'c':
+            _g_count = atoi(optarg);
+            break;
+        case 'l':
+            snprintf(_g_label, sizeof(_g_label), "%s", optarg);
+            break;
+        case 'L':
+            log = fopen(optarg, "w");
+            if (log == NULL)
+            {
+                fprintf(stderr, "Failed to open %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            snprintf(_g_only, sizeof(_g_only), "%s", optarg);
+            break;
+        case 'h':
+            return (show_usage(argv[0]));
+        default:
+            return (show_usage(argv[0]));
+        }
+    }
+
+    if (_g_count < 1)
+        _g_count = 1;
+
+    /**
+     * Everything after "--" is for the filesystem.
+     */
+    fs_argc = argc - optind + 1;
+    fs_argv = calloc(fs_argc + 1, sizeof(char *));
+    fs_argv[0] = argv[0];
+    for (i = optind; i < argc; i++)
+        fs_argv[i - optind + 1] = argv[i];
+
+    optind = 1;
+    if (parse_options(fs_argc, fs_argv) != 0)
+        return 1;
+
+    /**
+     * Keep the filesystem in memory, recording what is asked of it.
+     */
+    _g_mock = 1;
+    _g_recorder = record_new(mock_new(), log);
+    b = meter_new(_g_recorder);
+    if ((_g_recorder == NULL) || (b == NULL))
+    {
+        fprintf(stderr, "Failed to allocate the in-memory store.\n");
+        return 1;
+    }
+    backend_start(b);
+
+    /**
+     * The filesystem describes itself on stdout, which is ours.
+     */
+    fflush(stdout);
+    {
+        int out = dup(1);
+
+        dup2(2, 1);
+        if (setup_filesystem() != 0)
+            return 1;
+        fflush(stdout);
+        dup2(out, 1);
+        close(out);
+    }
+
+    redisfs_operations.init(NULL);
+
+    _g_open = calloc(_g_count, sizeof(struct fuse_file_info));
+    memset(_g_buffer, 'y', sizeof(_g_buffer));
+    redisfs_operations.mkdir("/mb", 0755);
+
+    for (i = 0; _g_benches[i].name != NULL; i++)
+    {
+        if (wanted(_g_benches[i].name))
+            measure(&_g_benches[i]);
+    }
+
+    redisfs_operations.destroy(NULL);
+    free(_g_open);
+    free(fs_argv);
+    if (log != NULL)
+        fclose(log);
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/**
+ * Test cases for the in-memory store which stands in for redis.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hiredis.h"
+#include "mock.h"
+#include "mock_test.h"
+
+
+/**
+ * Queue a command, given as space-separated words.
+ */
+static int
+queue(backend * b, const char *words)
+{
+    char copy[256];
+    char cmd[1024];
+    const char *argv[16];
+    int argc = 0;
+    char *word;
+    size_t len;
+    int i;
+
+    snprintf(copy, sizeof(copy), "%s", words);
+    for (word = strtok(copy, " "); word != NULL; word = strtok(NULL, " "))
+        argv[argc++] = word;
+
+    len = snprintf(cmd, sizeof(cmd), "*%d\r\n", argc);
+    for (i = 0; i < argc; i++)
+        len += snprintf(cmd + len, sizeof(cmd) - len, "$%d\r\n%s\r\n",
+                        (int)strlen(argv[i]), argv[i]);
+
+    return (b->append(b, cmd, len));
+}
+
+
+/**
+ * Send a command, and return its reply.
+ */
+static redisReply *
+command(backend * b, const char *words)
+{
+    void *reply = NULL;
+
+    if (queue(b, words) != 0)
+        return (NULL);
+    if (b->get_reply(b, &reply) != 0)
+        return (NULL);
+
+    return (reply);
+}
+
+
+/**
+ * Send a command, expecting a string reply.
+ */
+static void
+expect_string(CuTest * tc, backend * b, const char *words, int type,
+              const char *str)
+{
+    redisReply *reply = command(b, words);
+
+    CuAssertPtrNotNull(tc, reply);
+    CuAssertIntEquals(tc, type, reply->type);
+    if (str != NULL)
+        CuAssertStrEquals(tc, str, reply->str);
+    mock_free_reply(reply);
+}
+
+
+/**
+ * Send a command, expecting an integer reply.
+ */
+static void
+expect_integer(CuTest * tc, backend * b, const char *words, long long value)
+{
+    redisReply *reply = command(b, words);
+
+    CuAssertPtrNotNull(tc, reply);
+    CuAssertIntEquals(tc, REDIS_REPLY_INTEGER, reply->type);
+    CuAssertIntEquals(tc, (int)value, (int)reply->integer);
+    mock_free_reply(reply);
+}
+
+
+/**
+ * Test that commands are split into their arguments, and that broken
+ * ones are refused.
+ */
+void
+TestMockParse(CuTest * tc)
+{
+    const char *cmd = "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$5\r\nb\r\nar\r\n";
+    const char **argv = NULL;
+    size_t *argvlen = NULL;
+
+    CuAssertIntEquals(tc, 3, mock_parse(cmd, strlen(cmd), &argv, &argvlen));
+    CuAssertIntEquals(tc, 3, (int)argvlen[0]);
+    CuAssertTrue(tc, strncmp(argv[0], "SET", 3) == 0);
+    CuAssertTrue(tc, strncmp(argv[1], "foo", 3) == 0);
+    CuAssertIntEquals(tc, 5, (int)argvlen[2]);
+    CuAssertTrue(tc, memcmp(argv[2], "b\r\nar", 5) == 0);
+    free(argv);
+    free(argvlen);
+
+    /**
+     * Truncated, or not in the protocol at all.
+     */
+    CuAssertIntEquals(tc, -1, mock_parse(cmd, strlen(cmd) - 4, &argv,
+                                         &argvlen));
+    CuAssertIntEquals(tc, -1, mock_parse("PING\r\n", 6, &argv, &argvlen));
+    CuAssertIntEquals(tc, -1, mock_parse("*1\r\n$9\r\nPING\r\n", 14, &argv,
+                                         &argvlen));
+}
+
+
+/**
+ * Test the commands upon strings.
+ */
+void
+TestMockStrings(CuTest * tc)
+{
+    backend *b = mock_new();
+
+    CuAssertPtrNotNull(tc, b);
+    CuAssertStrEquals(tc, "mock", b->name);
+
+    expect_string(tc, b, "GET foo", REDIS_REPLY_NIL, NULL);
+    expect_string(tc, b, "SET foo bar", REDIS_REPLY_STATUS, "OK");
+    expect_string(tc, b, "GET foo", REDIS_REPLY_STRING, "bar");
+    expect_integer(tc, b, "SETNX foo baz", 0);
+    expect_integer(tc, b, "EXISTS foo", 1);
+    CuAssertIntEquals(tc, 1, (int)mock_count(b));
+
+    /**
+     * Ranges, which grow the value as needed.
+     */
+    expect_integer(tc, b, "SETRANGE foo 5 xy", 7);
+    expect_string(tc, b, "GETRANGE foo 1 2", REDIS_REPLY_STRING, "ar");
+    expect_string(tc, b, "GETRANGE foo 5 -1", REDIS_REPLY_STRING, "xy");
+
+    /**
+     * Counters.
+     */
+    expect_integer(tc, b, "INCR count", 1);
+    expect_integer(tc, b, "INCRBY count 1023", 1024);
+    expect_integer(tc, b, "DECR count", 1023);
+    expect_string(tc, b, "INCR foo", REDIS_REPLY_ERROR,
+                  "ERR value is not an integer or out of range");
+
+    expect_integer(tc, b, "DEL foo missing", 1);
+    expect_integer(tc, b, "UNLINK count missing", 1);
+    expect_integer(tc, b, "EXISTS foo", 0);
+    CuAssertIntEquals(tc, 0, (int)mock_count(b));
+
+    b->destroy(b);
+}
+
+
+/**
+ * Test the commands upon sets and hashes, and that a key of one type
+ * can't be used as another.
+ */
+void
+TestMockCollections(CuTest * tc)
+{
+    backend *b = mock_new();
+    redisReply *reply;
+
+    expect_integer(tc, b, "SADD set a b c", 3);
+    expect_integer(tc, b, "SADD set c d", 1);
+    expect_integer(tc, b, "SCARD set", 4);
+    expect_integer(tc, b, "SREM set a z", 1);
+
+    reply = command(b, "SMEMBERS set");
+    CuAssertIntEquals(tc, REDIS_REPLY_ARRAY, reply->type);
+    CuAssertIntEquals(tc, 3, (int)reply->elements);
+    mock_free_reply(reply);
+
+    reply = command(b, "SRANDMEMBER set");
+    CuAssertIntEquals(tc, REDIS_REPLY_STRING, reply->type);
+    CuAssertTrue(tc, strchr("bcd", reply->str[0]) != NULL);
+    mock_free_reply(reply);
+    expect_string(tc, b, "SRANDMEMBER missing", REDIS_REPLY_NIL, NULL);
+
+    expect_string(tc, b, "GET set", REDIS_REPLY_ERROR, NULL);
+    expect_string(tc, b, "TYPE set", REDIS_REPLY_STATUS, "set");
+
+    expect_integer(tc, b, "HSET hash name bob", 1);
+    expect_string(tc, b, "HMSET hash size 10 mode 644", REDIS_REPLY_STATUS,
+                  "OK");
+    expect_string(tc, b, "HGET hash size", REDIS_REPLY_STRING, "10");
+    expect_integer(tc, b, "HLEN hash", 3);
+
+    reply = command(b, "HMGET hash mode missing name");
+    CuAssertIntEquals(tc, REDIS_REPLY_ARRAY, reply->type);
+    CuAssertIntEquals(tc, 3, (int)reply->elements);
+    CuAssertStrEquals(tc, "644", reply->element[0]->str);
+    CuAssertIntEquals(tc, REDIS_REPLY_NIL, reply->element[1]->type);
+    CuAssertStrEquals(tc, "bob", reply->element[2]->str);
+    mock_free_reply(reply);
+
+    reply = command(b, "HGETALL hash");
+    CuAssertIntEquals(tc, 6, (int)reply->elements);
+    mock_free_reply(reply);
+
+    /**
+     * Emptied collections vanish.
+     */
+    expect_integer(tc, b, "HDEL hash name size mode", 3);
+    expect_integer(tc, b, "SREM set b c d", 3);
+    CuAssertIntEquals(tc, 0, (int)mock_count(b));
+
+    b->destroy(b);
+}
+
+
+/**
+ * Test that replies come back in the order the commands were sent, and
+ * that unknown commands are refused.
+ */
+void
+TestMockPipeline(CuTest * tc)
+{
+    backend *b = mock_new();
+    void *reply = NULL;
+
+    CuAssertIntEquals(tc, 0, queue(b, "SET foo 1"));
+    CuAssertIntEquals(tc, 0, queue(b, "SCRIPT LOAD x"));
+    CuAssertIntEquals(tc, 0, queue(b, "INCR foo"));
+
+    CuAssertIntEquals(tc, 0, b->get_reply(b, &reply));
+    CuAssertIntEquals(tc, REDIS_REPLY_STATUS, ((redisReply *) reply)->type);
+    mock_free_reply(reply);
+
+    CuAssertIntEquals(tc, 0, b->get_reply(b, &reply));
+    CuAssertIntEquals(tc, REDIS_REPLY_ERROR, ((redisReply *) reply)->type);
+    CuAssertStrEquals(tc, "ERR unknown command 'SCRIPT'",
+                      ((redisReply *) reply)->str);
+    mock_free_reply(reply);
+
+    CuAssertIntEquals(tc, 0, b->get_reply(b, &reply));
+    CuAssertIntEquals(tc, 2, (int)((redisReply *) reply)->integer);
+    mock_free_reply(reply);
+
+    /**
+     * Nothing more is waiting.
+     */
+    CuAssertIntEquals(tc, -1, b->get_reply(b, &reply));
+    CuAssertPtrEquals(tc, NULL, reply);
+
+    expect_string(tc, b, "GET", REDIS_REPLY_ERROR,
+                  "ERR wrong number of arguments for 'GET' command");
+
+    b->destroy(b);
+}
+
+
+CuSuite *
+mock_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestMockParse);
+    SUITE_ADD_TEST(suite, TestMockStrings);
+    SUITE_ADD_TEST(suite, TestMockCollections);
+    SUITE_ADD_TEST(suite, TestMockPipeline);
+
+    return suite;
+}
@@ -0,0 +1,17 @@
+#ifndef _mock_test_h_
+#define _mock_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *mock_getsuite ();
+
+
+
+#endif /* _mock_test_h_ */
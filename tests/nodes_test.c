@@ -0,0 +1,128 @@
+/**
+ * Test cases for the table of inodes the kernel knows of.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nodes.h"
+#include "nodes_test.h"
+
+
+/**
+ * Test that paths are built from the parent and name of each inode.
+ */
+void
+TestNodesPath(CuTest * tc)
+{
+    char path[64];
+
+    CuAssertIntEquals(tc, 0, nodes_path(NODES_ROOT, path, sizeof(path)));
+    CuAssertStrEquals(tc, "/", path);
+
+    CuAssertIntEquals(tc, 0, nodes_remember(1, NODES_ROOT, "usr"));
+    CuAssertIntEquals(tc, 0, nodes_remember(2, 1, "share"));
+    CuAssertIntEquals(tc, 0, nodes_remember(3, 2, "a file"));
+    CuAssertIntEquals(tc, 3, nodes_count());
+
+    CuAssertIntEquals(tc, 0, nodes_path(3, path, sizeof(path)));
+    CuAssertStrEquals(tc, "/usr/share/a file", path);
+
+    /**
+     * Unknown inodes, and paths too long, fail.
+     */
+    CuAssertIntEquals(tc, -1, nodes_path(4, path, sizeof(path)));
+    CuAssertIntEquals(tc, -1, nodes_path(3, path, 10));
+
+    /**
+     * Renames are followed.
+     */
+    nodes_move(2, NODES_ROOT, "share");
+    CuAssertIntEquals(tc, 0, nodes_path(3, path, sizeof(path)));
+    CuAssertStrEquals(tc, "/share/a file", path);
+
+    nodes_forget(3, 1);
+    nodes_forget(2, 1);
+    nodes_forget(1, 1);
+    CuAssertIntEquals(tc, 0, nodes_count());
+}
+
+
+/**
+ * Test that an inode is kept until every lookup of it is forgotten.
+ */
+void
+TestNodesForget(CuTest * tc)
+{
+    char path[64];
+
+    nodes_remember(5, NODES_ROOT, "tmp");
+    nodes_remember(5, NODES_ROOT, "tmp");
+    nodes_remember(5 + 4096, NODES_ROOT, "var");
+    CuAssertIntEquals(tc, 2, nodes_count());
+
+    nodes_forget(5, 1);
+    CuAssertIntEquals(tc, 0, nodes_path(5, path, sizeof(path)));
+    CuAssertStrEquals(tc, "/tmp", path);
+
+    nodes_forget(5, 1);
+    CuAssertIntEquals(tc, -1, nodes_path(5, path, sizeof(path)));
+    CuAssertIntEquals(tc, 0, nodes_path(5 + 4096, path, sizeof(path)));
+    CuAssertStrEquals(tc, "/var", path);
+
+    nodes_forget(5 + 4096, 10);
+    nodes_forget(99, 1);
+    CuAssertIntEquals(tc, 0, nodes_count());
+}
+
+
+/**
+ * Test that a removed inode, and everything below it, has no path.
+ */
+void
+TestNodesRemove(CuTest * tc)
+{
+    char path[64];
+
+    nodes_remember(7, NODES_ROOT, "dir");
+    nodes_remember(8, 7, "file");
+    nodes_remove(7);
+    CuAssertIntEquals(tc, 2, nodes_count());
+    CuAssertIntEquals(tc, -1, nodes_path(7, path, sizeof(path)));
+    CuAssertIntEquals(tc, -1, nodes_path(8, path, sizeof(path)));
+
+    /**
+     * A rename of whatever replaced it doesn't bring it back.
+     */
+    nodes_move(7, NODES_ROOT, "dir");
+    CuAssertIntEquals(tc, -1, nodes_path(7, path, sizeof(path)));
+
+    nodes_remove(99);
+    nodes_forget(8, 1);
+    nodes_forget(7, 1);
+    CuAssertIntEquals(tc, 0, nodes_count());
+}
+
+
+CuSuite *
+nodes_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestNodesPath);
+    SUITE_ADD_TEST(suite, TestNodesForget);
+    SUITE_ADD_TEST(suite, TestNodesRemove);
+
+    return suite;
+}
@@ -0,0 +1,17 @@
+#ifndef _nodes_test_h_
+#define _nodes_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *nodes_getsuite ();
+
+
+
+#endif /* _nodes_test_h_ */
@@ -0,0 +1,182 @@
+/**
+ * Test cases for the cache of file contents.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pagecache.h"
+#include "pagecache_test.h"
+
+
+/**
+ * Test that a disabled cache never returns anything.
+ */
+void
+TestPagecacheDisabled(CuTest * tc)
+{
+    char buf[8];
+    size_t len = 0;
+
+    pagecache_init(8, 0, 60000);
+    CuAssertIntEquals(tc, 0, pagecache_enabled());
+
+    pagecache_put(1, 0, "abcdefgh", 8);
+    CuAssertIntEquals(tc, 0, pagecache_get(1, 0, buf, &len));
+    CuAssertIntEquals(tc, 0, (int)pagecache_bytes());
+}
+
+
+/**
+ * Test that we can store and retrieve pages, including short ones.
+ */
+void
+TestPagecacheLookup(CuTest * tc)
+{
+    char buf[8];
+    size_t len = 0;
+
+    pagecache_init(8, 64, 60000);
+    CuAssertIntEquals(tc, 1, pagecache_enabled());
+    CuAssertIntEquals(tc, 8, (int)pagecache_page_size());
+
+    pagecache_put(1, 0, "abcdefgh", 8);
+    pagecache_put(1, 1, "ijk", 3);
+    pagecache_put(2, 0, "ABCDEFGH", 8);
+
+    CuAssertIntEquals(tc, 1, pagecache_get(1, 0, buf, &len));
+    CuAssertIntEquals(tc, 8, (int)len);
+    CuAssertTrue(tc, memcmp(buf, "abcdefgh", 8) == 0);
+
+    CuAssertIntEquals(tc, 1, pagecache_get(1, 1, buf, &len));
+    CuAssertIntEquals(tc, 3, (int)len);
+    CuAssertTrue(tc, memcmp(buf, "ijk", 3) == 0);
+
+    CuAssertIntEquals(tc, 1, pagecache_contains(2, 0));
+    CuAssertIntEquals(tc, 0, pagecache_contains(2, 1));
+    CuAssertIntEquals(tc, 19, (int)pagecache_bytes());
+
+    /**
+     * Replacing a page doesn't leak its space.
+     */
+    pagecache_put(1, 1, "ijklmnop", 8);
+    CuAssertIntEquals(tc, 24, (int)pagecache_bytes());
+
+    /**
+     * Oversized pages are refused.
+     */
+    pagecache_put(3, 0, "0123456789", 10);
+    CuAssertIntEquals(tc, 0, pagecache_contains(3, 0));
+
+    pagecache_init(8, 0, 0);
+}
+
+
+/**
+ * Test that the least recently used pages are discarded first.
+ */
+void
+TestPagecacheEviction(CuTest * tc)
+{
+    char buf[8];
+    size_t len = 0;
+
+    pagecache_init(8, 24, 60000);
+
+    pagecache_put(1, 0, "aaaaaaaa", 8);
+    pagecache_put(1, 1, "bbbbbbbb", 8);
+    pagecache_put(1, 2, "cccccccc", 8);
+
+    /**
+     * Using the first page makes the second the oldest.
+     */
+    CuAssertIntEquals(tc, 1, pagecache_get(1, 0, buf, &len));
+
+    pagecache_put(1, 3, "dddddddd", 8);
+
+    CuAssertIntEquals(tc, 1, pagecache_contains(1, 0));
+    CuAssertIntEquals(tc, 0, pagecache_contains(1, 1));
+    CuAssertIntEquals(tc, 1, pagecache_contains(1, 2));
+    CuAssertIntEquals(tc, 1, pagecache_contains(1, 3));
+    CuAssertIntEquals(tc, 24, (int)pagecache_bytes());
+
+    pagecache_init(8, 0, 0);
+}
+
+
+/**
+ * Test invalidation of a single inode.
+ */
+void
+TestPagecacheInvalidate(CuTest * tc)
+{
+    pagecache_init(8, 64, 60000);
+
+    pagecache_put(1, 0, "aaaaaaaa", 8);
+    pagecache_put(1, 5, "bbbbbbbb", 8);
+    pagecache_put(2, 0, "cccccccc", 8);
+
+    pagecache_invalidate(1);
+
+    CuAssertIntEquals(tc, 0, pagecache_contains(1, 0));
+    CuAssertIntEquals(tc, 0, pagecache_contains(1, 5));
+    CuAssertIntEquals(tc, 1, pagecache_contains(2, 0));
+    CuAssertIntEquals(tc, 8, (int)pagecache_bytes());
+
+    pagecache_flush();
+    CuAssertIntEquals(tc, 0, pagecache_contains(2, 0));
+    CuAssertIntEquals(tc, 0, (int)pagecache_bytes());
+
+    pagecache_init(8, 0, 0);
+}
+
+
+/**
+ * Test that pages expire.
+ */
+void
+TestPagecacheExpiry(CuTest * tc)
+{
+    char buf[8];
+    size_t len = 0;
+
+    pagecache_init(8, 64, 20);
+
+    pagecache_put(1, 0, "aaaaaaaa", 8);
+    CuAssertIntEquals(tc, 1, pagecache_get(1, 0, buf, &len));
+
+    usleep(50000);
+
+    CuAssertIntEquals(tc, 0, pagecache_contains(1, 0));
+    CuAssertIntEquals(tc, 0, pagecache_get(1, 0, buf, &len));
+    CuAssertIntEquals(tc, 0, (int)pagecache_bytes());
+
+    pagecache_init(8, 0, 0);
+}
+
+
+CuSuite *
+pagecache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestPagecacheDisabled);
+    SUITE_ADD_TEST(suite, TestPagecacheLookup);
+    SUITE_ADD_TEST(suite, TestPagecacheEviction);
+    SUITE_ADD_TEST(suite, TestPagecacheInvalidate);
+    SUITE_ADD_TEST(suite, TestPagecacheExpiry);
+
+    return suite;
+}
@@ -0,0 +1,18 @@
+
+#ifndef _pagecache_test_h_
+#define _pagecache_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *pagecache_getsuite ();
+
+
+
+#endif /* _pagecache_test_h_ */
@@ -0,0 +1,144 @@
+/**
+ * Test cases for the backend which records the commands passing
+ * through it.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hiredis.h"
+#include "mock.h"
+#include "record.h"
+#include "record_test.h"
+
+
+#define SET_FOO "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$3\r\nbar\r\n"
+#define GET_FOO "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n"
+
+
+/**
+ * Read a reply, and throw it away.
+ */
+static void
+discard(backend * b)
+{
+    void *reply = NULL;
+
+    b->get_reply(b, &reply);
+    mock_free_reply(reply);
+}
+
+
+/**
+ * Test that commands, round-trips and bytes are counted.
+ */
+void
+TestRecordCounts(CuTest * tc)
+{
+    backend *b = record_new(mock_new(), NULL);
+    record_counts counts;
+
+    CuAssertPtrNotNull(tc, b);
+    CuAssertPtrEquals(tc, NULL, record_new(NULL, NULL));
+
+    /**
+     * Two commands sent together cost a single round-trip.
+     */
+    CuAssertIntEquals(tc, 0, b->append(b, SET_FOO, strlen(SET_FOO)));
+    CuAssertIntEquals(tc, 0, b->append(b, GET_FOO, strlen(GET_FOO)));
+    discard(b);
+    discard(b);
+
+    record_get(b, &counts);
+    CuAssertIntEquals(tc, 2, (int)counts.commands);
+    CuAssertIntEquals(tc, 1, (int)counts.round_trips);
+    CuAssertIntEquals(tc, (int)(strlen(SET_FOO) + strlen(GET_FOO)),
+                      (int)counts.bytes_out);
+
+    /**
+     * "+OK\r\n" and "$3\r\nbar\r\n".
+     */
+    CuAssertIntEquals(tc, 5 + 9, (int)counts.bytes_in);
+
+    /**
+     * Each command sent alone costs one.
+     */
+    b->append(b, GET_FOO, strlen(GET_FOO));
+    discard(b);
+    b->append(b, GET_FOO, strlen(GET_FOO));
+    discard(b);
+
+    record_get(b, &counts);
+    CuAssertIntEquals(tc, 4, (int)counts.commands);
+    CuAssertIntEquals(tc, 3, (int)counts.round_trips);
+
+    record_reset(b);
+    record_get(b, &counts);
+    CuAssertIntEquals(tc, 0, (int)counts.commands);
+    CuAssertIntEquals(tc, 0, (int)counts.round_trips);
+    CuAssertIntEquals(tc, 0, (int)counts.bytes_out);
+    CuAssertIntEquals(tc, 0, (int)counts.bytes_in);
+
+    b->destroy(b);
+}
+
+
+/**
+ * Test that each command is logged as a line, with awkward arguments
+ * escaped and long ones shortened.
+ */
+void
+TestRecordLog(CuTest * tc)
+{
+    const char *odd = "*3\r\n$3\r\nSET\r\n$3\r\na b\r\n$60\r\n"
+        "012345678901234567890123456789012345678901234567890123456789\r\n";
+    FILE *log = tmpfile();
+    backend *b = record_new(mock_new(), log);
+    char line[256];
+
+    b->append(b, SET_FOO, strlen(SET_FOO));
+    b->append(b, GET_FOO, strlen(GET_FOO));
+    discard(b);
+    discard(b);
+    b->append(b, odd, strlen(odd));
+    discard(b);
+
+    fflush(log);
+    rewind(log);
+
+    CuAssertPtrNotNull(tc, fgets(line, sizeof(line), log));
+    CuAssertStrEquals(tc, "1 SET foo bar\n", line);
+    CuAssertPtrNotNull(tc, fgets(line, sizeof(line), log));
+    CuAssertStrEquals(tc, "1 GET foo\n", line);
+    CuAssertPtrNotNull(tc, fgets(line, sizeof(line), log));
+    CuAssertStrEquals(tc,
+                      "2 SET a\\x20b 012345678901234567890123456789012345678901234567..(60 bytes)\n",
+                      line);
+    CuAssertPtrEquals(tc, NULL, fgets(line, sizeof(line), log));
+
+    b->destroy(b);
+    fclose(log);
+}
+
+
+CuSuite *
+record_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestRecordCounts);
+    SUITE_ADD_TEST(suite, TestRecordLog);
+
+    return suite;
+}
@@ -0,0 +1,17 @@
+#ifndef _record_test_h_
+#define _record_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *record_getsuite ();
+
+
+
+#endif /* _record_test_h_ */
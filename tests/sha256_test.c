@@ -0,0 +1,105 @@
+/**
+ * Test cases for the SHA-256 digest.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sha256.h"
+#include "sha256_test.h"
+
+
+/**
+ * Test the digests given in FIPS 180-2.
+ */
+void
+TestSha256Vectors(CuTest * tc)
+{
+    char hex[SHA256_HEX_LEN + 1];
+    char *million = malloc(1000000);
+
+    sha256_hex("", 0, hex);
+    CuAssertStrEquals(tc,
+                      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+                      hex);
+
+    sha256_hex("abc", 3, hex);
+    CuAssertStrEquals(tc,
+                      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+                      hex);
+
+    sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+               hex);
+    CuAssertStrEquals(tc,
+                      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+                      hex);
+
+    CuAssertPtrNotNull(tc, million);
+    memset(million, 'a', 1000000);
+    sha256_hex(million, 1000000, hex);
+    CuAssertStrEquals(tc,
+                      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+                      hex);
+
+    free(million);
+}
+
+
+/**
+ * Test that feeding data in pieces gives the same digest as feeding
+ * it all at once.
+ */
+void
+TestSha256Pieces(CuTest * tc)
+{
+    unsigned char whole[SHA256_LEN];
+    unsigned char parts[SHA256_LEN];
+    char data[1000];
+    sha256_ctx ctx;
+    size_t done = 0;
+    size_t step = 1;
+    int i;
+
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i * 7);
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, sizeof(data));
+    sha256_final(&ctx, whole);
+
+    sha256_init(&ctx);
+    while (done < sizeof(data))
+    {
+        size_t len = (step > sizeof(data) - done) ? sizeof(data) - done : step;
+
+        sha256_update(&ctx, data + done, len);
+        done += len;
+        step = (step * 3) % 97 + 1;
+    }
+    sha256_final(&ctx, parts);
+
+    CuAssertTrue(tc, memcmp(whole, parts, SHA256_LEN) == 0);
+}
+
+
+CuSuite *
+sha256_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestSha256Vectors);
+    SUITE_ADD_TEST(suite, TestSha256Pieces);
+
+    return suite;
+}
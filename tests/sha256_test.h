@@ -0,0 +1,18 @@
+
+#ifndef _sha256_test_h_
+#define _sha256_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *codec_getsuite ();
+
+
+
+#endif /* _sha256_test_h_ */
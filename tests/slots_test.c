@@ -0,0 +1,127 @@
+/**
+ * Test cases for the hash slots of a Redis Cluster.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "slots.h"
+#include "slots_test.h"
+
+
+/**
+ * Test that keys hash to the slots a cluster would give them.
+ */
+void
+TestSlotOf(CuTest * tc)
+{
+    CuAssertIntEquals(tc, 12182, slot_of("foo", 3));
+    CuAssertIntEquals(tc, 12739, slot_of("123456789", 9));
+
+    /**
+     * Only the tag counts, if there is one.
+     */
+    CuAssertIntEquals(tc, slot_of("INODE:6", 7),
+                      slot_of("skx:{INODE:6}:NAME", 18));
+    CuAssertIntEquals(tc, slot_of("INODE:6", 7),
+                      slot_of("skx:VERSION:3:{INODE:6}", 23));
+
+    /**
+     * An empty tag is no tag at all.
+     */
+    CuAssertIntEquals(tc, slot_of("{}x", 3), 10595);
+    CuAssertTrue(tc, slot_of("skx:INODE:6:CHUNK:0", 19) !=
+                 slot_of("skx:INODE:6:CHUNK:1", 19));
+}
+
+
+/**
+ * Test that we find the key of a command.
+ */
+void
+TestSlotCommandKey(CuTest * tc)
+{
+    const char *get = "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n";
+    const char *ping = "*1\r\n$4\r\nPING\r\n";
+    const char *info = "*2\r\n$4\r\ninfo\r\n$6\r\nserver\r\n";
+    const char *eval0 = "*3\r\n$4\r\nEVAL\r\n$1\r\nx\r\n$1\r\n0\r\n";
+    const char *eval1 =
+        "*4\r\n$7\r\nEVALSHA\r\n$1\r\nx\r\n$1\r\n1\r\n$3\r\nbar\r\n";
+    const char *key = NULL;
+    size_t len = 0;
+
+    CuAssertIntEquals(tc, 1, slot_command_key(get, strlen(get), &key, &len));
+    CuAssertIntEquals(tc, 3, len);
+    CuAssertTrue(tc, strncmp(key, "foo", 3) == 0);
+
+    CuAssertIntEquals(tc, 0, slot_command_key(ping, strlen(ping), &key, &len));
+    CuAssertIntEquals(tc, 0, slot_command_key(info, strlen(info), &key, &len));
+    CuAssertIntEquals(tc, 0,
+                      slot_command_key(eval0, strlen(eval0), &key, &len));
+
+    CuAssertIntEquals(tc, 1,
+                      slot_command_key(eval1, strlen(eval1), &key, &len));
+    CuAssertTrue(tc, strncmp(key, "bar", 3) == 0);
+
+    /**
+     * Truncated commands are refused.
+     */
+    CuAssertIntEquals(tc, 0, slot_command_key(get, 18, &key, &len));
+}
+
+
+/**
+ * Test that redirections are understood.
+ */
+void
+TestSlotRedirect(CuTest * tc)
+{
+    char host[64];
+    int slot = 0;
+    int port = 0;
+
+    CuAssertIntEquals(tc, SLOT_MOVED,
+                      slot_redirect("MOVED 3999 127.0.0.1:6381", &slot, host,
+                                    sizeof(host), &port));
+    CuAssertIntEquals(tc, 3999, slot);
+    CuAssertStrEquals(tc, "127.0.0.1", host);
+    CuAssertIntEquals(tc, 6381, port);
+
+    CuAssertIntEquals(tc, SLOT_ASK,
+                      slot_redirect("ASK 12 redis-2:7000", &slot, host,
+                                    sizeof(host), &port));
+    CuAssertIntEquals(tc, 12, slot);
+    CuAssertStrEquals(tc, "redis-2", host);
+    CuAssertIntEquals(tc, 7000, port);
+
+    CuAssertIntEquals(tc, 0,
+                      slot_redirect("ERR unknown command", &slot, host,
+                                    sizeof(host), &port));
+    CuAssertIntEquals(tc, 0,
+                      slot_redirect("MOVED 99999 a:1", &slot, host,
+                                    sizeof(host), &port));
+}
+
+
+CuSuite *
+slots_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestSlotOf);
+    SUITE_ADD_TEST(suite, TestSlotCommandKey);
+    SUITE_ADD_TEST(suite, TestSlotRedirect);
+
+    return suite;
+}
@@ -0,0 +1,18 @@
+
+#ifndef _slots_test_h_
+#define _slots_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *codec_getsuite ();
+
+
+
+#endif /* _slots_test_h_ */
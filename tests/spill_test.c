@@ -0,0 +1,181 @@
+/**
+ * Test cases for keeping the contents of large files on disk.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "spill.h"
+#include "spill_test.h"
+
+
+/**
+ * Make a fresh directory to spill into.
+ */
+static char *
+spill_dir()
+{
+    static char dir[64];
+
+    snprintf(dir, sizeof(dir), "/tmp/spill_test.XXXXXX");
+    return (mkdtemp(dir));
+}
+
+
+/**
+ * Test that names carry their generation, and that others are refused.
+ */
+void
+TestSpillNames(CuTest * tc)
+{
+    char name[SPILL_NAME];
+
+    CuAssertIntEquals(tc, 0, spill_name(name, sizeof(name), "skx", 6, 0));
+    CuAssertStrEquals(tc, "skx.6.0", name);
+    CuAssertIntEquals(tc, 0, (int)spill_generation(name));
+
+    CuAssertIntEquals(tc, 0, spill_name(name, sizeof(name), "skx", -99, 12));
+    CuAssertStrEquals(tc, "skx.-99.12", name);
+    CuAssertIntEquals(tc, 12, (int)spill_generation(name));
+
+    CuAssertIntEquals(tc, -1, spill_name(name, 4, "skx", 6, 0));
+
+    CuAssertIntEquals(tc, -1, (int)spill_generation(NULL));
+    CuAssertIntEquals(tc, -1, (int)spill_generation("skx"));
+    CuAssertIntEquals(tc, -1, (int)spill_generation("skx.6."));
+    CuAssertIntEquals(tc, -1, (int)spill_generation("skx.6.x"));
+}
+
+
+/**
+ * Test writing, reading, truncating and removing a file.
+ */
+void
+TestSpillReadWrite(CuTest * tc)
+{
+    char *dir = spill_dir();
+    char *big = malloc(100000);
+    char buf[100];
+    int i;
+
+    CuAssertPtrNotNull(tc, dir);
+
+    for (i = 0; i < 100000; i++)
+        big[i] = 'a' + (i % 26);
+
+    CuAssertIntEquals(tc, 100000,
+                      (int)spill_write(dir, "skx.1.0", big, 100000, 0));
+    CuAssertIntEquals(tc, 5, (int)spill_write(dir, "skx.1.0", "HELLO", 5,
+                                              70000));
+
+    /**
+     * Reads need not start upon a page, and are short at the end.
+     */
+    CuAssertIntEquals(tc, 10, (int)spill_read(dir, "skx.1.0", buf, 10,
+                                              69998));
+    CuAssertTrue(tc, memcmp(buf, "ghHELLOnop", 10) == 0);
+
+    CuAssertIntEquals(tc, 3, (int)spill_read(dir, "skx.1.0", buf, 10,
+                                             99997));
+    CuAssertTrue(tc, memcmp(buf, big + 99997, 3) == 0);
+    CuAssertIntEquals(tc, 0, (int)spill_read(dir, "skx.1.0", buf, 10,
+                                             100000));
+
+    /**
+     * Cut down, then extended with zeros.
+     */
+    CuAssertIntEquals(tc, 0, spill_truncate(dir, "skx.1.0", 4));
+    CuAssertIntEquals(tc, 4, (int)spill_read(dir, "skx.1.0", buf, 10, 0));
+    CuAssertIntEquals(tc, 0, spill_truncate(dir, "skx.1.0", 6));
+    CuAssertIntEquals(tc, 6, (int)spill_read(dir, "skx.1.0", buf, 10, 0));
+    CuAssertTrue(tc, memcmp(buf, "abcd\0\0", 6) == 0);
+
+    CuAssertIntEquals(tc, 0, spill_remove(dir, "skx.1.0"));
+    CuAssertIntEquals(tc, 0, spill_remove(dir, "skx.1.0"));
+    CuAssertIntEquals(tc, -ENOENT, (int)spill_read(dir, "skx.1.0", buf, 10,
+                                                   0));
+
+    free(big);
+    rmdir(dir);
+}
+
+
+/**
+ * Test that a copy is independent of the file it came from.
+ */
+void
+TestSpillCopy(CuTest * tc)
+{
+    char *dir = spill_dir();
+    char buf[16];
+
+    spill_write(dir, "skx.2.0", "original", 8, 0);
+    CuAssertIntEquals(tc, 0, spill_copy(dir, "skx.2.0", "skx.2.1"));
+
+    spill_write(dir, "skx.2.1", "changed", 7, 0);
+
+    CuAssertIntEquals(tc, 8, (int)spill_read(dir, "skx.2.0", buf, 16, 0));
+    CuAssertTrue(tc, memcmp(buf, "original", 8) == 0);
+    CuAssertIntEquals(tc, 8, (int)spill_read(dir, "skx.2.1", buf, 16, 0));
+    CuAssertTrue(tc, memcmp(buf, "changedl", 8) == 0);
+
+    /**
+     * A missing file can't be copied, and leaves nothing behind.
+     */
+    CuAssertIntEquals(tc, -ENOENT, spill_copy(dir, "skx.3.0", "skx.3.1"));
+    CuAssertIntEquals(tc, -ENOENT, (int)spill_read(dir, "skx.3.1", buf, 16,
+                                                   0));
+
+    spill_remove(dir, "skx.2.0");
+    spill_remove(dir, "skx.2.1");
+    rmdir(dir);
+}
+
+
+/**
+ * Test that names which could lead outside the directory are refused.
+ */
+void
+TestSpillUnsafe(CuTest * tc)
+{
+    char *dir = spill_dir();
+    char buf[16];
+
+    CuAssertIntEquals(tc, -EINVAL, (int)spill_write(dir, "../x.1.0", "x", 1,
+                                                    0));
+    CuAssertIntEquals(tc, -EINVAL, (int)spill_read(dir, "/etc/passwd", buf,
+                                                   16, 0));
+    CuAssertIntEquals(tc, -EINVAL, spill_truncate(dir, "..", 0));
+    CuAssertIntEquals(tc, -EINVAL, spill_remove(dir, ""));
+    CuAssertIntEquals(tc, -EINVAL, spill_copy(dir, "skx.1.0", "a/b"));
+
+    CuAssertIntEquals(tc, 0, rmdir(dir));
+}
+
+
+CuSuite *
+spill_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestSpillNames);
+    SUITE_ADD_TEST(suite, TestSpillReadWrite);
+    SUITE_ADD_TEST(suite, TestSpillCopy);
+    SUITE_ADD_TEST(suite, TestSpillUnsafe);
+
+    return suite;
+}
@@ -0,0 +1,17 @@
+#ifndef _spill_test_h_
+#define _spill_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *spill_getsuite ();
+
+
+
+#endif /* _spill_test_h_ */
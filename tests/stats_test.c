@@ -0,0 +1,183 @@
+/**
+ * Test cases for the statistics of filesystem operations.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+#include "stats_test.h"
+
+
+static const char *names[] = { "getattr", "read" };
+
+
+/**
+ * Test that every latency falls within the bounds of its bucket, and
+ * that the buckets are no wider than an eighth of their values.
+ */
+void
+TestStatsBuckets(CuTest * tc)
+{
+    long long usec;
+    int last = 0;
+
+    CuAssertIntEquals(tc, 0, stats_bucket(0));
+    CuAssertIntEquals(tc, 7, stats_bucket(7));
+    CuAssertIntEquals(tc, 8, stats_bucket(8));
+
+    for (usec = 1; usec < 100000000; usec += 1 + usec / 7)
+    {
+        int bucket = stats_bucket(usec);
+
+        CuAssertTrue(tc, bucket >= last);
+        CuAssertTrue(tc, stats_bucket_max(bucket) >= usec);
+        CuAssertTrue(tc, (bucket == 0) || (stats_bucket_max(bucket - 1) < usec));
+        CuAssertTrue(tc, stats_bucket_max(bucket) - usec <= usec / 8);
+        last = bucket;
+    }
+
+    /**
+     * Huge latencies share the last bucket.
+     */
+    CuAssertIntEquals(tc, STATS_BUCKETS - 1, stats_bucket(1LL << 60));
+}
+
+
+/**
+ * Test that percentiles come from the right buckets.
+ */
+void
+TestStatsPercentile(CuTest * tc)
+{
+    int i;
+
+    stats_init(names, 2, 0);
+    CuAssertIntEquals(tc, 1, stats_enabled());
+    CuAssertIntEquals(tc, 0, (int)stats_percentile(0, 0.5));
+
+    for (i = 0; i < 90; i++)
+        stats_record(0, "/a", 100, 0, NULL);
+    for (i = 0; i < 10; i++)
+        stats_record(0, "/a", 5000, 0, NULL);
+
+    CuAssertIntEquals(tc, 100, (int)stats_count(0));
+    CuAssertIntEquals(tc, 0, (int)stats_count(1));
+
+    CuAssertTrue(tc, stats_percentile(0, 0.5) >= 100);
+    CuAssertTrue(tc, stats_percentile(0, 0.5) < 120);
+    CuAssertTrue(tc, stats_percentile(0, 0.9) < 120);
+    CuAssertTrue(tc, stats_percentile(0, 0.99) >= 5000);
+    CuAssertTrue(tc, stats_percentile(0, 0.99) < 5700);
+}
+
+
+/**
+ * Test that round-trips are counted once per batch of replies, and
+ * marked in the trace.
+ */
+void
+TestStatsUsage(CuTest * tc)
+{
+    stats_usage u;
+
+    stats_init(names, 2, 1000);
+    stats_begin(&u);
+
+    stats_sent(&u, 10, "HGET", 4);
+    stats_sent(&u, 10, "HLEN", 4);
+    stats_received(&u, 5);
+    stats_received(&u, 5);
+    stats_sent(&u, 20, "GET", 3);
+    stats_received(&u, 100);
+
+    CuAssertIntEquals(tc, 3, (int)u.commands);
+    CuAssertIntEquals(tc, 2, (int)u.round_trips);
+    CuAssertIntEquals(tc, 40, (int)u.bytes_out);
+    CuAssertIntEquals(tc, 110, (int)u.bytes_in);
+    CuAssertStrEquals(tc, "HGET HLEN | GET", u.trace);
+
+    stats_begin(&u);
+    CuAssertIntEquals(tc, 0, (int)u.commands);
+    CuAssertStrEquals(tc, "", u.trace);
+}
+
+
+/**
+ * Test the output, and the log of slow operations.
+ */
+void
+TestStatsFormat(CuTest * tc)
+{
+    stats_usage u;
+    char buf[8192];
+    size_t len;
+
+    stats_init(names, 2, 1000);
+    stats_begin(&u);
+    stats_sent(&u, 10, "HGET", 4);
+    stats_received(&u, 5);
+
+    stats_record(1, "/fast", 10, 0, &u);
+    stats_record(1, "/slow", 2000, 1, &u);
+    stats_cache(STATS_CACHE_ATTR, 1);
+    stats_cache(STATS_CACHE_ATTR, 0);
+    stats_cache(STATS_CACHE_ATTR, 1);
+
+    len = stats_format(buf, sizeof(buf));
+    CuAssertIntEquals(tc, (int)strlen(buf), (int)len);
+
+    CuAssertTrue(tc, strstr(buf, "op=\"getattr\"") == NULL);
+    CuAssertTrue(tc, strstr(buf,
+                            "redisfs_op_latency_seconds_count{op=\"read\"} 2\n")
+                 != NULL);
+    CuAssertTrue(tc, strstr(buf,
+                            "redisfs_op_failures_total{op=\"read\"} 1\n") !=
+                 NULL);
+    CuAssertTrue(tc, strstr(buf,
+                            "redisfs_op_round_trips_total{op=\"read\"} 2\n")
+                 != NULL);
+    CuAssertTrue(tc, strstr(buf,
+                            "redisfs_cache_hits_total{cache=\"attr\"} 2\n") !=
+                 NULL);
+    CuAssertTrue(tc, strstr(buf,
+                            "redisfs_cache_misses_total{cache=\"attr\"} 1\n")
+                 != NULL);
+
+    /**
+     * A short buffer is truncated, but the whole length reported.
+     */
+    CuAssertIntEquals(tc, (int)len, (int)stats_format(buf, 16));
+    CuAssertIntEquals(tc, 15, (int)strlen(buf));
+
+    len = stats_format_slow(buf, sizeof(buf));
+    CuAssertIntEquals(tc, (int)strlen(buf), (int)len);
+    CuAssertStrEquals(tc,
+                      "2.000ms read /slow [1 commands, 1 round-trips] HGET\n",
+                      buf);
+}
+
+
+CuSuite *
+stats_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestStatsBuckets);
+    SUITE_ADD_TEST(suite, TestStatsPercentile);
+    SUITE_ADD_TEST(suite, TestStatsUsage);
+    SUITE_ADD_TEST(suite, TestStatsFormat);
+
+    return suite;
+}
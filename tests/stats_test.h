@@ -0,0 +1,18 @@
+
+#ifndef _stats_test_h_
+#define _stats_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *stats_getsuite ();
+
+
+
+#endif /* _stats_test_h_ */
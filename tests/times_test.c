@@ -0,0 +1,149 @@
+/**
+ * Test cases for the timestamps left to be written later.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "times.h"
+#include "times_test.h"
+
+
+/**
+ * Take, and so forget, everything pending.
+ */
+static void
+times_empty()
+{
+    pending_times out[16];
+
+    while (times_take(out, 16, 0, 0) > 0)
+        ;
+}
+
+
+/**
+ * Test that the latest timestamps of each inode are kept.
+ */
+void
+TestTimesCoalesce(CuTest * tc)
+{
+    pending_times out[4];
+
+    times_empty();
+
+    CuAssertIntEquals(tc, 0, times_set(6, TIMES_MTIME, 100, 1000));
+    CuAssertIntEquals(tc, 0, times_set(6, TIMES_MTIME, 101, 1001));
+    CuAssertIntEquals(tc, 0, times_set(6, TIMES_ATIME, 102, 1002));
+    CuAssertIntEquals(tc, 0, times_set(7, TIMES_ATIME, 50, 1003));
+    CuAssertIntEquals(tc, 2, times_count());
+
+    CuAssertIntEquals(tc, 2, times_take(out, 4, 1003, 0));
+    CuAssertIntEquals(tc, 0, times_count());
+
+    if (out[0].inode != 6)
+    {
+        pending_times t = out[0];
+
+        out[0] = out[1];
+        out[1] = t;
+    }
+
+    CuAssertTrue(tc, out[0].inode == 6);
+    CuAssertIntEquals(tc, TIMES_ATIME | TIMES_MTIME, out[0].fields);
+    CuAssertIntEquals(tc, 102, (int)out[0].atime);
+    CuAssertIntEquals(tc, 101, (int)out[0].mtime);
+    CuAssertTrue(tc, out[0].since == 1000);
+
+    CuAssertTrue(tc, out[1].inode == 7);
+    CuAssertIntEquals(tc, TIMES_ATIME, out[1].fields);
+    CuAssertIntEquals(tc, 50, (int)out[1].atime);
+}
+
+
+/**
+ * Test that only those timestamps which have waited long enough are
+ * taken, and no more than are asked for.
+ */
+void
+TestTimesDue(CuTest * tc)
+{
+    pending_times out[4];
+
+    times_empty();
+
+    times_set(1, TIMES_MTIME, 1, 1000);
+    times_set(2, TIMES_MTIME, 2, 1500);
+    times_set(3, TIMES_MTIME, 3, 1900);
+
+    CuAssertIntEquals(tc, 0, times_take(out, 4, 1400, 500));
+    CuAssertIntEquals(tc, 1, times_take(out, 4, 1600, 500));
+    CuAssertTrue(tc, out[0].inode == 1);
+
+    CuAssertIntEquals(tc, 1, times_take(out, 1, 5000, 500));
+    CuAssertIntEquals(tc, 1, times_count());
+    CuAssertIntEquals(tc, 1, times_take(out, 4, 5000, 500));
+    CuAssertIntEquals(tc, 0, times_count());
+}
+
+
+/**
+ * Test that pending timestamps override those which are stored, and
+ * that they may be forgotten.
+ */
+void
+TestTimesApply(CuTest * tc)
+{
+    struct stat st;
+
+    times_empty();
+
+    memset(&st, 0, sizeof(st));
+    st.st_atime = 10;
+    st.st_mtime = 20;
+
+    CuAssertIntEquals(tc, 0, times_apply(6, &st));
+    CuAssertIntEquals(tc, 10, (int)st.st_atime);
+
+    times_set(6, TIMES_MTIME, 30, 0);
+    times_set(6 + 1024, TIMES_ATIME, 40, 0);
+
+    CuAssertIntEquals(tc, TIMES_MTIME, times_apply(6, &st));
+    CuAssertIntEquals(tc, 10, (int)st.st_atime);
+    CuAssertIntEquals(tc, 30, (int)st.st_mtime);
+
+    times_clear(6);
+    CuAssertIntEquals(tc, 1, times_count());
+    CuAssertIntEquals(tc, 0, times_apply(6, &st));
+
+    CuAssertIntEquals(tc, TIMES_ATIME, times_apply(6 + 1024, &st));
+    CuAssertIntEquals(tc, 40, (int)st.st_atime);
+
+    times_clear(6 + 1024);
+    times_clear(99);
+    CuAssertIntEquals(tc, 0, times_count());
+}
+
+
+CuSuite *
+times_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestTimesCoalesce);
+    SUITE_ADD_TEST(suite, TestTimesDue);
+    SUITE_ADD_TEST(suite, TestTimesApply);
+
+    return suite;
+}
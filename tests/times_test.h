@@ -0,0 +1,17 @@
+#ifndef _times_test_h_
+#define _times_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *times_getsuite ();
+
+
+
+#endif /* _times_test_h_ */
@@ -0,0 +1,147 @@
+/**
+ * Test cases for the buffers which coalesce writes.
+ *
+ * The testing framework uses cutest:
+ *
+ *   http://cutest.sourceforge.net/
+ *
+ * All tests are driven by the code in AllTests.c
+ *
+ * Steve
+ * --
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "writeback.h"
+#include "writeback_test.h"
+
+
+/**
+ * Test that sequential writes are coalesced.
+ */
+void
+TestWritebackSequential(CuTest * tc)
+{
+    write_buffer b;
+
+    CuAssertIntEquals(tc, 0, wbuf_init(&b, 16));
+    CuAssertIntEquals(tc, 0, wbuf_pending(&b));
+
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "hello ", 6, 100, 1));
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "world", 5, 106, 2));
+    CuAssertIntEquals(tc, 1, wbuf_pending(&b));
+
+    CuAssertIntEquals(tc, 100, (int)b.offset);
+    CuAssertIntEquals(tc, 11, (int)b.len);
+    CuAssertIntEquals(tc, 111, (int)wbuf_end(&b));
+    CuAssertTrue(tc, memcmp(b.data, "hello world", 11) == 0);
+
+    /**
+     * The time is that of the first write.
+     */
+    CuAssertIntEquals(tc, 1, (int)b.dirty_since);
+
+    wbuf_clear(&b);
+    CuAssertIntEquals(tc, 0, wbuf_pending(&b));
+
+    wbuf_free(&b);
+}
+
+
+/**
+ * Test that overlapping writes replace the buffered data.
+ */
+void
+TestWritebackOverlap(CuTest * tc)
+{
+    write_buffer b;
+
+    wbuf_init(&b, 16);
+
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "abcdef", 6, 0, 0));
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "XY", 2, 2, 0));
+    CuAssertIntEquals(tc, 6, (int)b.len);
+    CuAssertTrue(tc, memcmp(b.data, "abXYef", 6) == 0);
+
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "1234", 4, 4, 0));
+    CuAssertIntEquals(tc, 8, (int)b.len);
+    CuAssertTrue(tc, memcmp(b.data, "abXY1234", 8) == 0);
+
+    wbuf_free(&b);
+}
+
+
+/**
+ * Test the writes which must not be buffered.
+ */
+void
+TestWritebackRefused(CuTest * tc)
+{
+    write_buffer b;
+
+    wbuf_init(&b, 8);
+
+    /**
+     * Too large to ever fit.
+     */
+    CuAssertIntEquals(tc, 0, wbuf_add(&b, "0123456789", 10, 0, 0));
+    CuAssertIntEquals(tc, 0, wbuf_pending(&b));
+
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "abcd", 4, 10, 0));
+
+    /**
+     * Before the run, after a gap, or overflowing.
+     */
+    CuAssertIntEquals(tc, 0, wbuf_add(&b, "x", 1, 9, 0));
+    CuAssertIntEquals(tc, 0, wbuf_add(&b, "x", 1, 15, 0));
+    CuAssertIntEquals(tc, 0, wbuf_add(&b, "wxyzw", 5, 14, 0));
+
+    /**
+     * Just fits.
+     */
+    CuAssertIntEquals(tc, 1, wbuf_add(&b, "wxyz", 4, 14, 0));
+    CuAssertIntEquals(tc, 8, (int)b.len);
+
+    wbuf_free(&b);
+}
+
+
+/**
+ * Test that buffers become due after the delay.
+ */
+void
+TestWritebackDue(CuTest * tc)
+{
+    write_buffer b;
+
+    wbuf_init(&b, 8);
+
+    CuAssertIntEquals(tc, 0, wbuf_due(&b, 1000, 100));
+
+    wbuf_add(&b, "abc", 3, 0, 1000);
+    CuAssertIntEquals(tc, 0, wbuf_due(&b, 1050, 100));
+    CuAssertIntEquals(tc, 1, wbuf_due(&b, 1100, 100));
+
+    wbuf_clear(&b);
+    CuAssertIntEquals(tc, 0, wbuf_due(&b, 5000, 100));
+
+    wbuf_free(&b);
+}
+
+
+CuSuite *
+writeback_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, TestWritebackSequential);
+    SUITE_ADD_TEST(suite, TestWritebackOverlap);
+    SUITE_ADD_TEST(suite, TestWritebackRefused);
+    SUITE_ADD_TEST(suite, TestWritebackDue);
+
+    return suite;
+}
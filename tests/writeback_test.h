@@ -0,0 +1,18 @@
+
+#ifndef _writeback_test_h_
+#define _writeback_test_h_ 1
+
+
+
+
+#include "CuTest.h"
+
+
+/**
+ * Get the handle to our test suite.
+ */
+CuSuite *writeback_getsuite ();
+
+
+
+#endif /* _writeback_test_h_ */